@@ -0,0 +1,1003 @@
+#include <endian.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <libpq-fe.h>
+#include <mysql.h>
+#include <gdsql.h>
+#include <gdsql_log.h>
+
+/*
+ * Microbenchmarks for the cost of the library itself: binding
+ * parameters, stepping and decoding each type of column, on an
+ * in-memory SQLite database, run both through gdsql and through the
+ * sqlite3_* calls it wraps.  Each one is run a few times and the best
+ * time kept; results go to stdout as JSON, in nanoseconds per row.
+ *
+ * Postgres and MySQL are also measured, through gdsql and through
+ * libpq / libmysqlclient, when a server is given in
+ * GDSQL_BENCH_POSTGRES / GDSQL_BENCH_MYSQL as
+ * "host:port:name:user:password"; they use a gdsql_bench table, and
+ * the native versions follow what the drivers do (binary values on
+ * Postgres, prepared statements on both).
+ * GDSQL_BENCH_ROWS and GDSQL_BENCH_RUNS change the defaults below.
+ *
+ * Only warnings are logged, unless GDSQL_LOG_LEVEL says otherwise;
+ * the per-row messages would cost far more than the rest.
+ */
+
+#define BENCH_ROWS          100000
+#define BENCH_SERVER_ROWS    10000
+#define BENCH_RUNS               5
+
+#define BENCH_STRING   "gdsql benchmark"
+#define BENCH_DATE     2461000.5
+#define PG_EPOCH       2451544.5    // 2000-01-01 as a Julian date
+
+#define COL_INT      0
+#define COL_DOUBLE   1
+#define COL_STRING   2
+#define COL_DATE     3
+
+typedef struct Column {
+    const char* type;
+    const char* name;
+    int kind;
+} Column;
+
+typedef struct Target {
+    int type;
+    const char* env;            // server settings, 0 for SQLite
+    const char* create;
+    int dollar;                 // parameters are $1, $2...
+    int rows;
+    gdsql_db db;
+    sqlite3* native;
+    PGconn* pg;
+    MYSQL* my;
+} Target;
+
+typedef double (Runner)(Target* t,
+                        const Column* col);
+
+typedef struct Bench {
+    const char* name;
+    Runner* gdsql;
+    Runner* native[GDSQL_DB_COUNT];
+    int per_column;
+} Bench;
+
+static int open_target(gdsql gdsql,
+                       Target* t);
+static int open_native(Target* t,
+                       char** field);
+static void close_target(Target* t);
+static int fill_table(Target* t);
+static int native_fill(Target* t);
+static void make_insert(Target* t,
+                        const Column* col,
+                        char* sql);
+static double elapsed(unsigned long long t0,
+                      int rows);
+static double gdsql_step_rows(Target* t,
+                              const Column* col);
+static double gdsql_bind_rows(Target* t,
+                              const Column* col);
+static double gdsql_fetch_rows(Target* t,
+                               const Column* col);
+static double native_step_rows(Target* t,
+                               const Column* col);
+static double native_bind_rows(Target* t,
+                               const Column* col);
+static double native_fetch_rows(Target* t,
+                                const Column* col);
+static double pg_step_rows(Target* t,
+                           const Column* col);
+static double pg_bind_rows(Target* t,
+                           const Column* col);
+static double pg_fetch_rows(Target* t,
+                            const Column* col);
+static int pg_prepare(Target* t,
+                      const char* sql,
+                      int params);
+static double my_step_rows(Target* t,
+                           const Column* col);
+static double my_bind_rows(Target* t,
+                           const Column* col);
+static double my_fetch_rows(Target* t,
+                            const Column* col);
+static int best_of(const Bench* bench,
+                   Target* t,
+                   const Column* col,
+                   double* ns,
+                   double* native);
+static void put_result(Target* t,
+                       const char* name,
+                       double ns,
+                       double native);
+
+static const Column columns[] = {
+    { "int",    "i", COL_INT    },
+    { "double", "d", COL_DOUBLE },
+    { "string", "s", COL_STRING },
+    { "date",   "t", COL_DATE   },
+};
+#define COLUMN_COUNT  (int) (sizeof(columns) / sizeof(columns[0]))
+
+static const Bench benches[] = {
+    { "step",  gdsql_step_rows,
+      { native_step_rows,  pg_step_rows,  my_step_rows  }, 0 },
+    { "bind",  gdsql_bind_rows,
+      { native_bind_rows,  pg_bind_rows,  my_bind_rows  }, 1 },
+    { "fetch", gdsql_fetch_rows,
+      { native_fetch_rows, pg_fetch_rows, my_fetch_rows }, 1 },
+};
+#define BENCH_COUNT  (int) (sizeof(benches) / sizeof(benches[0]))
+
+static Target targets[] = {
+    { GDSQL_DB_SQLITE, 0,
+      "CREATE TABLE gdsql_bench (i INTEGER, d REAL, s TEXT, t REAL)",
+      0, BENCH_ROWS, 0, 0, 0, 0 },
+    { GDSQL_DB_POSTGRES, "GDSQL_BENCH_POSTGRES",
+      "CREATE TABLE gdsql_bench (i INTEGER, d DOUBLE PRECISION,"
+      " s VARCHAR(50), t TIMESTAMP)",
+      1, BENCH_SERVER_ROWS, 0, 0, 0, 0 },
+    { GDSQL_DB_MYSQL, "GDSQL_BENCH_MYSQL",
+      "CREATE TABLE gdsql_bench (i INTEGER, d DOUBLE,"
+      " s VARCHAR(50), t DATETIME)",
+      0, BENCH_SERVER_ROWS, 0, 0, 0, 0 },
+};
+#define TARGET_COUNT  (int) (sizeof(targets) / sizeof(targets[0]))
+
+static int runs = BENCH_RUNS;
+static int results = 0;
+static int errors = 0;
+
+// Everything read back goes here, so no loop can be optimized away.
+static volatile double sink = 0;
+
+int main(int argc, char* argv[])
+{
+    gdsql gdsql = 0;
+    char version[32];
+    int j = 0;
+    int b = 0;
+    int c = 0;
+
+    const char* env = getenv("GDSQL_BENCH_RUNS");
+    if (env != 0 && atoi(env) > 0)
+        runs = atoi(env);
+
+    if (getenv("GDSQL_LOG_LEVEL") == 0)
+        gdsql_set_log_level(LOG_WARNING);
+
+    do {
+        gdsql = gdsql_init();
+        if (gdsql == 0) {
+            ++errors;
+            break;
+        }
+
+        printf("{\n"
+               "  \"library\": \"gdsql\",\n"
+               "  \"version\": \"%s\",\n"
+               "  \"runs\": %d,\n"
+               "  \"results\": [",
+               gdsql_get_version(gdsql, version), runs);
+
+        for (j = 0; j < TARGET_COUNT; ++j) {
+            Target* t = &targets[j];
+            if (t->env != 0 && getenv(t->env) == 0)
+                continue;
+
+            if (open_target(gdsql, t) != 0) {
+                fprintf(stderr, "Could not set up %s\n",
+                        t->env ? t->env : "SQLite");
+                ++errors;
+                close_target(t);
+                continue;
+            }
+
+            for (b = 0; b < BENCH_COUNT; ++b) {
+                const Bench* bench = &benches[b];
+                int count = bench->per_column ? COLUMN_COUNT : 1;
+                for (c = 0; c < count; ++c) {
+                    char name[64];
+                    if (bench->per_column)
+                        sprintf(name, "%s_%s",
+                                bench->name, columns[c].type);
+                    else
+                        strcpy(name, bench->name);
+
+                    double ns = -1;
+                    double native = -1;
+                    best_of(bench, t, &columns[c], &ns, &native);
+                    put_result(t, name, ns, native);
+                }
+            }
+
+            close_target(t);
+        }
+
+        printf("\n  ]\n}\n");
+    } while (0);
+
+    gdsql_fini(gdsql);
+
+    if (errors)
+        fprintf(stderr, "%d errors\n", errors);
+    return errors ? 1 : 0;
+}
+
+static int open_target(gdsql gdsql,
+                       Target* t)
+{
+    int ret = 0;
+    char buf[512];
+    char* field[5] = { "", "", "", "", "" };
+
+    do {
+        const char* env = getenv("GDSQL_BENCH_ROWS");
+        if (env != 0 && atoi(env) > 0)
+            t->rows = atoi(env);
+
+        t->db = gdsql_alloc_db(gdsql, t->type);
+        if (t->db == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (t->env == 0)
+            gdsql_db_set_name(t->db, ":memory:");
+        else {
+            // host:port:name:user:password
+            int f = 0;
+            snprintf(buf, sizeof(buf), "%s", getenv(t->env));
+            field[0] = buf;
+            char* p;
+            for (p = buf; *p != '\0' && f < 4; ++p) {
+                if (*p == ':') {
+                    *p = '\0';
+                    field[++f] = p + 1;
+                }
+            }
+            gdsql_db_set_host(t->db, field[0]);
+            gdsql_db_set_port(t->db, atoi(field[1]));
+            gdsql_db_set_name(t->db, field[2]);
+            gdsql_db_set_user(t->db, field[3]);
+            gdsql_db_set_password(t->db, field[4]);
+        }
+
+        if (gdsql_db_open(t->db) != 0) {
+            ret = 2;
+            break;
+        }
+
+        gdsql_db_exec(t->db, "DROP TABLE IF EXISTS gdsql_bench");
+        if (gdsql_db_exec(t->db, t->create) != 0 ||
+            fill_table(t) != 0) {
+            ret = 3;
+            break;
+        }
+
+        if (open_native(t, field) != 0) {
+            ret = 4;
+            break;
+        }
+    } while (0);
+
+    return ret;
+}
+
+/*
+ * The servers share the table gdsql filled; SQLite gets its own.
+ */
+static int open_native(Target* t,
+                       char** field)
+{
+    switch (t->type) {
+    case GDSQL_DB_POSTGRES:
+        t->pg = PQsetdbLogin(field[0], field[1], 0, 0,
+                             field[2], field[3], field[4]);
+        return PQstatus(t->pg) != CONNECTION_OK;
+
+    case GDSQL_DB_MYSQL:
+        t->my = mysql_init(0);
+        if (t->my == 0)
+            return 1;
+        return mysql_real_connect(t->my, field[0], field[3], field[4],
+                                  field[2], atoi(field[1]), 0, 0) == 0;
+    }
+
+    return sqlite3_open(":memory:", &t->native) != SQLITE_OK ||
+           sqlite3_exec(t->native, t->create, 0, 0, 0) != SQLITE_OK ||
+           native_fill(t) != 0;
+}
+
+static void close_target(Target* t)
+{
+    if (t->db != 0) {
+        if (t->env != 0)
+            gdsql_db_exec(t->db, "DROP TABLE gdsql_bench");
+        gdsql_db_close(t->db);
+        gdsql_free_db(t->db);
+        t->db = 0;
+    }
+
+    if (t->native != 0) {
+        sqlite3_close(t->native);
+        t->native = 0;
+    }
+
+    if (t->pg != 0) {
+        PQfinish(t->pg);
+        t->pg = 0;
+    }
+
+    if (t->my != 0) {
+        mysql_close(t->my);
+        t->my = 0;
+    }
+}
+
+static int fill_table(Target* t)
+{
+    int ret = 0;
+    int j = 0;
+
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(t->db);
+    gdsql_stmt_set_query(stmt, t->dollar
+                         ? "INSERT INTO gdsql_bench VALUES ($1, $2, $3, $4)"
+                         : "INSERT INTO gdsql_bench VALUES (?, ?, ?, ?)");
+
+    gdsql_db_exec(t->db, "BEGIN");
+    for (j = 0; j < t->rows; ++j) {
+        gdsql_stmt_bindp_int(stmt, 1, j);
+        gdsql_stmt_bindp_double(stmt, 2, j * 0.5);
+        gdsql_stmt_bindp_string(stmt, 3, BENCH_STRING, -1);
+        gdsql_stmt_bindp_date(stmt, 4, BENCH_DATE + j / 86400.0);
+        gdsql_stmt_step(stmt);
+        gdsql_stmt_clear_bindings(stmt);
+    }
+    if (gdsql_db_exec(t->db, "COMMIT") != 0)
+        ret = 1;
+
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    return ret;
+}
+
+static int native_fill(Target* t)
+{
+    sqlite3_stmt* ps = 0;
+    int j = 0;
+
+    if (sqlite3_prepare_v2(t->native,
+                           "INSERT INTO gdsql_bench VALUES (?, ?, ?, ?)",
+                           -1, &ps, 0) != SQLITE_OK)
+        return 1;
+
+    sqlite3_exec(t->native, "BEGIN", 0, 0, 0);
+    for (j = 0; j < t->rows; ++j) {
+        sqlite3_bind_int(ps, 1, j);
+        sqlite3_bind_double(ps, 2, j * 0.5);
+        sqlite3_bind_text(ps, 3, BENCH_STRING, -1, SQLITE_STATIC);
+        sqlite3_bind_double(ps, 4, BENCH_DATE + j / 86400.0);
+        sqlite3_step(ps);
+        sqlite3_reset(ps);
+    }
+    sqlite3_finalize(ps);
+
+    return sqlite3_exec(t->native, "COMMIT", 0, 0, 0) != SQLITE_OK;
+}
+
+static void make_insert(Target* t,
+                        const Column* col,
+                        char* sql)
+{
+    sprintf(sql, "INSERT INTO gdsql_bench (%s) VALUES (%s)",
+            col->name, t->dollar ? "$1" : "?");
+}
+
+static double elapsed(unsigned long long t0,
+                      int rows)
+{
+    unsigned long long t1 = gdsql_get_nsecs();
+    return rows > 0 ? (double) (t1 - t0) / rows : -1;
+}
+
+/*
+ * Stepping through the rows without reading any column.
+ */
+static double gdsql_step_rows(Target* t,
+                              const Column* col)
+{
+    int rows = 0;
+
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(t->db);
+    gdsql_stmt_set_query(stmt, "SELECT i FROM gdsql_bench");
+    if (gdsql_stmt_prepare(stmt) != 0) {
+        gdsql_db_free_stmt(stmt);
+        return -1;
+    }
+
+    unsigned long long t0 = gdsql_get_nsecs();
+    while (gdsql_stmt_step(stmt) == 0)
+        ++rows;
+    double ns = elapsed(t0, rows);
+
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    return rows == t->rows ? ns : -1;
+}
+
+static double native_step_rows(Target* t,
+                               const Column* col)
+{
+    sqlite3_stmt* ps = 0;
+    int rows = 0;
+
+    if (sqlite3_prepare_v2(t->native, "SELECT i FROM gdsql_bench",
+                           -1, &ps, 0) != SQLITE_OK)
+        return -1;
+
+    unsigned long long t0 = gdsql_get_nsecs();
+    while (sqlite3_step(ps) == SQLITE_ROW)
+        ++rows;
+    double ns = elapsed(t0, rows);
+
+    sqlite3_finalize(ps);
+    return rows == t->rows ? ns : -1;
+}
+
+/*
+ * Inserting one value per row, inside a transaction.
+ */
+static double gdsql_bind_rows(Target* t,
+                              const Column* col)
+{
+    char sql[128];
+    int j = 0;
+
+    make_insert(t, col, sql);
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(t->db);
+    gdsql_stmt_set_query(stmt, sql);
+    if (gdsql_stmt_prepare(stmt) != 0) {
+        gdsql_db_free_stmt(stmt);
+        return -1;
+    }
+
+    gdsql_db_exec(t->db, "BEGIN");
+    unsigned long long t0 = gdsql_get_nsecs();
+    for (j = 0; j < t->rows; ++j) {
+        switch (col->kind) {
+        case COL_INT:
+            gdsql_stmt_bindp_int(stmt, 1, j);
+            break;
+        case COL_DOUBLE:
+            gdsql_stmt_bindp_double(stmt, 1, j * 0.5);
+            break;
+        case COL_STRING:
+            gdsql_stmt_bindp_string(stmt, 1, BENCH_STRING,
+                                    sizeof(BENCH_STRING) - 1);
+            break;
+        case COL_DATE:
+            gdsql_stmt_bindp_date(stmt, 1, BENCH_DATE);
+            break;
+        }
+        gdsql_stmt_step(stmt);
+        gdsql_stmt_clear_bindings(stmt);
+    }
+    double ns = elapsed(t0, t->rows);
+
+    // Leave the table as it was.
+    gdsql_db_exec(t->db, "ROLLBACK");
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    return ns;
+}
+
+static double native_bind_rows(Target* t,
+                               const Column* col)
+{
+    sqlite3_stmt* ps = 0;
+    char sql[128];
+    int j = 0;
+
+    make_insert(t, col, sql);
+    if (sqlite3_prepare_v2(t->native, sql, -1, &ps, 0) != SQLITE_OK)
+        return -1;
+
+    sqlite3_exec(t->native, "BEGIN", 0, 0, 0);
+    unsigned long long t0 = gdsql_get_nsecs();
+    for (j = 0; j < t->rows; ++j) {
+        switch (col->kind) {
+        case COL_INT:
+            sqlite3_bind_int(ps, 1, j);
+            break;
+        case COL_DOUBLE:
+            sqlite3_bind_double(ps, 1, j * 0.5);
+            break;
+        case COL_STRING:
+            sqlite3_bind_text(ps, 1, BENCH_STRING,
+                              sizeof(BENCH_STRING) - 1, SQLITE_STATIC);
+            break;
+        case COL_DATE:
+            sqlite3_bind_double(ps, 1, BENCH_DATE);
+            break;
+        }
+        sqlite3_step(ps);
+        sqlite3_reset(ps);
+        sqlite3_clear_bindings(ps);
+    }
+    double ns = elapsed(t0, t->rows);
+
+    sqlite3_exec(t->native, "ROLLBACK", 0, 0, 0);
+    sqlite3_finalize(ps);
+    return ns;
+}
+
+/*
+ * Reading one column from every row.
+ */
+static double gdsql_fetch_rows(Target* t,
+                               const Column* col)
+{
+    char sql[128];
+    int ival = 0;
+    double dval = 0;
+    char sval[64];
+    int rows = 0;
+
+    sprintf(sql, "SELECT %s FROM gdsql_bench", col->name);
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(t->db);
+    gdsql_stmt_set_query(stmt, sql);
+    switch (col->kind) {
+    case COL_INT:
+        gdsql_stmt_bindr_int(stmt, 1, &ival);
+        break;
+    case COL_DOUBLE:
+        gdsql_stmt_bindr_double(stmt, 1, &dval);
+        break;
+    case COL_STRING:
+        gdsql_stmt_bindr_string(stmt, 1, sval, sizeof(sval));
+        break;
+    case COL_DATE:
+        gdsql_stmt_bindr_date(stmt, 1, &dval);
+        break;
+    }
+    if (gdsql_stmt_prepare(stmt) != 0) {
+        gdsql_db_free_stmt(stmt);
+        return -1;
+    }
+
+    unsigned long long t0 = gdsql_get_nsecs();
+    while (gdsql_stmt_step(stmt) == 0) {
+        sink += ival + dval + sval[0];
+        ++rows;
+    }
+    double ns = elapsed(t0, rows);
+
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    return rows == t->rows ? ns : -1;
+}
+
+static double native_fetch_rows(Target* t,
+                                const Column* col)
+{
+    sqlite3_stmt* ps = 0;
+    char sql[128];
+    int ival = 0;
+    double dval = 0;
+    char sval[64];
+    int rows = 0;
+
+    sprintf(sql, "SELECT %s FROM gdsql_bench", col->name);
+    if (sqlite3_prepare_v2(t->native, sql, -1, &ps, 0) != SQLITE_OK)
+        return -1;
+
+    sval[0] = '\0';
+    unsigned long long t0 = gdsql_get_nsecs();
+    while (sqlite3_step(ps) == SQLITE_ROW) {
+        switch (col->kind) {
+        case COL_INT:
+            ival = sqlite3_column_int(ps, 0);
+            break;
+        case COL_DOUBLE:
+        case COL_DATE:
+            dval = sqlite3_column_double(ps, 0);
+            break;
+        case COL_STRING: {
+            const char* text = (const char*) sqlite3_column_text(ps, 0);
+            int len = sqlite3_column_bytes(ps, 0);
+            if (len >= (int) sizeof(sval))
+                len = sizeof(sval) - 1;
+            memcpy(sval, text, len);
+            sval[len] = '\0';
+            break;
+        }
+        }
+        sink += ival + dval + sval[0];
+        ++rows;
+    }
+    double ns = elapsed(t0, rows);
+
+    sqlite3_finalize(ps);
+    return rows == t->rows ? ns : -1;
+}
+
+/*
+ * The same through libpq: the unnamed statement, binary values both
+ * ways, and all the rows in one result, as the driver does by default.
+ */
+static double pg_step_rows(Target* t,
+                           const Column* col)
+{
+    int rows = 0;
+
+    if (pg_prepare(t, "SELECT i FROM gdsql_bench", 0) != 0)
+        return -1;
+
+    unsigned long long t0 = gdsql_get_nsecs();
+    PGresult* res = PQexecPrepared(t->pg, "", 0, 0, 0, 0, 1);
+    if (PQresultStatus(res) == PGRES_TUPLES_OK)
+        rows = PQntuples(res);
+    double ns = elapsed(t0, rows);
+
+    PQclear(res);
+    return rows == t->rows ? ns : -1;
+}
+
+static double pg_bind_rows(Target* t,
+                           const Column* col)
+{
+    char sql[128];
+    int j = 0;
+
+    // BEGIN first, since any query drops the unnamed statement.
+    PQclear(PQexec(t->pg, "BEGIN"));
+    make_insert(t, col, sql);
+    if (pg_prepare(t, sql, 1) != 0) {
+        PQclear(PQexec(t->pg, "ROLLBACK"));
+        return -1;
+    }
+
+    unsigned long long t0 = gdsql_get_nsecs();
+    for (j = 0; j < t->rows; ++j) {
+        char buf[8];
+        const char* val = buf;
+        int len = 0;
+        int bin = 1;
+        uint32_t u32 = 0;
+        uint64_t u64 = 0;
+        double d = 0;
+
+        switch (col->kind) {
+        case COL_INT:
+            u32 = htobe32((uint32_t) j);
+            memcpy(buf, &u32, 4);
+            len = 4;
+            break;
+        case COL_DOUBLE:
+            d = j * 0.5;
+            memcpy(&u64, &d, 8);
+            u64 = htobe64(u64);
+            memcpy(buf, &u64, 8);
+            len = 8;
+            break;
+        case COL_STRING:
+            val = BENCH_STRING;
+            len = sizeof(BENCH_STRING) - 1;
+            break;
+        case COL_DATE:
+            u64 = htobe64((uint64_t) (int64_t) ((BENCH_DATE - PG_EPOCH) *
+                                                86400000000.0));
+            memcpy(buf, &u64, 8);
+            len = 8;
+            break;
+        }
+        PQclear(PQexecPrepared(t->pg, "", 1, &val, &len, &bin, 1));
+    }
+    double ns = elapsed(t0, t->rows);
+
+    PQclear(PQexec(t->pg, "ROLLBACK"));
+    return ns;
+}
+
+static double pg_fetch_rows(Target* t,
+                            const Column* col)
+{
+    char sql[128];
+    int ival = 0;
+    double dval = 0;
+    char sval[64];
+    int rows = 0;
+    int j = 0;
+
+    sprintf(sql, "SELECT %s FROM gdsql_bench", col->name);
+    if (pg_prepare(t, sql, 0) != 0)
+        return -1;
+
+    sval[0] = '\0';
+    unsigned long long t0 = gdsql_get_nsecs();
+    PGresult* res = PQexecPrepared(t->pg, "", 0, 0, 0, 0, 1);
+    if (PQresultStatus(res) == PGRES_TUPLES_OK)
+        rows = PQntuples(res);
+    for (j = 0; j < rows; ++j) {
+        const char* val = PQgetvalue(res, j, 0);
+        uint32_t u32 = 0;
+        uint64_t u64 = 0;
+        int len = 0;
+
+        switch (col->kind) {
+        case COL_INT:
+            memcpy(&u32, val, 4);
+            ival = (int) be32toh(u32);
+            break;
+        case COL_DOUBLE:
+            memcpy(&u64, val, 8);
+            u64 = be64toh(u64);
+            memcpy(&dval, &u64, 8);
+            break;
+        case COL_STRING:
+            len = PQgetlength(res, j, 0);
+            if (len >= (int) sizeof(sval))
+                len = sizeof(sval) - 1;
+            memcpy(sval, val, len);
+            sval[len] = '\0';
+            break;
+        case COL_DATE:
+            memcpy(&u64, val, 8);
+            dval = PG_EPOCH + (int64_t) be64toh(u64) / 86400000000.0;
+            break;
+        }
+        sink += ival + dval + sval[0];
+    }
+    double ns = elapsed(t0, rows);
+
+    PQclear(res);
+    return rows == t->rows ? ns : -1;
+}
+
+static int pg_prepare(Target* t,
+                      const char* sql,
+                      int params)
+{
+    PGresult* res = PQprepare(t->pg, "", sql, params, 0);
+    int ret = PQresultStatus(res) != PGRES_COMMAND_OK;
+    PQclear(res);
+    return ret;
+}
+
+/*
+ * The same through libmysqlclient: prepared statements, with the rows
+ * fetched one at a time, as the driver does by default.
+ */
+static double my_step_rows(Target* t,
+                           const Column* col)
+{
+    const char* sql = "SELECT i FROM gdsql_bench";
+    int rows = 0;
+
+    MYSQL_STMT* ps = mysql_stmt_init(t->my);
+    if (ps == 0)
+        return -1;
+    if (mysql_stmt_prepare(ps, sql, strlen(sql)) != 0) {
+        mysql_stmt_close(ps);
+        return -1;
+    }
+
+    unsigned long long t0 = gdsql_get_nsecs();
+    if (mysql_stmt_execute(ps) == 0) {
+        while (mysql_stmt_fetch(ps) == 0)
+            ++rows;
+    }
+    double ns = elapsed(t0, rows);
+
+    mysql_stmt_close(ps);
+    return rows == t->rows ? ns : -1;
+}
+
+static double my_bind_rows(Target* t,
+                           const Column* col)
+{
+    char sql[128];
+    int ival = 0;
+    double dval = 0;
+    unsigned long len = sizeof(BENCH_STRING) - 1;
+    MYSQL_TIME ts;
+    MYSQL_BIND bind;
+    int j = 0;
+
+    make_insert(t, col, sql);
+    MYSQL_STMT* ps = mysql_stmt_init(t->my);
+    if (ps == 0)
+        return -1;
+    if (mysql_stmt_prepare(ps, sql, strlen(sql)) != 0) {
+        mysql_stmt_close(ps);
+        return -1;
+    }
+
+    int Y, M, D, h, m, s;
+    gdsql_jul2cal(BENCH_DATE, &Y, &M, &D, &h, &m, &s);
+    memset(&ts, 0, sizeof(ts));
+    ts.year = Y;
+    ts.month = M;
+    ts.day = D;
+    ts.hour = h;
+    ts.minute = m;
+    ts.second = s;
+
+    memset(&bind, 0, sizeof(bind));
+    switch (col->kind) {
+    case COL_INT:
+        bind.buffer_type = MYSQL_TYPE_LONG;
+        bind.buffer = &ival;
+        break;
+    case COL_DOUBLE:
+        bind.buffer_type = MYSQL_TYPE_DOUBLE;
+        bind.buffer = &dval;
+        break;
+    case COL_STRING:
+        bind.buffer_type = MYSQL_TYPE_STRING;
+        bind.buffer = (char*) BENCH_STRING;
+        bind.length = &len;
+        break;
+    case COL_DATE:
+        bind.buffer_type = MYSQL_TYPE_TIMESTAMP;
+        bind.buffer = &ts;
+        break;
+    }
+    if (mysql_stmt_bind_param(ps, &bind) != 0) {
+        mysql_stmt_close(ps);
+        return -1;
+    }
+
+    mysql_real_query(t->my, "BEGIN", 5);
+    unsigned long long t0 = gdsql_get_nsecs();
+    for (j = 0; j < t->rows; ++j) {
+        ival = j;
+        dval = j * 0.5;
+        mysql_stmt_execute(ps);
+    }
+    double ns = elapsed(t0, t->rows);
+
+    mysql_real_query(t->my, "ROLLBACK", 8);
+    mysql_stmt_close(ps);
+    return ns;
+}
+
+static double my_fetch_rows(Target* t,
+                            const Column* col)
+{
+    char sql[128];
+    int ival = 0;
+    double dval = 0;
+    char sval[64];
+    unsigned long len = 0;
+    MYSQL_TIME ts;
+    MYSQL_BIND bind;
+    int rows = 0;
+
+    sprintf(sql, "SELECT %s FROM gdsql_bench", col->name);
+    MYSQL_STMT* ps = mysql_stmt_init(t->my);
+    if (ps == 0)
+        return -1;
+    if (mysql_stmt_prepare(ps, sql, strlen(sql)) != 0) {
+        mysql_stmt_close(ps);
+        return -1;
+    }
+
+    memset(&bind, 0, sizeof(bind));
+    switch (col->kind) {
+    case COL_INT:
+        bind.buffer_type = MYSQL_TYPE_LONG;
+        bind.buffer = &ival;
+        break;
+    case COL_DOUBLE:
+        bind.buffer_type = MYSQL_TYPE_DOUBLE;
+        bind.buffer = &dval;
+        break;
+    case COL_STRING:
+        bind.buffer_type = MYSQL_TYPE_STRING;
+        bind.buffer = sval;
+        bind.buffer_length = sizeof(sval);
+        bind.length = &len;
+        break;
+    case COL_DATE:
+        bind.buffer_type = MYSQL_TYPE_TIMESTAMP;
+        bind.buffer = &ts;
+        break;
+    }
+
+    sval[0] = '\0';
+    unsigned long long t0 = gdsql_get_nsecs();
+    if (mysql_stmt_execute(ps) == 0 &&
+        mysql_stmt_bind_result(ps, &bind) == 0) {
+        int st = 0;
+        while ((st = mysql_stmt_fetch(ps)) == 0 ||
+               st == MYSQL_DATA_TRUNCATED) {
+            if (col->kind == COL_DATE)
+                dval = gdsql_cal2jul(ts.year, ts.month, ts.day,
+                                     ts.hour, ts.minute, ts.second);
+            sink += ival + dval + sval[0];
+            ++rows;
+        }
+    }
+    double ns = elapsed(t0, rows);
+
+    mysql_stmt_close(ps);
+    return rows == t->rows ? ns : -1;
+}
+
+/*
+ * Both versions take turns, so that they run in the same conditions;
+ * the first turn only warms things up.
+ */
+static int best_of(const Bench* bench,
+                   Target* t,
+                   const Column* col,
+                   double* ns,
+                   double* native)
+{
+    int j = 0;
+
+    *ns = -1;
+    *native = -1;
+    for (j = 0; j <= runs; ++j) {
+        double g = bench->gdsql(t, col);
+        if (g < 0) {
+            *ns = -1;
+            return 1;
+        }
+        if (j > 0 && (*ns < 0 || g < *ns))
+            *ns = g;
+
+        if (t->native == 0 && t->pg == 0 && t->my == 0)
+            continue;
+
+        double n = bench->native[t->type](t, col);
+        if (n < 0) {
+            *native = -1;
+            return 2;
+        }
+        if (j > 0 && (*native < 0 || n < *native))
+            *native = n;
+    }
+
+    return 0;
+}
+
+static void put_result(Target* t,
+                       const char* name,
+                       double ns,
+                       double native)
+{
+    static const char* dbnames[GDSQL_DB_COUNT] = {
+        "SQLite",
+        "Postgres",
+        "MySQL",
+    };
+
+    if (ns < 0) {
+        fprintf(stderr, "%s %s failed\n", dbnames[t->type], name);
+        ++errors;
+    }
+
+    printf("%s\n    { \"db\": \"%s\", \"bench\": \"%s\", \"rows\": %d, ",
+           results++ ? "," : "", dbnames[t->type], name, t->rows);
+    if (ns < 0)
+        printf("\"gdsql_ns_per_row\": null, ");
+    else
+        printf("\"gdsql_ns_per_row\": %.1f, ", ns);
+    if (ns < 0 || native < 0)
+        printf("\"native_ns_per_row\": null, "
+               "\"overhead_ns_per_row\": null }");
+    else
+        printf("\"native_ns_per_row\": %.1f, "
+               "\"overhead_ns_per_row\": %.1f }",
+               native, ns - native);
+}
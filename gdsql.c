@@ -2,9 +2,13 @@
 #include <stdlib.h>
 #include <gdsql_log.h>
 #include <gdsql_hidden.h>
+#include <gdsql_cache.h>
 #include <gdsql_util.h>
 #include <gdsql.h>
 
+static int use_driver(gdsqlh* xh,
+                      int type);
+
 gdsql gdsql_init(void)
 {
     gdsqlh* xh = 0;
@@ -18,6 +22,16 @@ gdsql gdsql_init(void)
         }
     
         xh->version = GDSQL_VERSION;
+        pthread_mutex_init(&xh->lock, 0);
+
+        int j = 0;
+        for (j = 0; j < GDSQL_DB_COUNT; ++j)
+            xh->drivers[j] = 0;
+
+        xh->hooks.start = 0;
+        xh->hooks.end = 0;
+        xh->hooks.ctx = 0;
+        xh->trace = 0;
     } while (0);
     
     return xh;
@@ -36,6 +50,15 @@ void gdsql_fini(gdsql gdsql)
             return;
         }
 
+        // Connections should all be freed by now; we are done with
+        // the drivers.
+        int j = 0;
+        for (j = 0; j < GDSQL_DB_COUNT; ++j) {
+            if (xh->drivers[j])
+                release_driver(j);
+        }
+
+        pthread_mutex_destroy(&xh->lock);
         free(xh);
     } while(0);
 }
@@ -56,6 +79,13 @@ gdsql_db gdsql_alloc_db(gdsql gdsql,
             break;
         }
 
+        if (use_driver(xh, type) != 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Could not start driver for DB %d",
+                       type));
+            break;
+        }
+
         dh = (gdsql_dbh*) malloc(sizeof(gdsql_dbh));
         if (dh == 0) {
             GDSQL_Log(LOG_WARNING,
@@ -71,10 +101,8 @@ gdsql_db gdsql_alloc_db(gdsql gdsql,
         dh->name[0] = '\0';
         dh->user[0] = '\0';
         dh->password[0] = '\0';
-
-        const DbOps* ops = get_dbops(dh->type);
-        if (ops != 0)
-            ops->init();
+        dh->stats = 0;
+        gdsql_cache_init(dh);
     } while (0);
     
     return dh;
@@ -87,10 +115,7 @@ void gdsql_free_db(gdsql_db gdsql_db)
         if (dh == 0)
             break;
 
-        const DbOps* ops = get_dbops(dh->type);
-        if (ops != 0)
-            ops->fini();
-
+        gdsql_cache_free(dh);
         free(dh);
     } while (0);
 }
@@ -116,6 +141,29 @@ const char* gdsql_get_version(gdsql gdsql,
     return buf;
 }
 
+int gdsql_set_trace(gdsql gdsql,
+                    gdsql_trace_start start,
+                    gdsql_trace_end end,
+                    void* ctx)
+{
+    int ret = 0;
+
+    do {
+        gdsqlh* xh = gdsql_check_gdsql(gdsql);
+        if (xh == 0) {
+            ret = 1;
+            break;
+        }
+
+        xh->hooks.start = start;
+        xh->hooks.end = end;
+        xh->hooks.ctx = ctx;
+        xh->trace = (start != 0 || end != 0) ? &xh->hooks : 0;
+    } while (0);
+
+    return ret;
+}
+
 int gdsql_add_db(int dbtype)
 {
     extern int gdsql_sqlite_boot(void);
@@ -173,3 +221,39 @@ int gdsql_add_all_dbs(void)
 
     return n;
 }
+
+
+/*
+ * Make sure the handle holds a reference on the driver for this type
+ * of DB, registering the driver if nobody did.  Once it does, this
+ * is just an atomic load.
+ */
+static int use_driver(gdsqlh* xh,
+                      int type)
+{
+    if (__atomic_load_n(&xh->drivers[type], __ATOMIC_ACQUIRE))
+        return 0;
+
+    int ret = 0;
+    pthread_mutex_lock(&xh->lock);
+    do {
+        if (xh->drivers[type])
+            break;
+
+        if (get_dbops(type) == 0 &&
+            gdsql_add_db(type) != 0) {
+            ret = 1;
+            break;
+        }
+
+        if (acquire_driver(type) != 0) {
+            ret = 2;
+            break;
+        }
+
+        __atomic_store_n(&xh->drivers[type], 1, __ATOMIC_RELEASE);
+    } while (0);
+    pthread_mutex_unlock(&xh->lock);
+
+    return ret;
+}
@@ -23,8 +23,47 @@ const char* gdsql_get_version(gdsql gdsql,
 int gdsql_add_db(int dbtype);
 int gdsql_add_all_dbs(void);
 
+/*
+ * Tracing hooks, called around the driver calls made for any
+ * connection of a gdsql handle: start gets the user context, which
+ * call it is, the DB type and the query (the DB name when opening),
+ * and whatever it returns is passed back to end, together with how
+ * long the call took and what it returned.  A step that runs the
+ * statement is traced as an execution, and so are both starting and
+ * completing an asynchronous statement.  Either hook may be 0; pass
+ * both as 0 to stop tracing.  Hooks may only be changed while no
+ * connection of the handle is in use.
+ */
+#define GDSQL_TRACE_DB_OPEN        0
+#define GDSQL_TRACE_STMT_PREPARE   1
+#define GDSQL_TRACE_STMT_EXECUTE   2
+#define GDSQL_TRACE_STMT_STEP      3
+#define GDSQL_TRACE_STMT_FINALIZE  4
+
+typedef void* (*gdsql_trace_start)(void* ctx,
+                                   int op,
+                                   int dbtype,
+                                   const char* query);
+typedef void (*gdsql_trace_end)(void* ctx,
+                                void* span,
+                                int op,
+                                int dbtype,
+                                const char* query,
+                                unsigned long long nsecs,
+                                int ret);
+
+int gdsql_set_trace(gdsql gdsql,
+                    gdsql_trace_start start,
+                    gdsql_trace_end end,
+                    void* ctx);
+
 #include <gdsql_db.h>
 #include <gdsql_stmt.h>
+#include <gdsql_load.h>
+#include <gdsql_group.h>
+#include <gdsql_pool.h>
+#include <gdsql_metrics.h>
+#include <gdsql_slow.h>
 #include <gdsql_date.h>
 
 #endif
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include <gdsql_log.h>
+#include <gdsql_cache.h>
+
+static unsigned int hash_query(const char* query);
+static void evict_entry(gdsql_dbh* db,
+                        CacheEntry* entry);
+static void drop_entry(CacheEntry* entry);
+
+void gdsql_cache_init(gdsql_dbh* db)
+{
+    db->cache.entries = 0;
+    db->cache.size = 0;
+    db->cache.count = 0;
+    db->cache.tick = 0;
+    db->cache.hits = 0;
+    db->cache.misses = 0;
+    db->cache.evictions = 0;
+}
+
+void gdsql_cache_free(gdsql_dbh* db)
+{
+    gdsql_cache_clear(db);
+    free(db->cache.entries);
+    db->cache.entries = 0;
+    db->cache.size = 0;
+}
+
+int gdsql_cache_resize(gdsql_dbh* db,
+                       int size)
+{
+    int ret = 0;
+
+    do {
+        if (size < 0) {
+            ret = 1;
+            break;
+        }
+
+        gdsql_cache_clear(db);
+        free(db->cache.entries);
+        db->cache.entries = 0;
+        db->cache.size = 0;
+        if (size == 0)
+            break;
+
+        db->cache.entries = (CacheEntry*) calloc(size, sizeof(CacheEntry));
+        if (db->cache.entries == 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Could not create statement cache of size %d",
+                       size));
+            ret = 2;
+            break;
+        }
+        db->cache.size = size;
+    } while (0);
+
+    return ret;
+}
+
+void gdsql_cache_clear(gdsql_dbh* db)
+{
+    int j = 0;
+    for (j = 0; j < db->cache.size; ++j) {
+        CacheEntry* entry = &db->cache.entries[j];
+        if (entry->handle == 0)
+            continue;
+
+        if (entry->busy)
+            drop_entry(entry);
+        else
+            evict_entry(db, entry);
+    }
+    db->cache.count = 0;
+}
+
+int gdsql_cache_enabled(gdsql_dbh* db)
+{
+    return db->cache.size > 0;
+}
+
+void* gdsql_cache_get(gdsql_dbh* db,
+                      const char* query)
+{
+    if (db->cache.size <= 0)
+        return 0;
+
+    unsigned int hash = hash_query(query);
+    int j = 0;
+    for (j = 0; j < db->cache.size; ++j) {
+        CacheEntry* entry = &db->cache.entries[j];
+        if (entry->handle == 0 ||
+            entry->busy ||
+            entry->hash != hash ||
+            strcmp(entry->query, query) != 0)
+            continue;
+
+        entry->busy = 1;
+        entry->used = ++db->cache.tick;
+        ++db->cache.hits;
+        GDSQL_Log(LOG_DEBUG,
+                  ("Statement cache hit for [%s]",
+                   query));
+        return entry->handle;
+    }
+
+    ++db->cache.misses;
+    return 0;
+}
+
+int gdsql_cache_put(gdsql_dbh* db,
+                    const char* query,
+                    void* handle)
+{
+    CacheEntry* slot = 0;
+    int j = 0;
+
+    if (db->cache.size <= 0 || handle == 0)
+        return 1;
+
+    for (j = 0; j < db->cache.size; ++j) {
+        CacheEntry* entry = &db->cache.entries[j];
+        if (entry->handle == 0) {
+            slot = entry;
+            break;
+        }
+        if (entry->busy)
+            continue;
+        if (slot == 0 || entry->used < slot->used)
+            slot = entry;
+    }
+
+    // Full and every handle in use: caller keeps ownership.
+    if (slot == 0)
+        return 2;
+
+    if (slot->handle != 0) {
+        evict_entry(db, slot);
+        --db->cache.count;
+    }
+
+    slot->query = strdup(query);
+    if (slot->query == 0)
+        return 3;
+
+    slot->hash = hash_query(query);
+    slot->handle = handle;
+    slot->busy = 1;
+    slot->used = ++db->cache.tick;
+    ++db->cache.count;
+    return 0;
+}
+
+int gdsql_cache_release(gdsql_dbh* db,
+                        void* handle)
+{
+    int j = 0;
+
+    if (handle == 0)
+        return 1;
+
+    for (j = 0; j < db->cache.size; ++j) {
+        CacheEntry* entry = &db->cache.entries[j];
+        if (entry->handle != handle)
+            continue;
+
+        entry->busy = 0;
+        return 0;
+    }
+
+    return 2;
+}
+
+
+static unsigned int hash_query(const char* query)
+{
+    unsigned int h = 5381;
+    int j = 0;
+    for (j = 0; query[j] != '\0'; ++j)
+        h = h * 33 + (unsigned char) query[j];
+    return h;
+}
+
+static void evict_entry(gdsql_dbh* db,
+                        CacheEntry* entry)
+{
+    const DbOps* ops = get_dbops(db->type);
+
+    GDSQL_Log(LOG_DEBUG,
+              ("Evicting cached statement [%s]",
+               entry->query));
+    if (ops != 0 && ops->cache_evict != 0)
+        ops->cache_evict(db, entry->handle);
+    ++db->cache.evictions;
+    drop_entry(entry);
+}
+
+static void drop_entry(CacheEntry* entry)
+{
+    free(entry->query);
+    entry->query = 0;
+    entry->hash = 0;
+    entry->handle = 0;
+    entry->busy = 0;
+    entry->used = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef GDSQL_CACHE_H
+#define GDSQL_CACHE_H
+
+#include <gdsql_hidden.h>
+
+/*
+ * Per-connection cache of prepared statement handles.
+ *
+ * A handle is checked out with gdsql_cache_get() (which counts a hit
+ * or a miss), and returned with gdsql_cache_release() when the
+ * statement using it is finalized.  A checked out handle is never
+ * handed to another statement.  When the cache is full, the least
+ * recently used idle handle is evicted, and the driver is asked to
+ * deallocate it on the server via DbOps.cache_evict.
+ */
+
+void gdsql_cache_init(gdsql_dbh* db);
+void gdsql_cache_free(gdsql_dbh* db);
+
+/*
+ * Change the capacity; 0 disables the cache.  All idle handles are
+ * evicted.
+ */
+int gdsql_cache_resize(gdsql_dbh* db,
+                       int size);
+
+/*
+ * Evict all idle handles and forget about busy ones; the statements
+ * holding them will deallocate them when they are finalized.
+ */
+void gdsql_cache_clear(gdsql_dbh* db);
+
+int gdsql_cache_enabled(gdsql_dbh* db);
+
+/*
+ * Return an idle handle prepared for query, or 0.
+ */
+void* gdsql_cache_get(gdsql_dbh* db,
+                      const char* query);
+
+/*
+ * Add a freshly prepared (and busy) handle.  Return 0 if the cache
+ * took it, non-zero if the caller still owns it.
+ */
+int gdsql_cache_put(gdsql_dbh* db,
+                    const char* query,
+                    void* handle);
+
+/*
+ * Mark a handle as idle again.  Return 0 if the handle belongs to the
+ * cache, non-zero if the caller must deallocate it.
+ */
+int gdsql_cache_release(gdsql_dbh* db,
+                        void* handle);
+
+#endif
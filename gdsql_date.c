@@ -107,18 +107,26 @@ unsigned int gdsql_get_now(int* Y, int* M, int* D,
     return gdsql_get_time(t, Y, M, D, h, m, s, utc);
 }
 
+unsigned long long gdsql_get_nsecs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 unsigned int gdsql_get_time(unsigned int when,
                             int* Y, int* M, int* D,
                             int* h, int* m, int* s,
                             int utc)
 {
+    struct tm buf;
     struct tm* tm;
     time_t t = when;
 
     if (utc)
-        tm = gmtime(&t);
+        tm = gmtime_r(&t, &buf);
     else
-        tm = localtime(&t);
+        tm = localtime_r(&t, &buf);
 
     if (Y != 0)
         *Y = tm->tm_year + 1900;
@@ -141,12 +149,13 @@ unsigned int gdsql_set_time(int Y, int M, int D,
                             int utc)
 {
     time_t t = 0; // 1-Jan-1970
+    struct tm buf;
     struct tm* tm;
 
     if (utc)
-        tm = gmtime(&t);
+        tm = gmtime_r(&t, &buf);
     else
-        tm = localtime(&t);
+        tm = localtime_r(&t, &buf);
 
     if (Y >= 0)
         tm->tm_year = Y - 1900;
@@ -42,6 +42,10 @@ unsigned int gdsql_get_time(unsigned int when,
                             int* h, int* m, int* s,
                             int utc);
 
+// Get a reading of a monotonic clock, in nanoseconds; only useful
+// to measure elapsed times.
+unsigned long long gdsql_get_nsecs(void);
+
 // Build a day/time with the specified separate components.
 unsigned int gdsql_set_time(int Y, int M, int D,
                             int h, int m, int s,
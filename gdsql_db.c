@@ -2,8 +2,11 @@
 #include <string.h>
 #include <gdsql_log.h>
 #include <gdsql_hidden.h>
+#include <gdsql_cache.h>
 #include <gdsql_util.h>
 #include <gdsql_db.h>
+#include <gdsql_group.h>
+#include <gdsql_pool.h>
 
 gdsql_stmt gdsql_db_alloc_stmt(gdsql_db gdsql_db)
 {
@@ -25,6 +28,12 @@ gdsql_stmt gdsql_db_alloc_stmt(gdsql_db gdsql_db)
         sh->data = 0;
         sh->state = STMT_STATE_CREATED;
         sh->query[0] = '\0';
+        sh->arrays = 0;
+        sh->fetch_mode = GDSQL_FETCH_DEFAULT;
+        sh->fetch_size = 0;
+        sh->status = 0;
+        memset(&sh->stats, 0, sizeof(sh->stats));
+        memset(&sh->slow_base, 0, sizeof(sh->slow_base));
     } while (0);
     
     return sh;
@@ -37,10 +46,193 @@ void gdsql_db_free_stmt(gdsql_stmt gdsql_stmt)
         if (sh == 0)
             break;
 
+        free(sh->arrays);
         free(sh);
     } while (0);
 }
 
+gdsql_load gdsql_db_alloc_load(gdsql_db gdsql_db)
+{
+    gdsql_loadh* lh = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0)
+            break;
+    
+        lh = (gdsql_loadh*) malloc(sizeof(gdsql_loadh));
+        if (lh == 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Could not create gdsql_load object"));
+            break;
+        }
+
+        lh->gdsql_db = dh;
+        lh->data = 0;
+        lh->state = LOAD_STATE_CREATED;
+        lh->rows = 0;
+    } while (0);
+    
+    return lh;
+}
+
+void gdsql_db_free_load(gdsql_load gdsql_load)
+{
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0)
+            break;
+
+        // A load that was started but never ended is aborted, so that
+        // none of its rows are committed; so is one whose end failed,
+        // in case the driver still holds on to something.
+        const DbOps* ops = get_dbops(lh->gdsql_db->type);
+        if ((lh->state == LOAD_STATE_STARTED ||
+             (lh->state == LOAD_STATE_FAILED && lh->data != 0)) &&
+            ops != 0 && ops->load_abort != 0)
+            ops->load_abort(lh);
+
+        free(lh);
+    } while (0);
+}
+
+gdsql_group gdsql_db_alloc_group(gdsql_db gdsql_db)
+{
+    gdsql_grouph* gh = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0)
+            break;
+
+        gh = (gdsql_grouph*) malloc(sizeof(gdsql_grouph));
+        if (gh == 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Could not create gdsql_group object"));
+            break;
+        }
+
+        gh->gdsql_db = dh;
+        gh->max_count = GDSQL_GROUP_DEFAULT_COUNT;
+        gh->max_msecs = GDSQL_GROUP_DEFAULT_MSECS;
+        pthread_mutex_init(&gh->lock, 0);
+        pthread_cond_init(&gh->more, 0);
+        pthread_cond_init(&gh->done, 0);
+        gh->head = 0;
+        gh->tail = 0;
+        gh->count = 0;
+        gh->leading = 0;
+        gh->batches = 0;
+    } while (0);
+
+    return gh;
+}
+
+void gdsql_db_free_group(gdsql_group gdsql_group)
+{
+    do {
+        gdsql_grouph* gh = gdsql_check_group(gdsql_group);
+        if (gh == 0)
+            break;
+
+        pthread_cond_destroy(&gh->done);
+        pthread_cond_destroy(&gh->more);
+        pthread_mutex_destroy(&gh->lock);
+        free(gh);
+    } while (0);
+}
+
+gdsql_pool gdsql_db_alloc_pool(gdsql_db gdsql_db,
+                               int min_size,
+                               int max_size)
+{
+    gdsql_poolh* ph = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0)
+            break;
+
+        if (min_size < 0 || max_size < 1 || min_size > max_size) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid pool size %d / %d",
+                       min_size, max_size));
+            break;
+        }
+
+        ph = (gdsql_poolh*) malloc(sizeof(gdsql_poolh));
+        if (ph == 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Could not create gdsql_pool object"));
+            break;
+        }
+        memset(ph, 0, sizeof(gdsql_poolh));
+
+        ph->slots = (PoolSlot*) calloc(max_size, sizeof(PoolSlot));
+        if (ph->slots == 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Could not create gdsql_pool object"));
+            free(ph);
+            ph = 0;
+            break;
+        }
+
+        ph->tmpl = dh;
+        ph->min_size = min_size;
+        ph->max_size = max_size;
+        ph->validate_msecs = GDSQL_POOL_DEFAULT_VALIDATE_MSECS;
+        ph->idle_msecs = GDSQL_POOL_DEFAULT_IDLE_MSECS;
+        pthread_mutex_init(&ph->lock, 0);
+        pthread_cond_init(&ph->free, 0);
+
+        // Open the minimum number of connections right away, so that
+        // the first users do not pay for them.
+        gdsql_pool_fill(ph);
+    } while (0);
+
+    return ph;
+}
+
+void gdsql_db_free_pool(gdsql_pool gdsql_pool)
+{
+    do {
+        gdsql_poolh* ph = gdsql_check_pool(gdsql_pool);
+        if (ph == 0)
+            break;
+
+        // Connections still checked out (or being opened) would be
+        // closed under their users; wait for them to come back.
+        pthread_mutex_lock(&ph->lock);
+        int j = 0;
+        while (1) {
+            int busy = 0;
+            for (j = 0; j < ph->max_size; ++j)
+                busy += ph->slots[j].busy;
+            if (busy == 0)
+                break;
+
+            GDSQL_Log(LOG_INFO,
+                      ("Waiting for %d pool connections to be checked in",
+                       busy));
+            pthread_cond_wait(&ph->free, &ph->lock);
+        }
+        pthread_mutex_unlock(&ph->lock);
+
+        for (j = 0; j < ph->max_size; ++j) {
+            if (ph->slots[j].db == 0)
+                continue;
+
+            gdsql_db_close(ph->slots[j].db);
+            gdsql_free_db(ph->slots[j].db);
+        }
+
+        pthread_cond_destroy(&ph->free);
+        pthread_mutex_destroy(&ph->lock);
+        free(ph->slots);
+        free(ph);
+    } while (0);
+}
+
 gdsql gdsql_db_get_gdsql(gdsql_db gdsql_db)
 {
     gdsql gdsql = 0;
@@ -246,8 +438,17 @@ int gdsql_db_open(gdsql_db gdsql_db)
             break;
 
         const DbOps* ops = get_dbops(dh->type);
-        if (ops != 0)
-            ret = ops->db_open(dh);
+        if (ops != 0) {
+            if (TRACE_ON(dh)) {
+                TraceSpan span;
+                trace_begin(&span, dh, GDSQL_TRACE_DB_OPEN, dh->name);
+                ret = ops->db_open(dh);
+                trace_end(&span, ret);
+            } else
+                ret = ops->db_open(dh);
+            metrics_count(dh->type,
+                          ret == 0 ? METRIC_CONN_OPENED : METRIC_ERRORS, 1);
+        }
     } while (0);
 
     return ret;
@@ -262,9 +463,334 @@ int gdsql_db_close(gdsql_db gdsql_db)
         if (dh == 0)
             break;
 
+        gdsql_cache_clear(dh);
+
         const DbOps* ops = get_dbops(dh->type);
-        if (ops != 0)
+        if (ops != 0) {
             ret = ops->db_close(dh);
+            metrics_count(dh->type,
+                          ret == 0 ? METRIC_CONN_CLOSED : METRIC_ERRORS, 1);
+        }
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_db_get_cache_size(gdsql_db gdsql_db)
+{
+    int size = -1;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0)
+            break;
+
+        size = dh->cache.size;
+    } while (0);
+
+    return size;
+}
+
+int gdsql_db_get_stats(gdsql_db gdsql_db)
+{
+    int on = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0)
+            break;
+
+        on = dh->stats;
+    } while (0);
+
+    return on;
+}
+
+int gdsql_db_set_stats(gdsql_db gdsql_db,
+                       int on)
+{
+    int old = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0)
+            break;
+
+        old = dh->stats;
+        dh->stats = (on != 0);
+    } while (0);
+
+    return old;
+}
+
+int gdsql_db_set_cache_size(gdsql_db gdsql_db,
+                            int size)
+{
+    int ret = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (size < 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid DB cache size"));
+            ret = 2;
+            break;
+        }
+
+        if (gdsql_cache_resize(dh, size) != 0) {
+            ret = 3;
+            break;
+        }
+    } while (0);
+
+    return ret;
+}
+
+unsigned long gdsql_db_get_cache_hits(gdsql_db gdsql_db)
+{
+    unsigned long hits = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0)
+            break;
+
+        hits = dh->cache.hits;
+    } while (0);
+
+    return hits;
+}
+
+unsigned long gdsql_db_get_cache_misses(gdsql_db gdsql_db)
+{
+    unsigned long misses = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0)
+            break;
+
+        misses = dh->cache.misses;
+    } while (0);
+
+    return misses;
+}
+
+unsigned long gdsql_db_get_cache_evictions(gdsql_db gdsql_db)
+{
+    unsigned long evictions = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0)
+            break;
+
+        evictions = dh->cache.evictions;
+    } while (0);
+
+    return evictions;
+}
+
+int gdsql_db_pipeline_begin(gdsql_db gdsql_db)
+{
+    int ret = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(dh->type);
+        if (ops == 0 || ops->db_pipeline_begin == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->db_pipeline_begin(dh);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_db_pipeline_sync(gdsql_db gdsql_db)
+{
+    int ret = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(dh->type);
+        if (ops == 0 || ops->db_pipeline_sync == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->db_pipeline_sync(dh);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_db_pipeline_end(gdsql_db gdsql_db)
+{
+    int ret = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(dh->type);
+        if (ops == 0 || ops->db_pipeline_end == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->db_pipeline_end(dh);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_db_get_socket(gdsql_db gdsql_db)
+{
+    int fd = -1;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0)
+            break;
+
+        const DbOps* ops = get_dbops(dh->type);
+        if (ops == 0 || ops->db_get_socket == 0)
+            break;
+
+        fd = ops->db_get_socket(dh);
+    } while (0);
+
+    return fd;
+}
+
+int gdsql_db_bulk_begin(gdsql_db gdsql_db,
+                        int rows,
+                        int msecs)
+{
+    int ret = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(dh->type);
+        if (ops == 0 || ops->db_bulk_begin == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->db_bulk_begin(dh, rows, msecs);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_db_bulk_end(gdsql_db gdsql_db)
+{
+    int ret = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(dh->type);
+        if (ops == 0 || ops->db_bulk_end == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->db_bulk_end(dh);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_db_exec(gdsql_db gdsql_db,
+                  const char* sql)
+{
+    int ret = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (sql == 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid SQL"));
+            ret = 2;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(dh->type);
+        if (ops == 0 || ops->db_exec == 0) {
+            ret = 2;
+            break;
+        }
+
+        if (TRACE_ON(dh)) {
+            TraceSpan span;
+            trace_begin(&span, dh, GDSQL_TRACE_STMT_EXECUTE, sql);
+            ret = ops->db_exec(dh, sql);
+            trace_end(&span, ret);
+        } else
+            ret = ops->db_exec(dh, sql);
+        metrics_count(dh->type,
+                      ret == 0 ? METRIC_STMT_EXECUTED : METRIC_ERRORS, 1);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_db_ping(gdsql_db gdsql_db)
+{
+    int ret = 0;
+
+    do {
+        gdsql_dbh* dh = gdsql_check_db(gdsql_db);
+        if (dh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(dh->type);
+        if (ops == 0 || ops->db_ping == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->db_ping(dh);
+        if (ret != 0)
+            metrics_count(dh->type, METRIC_ERRORS, 1);
     } while (0);
 
     return ret;
@@ -6,6 +6,17 @@
 gdsql_stmt gdsql_db_alloc_stmt(gdsql_db gdsql_db);
 void gdsql_db_free_stmt(gdsql_stmt stmt);
 
+gdsql_load gdsql_db_alloc_load(gdsql_db gdsql_db);
+void gdsql_db_free_load(gdsql_load load);
+
+gdsql_group gdsql_db_alloc_group(gdsql_db gdsql_db);
+void gdsql_db_free_group(gdsql_group group);
+
+gdsql_pool gdsql_db_alloc_pool(gdsql_db gdsql_db,
+                               int min_size,
+                               int max_size);
+void gdsql_db_free_pool(gdsql_pool pool);
+
 gdsql gdsql_db_get_gdsql(gdsql_db gdsql_db);
 
 int gdsql_db_get_type(gdsql_db gdsql_db);
@@ -33,4 +44,83 @@ void gdsql_db_set_password(gdsql_db gdsql_db,
 int gdsql_db_open(gdsql_db gdsql_db);
 int gdsql_db_close(gdsql_db gdsql_db);
 
+/*
+ * Prepared statements can be cached per connection, keyed by their
+ * exact query text, so that running the same query again skips the
+ * parse / plan round trip.  The cache is disabled (size 0) by
+ * default; when it is full, the least recently used statement not
+ * currently in use is deallocated.
+ */
+int gdsql_db_get_cache_size(gdsql_db gdsql_db);
+int gdsql_db_set_cache_size(gdsql_db gdsql_db,
+                            int size);
+unsigned long gdsql_db_get_cache_hits(gdsql_db gdsql_db);
+unsigned long gdsql_db_get_cache_misses(gdsql_db gdsql_db);
+unsigned long gdsql_db_get_cache_evictions(gdsql_db gdsql_db);
+
+/*
+ * Collect statistics for the statements of this connection (see
+ * gdsql_stmt_get_stats()).  Off by default, when it costs one test
+ * per call.  Return the previous setting.
+ */
+int gdsql_db_get_stats(gdsql_db gdsql_db);
+int gdsql_db_set_stats(gdsql_db gdsql_db,
+                       int on);
+
+/*
+ * Pipelining (Postgres only): between gdsql_db_pipeline_begin() and
+ * gdsql_db_pipeline_end(), statements cannot be stepped or started;
+ * instead they are queued with gdsql_stmt_pipeline_queue(), using the
+ * parameters bound at the time; the same statement can be queued many
+ * times, with different parameters.  gdsql_db_pipeline_sync() sends
+ * everything queued in one go, waits for all the results and stores
+ * the outcome in each statement, to be checked with
+ * gdsql_stmt_get_status().
+ *
+ * The statements queued between two syncs run in a single implicit
+ * transaction (unless one was opened explicitly): after the first
+ * failure the rest are skipped.  Rows returned by queued statements
+ * are discarded.  Ending the pipeline syncs whatever is still queued.
+ */
+int gdsql_db_pipeline_begin(gdsql_db gdsql_db);
+int gdsql_db_pipeline_sync(gdsql_db gdsql_db);
+int gdsql_db_pipeline_end(gdsql_db gdsql_db);
+
+/*
+ * The file descriptor to watch (for reading) while a statement started
+ * with gdsql_stmt_start() runs on this connection, or -1 if there is
+ * none.  See gdsql_stmt_poll().  On Postgres, a statement with large
+ * parameters may not be fully sent at once; watching for writing too
+ * lets gdsql_stmt_poll() send the rest sooner.
+ */
+int gdsql_db_get_socket(gdsql_db gdsql_db);
+
+/*
+ * Run one or more SQL statements that take no parameters, such as
+ * "BEGIN" or "CREATE TABLE ...", discarding any rows they return.
+ */
+int gdsql_db_exec(gdsql_db gdsql_db,
+                  const char* sql);
+
+/*
+ * Check that the connection is still alive, with a round trip to the
+ * server where there is one.
+ */
+int gdsql_db_ping(gdsql_db gdsql_db);
+
+/*
+ * Bulk mode (SQLite only), for loading lots of rows: between
+ * gdsql_db_bulk_begin() and gdsql_db_bulk_end(), all statements run
+ * inside transactions that are committed every rows rows or every
+ * msecs milliseconds, whichever comes first (0 means no limit), and
+ * the database is tuned for ingestion (WAL journal, relaxed syncs,
+ * bigger page cache, temporary tables in memory).  Ending the bulk
+ * mode commits the last transaction and restores the previous
+ * settings.  It cannot be started while a transaction is open.
+ */
+int gdsql_db_bulk_begin(gdsql_db gdsql_db,
+                        int rows,
+                        int msecs);
+int gdsql_db_bulk_end(gdsql_db gdsql_db);
+
 #endif
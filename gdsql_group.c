@@ -0,0 +1,244 @@
+#include <errno.h>
+#include <time.h>
+#include <gdsql_log.h>
+#include <gdsql_hidden.h>
+#include <gdsql_util.h>
+#include <gdsql_db.h>
+#include <gdsql_group.h>
+
+typedef struct GroupItem {
+    gdsql_group_work* work;
+    void* arg;
+    int ret;
+    int done;
+    struct GroupItem* next;
+} GroupItem;
+
+static void gather_batch(gdsql_grouph* gh);
+static int run_batch(gdsql_grouph* gh,
+                     GroupItem* batch,
+                     int count);
+static int run_item(gdsql_grouph* gh,
+                    GroupItem* item,
+                    int savepoint);
+
+int gdsql_group_set_limits(gdsql_group gdsql_group,
+                           int max_count,
+                           int max_msecs)
+{
+    int ret = 0;
+
+    do {
+        gdsql_grouph* gh = gdsql_check_group(gdsql_group);
+        if (gh == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (max_count < 1 || max_msecs < 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid group limits %d / %d",
+                       max_count, max_msecs));
+            ret = 2;
+            break;
+        }
+
+        pthread_mutex_lock(&gh->lock);
+        gh->max_count = max_count;
+        gh->max_msecs = max_msecs;
+        pthread_mutex_unlock(&gh->lock);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_group_submit(gdsql_group gdsql_group,
+                       gdsql_group_work* work,
+                       void* arg)
+{
+    int ret = 0;
+
+    do {
+        gdsql_grouph* gh = gdsql_check_group(gdsql_group);
+        if (gh == 0) {
+            ret = GDSQL_GROUP_INVALID;
+            break;
+        }
+
+        if (work == 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid group work"));
+            ret = GDSQL_GROUP_INVALID;
+            break;
+        }
+
+        // The item lives on our stack: we do not return before the
+        // batch that contains it is done.
+        GroupItem item;
+        item.work = work;
+        item.arg = arg;
+        item.ret = 0;
+        item.done = 0;
+        item.next = 0;
+
+        pthread_mutex_lock(&gh->lock);
+        if (gh->tail != 0)
+            gh->tail->next = &item;
+        else
+            gh->head = &item;
+        gh->tail = &item;
+        ++gh->count;
+        pthread_cond_signal(&gh->more);
+
+        while (! item.done) {
+            if (gh->leading) {
+                pthread_cond_wait(&gh->done, &gh->lock);
+                continue;
+            }
+
+            // Nobody is running a batch, so we do; our own item may
+            // end up in it or in a later one.
+            gh->leading = 1;
+            gather_batch(gh);
+
+            GroupItem* batch = gh->head;
+            int count = gh->count;
+            gh->head = 0;
+            gh->tail = 0;
+            gh->count = 0;
+            pthread_mutex_unlock(&gh->lock);
+
+            run_batch(gh, batch, count);
+
+            pthread_mutex_lock(&gh->lock);
+            GroupItem* p = batch;
+            while (p != 0) {
+                GroupItem* next = p->next;
+                p->done = 1;
+                p = next;
+            }
+            ++gh->batches;
+            gh->leading = 0;
+            pthread_cond_broadcast(&gh->done);
+        }
+        pthread_mutex_unlock(&gh->lock);
+
+        ret = item.ret;
+    } while (0);
+
+    return ret;
+}
+
+unsigned long gdsql_group_get_batches(gdsql_group gdsql_group)
+{
+    unsigned long batches = 0;
+
+    do {
+        gdsql_grouph* gh = gdsql_check_group(gdsql_group);
+        if (gh == 0)
+            break;
+
+        pthread_mutex_lock(&gh->lock);
+        batches = gh->batches;
+        pthread_mutex_unlock(&gh->lock);
+    } while (0);
+
+    return batches;
+}
+
+
+/*
+ * Called by the leader, with the lock held: wait for more work until
+ * the batch is full or the delay is over.
+ */
+static void gather_batch(gdsql_grouph* gh)
+{
+    if (gh->max_msecs <= 0)
+        return;
+
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += gh->max_msecs / 1000;
+    until.tv_nsec += (long) (gh->max_msecs % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_nsec -= 1000000000L;
+        ++until.tv_sec;
+    }
+
+    while (gh->count < gh->max_count) {
+        if (pthread_cond_timedwait(&gh->more,
+                                   &gh->lock,
+                                   &until) == ETIMEDOUT)
+            break;
+    }
+}
+
+static int run_batch(gdsql_grouph* gh,
+                     GroupItem* batch,
+                     int count)
+{
+    gdsql_dbh* dh = gh->gdsql_db;
+    GroupItem* p = 0;
+
+    GDSQL_Log(LOG_INFO,
+              ("Running group batch with %d items",
+               count));
+    if (gdsql_db_exec(dh, "BEGIN") != 0) {
+        for (p = batch; p != 0; p = p->next)
+            p->ret = GDSQL_GROUP_COMMIT_FAILED;
+        return 1;
+    }
+
+    // A single item needs no savepoint: if it fails, we roll back
+    // the whole transaction.
+    int ok = 0;
+    for (p = batch; p != 0; p = p->next) {
+        p->ret = run_item(gh, p, count > 1);
+        if (p->ret == GDSQL_GROUP_OK)
+            ++ok;
+    }
+
+    int ret = 0;
+    if (ok == 0) {
+        gdsql_db_exec(dh, "ROLLBACK");
+    } else if (gdsql_db_exec(dh, "COMMIT") != 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("Group commit of %d items failed",
+                   count));
+        gdsql_db_exec(dh, "ROLLBACK");
+        for (p = batch; p != 0; p = p->next)
+            if (p->ret == GDSQL_GROUP_OK)
+                p->ret = GDSQL_GROUP_COMMIT_FAILED;
+        ret = 2;
+    }
+
+    return ret;
+}
+
+static int run_item(gdsql_grouph* gh,
+                    GroupItem* item,
+                    int savepoint)
+{
+    gdsql_dbh* dh = gh->gdsql_db;
+
+    if (savepoint &&
+        gdsql_db_exec(dh, "SAVEPOINT gdsql_group") != 0)
+        return GDSQL_GROUP_COMMIT_FAILED;
+
+    if (item->work(dh, item->arg) != 0) {
+        if (savepoint) {
+            gdsql_db_exec(dh, "ROLLBACK TO SAVEPOINT gdsql_group");
+            gdsql_db_exec(dh, "RELEASE SAVEPOINT gdsql_group");
+        }
+        return GDSQL_GROUP_WORK_FAILED;
+    }
+
+    if (savepoint &&
+        gdsql_db_exec(dh, "RELEASE SAVEPOINT gdsql_group") != 0) {
+        gdsql_db_exec(dh, "ROLLBACK TO SAVEPOINT gdsql_group");
+        gdsql_db_exec(dh, "RELEASE SAVEPOINT gdsql_group");
+        return GDSQL_GROUP_WORK_FAILED;
+    }
+
+    return GDSQL_GROUP_OK;
+}
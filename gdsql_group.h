@@ -0,0 +1,44 @@
+#ifndef GDSQL_GROUP_H_
+#define GDSQL_GROUP_H_
+
+#include <gdsql_types.h>
+
+/*
+ * Group commit: many threads doing small writes on one connection,
+ * each followed by a commit, spend most of their time waiting for the
+ * disk.  With a group, created with gdsql_db_alloc_group(), each
+ * thread submits its work as a function instead, and blocks until a
+ * transaction shared with the work of other threads has committed.
+ * Work is gathered for up to max_msecs milliseconds, or until
+ * max_count submissions are waiting, and then run by one of the
+ * submitting threads, each piece inside its own savepoint: a piece of
+ * work that fails is rolled back without affecting the others.
+ *
+ * The work function gets the connection of the group and must not
+ * commit or roll back; it returns 0 on success.  Nobody else should
+ * use the connection while the group is in use.
+ */
+
+#define GDSQL_GROUP_DEFAULT_COUNT  64
+#define GDSQL_GROUP_DEFAULT_MSECS   5
+
+// Outcomes of gdsql_group_submit().
+#define GDSQL_GROUP_OK              0   // work committed
+#define GDSQL_GROUP_INVALID         1   // bad group or work
+#define GDSQL_GROUP_WORK_FAILED     2   // work failed, rolled back
+#define GDSQL_GROUP_COMMIT_FAILED   3   // transaction failed, nothing done
+
+typedef int (gdsql_group_work)(gdsql_db gdsql_db,
+                               void* arg);
+
+int gdsql_group_set_limits(gdsql_group gdsql_group,
+                           int max_count,
+                           int max_msecs);
+
+int gdsql_group_submit(gdsql_group gdsql_group,
+                       gdsql_group_work* work,
+                       void* arg);
+
+unsigned long gdsql_group_get_batches(gdsql_group gdsql_group);
+
+#endif
@@ -1,14 +1,43 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
 #include <gdsql.h>
 #include <gdsql_hidden.h>
 
+/*
+ * The registered drivers.  Each entry is written once, when its
+ * driver boots, and read on every call, so there is no lock: the
+ * atomic accesses make sure a thread that sees a driver also sees its
+ * fully initialized ops table.
+ */
 static const DbOps* dbops[GDSQL_DB_COUNT];
 
+/*
+ * How many gdsql handles are using each driver; this is only touched
+ * when a handle starts or stops using a driver, so a lock is fine.
+ */
+static pthread_mutex_t driver_lock = PTHREAD_MUTEX_INITIALIZER;
+static int driver_refs[GDSQL_DB_COUNT];
+
+static const char* dbnames[GDSQL_DB_COUNT] = {
+    "SQLite",
+    "Postgres",
+    "MySQL",
+};
+
+// Longest string value shown in full by param_text_string().
+#define PARAM_TEXT_STRING  32
+
+static void param_text_append(ParamText* text,
+                              const char* fmt,
+                              ...) __attribute__((format(printf, 2, 3)));
+
 const DbOps* get_dbops(int dbtype)
 {
     if (dbtype < 0 || dbtype >= GDSQL_DB_COUNT)
         return 0;
 
-    return dbops[dbtype];
+    return __atomic_load_n(&dbops[dbtype], __ATOMIC_ACQUIRE);
 }
 
 void set_dbops(int dbtype,
@@ -17,5 +46,173 @@ void set_dbops(int dbtype,
     if (dbtype < 0 || dbtype >= GDSQL_DB_COUNT)
         return;
 
-    dbops[dbtype] = ops;
+    __atomic_store_n(&dbops[dbtype], ops, __ATOMIC_RELEASE);
+}
+
+const char* get_dbname(int dbtype)
+{
+    if (dbtype < 0 || dbtype >= GDSQL_DB_COUNT)
+        return "unknown";
+
+    return dbnames[dbtype];
+}
+
+int acquire_driver(int dbtype)
+{
+    const DbOps* ops = get_dbops(dbtype);
+    if (ops == 0)
+        return 1;
+
+    int ret = 0;
+    pthread_mutex_lock(&driver_lock);
+    if (driver_refs[dbtype] == 0 &&
+        ops->init != 0 &&
+        ops->init() != 0)
+        ret = 2;
+    else
+        ++driver_refs[dbtype];
+    pthread_mutex_unlock(&driver_lock);
+
+    return ret;
+}
+
+void release_driver(int dbtype)
+{
+    const DbOps* ops = get_dbops(dbtype);
+    if (ops == 0)
+        return;
+
+    pthread_mutex_lock(&driver_lock);
+    if (driver_refs[dbtype] > 0 &&
+        --driver_refs[dbtype] == 0 &&
+        ops->fini != 0)
+        ops->fini();
+    pthread_mutex_unlock(&driver_lock);
+}
+
+void trace_begin(TraceSpan* span,
+                 gdsql_dbh* dh,
+                 int op,
+                 const char* query)
+{
+    const TraceHooks* hooks = dh->gdsql->trace;
+
+    span->hooks = hooks;
+    span->op = op;
+    span->dbtype = dh->type;
+    span->query = query;
+    span->span = 0;
+    if (hooks->start != 0)
+        span->span = hooks->start(hooks->ctx, op, dh->type, query);
+    span->t0 = gdsql_get_nsecs();
+}
+
+void trace_end(TraceSpan* span,
+               int ret)
+{
+    unsigned long long nsecs = gdsql_get_nsecs() - span->t0;
+    const TraceHooks* hooks = span->hooks;
+
+    if (hooks->end != 0)
+        hooks->end(hooks->ctx, span->span, span->op, span->dbtype,
+                   span->query, nsecs, ret);
+}
+
+void stmt_stats_row(gdsql_stmth* stmt,
+                    unsigned long long t0,
+                    unsigned long long bytes)
+{
+    stmt->stats.decode_nsecs += gdsql_get_nsecs() - t0;
+    stmt->stats.bytes += bytes;
+    ++stmt->stats.rows;
+}
+
+unsigned long long row_bytes(const Row* row)
+{
+    unsigned long long bytes = 0;
+    int j;
+
+    for (j = 0; j < row->ncol; ++j) {
+        const Col* col = &row->cols[j];
+        if (col->null)
+            continue;
+
+        switch (col->type) {
+        case STMT_VAL_INT:
+        case STMT_VAL_BOOLEAN:
+            bytes += sizeof(int);
+            break;
+        case STMT_VAL_DOUBLE:
+        case STMT_VAL_DATE:
+            bytes += sizeof(double);
+            break;
+        case STMT_VAL_STRING:
+            bytes += strlen(col->val.sval);
+            break;
+        }
+    }
+
+    return bytes;
+}
+
+void param_text_null(ParamText* text)
+{
+    param_text_append(text, "NULL");
+}
+
+void param_text_int(ParamText* text,
+                    int val)
+{
+    param_text_append(text, "%d", val);
+}
+
+void param_text_double(ParamText* text,
+                       double val)
+{
+    param_text_append(text, "%g", val);
+}
+
+void param_text_string(ParamText* text,
+                       const char* val,
+                       int len)
+{
+    if (len > PARAM_TEXT_STRING)
+        param_text_append(text, "'%.*s...'(%d)",
+                          PARAM_TEXT_STRING, val, len);
+    else
+        param_text_append(text, "'%.*s'", len, val);
+}
+
+void param_text_date(ParamText* text,
+                     double val)
+{
+    int Y, M, D, h, m, s;
+
+    gdsql_jul2cal(val, &Y, &M, &D, &h, &m, &s);
+    param_text_append(text, "'%04d-%02d-%02d %02d:%02d:%02d'",
+                      Y, M, D, h, m, s);
+}
+
+static void param_text_append(ParamText* text,
+                              const char* fmt,
+                              ...)
+{
+    if (text->len >= text->size - 1)
+        return;
+
+    if (text->len > 0)
+        text->len += snprintf(text->buf + text->len,
+                              text->size - text->len, ", ");
+    if (text->len >= text->size - 1) {
+        text->len = text->size - 1;
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    text->len += vsnprintf(text->buf + text->len,
+                           text->size - text->len, fmt, ap);
+    va_end(ap);
+    if (text->len >= text->size)
+        text->len = text->size - 1;
 }
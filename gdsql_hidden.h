@@ -1,11 +1,57 @@
 #ifndef GDSQL_HIDDEN_H
 #define GDSQL_HIDDEN_H
 
+#include <pthread.h>
+#include <gdsql.h>
+#include <gdsql_date.h>
+
+/*
+ * Tracing callbacks set with gdsql_set_trace().
+ */
+typedef struct TraceHooks {
+    gdsql_trace_start start;
+    gdsql_trace_end end;
+    void* ctx;
+} TraceHooks;
+
+/*
+ * The drivers this handle is using; each one holds a reference on
+ * the process-wide initialization of its client library (see
+ * acquire_driver()).
+ */
 typedef struct gdsqlh {
     unsigned char version;
+    pthread_mutex_t lock;
+    int drivers[GDSQL_DB_COUNT];
+    TraceHooks hooks;
+    const TraceHooks* trace;    // &hooks when tracing, 0 otherwise
 } gdsqlh;
 
 
+/*
+ * An LRU cache of prepared statement handles, kept per connection and
+ * keyed by the exact query text.  The handles are opaque to the cache;
+ * each driver decides what it stores there (a sqlite3_stmt*, a
+ * MYSQL_STMT*, the name of a Postgres prepared statement, etc).
+ */
+typedef struct CacheEntry {
+    char* query;
+    unsigned int hash;
+    void* handle;
+    int busy;
+    unsigned long used;
+} CacheEntry;
+
+typedef struct StmtCache {
+    CacheEntry* entries;
+    int size;
+    int count;
+    unsigned long tick;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} StmtCache;
+
 typedef struct gdsql_dbh {
     gdsqlh* gdsql;
     void* data;
@@ -15,6 +61,8 @@ typedef struct gdsql_dbh {
     char name[50];
     char user[50];
     char password[50];
+    StmtCache cache;
+    int stats;
 } gdsql_dbh;
 
 
@@ -31,9 +79,79 @@ typedef struct gdsql_stmth {
     void* data;
     int state;
     char query[512];
+    struct ArrayParams* arrays;
+    int fetch_mode;
+    int fetch_size;
+    int status;
+    gdsql_stmt_stats stats;
+    gdsql_stmt_stats slow_base;     // stats when the slow log last looked
 } gdsql_stmth;
 
 
+#define LOAD_STATE_CREATED   0
+#define LOAD_STATE_STARTED   1
+#define LOAD_STATE_FINISHED  2
+#define LOAD_STATE_FAILED    3
+
+typedef struct gdsql_loadh {
+    gdsql_dbh* gdsql_db;
+    void* data;
+    int state;
+    unsigned long rows;
+} gdsql_loadh;
+
+
+/*
+ * Work submitted to a group commit; submitters queue here and the
+ * first one to find no leader runs the whole batch.
+ */
+typedef struct gdsql_grouph {
+    gdsql_dbh* gdsql_db;
+    int max_count;
+    int max_msecs;
+    pthread_mutex_t lock;
+    pthread_cond_t more;        // signalled when work is queued
+    pthread_cond_t done;        // broadcast when a batch finishes
+    struct GroupItem* head;
+    struct GroupItem* tail;
+    int count;
+    int leading;
+    unsigned long batches;
+} gdsql_grouph;
+
+
+/*
+ * A pool of connections, all of them opened with the settings of a
+ * template connection.  A slot with no db is being opened by someone.
+ */
+typedef struct PoolSlot {
+    gdsql_dbh* db;
+    int busy;
+    unsigned long long idle_since;
+} PoolSlot;
+
+typedef struct gdsql_poolh {
+    gdsql_dbh* tmpl;
+    int min_size;
+    int max_size;
+    int validate_msecs;
+    int idle_msecs;
+    pthread_mutex_t lock;
+    pthread_cond_t free;        // signalled when a slot is released
+    PoolSlot* slots;
+    int size;                   // slots in use, open or being opened
+    int in_use;
+    unsigned long checkouts;
+    unsigned long waits;
+    unsigned long long wait_nsecs;
+    unsigned long timeouts;
+    unsigned long creations;
+    unsigned long failures;
+    unsigned long reaped;
+    unsigned long long reap_at;  // no idle connection expires before
+} gdsql_poolh;
+
+
 #define STMT_MAX_COLS    100
 
 #define STMT_VAL_INVALID 0
@@ -62,11 +180,81 @@ typedef struct Row {
     int ncol;
 } Row;
 
+/*
+ * Statement statistics (see gdsql_db_set_stats()), also collected
+ * while the slow query log is open.  STMT_STATS_START gives 0 when
+ * they are off, and then everything else is skipped; drivers call
+ * stmt_stats_row() after decoding each row.
+ */
+extern int slow_log_on;
+
+#define STMT_STATS_ON(dh)                                       \
+    (((dh)->stats | __atomic_load_n(&slow_log_on, __ATOMIC_RELAXED)) != 0)
+
+#define STMT_STATS_START(sh)                                    \
+    (__builtin_expect(STMT_STATS_ON((sh)->gdsql_db), 0) ? gdsql_get_nsecs() : 0)
+
+/*
+ * Tracing (see gdsql_set_trace()).  Callers test TRACE_ON once and
+ * then either call the driver op directly, or call it between
+ * trace_begin() and trace_end().
+ */
+#define TRACE_ON(dh)  __builtin_expect((dh)->gdsql->trace != 0, 0)
+
+typedef struct TraceSpan {
+    const TraceHooks* hooks;
+    int op;
+    int dbtype;
+    const char* query;
+    void* span;
+    unsigned long long t0;
+} TraceSpan;
+
+void trace_begin(TraceSpan* span,
+                 gdsql_dbh* dh,
+                 int op,
+                 const char* query);
+void trace_end(TraceSpan* span,
+               int ret);
+
+void stmt_stats_row(gdsql_stmth* stmt,
+                    unsigned long long t0,
+                    unsigned long long bytes);
+unsigned long long row_bytes(const Row* row);
+
+/*
+ * Column-wise parameters for bulk execution.  The values are not
+ * copied; they belong to the caller and must stay valid until the
+ * statement is executed.
+ */
+typedef struct ArrayParam {
+    int pos;
+    int type;
+    const void* vals;
+    const int* lens;
+    const char* nulls;
+} ArrayParam;
+
+typedef struct ArrayParams {
+    ArrayParam params[STMT_MAX_COLS];
+    int next;
+    int count;
+} ArrayParams;
+
 typedef int (sql_V)(void);
 typedef int (sql_Dp)(gdsql_dbh* db);
+typedef int (sql_DpII)(gdsql_dbh* db,
+                      int i1,
+                      int i2);
+typedef int (sql_DpXp)(gdsql_dbh* db,
+                      const char* sql);
+typedef int (sql_DpVp)(gdsql_dbh* db,
+                       void* handle);
 typedef int (sql_Sp)(gdsql_stmth* stmt);
 typedef int (sql_SpI)(gdsql_stmth* stmt,
                       int pos);
+typedef int (sql_SpIp)(gdsql_stmth* stmt,
+                       int* var);
 typedef int (sql_SpII)(gdsql_stmth* stmt,
                        int pos,
                        int val);
@@ -87,6 +275,21 @@ typedef int (sql_SpICpI)(gdsql_stmth* stmt,
                          int pos,
                          char* var,
                          int len);
+typedef int (sql_SpCpI)(gdsql_stmth* stmt,
+                        char* buf,
+                        int size);
+
+typedef int (sql_Lp)(gdsql_loadh* load);
+typedef int (sql_LpI)(gdsql_loadh* load,
+                      int val);
+typedef int (sql_LpD)(gdsql_loadh* load,
+                      double val);
+typedef int (sql_LpXpI)(gdsql_loadh* load,
+                        const char* val,
+                        int len);
+typedef int (sql_LpXpXp)(gdsql_loadh* load,
+                         const char* table,
+                         const char* columns);
 
 typedef struct DbOps {
     sql_V* init;
@@ -116,10 +319,102 @@ typedef struct DbOps {
     sql_Sp* stmt_step;
     sql_SpI* stmt_is_column_null;
     sql_Sp* stmt_finalize;
+    sql_Sp* stmt_reset;
+    sql_Sp* stmt_clear_bindings;
+    sql_SpIp* stmt_execute_array;
+
+    sql_DpVp* cache_evict;
+
+    sql_LpXpXp* load_begin;
+    sql_Lp* load_put_null;
+    sql_LpI* load_put_int;
+    sql_LpD* load_put_double;
+    sql_LpXpI* load_put_string;
+    sql_LpD* load_put_date;
+    sql_LpI* load_put_boolean;
+    sql_Lp* load_end_row;
+    sql_Lp* load_flush;
+    sql_Lp* load_end;
+    sql_Lp* load_abort;
+
+    sql_SpII* stmt_set_fetch;
+    sql_SpI* stmt_export;
+
+    sql_Dp* db_pipeline_begin;
+    sql_Dp* db_pipeline_sync;
+    sql_Dp* db_pipeline_end;
+    sql_Sp* stmt_pipeline_queue;
+
+    sql_Dp* db_get_socket;
+    sql_Sp* stmt_start;
+    sql_Sp* stmt_poll;
+    sql_Sp* stmt_complete;
+
+    sql_DpII* db_bulk_begin;
+    sql_Dp* db_bulk_end;
+
+    sql_DpXp* db_exec;
+    sql_Dp* db_ping;
+
+    sql_SpCpI* stmt_render_params;
 } DbOps;
 
 const DbOps* get_dbops(int dbtype);
 void set_dbops(int dbtype,
                const DbOps* ops);
+const char* get_dbname(int dbtype);
+
+/*
+ * Compact text for the bound parameters of a statement, for the slow
+ * query log; the stmt_render_params op of each driver adds them one
+ * by one, and whatever does not fit is cut off.
+ */
+typedef struct ParamText {
+    char* buf;
+    int size;
+    int len;
+} ParamText;
+
+void param_text_null(ParamText* text);
+void param_text_int(ParamText* text,
+                    int val);
+void param_text_double(ParamText* text,
+                       double val);
+void param_text_string(ParamText* text,
+                       const char* val,
+                       int len);
+void param_text_date(ParamText* text,
+                     double val);
+
+/*
+ * Called when a statement is done returning rows (or is abandoned);
+ * writes it to the slow query log if it took too long.
+ */
+void slow_log_check(gdsql_stmth* stmt);
+
+/*
+ * Process-wide metrics (see gdsql_metrics.h), counted by each thread
+ * in its own block.
+ */
+#define METRIC_CONN_OPENED      0
+#define METRIC_CONN_CLOSED      1
+#define METRIC_STMT_PREPARED    2
+#define METRIC_STMT_EXECUTED    3
+#define METRIC_ROWS_FETCHED     4
+#define METRIC_ERRORS           5
+#define METRIC_COUNT            6
+
+void metrics_count(int dbtype,
+                   int metric,
+                   unsigned long n);
+void metrics_count_log(int level);
+
+/*
+ * Reference counting for the process-wide initialization of each
+ * driver: the first reference runs its init op, and dropping the
+ * last one runs its fini op.
+ */
+int acquire_driver(int dbtype);
+void release_driver(int dbtype);
 
 #endif
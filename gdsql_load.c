@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <gdsql_log.h>
+#include <gdsql_hidden.h>
+#include <gdsql_util.h>
+#include <gdsql_load.h>
+
+static const DbOps* get_load_ops(gdsql_loadh* lh,
+                                 int state);
+
+int gdsql_load_begin(gdsql_load gdsql_load,
+                     const char* table,
+                     const char* columns)
+{
+    int ret = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (table == 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid load table"));
+            ret = 2;
+            break;
+        }
+
+        const DbOps* ops = get_load_ops(lh, LOAD_STATE_CREATED);
+        if (ops == 0 || ops->load_begin == 0) {
+            ret = 3;
+            break;
+        }
+
+        ret = ops->load_begin(lh, table, columns);
+        if (ret == 0) {
+            lh->state = LOAD_STATE_STARTED;
+            lh->rows = 0;
+        }
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_load_put_null(gdsql_load gdsql_load)
+{
+    int ret = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_load_ops(lh, LOAD_STATE_STARTED);
+        if (ops == 0 || ops->load_put_null == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->load_put_null(lh);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_load_put_int(gdsql_load gdsql_load,
+                       int val)
+{
+    int ret = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_load_ops(lh, LOAD_STATE_STARTED);
+        if (ops == 0 || ops->load_put_int == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->load_put_int(lh, val);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_load_put_double(gdsql_load gdsql_load,
+                          double val)
+{
+    int ret = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_load_ops(lh, LOAD_STATE_STARTED);
+        if (ops == 0 || ops->load_put_double == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->load_put_double(lh, val);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_load_put_string(gdsql_load gdsql_load,
+                          const char* val,
+                          int len)
+{
+    int ret = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_load_ops(lh, LOAD_STATE_STARTED);
+        if (ops == 0 || ops->load_put_string == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->load_put_string(lh, val, len);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_load_put_date(gdsql_load gdsql_load,
+                        double val)
+{
+    int ret = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_load_ops(lh, LOAD_STATE_STARTED);
+        if (ops == 0 || ops->load_put_date == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->load_put_date(lh, val);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_load_put_boolean(gdsql_load gdsql_load,
+                           int val)
+{
+    int ret = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_load_ops(lh, LOAD_STATE_STARTED);
+        if (ops == 0 || ops->load_put_boolean == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->load_put_boolean(lh, val);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_load_end_row(gdsql_load gdsql_load)
+{
+    int ret = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_load_ops(lh, LOAD_STATE_STARTED);
+        if (ops == 0 || ops->load_end_row == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->load_end_row(lh);
+        if (ret == 0)
+            ++lh->rows;
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_load_flush(gdsql_load gdsql_load)
+{
+    int ret = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_load_ops(lh, LOAD_STATE_STARTED);
+        if (ops == 0 || ops->load_flush == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->load_flush(lh);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_load_end(gdsql_load gdsql_load)
+{
+    int ret = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_load_ops(lh, LOAD_STATE_STARTED);
+        if (ops == 0 || ops->load_end == 0) {
+            ret = 2;
+            break;
+        }
+
+        ret = ops->load_end(lh);
+        lh->state = ret == 0 ? LOAD_STATE_FINISHED : LOAD_STATE_FAILED;
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_load_has_failed(gdsql_load gdsql_load)
+{
+    int failed = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0)
+            break;
+
+        failed = lh->state == LOAD_STATE_FAILED;
+    } while (0);
+
+    return failed;
+}
+
+unsigned long gdsql_load_get_rows(gdsql_load gdsql_load)
+{
+    unsigned long rows = 0;
+
+    do {
+        gdsql_loadh* lh = gdsql_check_load(gdsql_load);
+        if (lh == 0)
+            break;
+
+        rows = lh->rows;
+    } while (0);
+
+    return rows;
+}
+
+
+static const DbOps* get_load_ops(gdsql_loadh* lh,
+                                 int state)
+{
+    if (lh->state != state) {
+        GDSQL_Log(LOG_WARNING,
+                  ("Load is in state %d, expected %d",
+                   lh->state, state));
+        return 0;
+    }
+
+    return get_dbops(lh->gdsql_db->type);
+}
@@ -0,0 +1,44 @@
+#ifndef GDSQL_LOAD_H_
+#define GDSQL_LOAD_H_
+
+#include <gdsql_types.h>
+
+/*
+ * Bulk loading of rows into a table, using the fastest path each
+ * database offers, which is usually much faster than running an
+ * INSERT per row.  A load object is created with
+ * gdsql_db_alloc_load(); rows are appended one value at a time, in
+ * column order, and each row is closed with gdsql_load_end_row().
+ * Rows are buffered and sent to the server in large chunks;
+ * gdsql_load_end() sends whatever is left and finishes the load; if
+ * it fails, none of the rows are committed, and from then on
+ * gdsql_load_has_failed() returns 1.
+ *
+ * Freeing a load that was begun but not ended aborts it.
+ */
+
+int gdsql_load_begin(gdsql_load gdsql_load,
+                     const char* table,
+                     const char* columns);
+
+int gdsql_load_put_null(gdsql_load gdsql_load);
+int gdsql_load_put_int(gdsql_load gdsql_load,
+                       int val);
+int gdsql_load_put_double(gdsql_load gdsql_load,
+                          double val);
+int gdsql_load_put_string(gdsql_load gdsql_load,
+                          const char* val,
+                          int len);
+int gdsql_load_put_date(gdsql_load gdsql_load,
+                        double val);
+int gdsql_load_put_boolean(gdsql_load gdsql_load,
+                           int val);
+
+int gdsql_load_end_row(gdsql_load gdsql_load);
+int gdsql_load_flush(gdsql_load gdsql_load);
+int gdsql_load_end(gdsql_load gdsql_load);
+int gdsql_load_has_failed(gdsql_load gdsql_load);
+
+unsigned long gdsql_load_get_rows(gdsql_load gdsql_load);
+
+#endif
@@ -1,24 +1,106 @@
 #include <errno.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <gdsql_util.h>
 #include <gdsql_date.h>
 
 #include <gdsql_log.h>
+#include <gdsql_logbin.h>
+#include <gdsql_hidden.h>
 
 #define LOG_LEVEL_ENV "GDSQL_LOG_LEVEL"
+#define LOG_CATEGORIES_ENV "GDSQL_LOG_CATEGORIES"
+#define LOG_ASYNC_ENV "GDSQL_LOG_ASYNC"
+#define LOG_BINARY_ENV "GDSQL_LOG_BINARY"
 #define LOG_NAME      "gdsql"
 #define LOG_EXT       "log"
 
+/*
+ * Each message is put together in a per-thread buffer and then
+ * written in one go, so messages from different threads never get
+ * mixed up.  Longer messages are truncated.
+ */
+#define LOG_LINE_MAX      4096
+
+/*
+ * In asynchronous mode, each thread copies its messages into its own
+ * ring buffer (a single producer / single consumer queue, so there is
+ * no lock), and a flusher thread writes them out every
+ * LOG_FLUSH_MSECS milliseconds, or sooner when a ring gets half full;
+ * it also keeps the current time, so that logging threads do not
+ * have to ask for it.
+ *
+ * When a ring is full, new messages from that thread are DROPPED:
+ * logging never blocks the caller.  Dropped messages are counted
+ * (see gdsql_log_get_drops()) and the flusher reports them in the
+ * log.  Fatal messages are never dropped: everything pending is
+ * flushed and they are written right away.
+ */
+#define LOG_RING_SIZE     (64 * 1024)       // a power of 2
+#define LOG_FLUSH_MSECS   50
+#define LOG_RING_WRAP     0xffffffffu
+
+typedef struct LogRing {
+    char data[LOG_RING_SIZE];
+    unsigned long head;         // written only by the owner thread
+    unsigned long tail;         // written only by the flusher
+    int dead;                   // owner thread is gone
+    int kicked;                 // flusher was woken up for this ring
+    struct LogRing* next;
+} LogRing;
+
+typedef struct LogLine {
+    char buf[LOG_LINE_MAX];
+    int len;
+    int errnum;
+    time_t when;                // second for which stamp is valid
+    char stamp[32];
+    LogRing* ring;
+    gdsql_log_site* site;       // set when going to the binary log
+    unsigned long suppressed;   // held back before this message
+} LogLine;
+
 static int init(void);
+static void init_level(void);
+static void init_categories(void);
+static void build_masks(void);
+static void resolve_limit(gdsql_log_site* site,
+                          unsigned int gen);
+static void boot_log(void) __attribute__((constructor));
+static void init_stream(void);
 static FILE* get_stream(void);
-static const char* error_text(int errnum);
+static const char* error_text(int errnum,
+                              char* buf,
+                              int len);
 static const char* file_name(const char* full, char* buf);
 static int stack_trace(int level, int skip);
 
+static void line_append(LogLine* line,
+                        const char* fmt,
+                        ...);
+static void line_vappend(LogLine* line,
+                         const char* fmt,
+                         va_list vl);
+static void line_emit(LogLine* line,
+                      int level);
+static LogRing* ring_get(LogLine* line);
+static void ring_release(void* arg);
+static int ring_push(LogRing* ring,
+                     const char* buf,
+                     int len);
+static int ring_drain(LogRing* ring,
+                      FILE* f);
+static void* run_flusher(void* arg);
+static void flush_rings(FILE* f);
+static int start_flusher(void);
+static void stop_flusher(void);
+
 
 /*
  * Esta variable indica el nivel de severidad que se usara al correr
@@ -28,9 +110,90 @@ static int stack_trace(int level, int skip);
 static int log_level = -1;
 static char log_name[256];
 
+/*
+ * Run-time level of each category, and the masks built from them.
+ * The masks start out matching LOG_DEFAULT, so that anything logged
+ * before boot_log() runs behaves as it always did.
+ */
+#define DEFAULT_MASK(l)  ((l) >= LOG_DEFAULT ? LOG_CAT_ALL : 0)
+
+unsigned int gdsql_log_masks[LOG_LAST] = {
+    DEFAULT_MASK(LOG_DEBUG),
+    DEFAULT_MASK(LOG_INFO),
+    DEFAULT_MASK(LOG_WARNING),
+    DEFAULT_MASK(LOG_ERROR),
+    DEFAULT_MASK(LOG_FATAL),
+};
+
+static const char* cat_names[LOG_CAT_COUNT] = {
+    "core",
+    "sqlite",
+    "postgres",
+    "mysql",
+    "date",
+    "bind",
+    "step",
+    "column",
+};
+static int cat_levels[LOG_CAT_COUNT];
+static pthread_mutex_t cat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Rate limits and sampling for each level and category.  Sites look
+ * at these again only when limit_gen changes; while it is 0 (nobody
+ * ever set a limit), letting a message through costs nothing.
+ */
+typedef struct LogLimit {
+    int per_sec;
+    int burst;
+    int every;
+} LogLimit;
+
+static pthread_mutex_t limit_lock = PTHREAD_MUTEX_INITIALIZER;
+static LogLimit limits[LOG_LAST][LOG_CAT_COUNT];
+static unsigned int limit_gen = 0;
+static unsigned long log_suppressed[LOG_LAST];
+
+/*
+ * The level and the stream are set up only once, no matter how many
+ * threads are logging; after that, reading them takes no lock.
+ */
+static pthread_once_t level_once = PTHREAD_ONCE_INIT;
+static pthread_once_t stream_once = PTHREAD_ONCE_INIT;
+static FILE* log_stream = 0;
+
+static __thread LogLine log_line;
+
+/*
+ * State of the asynchronous mode.  The list of rings is only locked
+ * when a thread logs for the first time, when it exits, and by the
+ * flusher.
+ */
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static int ring_key_made = 0;
+static LogRing* rings = 0;
+static int async_on = 0;
+static int async_stop = 0;
+static pthread_t flusher;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static time_t log_now = 0;
+static unsigned long log_drops = 0;
+static unsigned long log_drops_seen = 0;
+
+/*
+ * Binary mode; see gdsql_logbin.h.
+ */
+static int binary_on = 0;
+
 
 int gdsql_log_before(int level)
 {
+    LogLine* line = &log_line;
+    line->len = 0;
+    line->errnum = errno;
+    line->site = 0;
     return level;
 }
 
@@ -43,81 +206,157 @@ int gdsql_log_after(int level)
 }
 
 
-int gdsql_log_where(int level,
-                    const char* filename,
-                    int lineno)
+/*
+ * Decide whether a message from a site is shown, using a token
+ * bucket kept as the time the next message is due (GCRA), so that it
+ * can be updated by several threads without a lock.
+ */
+int gdsql_log_admit(gdsql_log_site* site)
 {
-    FILE* f;
-    int Y, M, D, h, m, s;
+    unsigned int gen = __atomic_load_n(&limit_gen, __ATOMIC_ACQUIRE);
+    if (gen == 0)
+        return 1;
+
+    if (__atomic_load_n(&site->limit_gen, __ATOMIC_ACQUIRE) != gen)
+        resolve_limit(site, gen);
+
+    unsigned int every = __atomic_load_n(&site->every, __ATOMIC_RELAXED);
+    unsigned long long interval = __atomic_load_n(&site->interval, __ATOMIC_RELAXED);
+    int ok = 1;
+
+    if (every > 1 &&
+        __atomic_fetch_add(&site->seen, 1, __ATOMIC_RELAXED) % every != 0)
+        ok = 0;
+
+    if (ok && interval > 0) {
+        unsigned long long slack = __atomic_load_n(&site->slack, __ATOMIC_RELAXED);
+        unsigned long long now = gdsql_get_nsecs();
+        unsigned long long tat = __atomic_load_n(&site->tat, __ATOMIC_RELAXED);
+        unsigned long long next;
+        do {
+            unsigned long long base = tat > now ? tat : now;
+            if (base - now > slack) {
+                ok = 0;
+                break;
+            }
+            next = base + interval;
+        } while (! __atomic_compare_exchange_n(&site->tat, &tat, next, 0,
+                                               __ATOMIC_RELAXED,
+                                               __ATOMIC_RELAXED));
+    }
+
+    if (! ok) {
+        __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+        if (site->level < LOG_LAST)
+            __atomic_add_fetch(&log_suppressed[site->level], 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    log_line.suppressed = __atomic_exchange_n(&site->suppressed, 0,
+                                              __ATOMIC_RELAXED);
+    return 1;
+}
+
+int gdsql_log_where(gdsql_log_site* site)
+{
+    LogLine* line = &log_line;
+    int level = site->level;
     char buf[256];
 
-    if (level == LOG_ALWAYS)
+    // In binary mode, the site is all we need.
+    if (level != LOG_FATAL &&
+        __atomic_load_n(&binary_on, __ATOMIC_ACQUIRE)) {
+        line->site = site;
         return level;
+    }
 
-    f = get_stream();
-    if (f == 0)
+    if (level == LOG_ALWAYS)
         return level;
 
-    gdsql_get_now(&Y, &M, &D, &h, &m, &s, 0);
-    fprintf(f, "%04d%02d%02d %02d%02d%02d %s:%d ",
-            Y, M, D, h, m, s, file_name(filename, buf), lineno);
+    // Format the time only when the second changes; in asynchronous
+    // mode, the flusher keeps the current second for us.
+    time_t now = __atomic_load_n(&log_now, __ATOMIC_RELAXED);
+    if (now == 0 || ! __atomic_load_n(&async_on, __ATOMIC_RELAXED))
+        now = time(0);
+    if (now != line->when) {
+        int Y, M, D, h, m, s;
+        gdsql_get_time(now, &Y, &M, &D, &h, &m, &s, 0);
+        snprintf(line->stamp, sizeof(line->stamp),
+                 "%04d%02d%02d %02d%02d%02d",
+                 Y, M, D, h, m, s);
+        line->when = now;
+    }
+
+    line_append(line, "%s %s:%d ",
+                line->stamp, file_name(site->file, buf), site->line);
     return level;
 }
 
 int gdsql_log_head(int level)
 {
-    FILE* f;
+    LogLine* line = &log_line;
 
-    f = get_stream();
-    if (f == 0)
+    if (line->site != 0)
         return level;
 
     if (level == LOG_FATAL)
-        fprintf(f, "Fatal -- ");
+        line_append(line, "Fatal -- ");
     else if (level == LOG_ERROR)
-        fprintf(f, "Error -- ");
+        line_append(line, "Error -- ");
     else if (level == LOG_WARNING)
-        fprintf(f, "Warning -- ");
+        line_append(line, "Warning -- ");
 
     return level;
 }
 
 int gdsql_log_tail(int level)
 {
-    FILE* f;
+    LogLine* line = &log_line;
 
-    f = get_stream();
-    if (f == 0)
+    if (line->site != 0)
         return level;
 
+    if (line->suppressed > 0 && level != LOG_ALWAYS) {
+        line_append(line, " (suppressed %lu similar messages)",
+                    line->suppressed);
+        line->suppressed = 0;
+    }
+
     if (level == LOG_FATAL || level == LOG_ERROR) {
-        int errnum = errno;
-        const char* errtxt = error_text(errnum);
+        int errnum = line->errnum;
+        char buf[256];
+        const char* errtxt = error_text(errnum, buf, sizeof(buf));
         if (errtxt == 0)
             errtxt = "UNKNOWN";
 
-        fprintf(f, " (%d: %s)\n", errnum, errtxt);
-        if (level == LOG_FATAL)
-            stack_trace(level, 2);
+        line_append(line, " (%d: %s)\n", errnum, errtxt);
     } else if (level != LOG_ALWAYS)
-        fprintf(f, "\n");
+        line_append(line, "\n");
+
+    line_emit(line, level);
+    if (level == LOG_FATAL)
+        stack_trace(level, 2);
 
-    fflush(f);
     return level;
 }
 
 int gdsql_log_write(const char* fmt,
                     ...)
 {
+    LogLine* line = &log_line;
     va_list vl;
-    FILE* f;
-
-    f = get_stream();
-    if (f == 0)
-        return 0;
 
     va_start(vl, fmt);
-    vfprintf(f, fmt, vl);
+    if (line->site == 0)
+        line_vappend(line, fmt, vl);
+    else {
+        if (gdsql_logbin_write(line->site, line->errnum,
+                               line->suppressed, fmt, vl) != 0)
+            __atomic_add_fetch(&log_drops, 1, __ATOMIC_RELAXED);
+        else
+            metrics_count_log(line->site->level);
+        line->suppressed = 0;
+    }
     va_end(vl);
 
     return 0;
@@ -132,25 +371,164 @@ int gdsql_log_nothing(void)
 
 int gdsql_get_log_level(void)
 {
-    if (log_level == -1)
-        log_level = init();
+    int level = __atomic_load_n(&log_level, __ATOMIC_RELAXED);
+    if (level < 0) {
+        pthread_once(&level_once, init_level);
+        level = __atomic_load_n(&log_level, __ATOMIC_RELAXED);
+    }
 
-    return log_level;
+    return level;
 }
 
 int gdsql_set_log_level(int level)
 {
-    int current = gdsql_get_log_level();
-    log_level = level;
+    int c;
+    int old;
+
+    pthread_once(&level_once, init_level);
+    pthread_mutex_lock(&cat_lock);
+    old = __atomic_exchange_n(&log_level, level, __ATOMIC_RELAXED);
+    for (c = 0; c < LOG_CAT_COUNT; ++c)
+        cat_levels[c] = level;
+    build_masks();
+    pthread_mutex_unlock(&cat_lock);
+
+    return old;
+}
+
+int gdsql_log_get_category_level(unsigned int category)
+{
+    int c;
+    int level = LOG_LAST;
+
+    pthread_once(&level_once, init_level);
+    pthread_mutex_lock(&cat_lock);
+    for (c = 0; c < LOG_CAT_COUNT; ++c) {
+        if ((category & (1u << c)) != 0) {
+            level = cat_levels[c];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cat_lock);
+
+    return level;
+}
+
+int gdsql_log_set_category_level(unsigned int categories,
+                                 int level)
+{
+    int c;
+
+    if (level < 0 ||
+        (categories & ~LOG_CAT_ALL) != 0)
+        return 1;
+
+    if (level > LOG_LAST)
+        level = LOG_LAST;
+
+    pthread_once(&level_once, init_level);
+    pthread_mutex_lock(&cat_lock);
+    for (c = 0; c < LOG_CAT_COUNT; ++c) {
+        if ((categories & (1u << c)) != 0)
+            cat_levels[c] = level;
+    }
+    build_masks();
+    pthread_mutex_unlock(&cat_lock);
+
+    return 0;
+}
+
+int gdsql_log_set_async(int async)
+{
+    int current = __atomic_load_n(&async_on, __ATOMIC_ACQUIRE);
+
+    get_stream();
+    if (async && ! current)
+        start_flusher();
+    else if (! async && current)
+        stop_flusher();
+
     return current;
 }
 
+int gdsql_log_set_limit(unsigned int categories,
+                        int level,
+                        int per_sec,
+                        int burst,
+                        int every)
+{
+    int c;
+
+    if (level < 0 ||
+        level >= LOG_FATAL ||
+        (categories & ~LOG_CAT_ALL) != 0 ||
+        per_sec < 0 ||
+        burst < 0 ||
+        every < 0)
+        return 1;
+
+    pthread_mutex_lock(&limit_lock);
+    for (c = 0; c < LOG_CAT_COUNT; ++c) {
+        if ((categories & (1u << c)) == 0)
+            continue;
+
+        limits[level][c].per_sec = per_sec;
+        limits[level][c].burst = burst;
+        limits[level][c].every = every;
+    }
+    __atomic_add_fetch(&limit_gen, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&limit_lock);
+
+    return 0;
+}
+
+unsigned long gdsql_log_get_suppressed(int level)
+{
+    unsigned long total = 0;
+    int l;
+
+    if (level >= 0 && level < LOG_LAST)
+        return __atomic_load_n(&log_suppressed[level], __ATOMIC_RELAXED);
+
+    for (l = 0; l < LOG_LAST; ++l)
+        total += __atomic_load_n(&log_suppressed[l], __ATOMIC_RELAXED);
+    return total;
+}
+
+int gdsql_log_set_binary(int binary)
+{
+    int current = __atomic_load_n(&binary_on, __ATOMIC_ACQUIRE);
+
+    if (binary && ! current) {
+        if (gdsql_logbin_open() != 0) {
+            GDSQL_Log(LOG_WARNING, ("Could not open binary log file"));
+            return current;
+        }
+        __atomic_store_n(&binary_on, 1, __ATOMIC_RELEASE);
+    } else if (! binary && current)
+        __atomic_store_n(&binary_on, 0, __ATOMIC_RELEASE);
+
+    return current;
+}
+
+unsigned long gdsql_log_get_drops(void)
+{
+    return __atomic_load_n(&log_drops, __ATOMIC_RELAXED);
+}
+
 void gdsql_log_shutdown(void)
 {
+    stop_flusher();
+
+    __atomic_store_n(&binary_on, 0, __ATOMIC_RELEASE);
+    gdsql_logbin_close();
+
     FILE* fp = get_stream();
     if (fp != 0 &&
-        fp != stderr)
+        fp != stderr) {
+        log_stream = stderr;
         fclose(fp);
+    }
 
     log_name[0] = '\0';
 }
@@ -235,38 +613,173 @@ static int init(void)
     return level;
 }
 
-static FILE* get_stream(void)
+static void init_level(void)
 {
-    static FILE* stream = 0;
-    static int configured = 0;
-    static int level = 0;
-
-    if (! configured) {
-        ++level;
-        if (level <= 1) {
-            stream = stderr;
-            do {
-                unsigned int pid;
-                FILE* s;
-
-                pid = gdsql_getpid();
-                sprintf(log_name, "%s-%u.%s",
-                        LOG_NAME, pid, LOG_EXT);
-                s = fopen(log_name, "a");
-                if (s != 0)
-                    stream = s;
-            } while (0);
-            configured = 1;
+    int c;
+    int l = init();
+
+    pthread_mutex_lock(&cat_lock);
+    __atomic_store_n(&log_level, l, __ATOMIC_RELAXED);
+    for (c = 0; c < LOG_CAT_COUNT; ++c)
+        cat_levels[c] = l;
+    init_categories();
+    build_masks();
+    pthread_mutex_unlock(&cat_lock);
+}
+
+/*
+ * Parse GDSQL_LOG_CATEGORIES, a list of entries separated by commas:
+ * "name" sets that category to the global level, "name:LEVEL" sets
+ * it to LEVEL, and "-name" turns it off; "all" names every category.
+ * Unknown entries are ignored.
+ */
+static void init_categories(void)
+{
+    const char* env = gdsql_getenv(LOG_CATEGORIES_ENV, 0);
+    char buf[64];
+
+    while (env != 0 && *env != '\0') {
+        const char* end = strchr(env, ',');
+        int len = end ? (int) (end - env) : (int) strlen(env);
+        char* name = buf;
+        char* colon;
+        int level = log_level;
+        int c;
+
+        do {
+            if (len <= 0 || len >= (int) sizeof(buf))
+                break;
+
+            memcpy(buf, env, len);
+            buf[len] = '\0';
+            if (name[0] == '-') {
+                ++name;
+                level = LOG_LAST;
+            } else if ((colon = strchr(name, ':')) != 0) {
+                *colon++ = '\0';
+                level = get_level(colon);
+                if (level < 0)
+                    break;
+            }
+
+            for (c = 0; c < LOG_CAT_COUNT; ++c) {
+                if (strcmp(name, "all") == 0 ||
+                    strcmp(name, cat_names[c]) == 0)
+                    cat_levels[c] = level;
+            }
+        } while (0);
+
+        env = end ? end + 1 : 0;
+    }
+}
+
+/*
+ * Must be called with cat_lock held.
+ */
+static void build_masks(void)
+{
+    int l;
+    int c;
+
+    for (l = 0; l < LOG_LAST; ++l) {
+        unsigned int mask = 0;
+        for (c = 0; c < LOG_CAT_COUNT; ++c) {
+            if (l >= cat_levels[c])
+                mask |= 1u << c;
         }
-        --level;
+        __atomic_store_n(&gdsql_log_masks[l], mask, __ATOMIC_RELAXED);
     }
-    
-    return stream;
 }
 
-static const char* error_text(int errnum)
+/*
+ * Work out the strictest limits of all the categories of a site.
+ */
+static void resolve_limit(gdsql_log_site* site,
+                          unsigned int gen)
+{
+    unsigned int every = 0;
+    unsigned long long interval = 0;
+    unsigned long long slack = 0;
+    int c;
+
+    pthread_mutex_lock(&limit_lock);
+    for (c = 0; site->level < LOG_FATAL && c < LOG_CAT_COUNT; ++c) {
+        if ((site->cats & (1u << c)) == 0)
+            continue;
+
+        const LogLimit* limit = &limits[site->level][c];
+        if (limit->every > every)
+            every = limit->every;
+
+        if (limit->per_sec > 0) {
+            unsigned long long i = 1000000000ull / limit->per_sec;
+            if (i > interval) {
+                int burst = limit->burst > 0 ? limit->burst : 1;
+                interval = i;
+                slack = (burst - 1) * i;
+            }
+        }
+    }
+
+    __atomic_store_n(&site->every, every, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->interval, interval, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->slack, slack, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->limit_gen, gen, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&limit_lock);
+}
+
+/*
+ * The masks must be right before anybody logs, and nobody calls us
+ * first; so we read the environment when the library is loaded.
+ */
+static void boot_log(void)
+{
+    pthread_once(&level_once, init_level);
+
+    const char* env = gdsql_getenv(LOG_BINARY_ENV, 0);
+    if (env != 0 && env[0] != '\0' && strcmp(env, "0") != 0)
+        gdsql_log_set_binary(1);
+}
+
+static void init_stream(void)
+{
+    FILE* stream = stderr;
+    do {
+        unsigned int pid;
+        FILE* s;
+
+        pid = gdsql_getpid();
+        sprintf(log_name, "%s-%u.%s",
+                LOG_NAME, pid, LOG_EXT);
+        s = fopen(log_name, "a");
+        if (s != 0)
+            stream = s;
+    } while (0);
+
+    log_stream = stream;
+
+    const char* env = gdsql_getenv(LOG_ASYNC_ENV, 0);
+    if (env != 0 && env[0] != '\0' && strcmp(env, "0") != 0)
+        start_flusher();
+}
+
+static FILE* get_stream(void)
 {
-    return strerror(errnum);
+    pthread_once(&stream_once, init_stream);
+    return log_stream;
+}
+
+static const char* error_text(int errnum,
+                              char* buf,
+                              int len)
+{
+#if (_POSIX_C_SOURCE >= 200112L) && ! defined(_GNU_SOURCE)
+    if (strerror_r(errnum, buf, len) != 0)
+        return 0;
+    return buf;
+#else
+    return strerror_r(errnum, buf, len);
+#endif
 }
 
 static const char* file_name(const char* full, char* buf)
@@ -280,3 +793,283 @@ static int stack_trace(int level, int skip)
 {
     return level;
 }
+
+
+static void line_append(LogLine* line,
+                        const char* fmt,
+                        ...)
+{
+    va_list vl;
+
+    va_start(vl, fmt);
+    line_vappend(line, fmt, vl);
+    va_end(vl);
+}
+
+static void line_vappend(LogLine* line,
+                         const char* fmt,
+                         va_list vl)
+{
+    int room = LOG_LINE_MAX - line->len;
+    if (room <= 1)
+        return;
+
+    int n = vsnprintf(line->buf + line->len, room, fmt, vl);
+    if (n < 0)
+        return;
+
+    // Truncated: keep the end of line.
+    if (n >= room) {
+        n = room - 1;
+        line->buf[line->len + n - 1] = '\n';
+    }
+    line->len += n;
+}
+
+static void line_emit(LogLine* line,
+                      int level)
+{
+    if (line->len <= 0)
+        return;
+
+    if (level != LOG_FATAL &&
+        __atomic_load_n(&async_on, __ATOMIC_ACQUIRE)) {
+        LogRing* ring = ring_get(line);
+        if (ring != 0) {
+            if (ring_push(ring, line->buf, line->len) != 0)
+                __atomic_add_fetch(&log_drops, 1, __ATOMIC_RELAXED);
+            else
+                metrics_count_log(level);
+            return;
+        }
+    }
+
+    // Fatal messages go out after everything that came before them.
+    if (level == LOG_FATAL)
+        stop_flusher();
+
+    FILE* f = get_stream();
+    if (f == 0)
+        return;
+
+    fwrite(line->buf, 1, line->len, f);
+    fflush(f);
+    metrics_count_log(level);
+}
+
+/*
+ * The ring of the calling thread, created and registered the first
+ * time it is needed.
+ */
+static LogRing* ring_get(LogLine* line)
+{
+    if (line->ring != 0)
+        return line->ring;
+
+    LogRing* ring = (LogRing*) malloc(sizeof(LogRing));
+    if (ring == 0)
+        return 0;
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dead = 0;
+    ring->kicked = 0;
+
+    pthread_mutex_lock(&async_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&async_lock);
+
+    // Tell the flusher when this thread exits.
+    pthread_setspecific(ring_key, ring);
+    line->ring = ring;
+    return ring;
+}
+
+static void ring_release(void* arg)
+{
+    LogRing* ring = (LogRing*) arg;
+    log_line.ring = 0;
+    __atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static int ring_push(LogRing* ring,
+                     const char* buf,
+                     int len)
+{
+    unsigned long need = (sizeof(uint32_t) + len + 3) & ~3ul;
+    unsigned long head = ring->head;
+    unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    unsigned long pos = head & (LOG_RING_SIZE - 1);
+
+    // A message is never split: if it does not fit before the end of
+    // the buffer, we mark the rest as unused and go back to the start.
+    unsigned long skip = 0;
+    if (LOG_RING_SIZE - pos < need)
+        skip = LOG_RING_SIZE - pos;
+
+    if (head + skip + need - tail > LOG_RING_SIZE)
+        return 1;
+
+    if (skip > 0) {
+        *(uint32_t*) (ring->data + pos) = LOG_RING_WRAP;
+        head += skip;
+        pos = 0;
+    }
+
+    *(uint32_t*) (ring->data + pos) = (uint32_t) len;
+    memcpy(ring->data + pos + sizeof(uint32_t), buf, len);
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_RELEASE);
+
+    // Getting full: do not wait for the next tick.  Signalling
+    // without the lock may miss the flusher, which is harmless.
+    if (head + need - tail > LOG_RING_SIZE / 2 &&
+        ! __atomic_load_n(&ring->kicked, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&ring->kicked, 1, __ATOMIC_RELAXED);
+        pthread_cond_signal(&wake_cond);
+    }
+    return 0;
+}
+
+/*
+ * Write out everything in the ring; return how many messages there
+ * were.
+ */
+static int ring_drain(LogRing* ring,
+                      FILE* f)
+{
+    unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long tail = ring->tail;
+    int count = 0;
+
+    while (tail < head) {
+        unsigned long pos = tail & (LOG_RING_SIZE - 1);
+        uint32_t len = *(uint32_t*) (ring->data + pos);
+        if (len == LOG_RING_WRAP) {
+            tail += LOG_RING_SIZE - pos;
+            continue;
+        }
+
+        fwrite(ring->data + pos + sizeof(uint32_t), 1, len, f);
+        tail += (sizeof(uint32_t) + len + 3) & ~3ul;
+        ++count;
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->kicked, 0, __ATOMIC_RELAXED);
+    return count;
+}
+
+static void* run_flusher(void* arg)
+{
+    FILE* f = get_stream();
+
+    while (1) {
+        __atomic_store_n(&log_now, time(0), __ATOMIC_RELAXED);
+
+        int stop = __atomic_load_n(&async_stop, __ATOMIC_ACQUIRE);
+        flush_rings(f);
+        if (stop)
+            break;
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += LOG_FLUSH_MSECS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_nsec -= 1000000000L;
+            ++ts.tv_sec;
+        }
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_timedwait(&wake_cond, &wake_lock, &ts);
+        pthread_mutex_unlock(&wake_lock);
+    }
+
+    return 0;
+}
+
+/*
+ * Write out all the rings, forgetting those whose threads are gone,
+ * and report any messages that were dropped.
+ */
+static void flush_rings(FILE* f)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&async_lock);
+    LogRing** prev = &rings;
+    while (*prev != 0) {
+        LogRing* ring = *prev;
+        int dead = __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE);
+        count += ring_drain(ring, f);
+        if (dead) {
+            *prev = ring->next;
+            free(ring);
+            continue;
+        }
+        prev = &ring->next;
+    }
+    pthread_mutex_unlock(&async_lock);
+
+    unsigned long drops = __atomic_load_n(&log_drops, __ATOMIC_RELAXED);
+    if (drops != log_drops_seen) {
+        fprintf(f, "Warning -- %lu log messages dropped (%lu so far)\n",
+                drops - log_drops_seen, drops);
+        log_drops_seen = drops;
+        ++count;
+    }
+
+    if (count > 0)
+        fflush(f);
+}
+
+static int start_flusher(void)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&async_lock);
+    do {
+        if (async_on)
+            break;
+
+        if (! ring_key_made) {
+            if (pthread_key_create(&ring_key, ring_release) != 0) {
+                ret = 1;
+                break;
+            }
+            ring_key_made = 1;
+            atexit(stop_flusher);
+        }
+
+        __atomic_store_n(&log_now, time(0), __ATOMIC_RELAXED);
+        async_stop = 0;
+        if (pthread_create(&flusher, 0, run_flusher, 0) != 0) {
+            ret = 2;
+            break;
+        }
+
+        __atomic_store_n(&async_on, 1, __ATOMIC_RELEASE);
+    } while (0);
+    pthread_mutex_unlock(&async_lock);
+
+    return ret;
+}
+
+/*
+ * Go back to writing messages synchronously, after the flusher has
+ * written out everything pending.
+ */
+static void stop_flusher(void)
+{
+    pthread_mutex_lock(&async_lock);
+    int on = async_on;
+    if (on) {
+        __atomic_store_n(&async_on, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&async_stop, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&async_lock);
+
+    if (on) {
+        pthread_cond_signal(&wake_cond);
+        pthread_join(flusher, 0);
+    }
+}
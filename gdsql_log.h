@@ -17,6 +17,8 @@
  *    all lesser levels are not shown, although they have an impact on
  *    performance (export LOG_LEVEL=LOG_INFO).
  *
+ * 4. Being able to do both things per category (see below).
+ *
  * The different levels are:
  *
  *   LOG_DEBUG    Very abbundant debugging messages.
@@ -53,58 +55,142 @@
 #endif
 
 
+/*
+ * Categories: every message belongs to the category of the file it
+ * comes from (each file can #define LOG_CATEGORY before including
+ * this header; the default is LOG_CAT_CORE), plus any others given
+ * with GDSQL_LogC(), such as LOG_CAT_BIND for messages about binding
+ * parameters.  A message is shown only if all its categories are
+ * enabled for its level.
+ *
+ * At run time, each category has its own level, which starts as the
+ * global level and can be changed with gdsql_log_set_category_level()
+ * or with the environment variable GDSQL_LOG_CATEGORIES, a comma
+ * separated list of entries like these:
+ *
+ *   mysql:LOG_DEBUG   show mysql messages from LOG_DEBUG up
+ *   -column           do not show column messages at all
+ *   -all              do not show anything...
+ *   mysql             ... except for mysql, at the global level
+ *
+ * At compile time, -DLOG_CATEGORIES=<mask> keeps only the messages
+ * whose categories are all in the mask.
+ */
+#define  LOG_CAT_CORE       0x0001
+#define  LOG_CAT_SQLITE     0x0002
+#define  LOG_CAT_POSTGRES   0x0004
+#define  LOG_CAT_MYSQL      0x0008
+#define  LOG_CAT_DATE       0x0010
+#define  LOG_CAT_BIND       0x0020
+#define  LOG_CAT_STEP       0x0040
+#define  LOG_CAT_COLUMN     0x0080
+#define  LOG_CAT_ALL        0x00ff
+#define  LOG_CAT_COUNT      8
+
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES   LOG_CAT_ALL
+#endif
+
+#ifndef LOG_CATEGORY
+#define LOG_CATEGORY     LOG_CAT_CORE
+#endif
+
+/*
+ * For each level, the categories enabled at that level.  This is
+ * what every log call checks, so that a disabled call costs a load
+ * and a branch, without calling any function or evaluating any of
+ * its arguments.
+ */
+extern unsigned int gdsql_log_masks[LOG_LAST];
+
+/*
+ * Every log call has one of these, where it is: in binary mode, the
+ * first time it is used, its file, line and format are written out
+ * once under a new id, and after that each message only has the id.
+ */
+typedef struct gdsql_log_site {
+    const char* file;
+    int line;
+    int level;
+    unsigned int cats;
+    unsigned int id;            // 0 until first used in binary mode
+    unsigned int gen;           // binary log file the id belongs to
+
+    // Rate limit and sampling (see gdsql_log_set_limit()), taken
+    // from the settings when limit_gen changes.
+    unsigned int limit_gen;
+    unsigned int every;
+    unsigned long long interval;
+    unsigned long long slack;
+    unsigned long long tat;     // when the next message is due
+    unsigned long seen;
+    unsigned long suppressed;   // since the last one shown
+} gdsql_log_site;
+
+
 /*
  * Vudu magic so that when compiling with a certain log level, any
  * calls with a lower level will truly disappear from the code.
  */
-#define GDSQL_LOG_GO(l, r)    (gdsql_get_log_level() > l ? gdsql_log_nothing() : \
-                               (gdsql_log_before(l),                    \
-                                gdsql_log_where(l, __FILE__, __LINE__), \
-                                gdsql_log_head(l),                      \
-                                gdsql_log_write r,                      \
-                                gdsql_log_tail(l),                      \
-                                gdsql_log_after(l)))
+#define GDSQL_LOG_ON(l, c)    (((LOG_CATEGORIES) & (c)) == (c) &&        \
+                               __builtin_expect((__atomic_load_n(&gdsql_log_masks[l], \
+                                                                 __ATOMIC_RELAXED) & \
+                                                 (c)) == (c), 0))
+
+#define GDSQL_LOG_PUT(l, c, r) ({ static gdsql_log_site gdsql_site_ =   \
+                                      { __FILE__, __LINE__, l, c };    \
+                                  gdsql_log_admit(&gdsql_site_) &&     \
+                                  (gdsql_log_before(l),                \
+                                   gdsql_log_where(&gdsql_site_),      \
+                                   gdsql_log_head(l),                  \
+                                   gdsql_log_write r,                  \
+                                   gdsql_log_tail(l),                  \
+                                   gdsql_log_after(l), 1); })
+
+#define GDSQL_LOG_GO(l, c, r) ((void) (GDSQL_LOG_ON(l, c) &&            \
+                                       GDSQL_LOG_PUT(l, c, r)))
 
 
 #if LOG_LEVEL <= LOG_DEBUG
-#define _GDSQL_LOG_DEBUG(r)      GDSQL_LOG_GO(LOG_DEBUG, r)
+#define _GDSQL_LOG_DEBUG(c, r)      GDSQL_LOG_GO(LOG_DEBUG, c, r)
 #else
-#define _GDSQL_LOG_DEBUG(r)      gdsql_log_nothing()
+#define _GDSQL_LOG_DEBUG(c, r)      ((void) 0)
 #endif
 
 #if LOG_LEVEL <= LOG_INFO
-#define _GDSQL_LOG_INFO(r)       GDSQL_LOG_GO(LOG_INFO, r)
+#define _GDSQL_LOG_INFO(c, r)       GDSQL_LOG_GO(LOG_INFO, c, r)
 #else
-#define _GDSQL_LOG_INFO(r)       gdsql_log_nothing()
+#define _GDSQL_LOG_INFO(c, r)       ((void) 0)
 #endif
 
 #if LOG_LEVEL <= LOG_WARNING
-#define _GDSQL_LOG_WARNING(r)    GDSQL_LOG_GO(LOG_WARNING, r)
+#define _GDSQL_LOG_WARNING(c, r)    GDSQL_LOG_GO(LOG_WARNING, c, r)
 #else
-#define _GDSQL_LOG_WARNING(r)    gdsql_log_nothing()
+#define _GDSQL_LOG_WARNING(c, r)    ((void) 0)
 #endif
 
 #if LOG_LEVEL <= LOG_ERROR
-#define _GDSQL_LOG_ERROR(r)      GDSQL_LOG_GO(LOG_ERROR, r)
+#define _GDSQL_LOG_ERROR(c, r)      GDSQL_LOG_GO(LOG_ERROR, c, r)
 #else
-#define _GDSQL_LOG_ERROR(r)      gdsql_log_nothing()
+#define _GDSQL_LOG_ERROR(c, r)      ((void) 0)
 #endif
 
 #if LOG_LEVEL <= LOG_FATAL
-#define _GDSQL_LOG_FATAL(r)      GDSQL_LOG_GO(LOG_FATAL, r)
+#define _GDSQL_LOG_FATAL(c, r)      GDSQL_LOG_GO(LOG_FATAL, c, r)
 #else
-#define _GDSQL_LOG_FATAL(r)      gdsql_log_nothing()
+#define _GDSQL_LOG_FATAL(c, r)      ((void) 0)
 #endif
 
 
 #if 1  /* always! */
-#define _GDSQL_LOG_ALWAYS(r)     GDSQL_LOG_GO(LOG_ALWAYS, r)
+#define _GDSQL_LOG_ALWAYS(c, r)     ((void) GDSQL_LOG_PUT(LOG_ALWAYS, c, r))
 #else
-#define _GDSQL_LOG_ALWAYS(r)     gdsql_log_nothing()
+#define _GDSQL_LOG_ALWAYS(c, r)     ((void) 0)
 #endif
 
 
-#define  GDSQL_Log(l,r)          _GDSQL_##l(r)
+#define  GDSQL_Log(l,r)          _GDSQL_##l(LOG_CATEGORY, r)
+#define  GDSQL_LogC(c,l,r)       _GDSQL_##l((LOG_CATEGORY) | (c), r)
 
 
 
@@ -119,9 +205,8 @@ int gdsql_log_after(int level);
  * Build the log message.  Must return a value because these functions
  * are used within a comma list.
  */
-int gdsql_log_where(int level,
-                    const char* filename,
-                    int lineno);
+int gdsql_log_admit(gdsql_log_site* site);
+int gdsql_log_where(gdsql_log_site* site);
 int gdsql_log_head(int level);
 int gdsql_log_tail(int level);
 
@@ -136,10 +221,18 @@ int gdsql_log_write(const char* fmt, ...);
 int gdsql_get_log_level(void);
 
 /*
- * Set run-time log level. Return previous level.
+ * Set run-time log level, for all categories. Return previous level.
  */
 int gdsql_set_log_level(int level);
 
+/*
+ * Get / set the run-time log level of some categories (a mask of
+ * LOG_CAT_* values); LOG_LAST turns them off.
+ */
+int gdsql_log_get_category_level(unsigned int category);
+int gdsql_log_set_category_level(unsigned int categories,
+                                 int level);
+
 /*
  * A do-nothing function, so that the compiler won't complain with:
  *
@@ -148,6 +241,58 @@ int gdsql_set_log_level(int level);
  */
 int gdsql_log_nothing(void);
 
+/*
+ * Write log messages asynchronously (async != 0) or right away;
+ * return the previous setting.  Asynchronous mode can also be turned
+ * on with the environment variable GDSQL_LOG_ASYNC=1.  In this mode
+ * each thread queues its messages in its own buffer and a background
+ * thread writes them out a few times per second; if a thread logs
+ * faster than that and its buffer fills up, its new messages are
+ * dropped (never waited for), and counted.
+ */
+int gdsql_log_set_async(int async);
+
+/*
+ * Write log messages to a binary file (binary != 0) or as text;
+ * return the previous setting.  Binary mode can also be turned on
+ * with the environment variable GDSQL_LOG_BINARY=1.  In this mode
+ * messages are not formatted at all: each one is written as its call
+ * site id, a timestamp and the raw values of its arguments, into a
+ * memory mapped file gdsql-<pid>.bin, which the gdsql-logdec tool
+ * turns back into text.  When the file reaches 1 GB, logging goes on
+ * in gdsql-<pid>-2.bin and so on, and only the last 4 files are
+ * kept.  Fatal messages are still written as text.
+ */
+int gdsql_log_set_binary(int binary);
+
+/*
+ * Limit how often each call site of the given categories and level
+ * can log: at most per_sec messages per second on average, with
+ * bursts of up to burst messages (per_sec 0 means no limit), and
+ * only one message out of every (1 means all of them).  When a site
+ * has messages held back, the next one it shows ends with
+ * "(suppressed N similar messages)".  A site in several categories
+ * gets the strictest settings.  Fatal messages are never held back.
+ * Return 0 if OK.
+ */
+int gdsql_log_set_limit(unsigned int categories,
+                        int level,
+                        int per_sec,
+                        int burst,
+                        int every);
+
+/*
+ * How many messages of a level (or of all levels, with LOG_LAST)
+ * were held back by limits or sampling.
+ */
+unsigned long gdsql_log_get_suppressed(int level);
+
+/*
+ * How many messages were dropped in asynchronous mode, or in binary
+ * mode because the file could not grow.
+ */
+unsigned long gdsql_log_get_drops(void);
+
 /*
  * A function to force shutdown of the loggin system.
  */
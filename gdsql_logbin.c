@@ -0,0 +1,1105 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <gdsql_util.h>
+#include <gdsql_date.h>
+#include <gdsql_logbin.h>
+
+#define BIN_NAME        "gdsql"
+#define BIN_EXT         "bin"
+#define BIN_MAGIC       "GDSQLBIN"
+#define BIN_VERSION     1
+
+/*
+ * Threads take blocks of BIN_BLOCK bytes, out of chunks of BIN_CHUNK
+ * bytes mapped at a time.  A thread moves on to a new block when the
+ * one it has has less than BIN_RECORD_MAX bytes left, which is also
+ * the most a record can take (arguments that do not fit are cut).
+ * The first block only has the header.  A chunk is unmapped once all
+ * its blocks were handed out and given back; a file that reaches
+ * BIN_FILE_MAX bytes is closed and a new one opened, and only the
+ * last BIN_FILES files are kept.
+ */
+#define BIN_BLOCK       (64 * 1024)
+#define BIN_CHUNK       (256 * BIN_BLOCK)
+#define BIN_RECORD_MAX  4096
+#define BIN_FILE_MAX    (64 * (off_t) BIN_CHUNK)
+#define BIN_FILES       4
+
+// Types of records; a zero means the rest of the block is unused.
+#define BIN_EMPTY       0
+#define BIN_SITE        1
+#define BIN_EVENT       2
+
+#define BIN_ROUND(n)    (((n) + 7) & ~7ul)
+
+typedef struct BinHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t block;
+    uint64_t real0;             // CLOCK_REALTIME when opened, in nsecs
+    uint64_t mono0;             // gdsql_get_nsecs() at the same time
+} BinHeader;
+
+typedef struct BinRecord {
+    uint16_t type;              // written last
+    uint16_t size;              // of the whole record, a multiple of 8
+    uint32_t id;                // of the site
+} BinRecord;
+
+typedef struct BinSite {
+    BinRecord rec;
+    int32_t level;
+    int32_t line;
+    // followed by the file and the format, each ending in '\0'
+} BinSite;
+
+typedef struct BinEvent {
+    BinRecord rec;
+    int32_t errnum;
+    uint32_t suppressed;        // held back before this one
+    uint64_t when;              // gdsql_get_nsecs()
+    // followed by the arguments
+} BinEvent;
+
+typedef struct BinMap {
+    char* base;
+    int busy;                   // blocks handed out and not given back
+    int full;                   // no more blocks will be handed out
+    struct BinMap* next;
+} BinMap;
+
+typedef struct BinBlock {
+    char* cur;
+    char* end;
+    unsigned int gen;
+    BinMap* map;                // the block is in, 0 if none
+} BinBlock;
+
+/*
+ * What we need to know about one conversion in a format, both to
+ * store its argument and to print it back.
+ */
+typedef struct BinSpec {
+    const char* beg;            // the '%'
+    const char* end;            // just past the conversion
+    int star_width;
+    int star_prec;
+    int prec;                   // -1 if not given as a number
+    char size;                  // h l j z t, H for hh, Q for ll, D for L
+    char conv;
+} BinSpec;
+
+typedef struct DecSite {
+    int level;
+    int line;
+    const char* file;
+    const char* fmt;
+} DecSite;
+
+static void file_name(char* buf,
+                      unsigned int num);
+static int open_file(void);
+static void close_file(void);
+static int map_chunk(void);
+static void drop_maps(void);
+static void give_back(BinBlock* block);
+static void block_release(void* arg);
+static int take_block(BinBlock* block);
+static char* get_room(BinBlock* block);
+static void put_record(char* p,
+                       int type,
+                       unsigned long size,
+                       unsigned int id);
+static unsigned int site_id(gdsql_log_site* site,
+                            unsigned int gen);
+static int write_site(BinBlock* block,
+                      gdsql_log_site* site,
+                      const char* fmt);
+static char* put_slot(char* q,
+                      char* end,
+                      const void* val);
+static char* put_text(char* q,
+                      char* end,
+                      const char* s,
+                      size_t len);
+static char* put_args(char* q,
+                      char* end,
+                      const char* fmt,
+                      va_list* vl);
+static const char* next_spec(const char* fmt,
+                             BinSpec* spec);
+static int known_conv(int conv);
+
+static int compare_events(const void* a,
+                          const void* b);
+static void render_event(FILE* out,
+                         const BinHeader* head,
+                         const DecSite* site,
+                         const BinEvent* ev);
+static void render_args(FILE* out,
+                        const char* fmt,
+                        const char* q,
+                        const char* end,
+                        int errnum);
+static const char* get_slot(const char* q,
+                            const char* end,
+                            void* val);
+
+/*
+ * The file and its mapped chunks; only touched with bin_lock held,
+ * except for bin_gen, which changes every time a file is opened or
+ * closed.  A chunk stays mapped while a thread has a block in it, even
+ * after its file was closed, so that a thread still writing there
+ * never touches unmapped memory; the next time it logs it sees that
+ * bin_gen changed and gives its block back.
+ */
+static pthread_mutex_t bin_lock = PTHREAD_MUTEX_INITIALIZER;
+static int bin_fd = -1;
+static char bin_name[256];
+static BinMap* bin_maps = 0;
+static BinMap* bin_map = 0;
+static char* bin_next = 0;
+static char* bin_end = 0;
+static off_t bin_size = 0;
+static off_t bin_used = 0;
+static unsigned int bin_gen = 0;
+static unsigned int bin_sites = 0;
+static unsigned int bin_files = 0;
+static pthread_key_t block_key;
+static int block_key_made = 0;
+
+static __thread BinBlock bin_block;
+
+
+int gdsql_logbin_open(void)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&bin_lock);
+    do {
+        if (bin_fd >= 0)
+            break;
+
+        // Give the blocks of exiting threads back.
+        if (! block_key_made) {
+            if (pthread_key_create(&block_key, block_release) != 0) {
+                ret = 3;
+                break;
+            }
+            block_key_made = 1;
+        }
+
+        ret = open_file();
+    } while (0);
+    pthread_mutex_unlock(&bin_lock);
+
+    return ret;
+}
+
+void gdsql_logbin_close(void)
+{
+    pthread_mutex_lock(&bin_lock);
+    if (bin_fd >= 0)
+        close_file();
+    pthread_mutex_unlock(&bin_lock);
+}
+
+int gdsql_logbin_write(gdsql_log_site* site,
+                       int errnum,
+                       unsigned long suppressed,
+                       const char* fmt,
+                       va_list vl)
+{
+    BinBlock* block = &bin_block;
+
+    char* p = get_room(block);
+    if (p == 0)
+        return 2;
+
+    // The site must be in the same file as the block; if the file
+    // changes in between, the message is dropped.
+    unsigned int id = site_id(site, block->gen);
+    if (id == 0) {
+        if (write_site(block, site, fmt) != 0)
+            return 1;
+
+        p = get_room(block);
+        if (p == 0)
+            return 2;
+
+        id = site_id(site, block->gen);
+        if (id == 0)
+            return 2;
+    }
+
+    BinEvent* ev = (BinEvent*) p;
+    ev->errnum = errnum;
+    ev->suppressed = suppressed > UINT32_MAX ? UINT32_MAX : suppressed;
+    ev->when = gdsql_get_nsecs();
+
+    va_list args;
+    va_copy(args, vl);
+    char* q = put_args(p + sizeof(BinEvent), p + BIN_RECORD_MAX,
+                       fmt, &args);
+    va_end(args);
+
+    unsigned long size = BIN_ROUND(q - p);
+    put_record(p, BIN_EVENT, size, id);
+    block->cur += size;
+
+    return 0;
+}
+
+int gdsql_logbin_decode(const char* name,
+                        FILE* out)
+{
+    int ret = 0;
+    int fd = -1;
+    char* base = 0;
+    size_t size = 0;
+    DecSite* sites = 0;
+    unsigned int nsites = 0;
+    const BinEvent** events = 0;
+    size_t nevents = 0;
+    size_t aevents = 0;
+
+    do {
+        fd = open(name, O_RDONLY);
+        if (fd < 0) {
+            ret = 1;
+            break;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 ||
+            st.st_size < (off_t) sizeof(BinHeader)) {
+            ret = 2;
+            break;
+        }
+
+        size = st.st_size;
+        base = (char*) mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            base = 0;
+            ret = 3;
+            break;
+        }
+
+        const BinHeader* head = (const BinHeader*) base;
+        if (memcmp(head->magic, BIN_MAGIC, sizeof(head->magic)) != 0 ||
+            head->version != BIN_VERSION ||
+            head->block < BIN_RECORD_MAX ||
+            head->block % 8 != 0) {
+            ret = 4;
+            break;
+        }
+
+        // Gather all sites and events; a block ends at its first
+        // empty (or broken) record.
+        size_t off;
+        for (off = head->block; off < size && ret == 0; off += head->block) {
+            const char* p = base + off;
+            const char* end = base + (size - off < head->block ?
+                                      size : off + head->block);
+            while (p + sizeof(BinRecord) <= end) {
+                const BinRecord* rec = (const BinRecord*) p;
+                if (rec->type == BIN_EMPTY ||
+                    rec->size < sizeof(BinRecord) ||
+                    rec->size % 8 != 0 ||
+                    p + rec->size > end)
+                    break;
+
+                if (rec->type == BIN_SITE &&
+                    rec->size > sizeof(BinSite)) {
+                    if (rec->id >= nsites) {
+                        unsigned int n = rec->id + 256;
+                        DecSite* s = (DecSite*) realloc(sites, n * sizeof(DecSite));
+                        if (s == 0) {
+                            ret = 5;
+                            break;
+                        }
+                        memset(s + nsites, 0, (n - nsites) * sizeof(DecSite));
+                        sites = s;
+                        nsites = n;
+                    }
+
+                    const BinSite* bs = (const BinSite*) p;
+                    DecSite* s = &sites[rec->id];
+                    s->level = bs->level;
+                    s->line = bs->line;
+                    s->file = p + sizeof(BinSite);
+                    s->fmt = s->file + strnlen(s->file, rec->size - sizeof(BinSite)) + 1;
+                    if (s->fmt >= p + rec->size)
+                        s->fmt = "";
+                } else if (rec->type == BIN_EVENT &&
+                           rec->size >= sizeof(BinEvent)) {
+                    if (nevents >= aevents) {
+                        size_t n = aevents ? 2 * aevents : 4096;
+                        const BinEvent** e = (const BinEvent**) realloc(events, n * sizeof(BinEvent*));
+                        if (e == 0) {
+                            ret = 5;
+                            break;
+                        }
+                        events = e;
+                        aevents = n;
+                    }
+                    events[nevents++] = (const BinEvent*) p;
+                }
+
+                p += rec->size;
+            }
+        }
+        if (ret != 0)
+            break;
+
+        // Threads wrote into their own blocks, so put the events back
+        // in the order they happened.
+        qsort(events, nevents, sizeof(BinEvent*), compare_events);
+
+        size_t j;
+        for (j = 0; j < nevents; ++j) {
+            const BinEvent* ev = events[j];
+            const DecSite* site = 0;
+            if (ev->rec.id < nsites && sites[ev->rec.id].file != 0)
+                site = &sites[ev->rec.id];
+            render_event(out, head, site, ev);
+        }
+    } while (0);
+
+    free(events);
+    free(sites);
+    if (base != 0)
+        munmap(base, size);
+    if (fd >= 0)
+        close(fd);
+
+    return ret;
+}
+
+
+/*
+ * Name of the num-th file opened by this process.
+ */
+static void file_name(char* buf,
+                      unsigned int num)
+{
+    unsigned int pid = gdsql_getpid();
+    if (num <= 1)
+        sprintf(buf, "%s-%u.%s", BIN_NAME, pid, BIN_EXT);
+    else
+        sprintf(buf, "%s-%u-%u.%s", BIN_NAME, pid, num, BIN_EXT);
+}
+
+/*
+ * Must be called with bin_lock held.
+ */
+static int open_file(void)
+{
+    // Never overwrite the file of an earlier open, but do not keep
+    // more than BIN_FILES of them either.
+    ++bin_files;
+    if (bin_files > BIN_FILES) {
+        char old[256];
+        file_name(old, bin_files - BIN_FILES);
+        unlink(old);
+    }
+    file_name(bin_name, bin_files);
+
+    bin_fd = open(bin_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (bin_fd < 0)
+        return 1;
+
+    bin_size = 0;
+    if (map_chunk() != 0) {
+        close(bin_fd);
+        bin_fd = -1;
+        return 2;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    BinHeader* head = (BinHeader*) bin_next;
+    memcpy(head->magic, BIN_MAGIC, sizeof(head->magic));
+    head->version = BIN_VERSION;
+    head->block = BIN_BLOCK;
+    head->real0 = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    head->mono0 = gdsql_get_nsecs();
+
+    bin_next += BIN_BLOCK;
+    bin_used = BIN_BLOCK;
+    bin_sites = 0;
+    __atomic_add_fetch(&bin_gen, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Must be called with bin_lock held.  Chunks with blocks still held
+ * by some thread are unmapped when they are given back.
+ */
+static void close_file(void)
+{
+    BinMap* map;
+    for (map = bin_maps; map != 0; map = map->next)
+        map->full = 1;
+    drop_maps();
+
+    // Do not leave the unused part of the last chunk behind.
+    if (ftruncate(bin_fd, bin_used) != 0)
+        bin_used = bin_size;
+
+    close(bin_fd);
+    bin_fd = -1;
+    bin_map = 0;
+    bin_next = 0;
+    bin_end = 0;
+    bin_size = 0;
+    bin_used = 0;
+    __atomic_add_fetch(&bin_gen, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Must be called with bin_lock held.
+ */
+static int map_chunk(void)
+{
+    if (ftruncate(bin_fd, bin_size + BIN_CHUNK) != 0)
+        return 1;
+
+    void* p = mmap(0, BIN_CHUNK, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   bin_fd, bin_size);
+    if (p == MAP_FAILED)
+        return 2;
+
+    BinMap* map = (BinMap*) malloc(sizeof(BinMap));
+    if (map == 0) {
+        munmap(p, BIN_CHUNK);
+        return 3;
+    }
+
+    // All blocks of the previous chunk have been handed out.
+    if (bin_map != 0) {
+        bin_map->full = 1;
+        drop_maps();
+    }
+
+    map->base = (char*) p;
+    map->busy = 0;
+    map->full = 0;
+    map->next = bin_maps;
+    bin_maps = map;
+    bin_map = map;
+
+    bin_next = map->base;
+    bin_end = map->base + BIN_CHUNK;
+    bin_size += BIN_CHUNK;
+    return 0;
+}
+
+/*
+ * Unmap the chunks nobody will write to again.  Must be called with
+ * bin_lock held.
+ */
+static void drop_maps(void)
+{
+    BinMap** prev = &bin_maps;
+    while (*prev != 0) {
+        BinMap* map = *prev;
+        if (map->full && map->busy == 0) {
+            *prev = map->next;
+            munmap(map->base, BIN_CHUNK);
+            free(map);
+        } else
+            prev = &map->next;
+    }
+}
+
+/*
+ * Must be called with bin_lock held.
+ */
+static void give_back(BinBlock* block)
+{
+    BinMap* map = block->map;
+    if (map == 0)
+        return;
+
+    block->map = 0;
+    block->cur = 0;
+    block->end = 0;
+    if (--map->busy == 0 && map->full)
+        drop_maps();
+}
+
+static void block_release(void* arg)
+{
+    pthread_mutex_lock(&bin_lock);
+    give_back((BinBlock*) arg);
+    pthread_mutex_unlock(&bin_lock);
+}
+
+static int take_block(BinBlock* block)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&bin_lock);
+    do {
+        give_back(block);
+
+        if (bin_fd < 0) {
+            ret = 1;
+            break;
+        }
+
+        if (bin_used + BIN_BLOCK > BIN_FILE_MAX) {
+            close_file();
+            if (open_file() != 0) {
+                ret = 3;
+                break;
+            }
+        }
+
+        if (bin_next + BIN_BLOCK > bin_end &&
+            map_chunk() != 0) {
+            ret = 2;
+            break;
+        }
+
+        pthread_setspecific(block_key, block);
+        block->cur = bin_next;
+        block->end = bin_next + BIN_BLOCK;
+        block->gen = bin_gen;
+        block->map = bin_map;
+        ++bin_map->busy;
+        bin_next += BIN_BLOCK;
+        bin_used += BIN_BLOCK;
+    } while (0);
+    pthread_mutex_unlock(&bin_lock);
+
+    return ret;
+}
+
+/*
+ * Where the next record of this thread goes, with room for at least
+ * BIN_RECORD_MAX bytes.
+ */
+static char* get_room(BinBlock* block)
+{
+    if (block->gen != __atomic_load_n(&bin_gen, __ATOMIC_ACQUIRE) ||
+        block->end - block->cur < BIN_RECORD_MAX) {
+        if (take_block(block) != 0)
+            return 0;
+    }
+
+    return block->cur;
+}
+
+/*
+ * The type goes in last, so that a reader never sees half a record
+ * as a whole one.
+ */
+static void put_record(char* p,
+                       int type,
+                       unsigned long size,
+                       unsigned int id)
+{
+    BinRecord* rec = (BinRecord*) p;
+    rec->size = (uint16_t) size;
+    rec->id = id;
+    __atomic_store_n(&rec->type, (uint16_t) type, __ATOMIC_RELEASE);
+}
+
+/*
+ * The id of the site in the file of generation gen, or 0 if it has
+ * not been written there; the id is only good if gen did not change
+ * while reading it.
+ */
+static unsigned int site_id(gdsql_log_site* site,
+                            unsigned int gen)
+{
+    if (__atomic_load_n(&site->gen, __ATOMIC_ACQUIRE) != gen)
+        return 0;
+
+    unsigned int id = __atomic_load_n(&site->id, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&site->gen, __ATOMIC_RELAXED) != gen)
+        return 0;
+
+    return id;
+}
+
+/*
+ * Write the site into the block, which must have room for it (see
+ * get_room()) and still be in the current file.
+ */
+static int write_site(BinBlock* block,
+                      gdsql_log_site* site,
+                      const char* fmt)
+{
+    char* p = block->cur;
+    int ret = 0;
+
+    pthread_mutex_lock(&bin_lock);
+    if (block->gen != bin_gen)
+        ret = 1;
+    else if (__atomic_load_n(&site->gen, __ATOMIC_RELAXED) != bin_gen) {
+        BinSite* bs = (BinSite*) p;
+        char* q = p + sizeof(BinSite);
+        char* end = p + BIN_RECORD_MAX;
+        const char* file = site->file + gdsql_file_base(site->file);
+        size_t len;
+
+        bs->level = site->level;
+        bs->line = site->line;
+
+        len = strlen(file);
+        if (len > 255)
+            len = 255;
+        memcpy(q, file, len);
+        q += len;
+        *q++ = '\0';
+
+        len = strlen(fmt);
+        if (len > (size_t) (end - q - 1))
+            len = end - q - 1;
+        memcpy(q, fmt, len);
+        q += len;
+        *q++ = '\0';
+
+        // Clear gen before changing id, for site_id().
+        unsigned long size = BIN_ROUND(q - p);
+        unsigned int id = ++bin_sites;
+        __atomic_store_n(&site->gen, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->id, id, __ATOMIC_RELEASE);
+        put_record(p, BIN_SITE, size, id);
+        block->cur += size;
+        __atomic_store_n(&site->gen, bin_gen, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&bin_lock);
+
+    return ret;
+}
+
+static char* put_slot(char* q,
+                      char* end,
+                      const void* val)
+{
+    if (q == 0 || end - q < 8)
+        return 0;
+
+    memcpy(q, val, 8);
+    return q + 8;
+}
+
+/*
+ * A string goes as its length (4 bytes), its bytes and a '\0'; it is
+ * cut if it does not fit.
+ */
+static char* put_text(char* q,
+                      char* end,
+                      const char* s,
+                      size_t len)
+{
+    if (q == 0 || end - q < 8)
+        return 0;
+
+    if (len > (size_t) (end - q - 5))
+        len = end - q - 5;
+
+    uint32_t l = (uint32_t) len;
+    memcpy(q, &l, 4);
+    memcpy(q + 4, s, len);
+    q[4 + len] = '\0';
+    return q + BIN_ROUND(4 + len + 1);
+}
+
+/*
+ * Store the arguments for a format; return where they end.  We stop
+ * at the first conversion we do not know, as we cannot tell the type
+ * of its argument.
+ */
+static char* put_args(char* q,
+                      char* end,
+                      const char* fmt,
+                      va_list* vl)
+{
+    char* last = q;
+    BinSpec spec;
+
+    while (q != 0 &&
+           (fmt = next_spec(fmt, &spec)) != 0) {
+        int64_t i;
+        uint64_t u;
+        double d;
+
+        if (! known_conv(spec.conv))
+            break;
+
+        if (spec.star_width) {
+            i = va_arg(*vl, int);
+            q = put_slot(q, end, &i);
+        }
+        if (spec.star_prec) {
+            i = va_arg(*vl, int);
+            spec.prec = (int) i;
+            q = put_slot(q, end, &i);
+        }
+
+        switch (spec.conv) {
+        case 'd':
+        case 'i':
+            switch (spec.size) {
+            case 'H': i = (signed char) va_arg(*vl, int); break;
+            case 'h': i = (short) va_arg(*vl, int);       break;
+            case 'l': i = va_arg(*vl, long);              break;
+            case 'Q': i = va_arg(*vl, long long);         break;
+            case 'j': i = va_arg(*vl, intmax_t);          break;
+            case 'z': i = va_arg(*vl, ssize_t);           break;
+            case 't': i = va_arg(*vl, ptrdiff_t);         break;
+            default:  i = va_arg(*vl, int);               break;
+            }
+            q = put_slot(q, end, &i);
+            break;
+
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            switch (spec.size) {
+            case 'H': u = (unsigned char) va_arg(*vl, unsigned int);  break;
+            case 'h': u = (unsigned short) va_arg(*vl, unsigned int); break;
+            case 'l': u = va_arg(*vl, unsigned long);                 break;
+            case 'Q': u = va_arg(*vl, unsigned long long);            break;
+            case 'j': u = va_arg(*vl, uintmax_t);                     break;
+            case 'z': u = va_arg(*vl, size_t);                        break;
+            case 't': u = va_arg(*vl, ptrdiff_t);                     break;
+            default:  u = va_arg(*vl, unsigned int);                  break;
+            }
+            q = put_slot(q, end, &u);
+            break;
+
+        case 'c':
+            i = va_arg(*vl, int);
+            q = put_slot(q, end, &i);
+            break;
+
+        case 'e': case 'E':
+        case 'f': case 'F':
+        case 'g': case 'G':
+        case 'a': case 'A':
+            if (spec.size == 'D')
+                d = (double) va_arg(*vl, long double);
+            else
+                d = va_arg(*vl, double);
+            q = put_slot(q, end, &d);
+            break;
+
+        case 's': {
+            const char* s = va_arg(*vl, const char*);
+            if (s == 0)
+                s = "(null)";
+            size_t len = spec.prec >= 0 ? strnlen(s, spec.prec) : strlen(s);
+            q = put_text(q, end, s, len);
+            break;
+        }
+
+        case 'p':
+            u = (uintptr_t) va_arg(*vl, void*);
+            q = put_slot(q, end, &u);
+            break;
+
+        case 'n':
+            (void) va_arg(*vl, void*);
+            break;
+
+        default:                // '%' and 'm' take no argument
+            break;
+        }
+
+        if (q != 0)
+            last = q;
+    }
+
+    return last;
+}
+
+/*
+ * Find the next conversion in fmt; return where it ends, or 0 if
+ * there are no more.
+ */
+static const char* next_spec(const char* fmt,
+                             BinSpec* spec)
+{
+    const char* p = strchr(fmt, '%');
+    if (p == 0)
+        return 0;
+
+    spec->beg = p++;
+    spec->star_width = 0;
+    spec->star_prec = 0;
+    spec->prec = -1;
+    spec->size = 0;
+
+    while (*p != '\0' && strchr("-+ #0'", *p) != 0)
+        ++p;
+
+    if (*p == '*') {
+        spec->star_width = 1;
+        ++p;
+    } else {
+        while (isdigit((int) *p))
+            ++p;
+    }
+
+    if (*p == '.') {
+        ++p;
+        if (*p == '*') {
+            spec->star_prec = 1;
+            ++p;
+        } else {
+            spec->prec = 0;
+            while (isdigit((int) *p))
+                spec->prec = spec->prec * 10 + *p++ - '0';
+        }
+    }
+
+    switch (*p) {
+    case 'h':
+        spec->size = *p++;
+        if (*p == 'h') {
+            spec->size = 'H';
+            ++p;
+        }
+        break;
+    case 'l':
+        spec->size = *p++;
+        if (*p == 'l') {
+            spec->size = 'Q';
+            ++p;
+        }
+        break;
+    case 'q':
+        spec->size = 'Q';
+        ++p;
+        break;
+    case 'L':
+        spec->size = 'D';
+        ++p;
+        break;
+    case 'j':
+    case 'z':
+    case 't':
+        spec->size = *p++;
+        break;
+    }
+
+    spec->conv = *p;
+    if (*p != '\0')
+        ++p;
+    spec->end = p;
+    return p;
+}
+
+static int known_conv(int conv)
+{
+    return conv != '\0' && strchr("diuoxXceEfFgGaAspnm%", conv) != 0;
+}
+
+
+static int compare_events(const void* a,
+                          const void* b)
+{
+    const BinEvent* l = *(const BinEvent**) a;
+    const BinEvent* r = *(const BinEvent**) b;
+
+    if (l->when != r->when)
+        return l->when < r->when ? -1 : 1;
+    if (l != r)
+        return l < r ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Print one event just like the text log would have, except that the
+ * time has microseconds.
+ */
+static void render_event(FILE* out,
+                         const BinHeader* head,
+                         const DecSite* site,
+                         const BinEvent* ev)
+{
+    const char* args = (const char*) ev + sizeof(BinEvent);
+    const char* end = (const char*) ev + ev->rec.size;
+
+    if (site == 0) {
+        fprintf(out, "Unknown log site %u\n", ev->rec.id);
+        return;
+    }
+
+    if (site->level != LOG_ALWAYS) {
+        uint64_t real = head->real0 + (ev->when - head->mono0);
+        int Y, M, D, h, m, s;
+        gdsql_get_time((unsigned int) (real / 1000000000ull),
+                       &Y, &M, &D, &h, &m, &s, 0);
+        fprintf(out, "%04d%02d%02d %02d%02d%02d.%06u %s:%d ",
+                Y, M, D, h, m, s,
+                (unsigned int) (real % 1000000000ull / 1000),
+                site->file, site->line);
+    }
+
+    if (site->level == LOG_FATAL)
+        fputs("Fatal -- ", out);
+    else if (site->level == LOG_ERROR)
+        fputs("Error -- ", out);
+    else if (site->level == LOG_WARNING)
+        fputs("Warning -- ", out);
+
+    render_args(out, site->fmt, args, end, ev->errnum);
+
+    if (ev->suppressed > 0 && site->level != LOG_ALWAYS)
+        fprintf(out, " (suppressed %u similar messages)", ev->suppressed);
+
+    if (site->level == LOG_FATAL || site->level == LOG_ERROR)
+        fprintf(out, " (%d: %s)\n", ev->errnum, strerror(ev->errnum));
+    else if (site->level != LOG_ALWAYS)
+        fputs("\n", out);
+}
+
+/*
+ * Print a format with the stored arguments, one conversion at a time,
+ * rewritten for the way the argument was stored.  Whatever was cut
+ * when logging is not printed.
+ */
+static void render_args(FILE* out,
+                        const char* fmt,
+                        const char* q,
+                        const char* end,
+                        int errnum)
+{
+    const char* next;
+    BinSpec spec;
+
+    while ((next = next_spec(fmt, &spec)) != 0) {
+        fwrite(fmt, 1, spec.beg - fmt, out);
+        fmt = next;
+
+        if (! known_conv(spec.conv)) {
+            fputs(spec.beg, out);
+            return;
+        }
+
+        int64_t width = 0;
+        int64_t prec = 0;
+        if (spec.star_width &&
+            (q = get_slot(q, end, &width)) == 0)
+            return;
+        if (spec.star_prec &&
+            (q = get_slot(q, end, &prec)) == 0)
+            return;
+
+        // Same flags, width and precision; our own size.
+        char f[64];
+        int n = 0;
+        int dot = 0;
+        const char* c;
+        for (c = spec.beg; c < spec.end - 1 && n < 32; ++c) {
+            if (*c == '.')
+                dot = 1;
+            if (*c == '*')
+                n += sprintf(f + n, "%d", (int) (dot ? prec : width));
+            else if (strchr("hlqLjzt", *c) == 0)
+                f[n++] = *c;
+        }
+        if (strchr("diuoxX", spec.conv) != 0) {
+            f[n++] = 'l';
+            f[n++] = 'l';
+        }
+        f[n++] = spec.conv;
+        f[n] = '\0';
+
+        int64_t i;
+        double d;
+        switch (spec.conv) {
+        case '%':
+            fputc('%', out);
+            break;
+
+        case 'm':
+            fputs(strerror(errnum), out);
+            break;
+
+        case 'n':
+            break;
+
+        case 's': {
+            uint32_t len;
+            if (end - q < 8)
+                return;
+            memcpy(&len, q, 4);
+            if (len > (uint32_t) (end - q - 5))
+                return;
+            fprintf(out, f, q + 4);
+            q += BIN_ROUND(4 + len + 1);
+            break;
+        }
+
+        case 'e': case 'E':
+        case 'f': case 'F':
+        case 'g': case 'G':
+        case 'a': case 'A':
+            if ((q = get_slot(q, end, &d)) == 0)
+                return;
+            fprintf(out, f, d);
+            break;
+
+        case 'p':
+            if ((q = get_slot(q, end, &i)) == 0)
+                return;
+            fprintf(out, f, (void*) (uintptr_t) i);
+            break;
+
+        case 'c':
+            if ((q = get_slot(q, end, &i)) == 0)
+                return;
+            fprintf(out, f, (int) i);
+            break;
+
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            if ((q = get_slot(q, end, &i)) == 0)
+                return;
+            fprintf(out, f, (unsigned long long) i);
+            break;
+
+        default:
+            if ((q = get_slot(q, end, &i)) == 0)
+                return;
+            fprintf(out, f, (long long) i);
+            break;
+        }
+    }
+
+    fputs(fmt, out);
+}
+
+static const char* get_slot(const char* q,
+                            const char* end,
+                            void* val)
+{
+    if (q == 0 || end - q < 8)
+        return 0;
+
+    memcpy(val, q, 8);
+    return q + 8;
+}
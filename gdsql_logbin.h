@@ -0,0 +1,56 @@
+#ifndef GDSQL_LOGBIN_H_
+#define GDSQL_LOGBIN_H_
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <gdsql_log.h>
+
+/*
+ * Binary log, used by the logging code when binary mode is on (see
+ * gdsql_log_set_binary()); it is never formatted in the process
+ * doing the logging.
+ *
+ * The file starts with a header and is then made of blocks; each
+ * thread fills its own block with records, and takes a new one when
+ * it runs out of room, so writing a message takes no lock.  There are
+ * two kinds of records: one for each call site, written the first
+ * time it is used, with its level, file, line and format; and one for
+ * each message, with the id of its site, the time, errno, how many
+ * messages of the site were held back before it, and the values of
+ * its arguments.  Strings are copied, everything else is stored as
+ * 8 bytes.  Unused space is left as zeroes.
+ *
+ * Blocks are taken from chunks of the file which are mapped in
+ * memory, so whatever was logged survives a crash of the process.
+ * A chunk is unmapped once its blocks are all used up.  When a file
+ * gets too big a new one is started, and only the last few are kept.
+ */
+
+/*
+ * Open the binary log file (if not yet open); return 0 if OK.
+ */
+int gdsql_logbin_open(void);
+
+/*
+ * Close the binary log file.  Threads still logging write at most
+ * one more message into it, and let go of it the next time they log
+ * or when they exit.
+ */
+void gdsql_logbin_close(void);
+
+/*
+ * Write one message for a site; return 0 if OK.
+ */
+int gdsql_logbin_write(gdsql_log_site* site,
+                       int errnum,
+                       unsigned long suppressed,
+                       const char* fmt,
+                       va_list vl);
+
+/*
+ * Render binary log file name as text into out; return 0 if OK.
+ */
+int gdsql_logbin_decode(const char* name,
+                        FILE* out);
+
+#endif
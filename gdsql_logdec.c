@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <gdsql_logbin.h>
+
+/*
+ * Print binary log files (see gdsql_log_set_binary()) as text.
+ */
+int main(int argc, char* argv[])
+{
+    int ret = 0;
+    int j;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s gdsql-<pid>.bin ...\n", argv[0]);
+        return 1;
+    }
+
+    for (j = 1; j < argc; ++j) {
+        int r = gdsql_logbin_decode(argv[j], stdout);
+        if (r != 0) {
+            fprintf(stderr, "%s: could not decode %s (%d)\n",
+                    argv[0], argv[j], r);
+            ret = 2;
+        }
+    }
+
+    return ret;
+}
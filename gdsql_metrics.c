@@ -0,0 +1,385 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gdsql_log.h>
+#include <gdsql_hidden.h>
+#include <gdsql_util.h>
+#include <gdsql_metrics.h>
+
+// Log lines are counted per level; the last one is for LOG_ALWAYS.
+#define METRICS_LEVELS   (LOG_LAST + 1)
+
+typedef struct MetricsBlock {
+    unsigned long driver[GDSQL_DB_COUNT][METRIC_COUNT];
+    unsigned long log[METRICS_LEVELS];
+    struct MetricsBlock* next;
+} MetricsBlock;
+
+typedef struct MetricsFamily {
+    const char* name;
+    const char* type;
+    const char* help;
+} MetricsFamily;
+
+static MetricsBlock* get_block(void);
+static void make_key(void);
+static void release_block(void* arg);
+static void bump(unsigned long* counter,
+                 unsigned long n);
+static void add_block(MetricsBlock* sum,
+                      const MetricsBlock* block);
+static void collect(MetricsBlock* sum);
+static void put_family(FILE* fp,
+                       const MetricsFamily* family);
+static int write_file(const char* path);
+static void* run_exporter(void* arg);
+
+static const char* level_names[METRICS_LEVELS] = {
+    "debug",
+    "info",
+    "warning",
+    "error",
+    "fatal",
+    "always",
+};
+
+static const MetricsFamily driver_families[METRIC_COUNT] = {
+    { "gdsql_connections_opened_total", "counter",
+      "Connections opened." },
+    { "gdsql_connections_closed_total", "counter",
+      "Connections closed." },
+    { "gdsql_statements_prepared_total", "counter",
+      "Statements prepared." },
+    { "gdsql_statements_executed_total", "counter",
+      "Statement executions." },
+    { "gdsql_rows_fetched_total", "counter",
+      "Rows fetched." },
+    { "gdsql_errors_total", "counter",
+      "Calls that failed." },
+};
+
+/*
+ * The blocks of the live threads, and what the threads that are gone
+ * had counted.  The lock is only taken when a thread counts for the
+ * first time, when it exits, and when dumping.
+ */
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t block_key;
+static MetricsBlock* blocks = 0;
+static MetricsBlock retired;
+
+static __thread MetricsBlock* local_block = 0;
+
+/*
+ * The exporter thread.
+ */
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t export_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t exporter;
+static int export_on = 0;
+static int export_stop = 0;
+static int export_msecs = GDSQL_METRICS_DEFAULT_MSECS;
+static char export_path[1024];
+
+
+void metrics_count(int dbtype,
+                   int metric,
+                   unsigned long n)
+{
+    if (dbtype < 0 || dbtype >= GDSQL_DB_COUNT ||
+        metric < 0 || metric >= METRIC_COUNT)
+        return;
+
+    MetricsBlock* block = get_block();
+    if (block != 0)
+        bump(&block->driver[dbtype][metric], n);
+}
+
+void metrics_count_log(int level)
+{
+    if (level < 0 || level >= LOG_LAST)
+        level = LOG_LAST;
+
+    MetricsBlock* block = get_block();
+    if (block != 0)
+        bump(&block->log[level], 1);
+}
+
+int gdsql_metrics_dump(FILE* fp)
+{
+    MetricsBlock sum;
+    int m;
+    int t;
+    int l;
+
+    if (fp == 0)
+        return 1;
+
+    collect(&sum);
+
+    for (m = 0; m < METRIC_COUNT; ++m) {
+        put_family(fp, &driver_families[m]);
+        for (t = 0; t < GDSQL_DB_COUNT; ++t)
+            fprintf(fp, "%s{driver=\"%s\"} %lu\n",
+                    driver_families[m].name, get_dbname(t),
+                    sum.driver[t][m]);
+    }
+
+    static const MetricsFamily current = {
+        "gdsql_connections_open", "gauge",
+        "Connections currently open."
+    };
+    put_family(fp, &current);
+    for (t = 0; t < GDSQL_DB_COUNT; ++t)
+        fprintf(fp, "%s{driver=\"%s\"} %ld\n",
+                current.name, get_dbname(t),
+                (long) (sum.driver[t][METRIC_CONN_OPENED] -
+                        sum.driver[t][METRIC_CONN_CLOSED]));
+
+    static const MetricsFamily written = {
+        "gdsql_log_lines_total", "counter",
+        "Log lines written."
+    };
+    put_family(fp, &written);
+    for (l = 0; l < METRICS_LEVELS; ++l)
+        fprintf(fp, "%s{level=\"%s\"} %lu\n",
+                written.name, level_names[l], sum.log[l]);
+
+    static const MetricsFamily suppressed = {
+        "gdsql_log_lines_suppressed_total", "counter",
+        "Log lines held back by rate limits or sampling."
+    };
+    put_family(fp, &suppressed);
+    for (l = 0; l < LOG_LAST; ++l)
+        fprintf(fp, "%s{level=\"%s\"} %lu\n",
+                suppressed.name, level_names[l],
+                gdsql_log_get_suppressed(l));
+
+    static const MetricsFamily dropped = {
+        "gdsql_log_lines_dropped_total", "counter",
+        "Log lines lost because a buffer or the log file was full."
+    };
+    put_family(fp, &dropped);
+    fprintf(fp, "%s %lu\n", dropped.name, gdsql_log_get_drops());
+
+    return ferror(fp) ? 2 : 0;
+}
+
+int gdsql_metrics_start_export(const char* path,
+                               int msecs)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&export_lock);
+    do {
+        if (export_on) {
+            ret = 1;
+            break;
+        }
+
+        if (path == 0 || path[0] == '\0' ||
+            strlen(path) >= sizeof(export_path) - 32) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid metrics export path"));
+            ret = 2;
+            break;
+        }
+
+        strcpy(export_path, path);
+        export_msecs = msecs > 0 ? msecs : GDSQL_METRICS_DEFAULT_MSECS;
+        export_stop = 0;
+        if (pthread_create(&exporter, 0, run_exporter, 0) != 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Could not start metrics exporter"));
+            ret = 3;
+            break;
+        }
+
+        export_on = 1;
+    } while (0);
+    pthread_mutex_unlock(&export_lock);
+
+    return ret;
+}
+
+int gdsql_metrics_stop_export(void)
+{
+    pthread_mutex_lock(&export_lock);
+    int on = export_on;
+    if (on) {
+        export_on = 0;
+        export_stop = 1;
+        pthread_cond_signal(&export_cond);
+    }
+    pthread_mutex_unlock(&export_lock);
+
+    if (! on)
+        return 1;
+
+    pthread_join(exporter, 0);
+    return write_file(export_path);
+}
+
+
+/*
+ * The block of the calling thread, created and registered the first
+ * time it counts something.
+ */
+static MetricsBlock* get_block(void)
+{
+    if (local_block != 0)
+        return local_block;
+
+    pthread_once(&key_once, make_key);
+
+    MetricsBlock* block = (MetricsBlock*) calloc(1, sizeof(MetricsBlock));
+    if (block == 0)
+        return 0;
+
+    pthread_mutex_lock(&metrics_lock);
+    block->next = blocks;
+    blocks = block;
+    pthread_mutex_unlock(&metrics_lock);
+
+    pthread_setspecific(block_key, block);
+    local_block = block;
+    return block;
+}
+
+static void make_key(void)
+{
+    pthread_key_create(&block_key, release_block);
+}
+
+/*
+ * A thread is gone: keep what it counted, and forget its block.
+ */
+static void release_block(void* arg)
+{
+    MetricsBlock* block = (MetricsBlock*) arg;
+
+    pthread_mutex_lock(&metrics_lock);
+    MetricsBlock** prev = &blocks;
+    while (*prev != 0 && *prev != block)
+        prev = &(*prev)->next;
+    if (*prev != 0)
+        *prev = block->next;
+    add_block(&retired, block);
+    pthread_mutex_unlock(&metrics_lock);
+
+    local_block = 0;
+    free(block);
+}
+
+/*
+ * Only the owner thread writes to its block, so this needs no locked
+ * instruction; the atomic store keeps readers from seeing a torn
+ * value.
+ */
+static void bump(unsigned long* counter,
+                 unsigned long n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static void add_block(MetricsBlock* sum,
+                      const MetricsBlock* block)
+{
+    int t;
+    int m;
+    int l;
+
+    for (t = 0; t < GDSQL_DB_COUNT; ++t) {
+        for (m = 0; m < METRIC_COUNT; ++m)
+            sum->driver[t][m] += __atomic_load_n(&block->driver[t][m],
+                                                 __ATOMIC_RELAXED);
+    }
+    for (l = 0; l < METRICS_LEVELS; ++l)
+        sum->log[l] += __atomic_load_n(&block->log[l], __ATOMIC_RELAXED);
+}
+
+static void collect(MetricsBlock* sum)
+{
+    memset(sum, 0, sizeof(MetricsBlock));
+
+    pthread_mutex_lock(&metrics_lock);
+    add_block(sum, &retired);
+    const MetricsBlock* block;
+    for (block = blocks; block != 0; block = block->next)
+        add_block(sum, block);
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+static void put_family(FILE* fp,
+                       const MetricsFamily* family)
+{
+    fprintf(fp, "# HELP %s %s\n", family->name, family->help);
+    fprintf(fp, "# TYPE %s %s\n", family->name, family->type);
+}
+
+/*
+ * Write to a temporary file and rename it, so that nobody ever reads
+ * half a file.
+ */
+static int write_file(const char* path)
+{
+    char tmp[sizeof(export_path)];
+    int ret = 0;
+
+    snprintf(tmp, sizeof(tmp), "%s.%u.tmp", path, gdsql_getpid());
+    do {
+        FILE* fp = fopen(tmp, "w");
+        if (fp == 0) {
+            ret = 1;
+            break;
+        }
+
+        ret = gdsql_metrics_dump(fp);
+        if (fclose(fp) != 0 && ret == 0)
+            ret = 3;
+        if (ret != 0) {
+            remove(tmp);
+            break;
+        }
+
+        if (rename(tmp, path) != 0) {
+            remove(tmp);
+            ret = 4;
+            break;
+        }
+    } while (0);
+
+    if (ret != 0)
+        GDSQL_Log(LOG_WARNING,
+                  ("Could not write metrics to [%s] (%d)",
+                   path, ret));
+    return ret;
+}
+
+static void* run_exporter(void* arg)
+{
+    pthread_mutex_lock(&export_lock);
+    while (! export_stop) {
+        pthread_mutex_unlock(&export_lock);
+        write_file(export_path);
+        pthread_mutex_lock(&export_lock);
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += export_msecs / 1000;
+        ts.tv_nsec += (export_msecs % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_nsec -= 1000000000L;
+            ++ts.tv_sec;
+        }
+        while (! export_stop &&
+               pthread_cond_timedwait(&export_cond, &export_lock, &ts) == 0)
+            ;
+    }
+    pthread_mutex_unlock(&export_lock);
+
+    return 0;
+}
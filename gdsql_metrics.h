@@ -0,0 +1,29 @@
+#ifndef GDSQL_METRICS_H_
+#define GDSQL_METRICS_H_
+
+#include <stdio.h>
+
+/*
+ * Process-wide metrics: connections opened and closed, statements
+ * prepared and executed, rows fetched and errors, for each driver,
+ * and log lines written, dropped and suppressed.  They are always
+ * collected; each thread counts into its own block, so counting
+ * takes no lock and threads never fight over a cache line, and the
+ * blocks are only added up when the metrics are dumped.
+ *
+ * gdsql_metrics_dump() writes them in the Prometheus text exposition
+ * format.  gdsql_metrics_start_export() starts a thread that rewrites
+ * a file with them every msecs milliseconds, for node_exporter's
+ * textfile collector; the file is replaced atomically, and written
+ * once more when the export is stopped.
+ */
+
+#define GDSQL_METRICS_DEFAULT_MSECS  15000
+
+int gdsql_metrics_dump(FILE* fp);
+
+int gdsql_metrics_start_export(const char* path,
+                               int msecs);
+int gdsql_metrics_stop_export(void);
+
+#endif
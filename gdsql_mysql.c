@@ -1,15 +1,26 @@
+#define LOG_CATEGORY LOG_CAT_MYSQL
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <mysql.h>
 #include <gdsql_date.h>
 #include <gdsql_log.h>
 #include <gdsql_hidden.h>
+#include <gdsql_cache.h>
 #include <gdsql_util.h>
 
 #define DBNAME "MySQL"
 
 typedef struct DbData {
     MYSQL* db;
+    int notify[2];              // see Async below
+    gdsql_stmth* busy;   // statement started and not completed
+    struct LoadData* load;      // load in progress, if any
 } DbData;
 
 #define STMT_MAX_PARAMS        100
@@ -18,6 +29,7 @@ typedef struct DbData {
 typedef struct Param {
     char buf[STMT_MAX_PARAMS][STMT_MAX_PARAM_LENGTH+1];
     unsigned long len[STMT_MAX_PARAMS];
+    my_bool null[STMT_MAX_PARAMS];
     MYSQL_BIND bind[STMT_MAX_PARAMS];
     int next;
 } Param;
@@ -25,6 +37,12 @@ typedef struct Param {
 #define STMT_MAX_RESULTS        100
 #define STMT_MAX_RESULT_LENGTH   50
 
+/*
+ * How many rows to get from a server-side cursor in each round trip,
+ * when the statement does not say.
+ */
+#define STMT_CURSOR_PREFETCH   1000
+
 typedef struct TimeColResult {
     MYSQL_TIME stamp;
     double* result;
@@ -44,12 +62,65 @@ typedef struct Result {
     int next;
 } Result;
 
+/*
+ * A statement running without blocking the caller.  MariaDB's client
+ * library can do this by itself (it defines MYSQL_WAIT_READ); with
+ * other libraries the statement runs in a worker thread, which writes
+ * a byte to the connection's notify pipe when it is done.  Either way,
+ * any results are read into client memory before we are done.
+ */
+typedef struct Async {
+    int active;
+    int err;
+#ifdef MYSQL_WAIT_READ
+    int wait;       // events the library is waiting for, 0 when done
+    int storing;    // executed, now reading the results
+#else
+    pthread_t thread;
+#endif
+} Async;
+
 typedef struct StmtData {
     MYSQL_STMT* ps;
     Param param;
     Result result;
+    Async async;
 } StmtData;
 
+/*
+ * Rows being loaded with LOAD DATA LOCAL INFILE, as tab-separated
+ * text.  The statement runs in a worker thread, where the client
+ * library pulls the data through our local infile callbacks; rows are
+ * written into one buffer while the other one is being sent, so no
+ * temporary file is needed.
+ */
+#define LOAD_FLUSH_SIZE   (256 * 1024)
+
+typedef struct LoadBuf {
+    char* data;
+    int size;
+    int len;
+} LoadBuf;
+
+typedef struct LoadData {
+    MYSQL* db;
+    char* sql;
+    LoadBuf bufs[2];
+    int fill;           // buffer being filled by the caller
+    int sent;           // buffer being sent by the worker, or -1
+    int pos;            // how much of it was already sent
+    int fields;         // fields so far in the current row
+    int in_row;
+    int finished;       // no more data is coming
+    int aborted;
+    int stopped;        // the worker is done
+    int ret;
+    unsigned long long rows;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} LoadData;
+
 static int gdsql_mysql_init(void);
 static int gdsql_mysql_fini(void);
 
@@ -102,6 +173,92 @@ static int gdsql_mysql_stmt_step(gdsql_stmth* stmt);
 static int gdsql_mysql_stmt_is_column_null(gdsql_stmth* stmt,
                                            int pos);
 static int gdsql_mysql_stmt_finalize(gdsql_stmth* stmt);
+static int gdsql_mysql_stmt_reset(gdsql_stmth* stmt);
+static int gdsql_mysql_stmt_clear_bindings(gdsql_stmth* stmt);
+static int gdsql_mysql_stmt_execute_array(gdsql_stmth* stmt,
+                                          int* done);
+
+static int gdsql_mysql_cache_evict(gdsql_dbh* db,
+                                   void* handle);
+
+static int gdsql_mysql_load_begin(gdsql_loadh* load,
+                                  const char* table,
+                                  const char* columns);
+static int gdsql_mysql_load_put_null(gdsql_loadh* load);
+static int gdsql_mysql_load_put_int(gdsql_loadh* load,
+                                    int val);
+static int gdsql_mysql_load_put_double(gdsql_loadh* load,
+                                       double val);
+static int gdsql_mysql_load_put_string(gdsql_loadh* load,
+                                       const char* val,
+                                       int len);
+static int gdsql_mysql_load_put_date(gdsql_loadh* load,
+                                     double val);
+static int gdsql_mysql_load_put_boolean(gdsql_loadh* load,
+                                        int val);
+static int gdsql_mysql_load_end_row(gdsql_loadh* load);
+static int gdsql_mysql_load_flush(gdsql_loadh* load);
+static int gdsql_mysql_load_end(gdsql_loadh* load);
+static int gdsql_mysql_load_abort(gdsql_loadh* load);
+
+static int gdsql_mysql_stmt_set_fetch(gdsql_stmth* stmt,
+                                      int mode,
+                                      int size);
+
+static int gdsql_mysql_db_get_socket(gdsql_dbh* db);
+static int gdsql_mysql_stmt_start(gdsql_stmth* stmt);
+static int gdsql_mysql_stmt_poll(gdsql_stmth* stmt);
+static int gdsql_mysql_stmt_complete(gdsql_stmth* stmt);
+
+static int gdsql_mysql_db_exec(gdsql_dbh* db,
+                               const char* sql);
+static int gdsql_mysql_db_ping(gdsql_dbh* db);
+
+static int gdsql_mysql_stmt_render_params(gdsql_stmth* stmt,
+                                          char* buf,
+                                          int size);
+
+static int param_slot(Param* param,
+                      int pos);
+static int bind_statement(gdsql_stmth* stmt);
+static int set_cursor(gdsql_stmth* stmt);
+static int finish_async(gdsql_stmth* stmt);
+#ifdef MYSQL_WAIT_READ
+static void advance_async(StmtData* sdata,
+                          int ready);
+static int wait_events(MYSQL* db,
+                       int wait,
+                       int block);
+#else
+static int open_notify(DbData* ddata);
+static void* run_async(void* arg);
+#endif
+
+/*
+ * Functions to feed a LOAD DATA LOCAL INFILE.
+ */
+static void* run_load(void* arg);
+static int load_reserve(LoadBuf* buf,
+                        int need);
+static char* load_field(LoadData* ldata,
+                        int len);
+static int load_text(LoadData* ldata,
+                     const char* val,
+                     int len);
+static int load_send(LoadData* ldata);
+static void load_stop(LoadData* ldata,
+                      int abort);
+static void load_free(gdsql_loadh* load);
+static int infile_init(void** ptr,
+                       const char* filename,
+                       void* userdata);
+static int infile_read(void* ptr,
+                       char* buf,
+                       unsigned int len);
+static void infile_end(void* ptr);
+static int infile_error(void* ptr,
+                        char* msg,
+                        unsigned int len);
 
 
 int gdsql_mysql_boot(void)
@@ -129,6 +286,36 @@ int gdsql_mysql_boot(void)
         gdsql_mysql_stmt_step,
         gdsql_mysql_stmt_is_column_null,
         gdsql_mysql_stmt_finalize,
+        gdsql_mysql_stmt_reset,
+        gdsql_mysql_stmt_clear_bindings,
+        gdsql_mysql_stmt_execute_array,
+        gdsql_mysql_cache_evict,
+        gdsql_mysql_load_begin,
+        gdsql_mysql_load_put_null,
+        gdsql_mysql_load_put_int,
+        gdsql_mysql_load_put_double,
+        gdsql_mysql_load_put_string,
+        gdsql_mysql_load_put_date,
+        gdsql_mysql_load_put_boolean,
+        gdsql_mysql_load_end_row,
+        gdsql_mysql_load_flush,
+        gdsql_mysql_load_end,
+        gdsql_mysql_load_abort,
+        gdsql_mysql_stmt_set_fetch,
+        0,
+        0,
+        0,
+        0,
+        0,
+        gdsql_mysql_db_get_socket,
+        gdsql_mysql_stmt_start,
+        gdsql_mysql_stmt_poll,
+        gdsql_mysql_stmt_complete,
+        0,   // db_bulk_begin
+        0,   // db_bulk_end
+        gdsql_mysql_db_exec,
+        gdsql_mysql_db_ping,
+        gdsql_mysql_stmt_render_params,
     };
 
     GDSQL_Log(LOG_INFO,
@@ -188,8 +375,27 @@ static int gdsql_mysql_db_open(gdsql_dbh* db)
 
     DbData* ddata = (DbData*) malloc(sizeof(DbData));
     ddata->db = sql_db;
+    ddata->notify[0] = -1;
+    ddata->notify[1] = -1;
+    ddata->busy = 0;
+    ddata->load = 0;
     db->data = ddata;
 
+    // Bulk loads send their rows as a local file; the handler refuses
+    // any such request made when we are not loading.
+    unsigned int local_infile = 1;
+    mysql_options(ddata->db, MYSQL_OPT_LOCAL_INFILE, &local_infile);
+    mysql_set_local_infile_handler(ddata->db,
+                                   infile_init,
+                                   infile_read,
+                                   infile_end,
+                                   infile_error,
+                                   ddata);
+
+#ifdef MYSQL_WAIT_READ
+    mysql_options(ddata->db, MYSQL_OPT_NONBLOCK, 0);
+#endif
+
     GDSQL_Log(LOG_INFO,
               ("%s: Opening connection to [%s:%hd:%s:%s:%s]",
                DBNAME, db->host, db->port, db->name, db->user, db->password));
@@ -235,6 +441,10 @@ static int gdsql_mysql_db_close(gdsql_dbh* db)
             GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
         } while (0);
 
+        if (ddata->notify[0] >= 0)
+            close(ddata->notify[0]);
+        if (ddata->notify[1] >= 0)
+            close(ddata->notify[1]);
         free(ddata);
         db->data = 0;
     } while (0);
@@ -272,10 +482,19 @@ static int gdsql_mysql_stmt_prepare(gdsql_stmth* stmt)
     if (sdata == 0)
         return 4;
 
+    MYSQL_STMT* sql_ps = (MYSQL_STMT*) gdsql_cache_get(stmt->gdsql_db,
+                                                       stmt->query);
+    if (sql_ps != 0) {
+        GDSQL_Log(LOG_INFO,
+                  ("%s: reusing cached statement [%s]",
+                   DBNAME, stmt->query));
+        sdata->ps = sql_ps;
+        return 0;
+    }
+
     GDSQL_Log(LOG_INFO,
               ("%s: creating statement",
                DBNAME));
-    MYSQL_STMT* sql_ps = 0;
     sql_ps = mysql_stmt_init(ddata->db);
     if (sql_ps == 0)
         return 5;
@@ -287,11 +506,14 @@ static int gdsql_mysql_stmt_prepare(gdsql_stmth* stmt)
     unsigned long len = strlen(stmt->query);
     if (mysql_stmt_prepare(sql_ps,
                            stmt->query,
-                           len) != 0)
+                           len) != 0) {
+        mysql_stmt_close(sql_ps);
         return 6;
+    }
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
     
     sdata->ps = sql_ps;
+    gdsql_cache_put(stmt->gdsql_db, stmt->query, sql_ps);
     return 0;
 }
 
@@ -303,16 +525,16 @@ static int gdsql_mysql_stmt_bindp_null(gdsql_stmth* stmt,
         return 1;
 
     Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
+    int j = param_slot(param, pos);
+    if (j < 0)
         return 3;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding NULL param pos %d",
-               DBNAME, pos));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding NULL param pos %d",
+                DBNAME, pos));
 
-    memset(&param->bind[param->next], 0, sizeof(MYSQL_BIND));
-    param->bind[param->next].buffer_type = MYSQL_TYPE_NULL;
-    ++param->next;
+    memset(&param->bind[j], 0, sizeof(MYSQL_BIND));
+    param->bind[j].buffer_type = MYSQL_TYPE_NULL;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -328,19 +550,19 @@ static int gdsql_mysql_stmt_bindp_int(gdsql_stmth* stmt,
         return 1;
 
     Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
+    int j = param_slot(param, pos);
+    if (j < 0)
         return 3;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding int param pos %d to %d",
-               DBNAME, pos, val));
-    int* ip = (int*) param->buf[param->next];
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding int param pos %d to %d",
+                DBNAME, pos, val));
+    int* ip = (int*) param->buf[j];
     *ip = val;
 
-    memset(&param->bind[param->next], 0, sizeof(MYSQL_BIND));
-    param->bind[param->next].buffer_type = MYSQL_TYPE_LONG;
-    param->bind[param->next].buffer = param->buf[param->next];
-    ++param->next;
+    memset(&param->bind[j], 0, sizeof(MYSQL_BIND));
+    param->bind[j].buffer_type = MYSQL_TYPE_LONG;
+    param->bind[j].buffer = param->buf[j];
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -356,19 +578,19 @@ static int gdsql_mysql_stmt_bindp_double(gdsql_stmth* stmt,
         return 1;
 
     Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
+    int j = param_slot(param, pos);
+    if (j < 0)
         return 3;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding double param pos %d to %lf",
-               DBNAME, pos, val));
-    double* dp = (double*) param->buf[param->next];
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding double param pos %d to %lf",
+                DBNAME, pos, val));
+    double* dp = (double*) param->buf[j];
     *dp = val;
 
-    memset(&param->bind[param->next], 0, sizeof(MYSQL_BIND));
-    param->bind[param->next].buffer_type = MYSQL_TYPE_DOUBLE;
-    param->bind[param->next].buffer = param->buf[param->next];
-    ++param->next;
+    memset(&param->bind[j], 0, sizeof(MYSQL_BIND));
+    param->bind[j].buffer_type = MYSQL_TYPE_DOUBLE;
+    param->bind[j].buffer = param->buf[j];
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -384,26 +606,27 @@ static int gdsql_mysql_stmt_bindp_string(gdsql_stmth* stmt,
     if (sdata == 0)
         return 1;
 
-    Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
-        return 3;
-
+    // Check the value before taking a slot for it.
     if (len < 0)
         len = strlen(val);
     if (len >= STMT_MAX_PARAM_LENGTH)
         return 4;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding string param pos %d to [%d:%s]",
-               DBNAME, pos, len, val));
-
-    memset(&param->bind[param->next], 0, sizeof(MYSQL_BIND));
-    memcpy(param->buf[param->next], val, len);
-    param->len[param->next] = len;
-    param->bind[param->next].buffer_type = MYSQL_TYPE_STRING;
-    param->bind[param->next].buffer = param->buf[param->next];
-    param->bind[param->next].length = &param->len[param->next];
-    ++param->next;
+    Param* param = &sdata->param;
+    int j = param_slot(param, pos);
+    if (j < 0)
+        return 3;
+
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding string param pos %d to [%d:%s]",
+                DBNAME, pos, len, val));
+
+    memset(&param->bind[j], 0, sizeof(MYSQL_BIND));
+    memcpy(param->buf[j], val, len);
+    param->len[j] = len;
+    param->bind[j].buffer_type = MYSQL_TYPE_STRING;
+    param->bind[j].buffer = param->buf[j];
+    param->bind[j].length = &param->len[j];
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -419,18 +642,19 @@ static int gdsql_mysql_stmt_bindp_date(gdsql_stmth* stmt,
         return 1;
 
     Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
+    int j = param_slot(param, pos);
+    if (j < 0)
         return 3;
 
     int Y, M, D;
     int h, m, s;
     gdsql_jul2cal(val, &Y, &M, &D, &h, &m, &s);
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding date param pos %d to %lf = %04d/%02d/%02d %02d:%02d:%02d",
-               DBNAME, pos, val,
-               Y, M, D, h, m, s));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding date param pos %d to %lf = %04d/%02d/%02d %02d:%02d:%02d",
+                DBNAME, pos, val,
+                Y, M, D, h, m, s));
 
-    MYSQL_TIME* ts = (MYSQL_TIME*) param->buf[param->next];
+    MYSQL_TIME* ts = (MYSQL_TIME*) param->buf[j];
     ts->year = Y;
     ts->month = M;
     ts->day = D;
@@ -438,10 +662,9 @@ static int gdsql_mysql_stmt_bindp_date(gdsql_stmth* stmt,
     ts->minute = m;
     ts->second = s;
     
-    memset(&param->bind[param->next], 0, sizeof(MYSQL_BIND));
-    param->bind[param->next].buffer_type = MYSQL_TYPE_TIMESTAMP;
-    param->bind[param->next].buffer = param->buf[param->next];
-    ++param->next;
+    memset(&param->bind[j], 0, sizeof(MYSQL_BIND));
+    param->bind[j].buffer_type = MYSQL_TYPE_TIMESTAMP;
+    param->bind[j].buffer = param->buf[j];
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -471,9 +694,9 @@ static int gdsql_mysql_stmt_bindr_int(gdsql_stmth* stmt,
         return 4;
     result->pos[result->next] = --pos;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding int result pos %d to %p",
-               DBNAME, pos, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding int result pos %d to %p",
+                DBNAME, pos, var));
 
     memset(&result->bind[result->next], 0, sizeof(MYSQL_BIND));
     result->bind[result->next].buffer_type = MYSQL_TYPE_LONG;
@@ -504,9 +727,9 @@ static int gdsql_mysql_stmt_bindr_double(gdsql_stmth* stmt,
         return 4;
     result->pos[result->next] = --pos;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding double result pos %d to %p",
-               DBNAME, pos, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding double result pos %d to %p",
+                DBNAME, pos, var));
 
     memset(&result->bind[result->next], 0, sizeof(MYSQL_BIND));
     result->bind[result->next].buffer_type = MYSQL_TYPE_DOUBLE;
@@ -538,9 +761,9 @@ static int gdsql_mysql_stmt_bindr_string(gdsql_stmth* stmt,
         return 4;
     result->pos[result->next] = --pos;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding string result pos %d to [%d:%p]",
-               DBNAME, pos, len, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding string result pos %d to [%d:%p]",
+                DBNAME, pos, len, var));
 
     memset(&result->bind[result->next], 0, sizeof(MYSQL_BIND));
     result->bind[result->next].buffer_type = MYSQL_TYPE_STRING;
@@ -572,9 +795,9 @@ static int gdsql_mysql_stmt_bindr_date(gdsql_stmth* stmt,
         return 4;
     result->pos[result->next] = --pos;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding date result pos %d to %p",
-               DBNAME, pos, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding date result pos %d to %p",
+                DBNAME, pos, var));
 
     memset(&result->bind[result->next], 0, sizeof(MYSQL_BIND));
     result->bind[result->next].buffer_type = MYSQL_TYPE_TIMESTAMP;
@@ -605,61 +828,44 @@ static int gdsql_mysql_stmt_step(gdsql_stmth* stmt)
 
     Result* result = &sdata->result;
 
-    if (stmt->state < STMT_STATE_PREPARED) {
-        // Must prepare statement
-        if (gdsql_mysql_stmt_prepare(stmt) != 0)
-            return 2;
-        
-        stmt->state = STMT_STATE_PREPARED;
-    }
-    
-    if (stmt->state < STMT_STATE_BOUNDP) {
-        if (sdata->param.next > 0) {
-            // Must call bind for params
-        
-            GDSQL_Log(LOG_INFO,
-                      ("%s: binding params",
-                       DBNAME));
-            if (mysql_stmt_bind_param(sdata->ps,
-                                      sdata->param.bind) != 0)
-                return 3;
-        }
-
-        stmt->state = STMT_STATE_BOUNDP;
-    }
-
-    if (stmt->state < STMT_STATE_BOUNDR) {
-        if (result->next > 0) {
-            // Must call bind for results
-        
-            GDSQL_Log(LOG_INFO,
-                      ("%s: binding results",
-                       DBNAME));
-            if (mysql_stmt_bind_result(sdata->ps,
-                                       result->bind) != 0)
-                return 4;
-        }
-
-        stmt->state = STMT_STATE_BOUNDR;
-    }
+    int ret = bind_statement(stmt);
+    if (ret != 0)
+        return ret;
 
     if (stmt->state < STMT_STATE_EXECUTED) {
         // Must call execute
         
+        if (set_cursor(stmt) != 0)
+            return 5;
+
         GDSQL_Log(LOG_INFO,
                   ("%s: executing [%s]",
                    DBNAME, stmt->query));
         if (mysql_stmt_execute(sdata->ps) != 0)
             return 5;
 
+        if (stmt->fetch_mode == GDSQL_FETCH_BUFFERED &&
+            mysql_stmt_field_count(sdata->ps) > 0) {
+            GDSQL_Log(LOG_INFO,
+                      ("%s: buffering results",
+                       DBNAME));
+            if (mysql_stmt_store_result(sdata->ps) != 0)
+                return 5;
+        }
+
         stmt->state = STMT_STATE_EXECUTED;
     }
     
     if (stmt->state < STMT_STATE_EXHAUSTED) {
         // Not yet done, can call fetch
-        GDSQL_Log(LOG_INFO,
-                  ("%s: stepping statement [%s]",
-                   DBNAME, stmt->query));
+        GDSQL_LogC(LOG_CAT_STEP, LOG_INFO,
+                   ("%s: stepping statement [%s]",
+                    DBNAME, stmt->query));
+
+        // The client library converts the values as it fetches them;
+        // with all rows buffered, that is all a fetch does.
+        int buffered = (stmt->fetch_mode == GDSQL_FETCH_BUFFERED);
+        unsigned long long t0 = buffered ? STMT_STATS_START(stmt) : 0;
         int st = mysql_stmt_fetch(sdata->ps);
         if (st != 0) {
             GDSQL_Log(LOG_INFO,
@@ -667,8 +873,12 @@ static int gdsql_mysql_stmt_step(gdsql_stmth* stmt)
                        DBNAME, st, MYSQL_NO_DATA, MYSQL_DATA_TRUNCATED,
                        mysql_stmt_error(sdata->ps)));
             stmt->state = STMT_STATE_EXHAUSTED;
+            if (st != MYSQL_NO_DATA)
+                metrics_count(GDSQL_DB_MYSQL, METRIC_ERRORS, 1);
             return 6;
         }
+        if (! buffered)
+            t0 = STMT_STATS_START(stmt);
 
         int j = 0;
         for (j = 0; j < result->next; ++j) {
@@ -683,6 +893,15 @@ static int gdsql_mysql_stmt_step(gdsql_stmth* stmt)
             *dp = gdsql_cal2jul(ts->year, ts->month, ts->day,
                                 ts->hour, ts->minute, ts->second);
         }
+
+        if (t0 != 0) {
+            unsigned long long bytes = 0;
+            for (j = 0; j < result->next; ++j) {
+                if (! result->null[j])
+                    bytes += result->len[j];
+            }
+            stmt_stats_row(stmt, t0, bytes);
+        }
     }
     
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
@@ -720,12 +939,24 @@ static int gdsql_mysql_stmt_finalize(gdsql_stmth* stmt)
             break;
         }
 
+        if (sdata->async.active)
+            finish_async(stmt);
+
         do {
             if (sdata->ps == 0) {
                 ret = 2;
                 break;
             }
 
+            if (gdsql_cache_release(stmt->gdsql_db, sdata->ps) == 0) {
+                GDSQL_Log(LOG_DEBUG,
+                          ("%s: returning statement [%s] to cache",
+                           DBNAME, stmt->query));
+                mysql_stmt_free_result(sdata->ps);
+                mysql_stmt_reset(sdata->ps);
+                break;
+            }
+
             GDSQL_Log(LOG_INFO,
                       ("%s: finalizing mysql3 statement [%s]",
                        DBNAME, stmt->query));
@@ -742,3 +973,1096 @@ static int gdsql_mysql_stmt_finalize(gdsql_stmth* stmt)
 
     return ret;
 }
+
+static int gdsql_mysql_stmt_reset(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    if (sdata->async.active)
+        finish_async(stmt);
+
+    if (sdata->ps != 0) {
+        GDSQL_Log(LOG_DEBUG,
+                  ("%s: resetting statement [%s]",
+                   DBNAME, stmt->query));
+        mysql_stmt_free_result(sdata->ps);
+        if (mysql_stmt_reset(sdata->ps) != 0)
+            return 2;
+    }
+
+    return 0;
+}
+
+static int gdsql_mysql_stmt_clear_bindings(gdsql_stmth* stmt)
+{
+    int ret = gdsql_mysql_stmt_reset(stmt);
+    if (ret != 0)
+        return ret;
+
+    StmtData* sdata = (StmtData*) stmt->data;
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: clearing bindings for statement [%s]",
+               DBNAME, stmt->query));
+    sdata->param.next = 0;
+
+    return 0;
+}
+
+static void bind_array_value(Param* param,
+                             int j,
+                             const ArrayParam* ap,
+                             int row)
+{
+    MYSQL_BIND* bind = &param->bind[j];
+
+    memset(bind, 0, sizeof(MYSQL_BIND));
+    param->null[j] = (ap->nulls != 0 && ap->nulls[row]);
+    bind->is_null = &param->null[j];
+    bind->buffer = param->buf[j];
+
+    switch (ap->type) {
+    case STMT_VAL_INT:
+    case STMT_VAL_BOOLEAN:
+        bind->buffer_type = MYSQL_TYPE_LONG;
+        *((int*) param->buf[j]) = ((const int*) ap->vals)[row];
+        break;
+    case STMT_VAL_DOUBLE:
+        bind->buffer_type = MYSQL_TYPE_DOUBLE;
+        *((double*) param->buf[j]) = ((const double*) ap->vals)[row];
+        break;
+    case STMT_VAL_DATE: {
+        int Y, M, D;
+        int h, m, s;
+        gdsql_jul2cal(((const double*) ap->vals)[row],
+                      &Y, &M, &D, &h, &m, &s);
+        MYSQL_TIME* ts = (MYSQL_TIME*) param->buf[j];
+        memset(ts, 0, sizeof(MYSQL_TIME));
+        ts->year = Y;
+        ts->month = M;
+        ts->day = D;
+        ts->hour = h;
+        ts->minute = m;
+        ts->second = s;
+        bind->buffer_type = MYSQL_TYPE_TIMESTAMP;
+        break;
+    }
+    case STMT_VAL_STRING: {
+        // Strings are sent straight from the caller's memory.
+        const char* val = ((const char* const*) ap->vals)[row];
+        param->len[j] = ap->lens ? (unsigned long) ap->lens[row]
+                                 : (val ? strlen(val) : 0);
+        bind->buffer_type = MYSQL_TYPE_STRING;
+        bind->buffer = (char*) val;
+        bind->length = &param->len[j];
+        break;
+    }
+    }
+}
+
+static int gdsql_mysql_stmt_execute_array(gdsql_stmth* stmt,
+                                          int* done)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    if (stmt->state < STMT_STATE_PREPARED) {
+        if (gdsql_mysql_stmt_prepare(stmt) != 0)
+            return 2;
+
+        stmt->state = STMT_STATE_PREPARED;
+    }
+
+    ArrayParams* arrays = stmt->arrays;
+    if (arrays->next > STMT_MAX_PARAMS)
+        return 3;
+
+    // The client library has no array binding, so we execute once per
+    // row; binding is local to the client and does not hit the server.
+    GDSQL_Log(LOG_INFO,
+              ("%s: executing statement [%s] for %d rows",
+               DBNAME, stmt->query, arrays->count));
+    Param* param = &sdata->param;
+    int ret = 0;
+    int row = 0;
+    for (row = 0; row < arrays->count; ++row) {
+        int j = 0;
+        for (j = 0; j < arrays->next; ++j)
+            bind_array_value(param, j, &arrays->params[j], row);
+
+        if (mysql_stmt_bind_param(sdata->ps, param->bind) != 0) {
+            ret = 4;
+            break;
+        }
+
+        if (mysql_stmt_execute(sdata->ps) != 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("%s: row %d failed: %s",
+                       DBNAME, row, mysql_stmt_error(sdata->ps)));
+            ret = 5;
+            break;
+        }
+    }
+    param->next = 0;
+    *done = row;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: executed %d rows, ret %d",
+               DBNAME, *done, ret));
+    return ret;
+}
+
+static int gdsql_mysql_cache_evict(gdsql_dbh* db,
+                                   void* handle)
+{
+    MYSQL_STMT* sql_ps = (MYSQL_STMT*) handle;
+
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: closing cached statement %p",
+               DBNAME, sql_ps));
+    if (mysql_stmt_close(sql_ps) != 0)
+        return 1;
+
+    return 0;
+}
+
+static int gdsql_mysql_load_begin(gdsql_loadh* load,
+                                  const char* table,
+                                  const char* columns)
+{
+    DbData* ddata = (DbData*) load->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 3;
+
+    if (ddata->load != 0 || ddata->busy != 0)
+        return 4;
+
+    LoadData* ldata = (LoadData*) malloc(sizeof(LoadData));
+    if (ldata == 0)
+        return 5;
+    memset(ldata, 0, sizeof(LoadData));
+
+    int size = strlen(table) + (columns ? strlen(columns) : 0) + 256;
+    ldata->sql = (char*) malloc(size);
+    ldata->bufs[0].size = LOAD_FLUSH_SIZE + LOAD_FLUSH_SIZE / 4;
+    ldata->bufs[0].data = (char*) malloc(ldata->bufs[0].size);
+    ldata->bufs[1].size = LOAD_FLUSH_SIZE + LOAD_FLUSH_SIZE / 4;
+    ldata->bufs[1].data = (char*) malloc(ldata->bufs[1].size);
+    if (ldata->sql == 0 ||
+        ldata->bufs[0].data == 0 ||
+        ldata->bufs[1].data == 0) {
+        free(ldata->sql);
+        free(ldata->bufs[0].data);
+        free(ldata->bufs[1].data);
+        free(ldata);
+        return 5;
+    }
+
+    snprintf(ldata->sql, size,
+             "LOAD DATA LOCAL INFILE 'gdsql' INTO TABLE %s"
+             " CHARACTER SET utf8mb4"
+             " FIELDS TERMINATED BY '\\t' ESCAPED BY '\\\\'"
+             " LINES TERMINATED BY '\\n'"
+             "%s%s%s",
+             table,
+             columns && columns[0] ? " (" : "",
+             columns && columns[0] ? columns : "",
+             columns && columns[0] ? ")" : "");
+
+    ldata->db = ddata->db;
+    ldata->sent = -1;
+    pthread_mutex_init(&ldata->lock, 0);
+    pthread_cond_init(&ldata->cond, 0);
+    load->data = ldata;
+    ddata->load = ldata;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: starting load [%s]",
+               DBNAME, ldata->sql));
+    if (pthread_create(&ldata->thread, 0, run_load, ldata) != 0) {
+        load_free(load);
+        return 6;
+    }
+
+    return 0;
+}
+
+static int gdsql_mysql_load_put_null(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    char* data = load_field(ldata, 2);
+    if (data == 0)
+        return 2;
+
+    memcpy(data, "\\N", 2);
+    return 0;
+}
+
+static int gdsql_mysql_load_put_int(gdsql_loadh* load,
+                                    int val)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    char tmp[32];
+    int len = sprintf(tmp, "%d", val);
+    return load_text(ldata, tmp, len);
+}
+
+static int gdsql_mysql_load_put_double(gdsql_loadh* load,
+                                       double val)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    char tmp[64];
+    int len = sprintf(tmp, "%.17g", val);
+    return load_text(ldata, tmp, len);
+}
+
+static int gdsql_mysql_load_put_string(gdsql_loadh* load,
+                                       const char* val,
+                                       int len)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    if (val == 0)
+        return gdsql_mysql_load_put_null(load);
+
+    if (len < 0)
+        len = strlen(val);
+
+    // Worst case, every character needs escaping.
+    char* data = load_field(ldata, 2 * len);
+    if (data == 0)
+        return 2;
+
+    char* out = data;
+    int j = 0;
+    for (j = 0; j < len; ++j) {
+        char c = val[j];
+        switch (c) {
+        case '\\': *out++ = '\\'; *out++ = '\\'; break;
+        case '\t':  *out++ = '\\'; *out++ = 't';  break;
+        case '\n':  *out++ = '\\'; *out++ = 'n';  break;
+        case '\r':  *out++ = '\\'; *out++ = 'r';  break;
+        case '\0':  *out++ = '\\'; *out++ = '0';  break;
+        default:    *out++ = c;                   break;
+        }
+    }
+
+    // Give back what we did not need.
+    LoadBuf* buf = &ldata->bufs[ldata->fill];
+    buf->len -= 2 * len - (out - data);
+    return 0;
+}
+
+static int gdsql_mysql_load_put_date(gdsql_loadh* load,
+                                     double val)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    int Y, M, D, h, m, s;
+    gdsql_jul2cal(val, &Y, &M, &D, &h, &m, &s);
+
+    char tmp[64];
+    int len = sprintf(tmp, "%04d-%02d-%02d %02d:%02d:%02d",
+                      Y, M, D, h, m, s);
+    return load_text(ldata, tmp, len);
+}
+
+static int gdsql_mysql_load_put_boolean(gdsql_loadh* load,
+                                        int val)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    return load_text(ldata, val ? "1" : "0", 1);
+}
+
+static int gdsql_mysql_load_end_row(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    if (! ldata->in_row)
+        return 2;
+
+    LoadBuf* buf = &ldata->bufs[ldata->fill];
+    if (load_reserve(buf, 1) != 0)
+        return 3;
+
+    buf->data[buf->len++] = '\n';
+    ldata->in_row = 0;
+
+    if (buf->len >= LOAD_FLUSH_SIZE)
+        return gdsql_mysql_load_flush(load);
+
+    return 0;
+}
+
+static int gdsql_mysql_load_flush(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    if (load_send(ldata) != 0)
+        return 4;
+
+    return 0;
+}
+
+static int gdsql_mysql_load_end(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    int ret = 0;
+    do {
+        if (ldata->in_row) {
+            GDSQL_Log(LOG_WARNING,
+                      ("%s: load ended in the middle of a row",
+                       DBNAME));
+            load_stop(ldata, 1);
+            ret = 4;
+            break;
+        }
+
+        if (load_send(ldata) != 0) {
+            load_stop(ldata, 1);
+            ret = 6;
+            break;
+        }
+
+        load_stop(ldata, 0);
+        if (ldata->ret != 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("%s: load failed: %s",
+                       DBNAME, mysql_error(ldata->db)));
+            ret = 7;
+            break;
+        }
+
+        GDSQL_Log(LOG_INFO,
+                  ("%s: load finished, %lu rows sent, %llu loaded",
+                   DBNAME, load->rows, ldata->rows));
+    } while (0);
+
+    load_free(load);
+    return ret;
+}
+
+static int gdsql_mysql_load_abort(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: aborting load",
+               DBNAME));
+    load_stop(ldata, 1);
+    load_free(load);
+    return 0;
+}
+
+static int gdsql_mysql_stmt_set_fetch(gdsql_stmth* stmt,
+                                      int mode,
+                                      int size)
+{
+    if (mode != GDSQL_FETCH_DEFAULT &&
+        mode != GDSQL_FETCH_BUFFERED &&
+        mode != GDSQL_FETCH_CURSOR)
+        return 1;
+
+    return 0;
+}
+
+static int gdsql_mysql_db_get_socket(gdsql_dbh* db)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return -1;
+
+#ifdef MYSQL_WAIT_READ
+    return mysql_get_socket(ddata->db);
+#else
+    if (open_notify(ddata) != 0)
+        return -1;
+
+    return ddata->notify[0];
+#endif
+}
+
+static int gdsql_mysql_stmt_start(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 2;
+
+    // Results are always buffered when running without blocking.
+    if ((stmt->fetch_mode != GDSQL_FETCH_DEFAULT &&
+         stmt->fetch_mode != GDSQL_FETCH_BUFFERED) ||
+        ddata->busy != 0)
+        return 3;
+
+    int ret = bind_statement(stmt);
+    if (ret != 0)
+        return ret;
+
+    if (set_cursor(stmt) != 0)
+        return 5;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: starting [%s]",
+               DBNAME, stmt->query));
+    Async* async = &sdata->async;
+    async->err = 0;
+#ifdef MYSQL_WAIT_READ
+    async->storing = 0;
+    async->wait = mysql_stmt_execute_start(&async->err, sdata->ps);
+    advance_async(sdata, 0);
+#else
+    if (open_notify(ddata) != 0)
+        return 6;
+    if (pthread_create(&async->thread, 0, run_async, stmt) != 0)
+        return 6;
+#endif
+
+    async->active = 1;
+    ddata->busy = stmt;
+    return 0;
+}
+
+static int gdsql_mysql_stmt_poll(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0 || ! sdata->async.active)
+        return GDSQL_POLL_ERROR;
+
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return GDSQL_POLL_ERROR;
+
+    Async* async = &sdata->async;
+#ifdef MYSQL_WAIT_READ
+    if (async->wait != 0)
+        advance_async(sdata, wait_events(ddata->db, async->wait, 0));
+    if (async->wait != 0)
+        return GDSQL_POLL_BUSY;
+#else
+    // The worker writes to the pipe when done; the byte is left there
+    // for gdsql_stmt_complete(), so that the pipe stays readable.
+    struct pollfd pfd;
+    pfd.fd = ddata->notify[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) <= 0)
+        return GDSQL_POLL_BUSY;
+#endif
+
+    return async->err == 0 ? GDSQL_POLL_DONE : GDSQL_POLL_ERROR;
+}
+
+static int gdsql_mysql_stmt_complete(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0 || ! sdata->async.active)
+        return 1;
+
+    int ret = finish_async(stmt);
+    if (ret != 0)
+        return ret;
+
+    stmt->state = STMT_STATE_EXECUTED;
+    return 0;
+}
+
+static int gdsql_mysql_db_exec(gdsql_dbh* db,
+                               const char* sql)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 3;
+
+    if (ddata->busy != 0 || ddata->load != 0)
+        return 4;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: running [%s]",
+               DBNAME, sql));
+
+    // Several statements in one query are only allowed for the length
+    // of this call, and only when there may be more than one.
+    int multi = strchr(sql, ';') != 0;
+    if (multi &&
+        mysql_set_server_option(ddata->db,
+                                MYSQL_OPTION_MULTI_STATEMENTS_ON) != 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not allow multiple statements: %s",
+                   DBNAME, mysql_error(ddata->db)));
+        return 5;
+    }
+
+    int more = 0;
+    if (mysql_real_query(ddata->db, sql, strlen(sql)) != 0)
+        more = 1;
+    else {
+        // There is one result per statement; any rows are discarded,
+        // but the results must all be read before the connection can
+        // be used again.
+        do {
+            MYSQL_RES* res = mysql_store_result(ddata->db);
+            if (res != 0)
+                mysql_free_result(res);
+            else if (mysql_field_count(ddata->db) != 0) {
+                // It had rows, but we could not read them.
+                more = 1;
+                break;
+            }
+
+            more = mysql_next_result(ddata->db);
+        } while (more == 0);
+    }
+
+    if (more > 0)
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: [%s] failed: %s",
+                   DBNAME, sql, mysql_error(ddata->db)));
+
+    if (multi &&
+        mysql_set_server_option(ddata->db,
+                                MYSQL_OPTION_MULTI_STATEMENTS_OFF) != 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not disallow multiple statements: %s",
+                   DBNAME, mysql_error(ddata->db)));
+        return 6;
+    }
+
+    return more > 0 ? 5 : 0;
+}
+
+static int gdsql_mysql_db_ping(gdsql_dbh* db)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 3;
+
+    if (ddata->busy != 0 || ddata->load != 0)
+        return 4;
+
+    if (mysql_ping(ddata->db) != 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: ping failed: %s",
+                   DBNAME, mysql_error(ddata->db)));
+        return 5;
+    }
+
+    return 0;
+}
+
+static int gdsql_mysql_stmt_render_params(gdsql_stmth* stmt,
+                                          char* buf,
+                                          int size)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    const Param* param = &sdata->param;
+    ParamText text = { buf, size, 0 };
+    int j = 0;
+    for (j = 0; j < param->next; ++j) {
+        const MYSQL_BIND* bind = &param->bind[j];
+        if (bind->buffer_type == MYSQL_TYPE_NULL ||
+            (bind->is_null != 0 && *bind->is_null)) {
+            param_text_null(&text);
+            continue;
+        }
+
+        switch (bind->buffer_type) {
+        case MYSQL_TYPE_LONG:
+            param_text_int(&text, *((const int*) bind->buffer));
+            break;
+        case MYSQL_TYPE_DOUBLE:
+            param_text_double(&text, *((const double*) bind->buffer));
+            break;
+        case MYSQL_TYPE_STRING:
+            param_text_string(&text, (const char*) bind->buffer,
+                              (int) *bind->length);
+            break;
+        case MYSQL_TYPE_TIMESTAMP: {
+            const MYSQL_TIME* ts = (const MYSQL_TIME*) bind->buffer;
+            param_text_date(&text,
+                            gdsql_cal2jul(ts->year, ts->month, ts->day,
+                                          ts->hour, ts->minute, ts->second));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * The slot for the parameter at pos, replacing whatever was bound
+ * there before; slots skipped over are sent as NULL.  Return -1 if
+ * pos is out of range.
+ */
+static int param_slot(Param* param,
+                      int pos)
+{
+    if (pos < 1 || pos > STMT_MAX_PARAMS)
+        return -1;
+
+    while (param->next < pos) {
+        memset(&param->bind[param->next], 0, sizeof(MYSQL_BIND));
+        param->bind[param->next].buffer_type = MYSQL_TYPE_NULL;
+        ++param->next;
+    }
+
+    return pos - 1;
+}
+
+static int bind_statement(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    Result* result = &sdata->result;
+
+    if (stmt->state < STMT_STATE_PREPARED) {
+        // Must prepare statement
+        if (gdsql_mysql_stmt_prepare(stmt) != 0)
+            return 2;
+        
+        stmt->state = STMT_STATE_PREPARED;
+    }
+    
+    if (stmt->state < STMT_STATE_BOUNDP) {
+        if (sdata->param.next > 0) {
+            // Must call bind for params
+        
+            GDSQL_Log(LOG_INFO,
+                      ("%s: binding params",
+                       DBNAME));
+            if (mysql_stmt_bind_param(sdata->ps,
+                                      sdata->param.bind) != 0)
+                return 3;
+        }
+
+        stmt->state = STMT_STATE_BOUNDP;
+    }
+
+    if (stmt->state < STMT_STATE_BOUNDR) {
+        if (result->next > 0) {
+            // Must call bind for results
+        
+            GDSQL_Log(LOG_INFO,
+                      ("%s: binding results",
+                       DBNAME));
+            if (mysql_stmt_bind_result(sdata->ps,
+                                       result->bind) != 0)
+                return 4;
+        }
+
+        stmt->state = STMT_STATE_BOUNDR;
+    }
+
+    return 0;
+}
+
+/*
+ * Ask for a server-side cursor, or for none.  This is always set,
+ * since a cached statement may have been used with another mode.
+ */
+static int set_cursor(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+
+    unsigned long type = CURSOR_TYPE_NO_CURSOR;
+    if (stmt->fetch_mode == GDSQL_FETCH_CURSOR)
+        type = CURSOR_TYPE_READ_ONLY;
+    if (mysql_stmt_attr_set(sdata->ps,
+                            STMT_ATTR_CURSOR_TYPE,
+                            &type) != 0)
+        return 1;
+
+    if (type == CURSOR_TYPE_NO_CURSOR)
+        return 0;
+
+    unsigned long rows = stmt->fetch_size > 0
+                       ? stmt->fetch_size : STMT_CURSOR_PREFETCH;
+    GDSQL_Log(LOG_INFO,
+              ("%s: using a cursor, prefetching %lu rows",
+               DBNAME, rows));
+    if (mysql_stmt_attr_set(sdata->ps,
+                            STMT_ATTR_PREFETCH_ROWS,
+                            &rows) != 0)
+        return 2;
+
+    return 0;
+}
+
+static int finish_async(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    Async* async = &sdata->async;
+
+#ifdef MYSQL_WAIT_READ
+    while (async->wait != 0)
+        advance_async(sdata, wait_events(ddata->db, async->wait, 1));
+#else
+    pthread_join(async->thread, 0);
+
+    char c = 0;
+    while (read(ddata->notify[0], &c, 1) < 0 && errno == EINTR)
+        ;
+#endif
+
+    async->active = 0;
+    ddata->busy = 0;
+    if (async->err != 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not run [%s]: %s",
+                   DBNAME, stmt->query, mysql_stmt_error(sdata->ps)));
+        return 5;
+    }
+
+    return 0;
+}
+
+#ifdef MYSQL_WAIT_READ
+
+/*
+ * Let the client library go on with whatever it was waiting for, and
+ * read the results into memory once the statement is executed.
+ */
+static void advance_async(StmtData* sdata,
+                          int ready)
+{
+    Async* async = &sdata->async;
+    if (async->wait != 0) {
+        if (ready == 0)
+            return;
+
+        if (async->storing)
+            async->wait = mysql_stmt_store_result_cont(&async->err,
+                                                       sdata->ps,
+                                                       ready);
+        else
+            async->wait = mysql_stmt_execute_cont(&async->err,
+                                                  sdata->ps,
+                                                  ready);
+    }
+
+    if (async->wait == 0 &&
+        async->err == 0 &&
+        ! async->storing &&
+        mysql_stmt_field_count(sdata->ps) > 0) {
+        async->storing = 1;
+        async->wait = mysql_stmt_store_result_start(&async->err,
+                                                    sdata->ps);
+    }
+}
+
+/*
+ * Return which of the events the client library waits for have
+ * happened; if block is set, wait until one of them does.
+ */
+static int wait_events(MYSQL* db,
+                       int wait,
+                       int block)
+{
+    struct pollfd pfd;
+    pfd.fd = mysql_get_socket(db);
+    pfd.events = 0;
+    pfd.revents = 0;
+    if (wait & MYSQL_WAIT_READ)
+        pfd.events |= POLLIN;
+    if (wait & MYSQL_WAIT_WRITE)
+        pfd.events |= POLLOUT;
+    if (wait & MYSQL_WAIT_EXCEPT)
+        pfd.events |= POLLPRI;
+
+    int timeout = 0;
+    if (block)
+        timeout = (wait & MYSQL_WAIT_TIMEOUT)
+                ? (int) mysql_get_timeout_value_ms(db)
+                : -1;
+
+    int n = poll(&pfd, 1, timeout);
+    if (n < 0)
+        return 0;
+    if (n == 0)
+        return (block && (wait & MYSQL_WAIT_TIMEOUT)) ? MYSQL_WAIT_TIMEOUT : 0;
+
+    int ready = 0;
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+        ready |= MYSQL_WAIT_READ;
+    if (pfd.revents & POLLOUT)
+        ready |= MYSQL_WAIT_WRITE;
+    if (pfd.revents & POLLPRI)
+        ready |= MYSQL_WAIT_EXCEPT;
+    return ready;
+}
+
+#else
+
+/*
+ * The notify pipe is only made when a statement is first run without
+ * blocking, so that other connections do not pay two descriptors.
+ */
+static int open_notify(DbData* ddata)
+{
+    if (ddata->notify[0] >= 0)
+        return 0;
+
+    if (pipe(ddata->notify) != 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not create notify pipe: %s",
+                   DBNAME, strerror(errno)));
+        ddata->notify[0] = -1;
+        ddata->notify[1] = -1;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void* run_async(void* arg)
+{
+    gdsql_stmth* stmt = (gdsql_stmth*) arg;
+    StmtData* sdata = (StmtData*) stmt->data;
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    Async* async = &sdata->async;
+
+    async->err = mysql_stmt_execute(sdata->ps);
+    if (async->err == 0 &&
+        mysql_stmt_field_count(sdata->ps) > 0)
+        async->err = mysql_stmt_store_result(sdata->ps);
+
+    char c = 0;
+    while (write(ddata->notify[1], &c, 1) < 0 && errno == EINTR)
+        ;
+
+    return 0;
+}
+
+#endif
+
+static void* run_load(void* arg)
+{
+    LoadData* ldata = (LoadData*) arg;
+
+    int ret = mysql_real_query(ldata->db,
+                               ldata->sql,
+                               strlen(ldata->sql));
+    unsigned long long rows = ret == 0 ? mysql_affected_rows(ldata->db) : 0;
+
+    pthread_mutex_lock(&ldata->lock);
+    ldata->ret = ret;
+    ldata->rows = rows;
+    ldata->stopped = 1;
+    pthread_cond_broadcast(&ldata->cond);
+    pthread_mutex_unlock(&ldata->lock);
+
+    return 0;
+}
+
+static int load_reserve(LoadBuf* buf,
+                        int need)
+{
+    if (buf->len + need <= buf->size)
+        return 0;
+
+    int size = buf->size * 2;
+    while (buf->len + need > size)
+        size *= 2;
+    char* data = (char*) realloc(buf->data, size);
+    if (data == 0)
+        return 1;
+
+    buf->data = data;
+    buf->size = size;
+    return 0;
+}
+
+/*
+ * Make room for a field of at most len bytes (plus its separator) in
+ * the current row, starting the row if needed; return where the field
+ * data goes.
+ */
+static char* load_field(LoadData* ldata,
+                        int len)
+{
+    LoadBuf* buf = &ldata->bufs[ldata->fill];
+    if (load_reserve(buf, 1 + len) != 0)
+        return 0;
+
+    if (! ldata->in_row) {
+        ldata->fields = 0;
+        ldata->in_row = 1;
+    }
+
+    if (ldata->fields > 0)
+        buf->data[buf->len++] = '\t';
+    ++ldata->fields;
+
+    char* data = buf->data + buf->len;
+    buf->len += len;
+    return data;
+}
+
+static int load_text(LoadData* ldata,
+                     const char* val,
+                     int len)
+{
+    char* data = load_field(ldata, len);
+    if (data == 0)
+        return 2;
+
+    memcpy(data, val, len);
+    return 0;
+}
+
+/*
+ * Hand the buffer we were filling to the worker, waiting until it is
+ * done with the previous one, and go on with the other buffer.
+ */
+static int load_send(LoadData* ldata)
+{
+    if (ldata->bufs[ldata->fill].len <= 0)
+        return 0;
+
+    int ret = 0;
+    pthread_mutex_lock(&ldata->lock);
+    while (ldata->sent >= 0 && ! ldata->stopped)
+        pthread_cond_wait(&ldata->cond, &ldata->lock);
+
+    if (ldata->stopped)
+        ret = 1;
+    else {
+        ldata->sent = ldata->fill;
+        ldata->pos = 0;
+        ldata->fill = 1 - ldata->fill;
+        ldata->bufs[ldata->fill].len = 0;
+        pthread_cond_broadcast(&ldata->cond);
+    }
+    pthread_mutex_unlock(&ldata->lock);
+
+    return ret;
+}
+
+/*
+ * Tell the worker there is no more data (or that it must give up) and
+ * wait for the LOAD DATA to finish.
+ */
+static void load_stop(LoadData* ldata,
+                      int abort)
+{
+    pthread_mutex_lock(&ldata->lock);
+    if (abort)
+        ldata->aborted = 1;
+    else
+        ldata->finished = 1;
+    pthread_cond_broadcast(&ldata->cond);
+    pthread_mutex_unlock(&ldata->lock);
+
+    pthread_join(ldata->thread, 0);
+}
+
+static void load_free(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    DbData* ddata = (DbData*) load->gdsql_db->data;
+    if (ddata != 0 && ddata->load == ldata)
+        ddata->load = 0;
+
+    pthread_cond_destroy(&ldata->cond);
+    pthread_mutex_destroy(&ldata->lock);
+    free(ldata->bufs[0].data);
+    free(ldata->bufs[1].data);
+    free(ldata->sql);
+    free(ldata);
+    load->data = 0;
+}
+
+/*
+ * Local infile callbacks, called by the client library from the
+ * worker thread.  A request for a local file when we are not loading
+ * (for instance, coming from a query written by someone else) is
+ * refused.
+ */
+static int infile_init(void** ptr,
+                       const char* filename,
+                       void* userdata)
+{
+    DbData* ddata = (DbData*) userdata;
+    *ptr = ddata ? ddata->load : 0;
+    return *ptr == 0 ? 1 : 0;
+}
+
+static int infile_read(void* ptr,
+                       char* buf,
+                       unsigned int len)
+{
+    LoadData* ldata = (LoadData*) ptr;
+    int n = 0;
+
+    pthread_mutex_lock(&ldata->lock);
+    while (ldata->sent < 0 && ! ldata->finished && ! ldata->aborted)
+        pthread_cond_wait(&ldata->cond, &ldata->lock);
+
+    if (ldata->aborted)
+        n = -1;
+    else if (ldata->sent >= 0) {
+        LoadBuf* out = &ldata->bufs[ldata->sent];
+        n = out->len - ldata->pos;
+        if (n > (int) len)
+            n = len;
+        memcpy(buf, out->data + ldata->pos, n);
+        ldata->pos += n;
+        if (ldata->pos >= out->len) {
+            ldata->sent = -1;
+            pthread_cond_broadcast(&ldata->cond);
+        }
+    }
+    pthread_mutex_unlock(&ldata->lock);
+
+    return n;
+}
+
+static void infile_end(void* ptr)
+{
+}
+
+static int infile_error(void* ptr,
+                        char* msg,
+                        unsigned int len)
+{
+    snprintf(msg, len, "%s",
+             ptr == 0 ? "LOAD DATA LOCAL is only allowed for gdsql loads"
+                      : "gdsql load aborted");
+    return 2000;  // CR_UNKNOWN_ERROR
+}
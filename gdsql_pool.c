@@ -0,0 +1,458 @@
+#include <errno.h>
+#include <time.h>
+#include <gdsql_log.h>
+#include <gdsql_hidden.h>
+#include <gdsql_util.h>
+#include <gdsql.h>
+#include <gdsql_pool.h>
+
+static gdsql_dbh* open_db(gdsql_poolh* ph);
+static void close_db(gdsql_dbh* dh);
+static int find_idle(gdsql_poolh* ph);
+static int find_empty(gdsql_poolh* ph);
+static int find_db(gdsql_poolh* ph,
+                   gdsql_dbh* dh);
+static gdsql_dbh* take_reapable(gdsql_poolh* ph);
+static void get_deadline(struct timespec* until,
+                         int msecs);
+
+gdsql_db gdsql_pool_checkout(gdsql_pool gdsql_pool,
+                             int msecs)
+{
+    gdsql_dbh* dh = 0;
+
+    do {
+        gdsql_poolh* ph = gdsql_check_pool(gdsql_pool);
+        if (ph == 0)
+            break;
+
+        struct timespec until;
+        if (msecs > 0)
+            get_deadline(&until, msecs);
+
+        pthread_mutex_lock(&ph->lock);
+        unsigned long long waited = 0;
+        int slot = -1;
+        int fresh = 0;
+        while (1) {
+            slot = find_idle(ph);
+            if (slot >= 0)
+                break;
+
+            // Nothing idle; open a new connection if we can.
+            if (ph->size < ph->max_size) {
+                slot = find_empty(ph);
+                fresh = 1;
+                break;
+            }
+
+            if (msecs == 0)
+                break;
+
+            if (waited == 0) {
+                waited = gdsql_get_nsecs();
+                ++ph->waits;
+            }
+
+            if (msecs < 0)
+                pthread_cond_wait(&ph->free, &ph->lock);
+            else if (pthread_cond_timedwait(&ph->free,
+                                            &ph->lock,
+                                            &until) == ETIMEDOUT)
+                break;
+        }
+
+        if (waited != 0)
+            ph->wait_nsecs += gdsql_get_nsecs() - waited;
+
+        if (slot < 0) {
+            ++ph->timeouts;
+            pthread_mutex_unlock(&ph->lock);
+            GDSQL_Log(LOG_WARNING,
+                      ("No connection available in pool after %d ms",
+                       msecs));
+            break;
+        }
+
+        PoolSlot* ps = &ph->slots[slot];
+        ps->busy = 1;
+        if (fresh)
+            ++ph->size;
+        ++ph->in_use;
+        ++ph->checkouts;
+        int validate = ph->validate_msecs;
+        unsigned long long idle_since = ps->idle_since;
+        dh = ps->db;
+        pthread_mutex_unlock(&ph->lock);
+
+        // Connecting and validating are done without the lock, since
+        // they may take a while.
+        if (dh != 0 &&
+            validate >= 0 &&
+            gdsql_get_nsecs() - idle_since >=
+            (unsigned long long) validate * 1000000ULL &&
+            gdsql_db_ping(dh) != 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Pooled connection %p is dead, reopening",
+                       dh));
+            close_db(dh);
+            dh = 0;
+
+            pthread_mutex_lock(&ph->lock);
+            ++ph->failures;
+            ps->db = 0;
+            pthread_mutex_unlock(&ph->lock);
+        }
+
+        if (dh == 0)
+            dh = open_db(ph);
+
+        pthread_mutex_lock(&ph->lock);
+        if (dh == 0) {
+            // Give the slot back, so that someone else can try.
+            ps->busy = 0;
+            --ph->size;
+            --ph->in_use;
+            pthread_cond_signal(&ph->free);
+        } else {
+            ps->db = dh;
+        }
+        pthread_mutex_unlock(&ph->lock);
+    } while (0);
+
+    return dh;
+}
+
+int gdsql_pool_checkin(gdsql_pool gdsql_pool,
+                       gdsql_db gdsql_db)
+{
+    int ret = 0;
+
+    do {
+        gdsql_poolh* ph = gdsql_check_pool(gdsql_pool);
+        if (ph == 0) {
+            ret = 1;
+            break;
+        }
+
+        pthread_mutex_lock(&ph->lock);
+        int slot = find_db(ph, (gdsql_dbh*) gdsql_db);
+        if (slot < 0) {
+            pthread_mutex_unlock(&ph->lock);
+            GDSQL_Log(LOG_WARNING,
+                      ("Connection %p does not belong to the pool",
+                       gdsql_db));
+            ret = 2;
+            break;
+        }
+
+        unsigned long long now = gdsql_get_nsecs();
+        ph->slots[slot].busy = 0;
+        ph->slots[slot].idle_since = now;
+        --ph->in_use;
+        pthread_cond_signal(&ph->free);
+
+        // Only look for idle connections to close once one of them
+        // may have been idle for long enough.
+        int reap = (ph->idle_msecs > 0 &&
+                    ph->size > ph->min_size &&
+                    now >= ph->reap_at);
+        pthread_mutex_unlock(&ph->lock);
+
+        if (reap)
+            gdsql_pool_reap(ph);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_pool_set_validate_msecs(gdsql_pool gdsql_pool,
+                                  int msecs)
+{
+    int ret = 0;
+
+    do {
+        gdsql_poolh* ph = gdsql_check_pool(gdsql_pool);
+        if (ph == 0) {
+            ret = 1;
+            break;
+        }
+
+        pthread_mutex_lock(&ph->lock);
+        ph->validate_msecs = msecs < 0 ? -1 : msecs;
+        pthread_mutex_unlock(&ph->lock);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_pool_set_idle_msecs(gdsql_pool gdsql_pool,
+                              int msecs)
+{
+    int ret = 0;
+
+    do {
+        gdsql_poolh* ph = gdsql_check_pool(gdsql_pool);
+        if (ph == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (msecs < 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid pool idle time %d",
+                       msecs));
+            ret = 2;
+            break;
+        }
+
+        pthread_mutex_lock(&ph->lock);
+        ph->idle_msecs = msecs;
+        ph->reap_at = 0;
+        pthread_mutex_unlock(&ph->lock);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_pool_fill(gdsql_pool gdsql_pool)
+{
+    int ret = 0;
+
+    do {
+        gdsql_poolh* ph = gdsql_check_pool(gdsql_pool);
+        if (ph == 0) {
+            ret = 1;
+            break;
+        }
+
+        while (1) {
+            pthread_mutex_lock(&ph->lock);
+            if (ph->size >= ph->min_size) {
+                pthread_mutex_unlock(&ph->lock);
+                break;
+            }
+
+            int slot = find_empty(ph);
+            ph->slots[slot].busy = 1;
+            ++ph->size;
+            pthread_mutex_unlock(&ph->lock);
+
+            gdsql_dbh* dh = open_db(ph);
+
+            pthread_mutex_lock(&ph->lock);
+            ph->slots[slot].busy = 0;
+            if (dh == 0)
+                --ph->size;
+            else {
+                ph->slots[slot].db = dh;
+                ph->slots[slot].idle_since = gdsql_get_nsecs();
+            }
+            pthread_cond_signal(&ph->free);
+            pthread_mutex_unlock(&ph->lock);
+
+            if (dh == 0) {
+                ret = 2;
+                break;
+            }
+        }
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_pool_reap(gdsql_pool gdsql_pool)
+{
+    int ret = 0;
+
+    do {
+        gdsql_poolh* ph = gdsql_check_pool(gdsql_pool);
+        if (ph == 0) {
+            ret = 1;
+            break;
+        }
+
+        // One at a time, closing each one without the lock.
+        while (1) {
+            pthread_mutex_lock(&ph->lock);
+            gdsql_dbh* dh = take_reapable(ph);
+            pthread_mutex_unlock(&ph->lock);
+            if (dh == 0)
+                break;
+
+            close_db(dh);
+        }
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_pool_get_stats(gdsql_pool gdsql_pool,
+                         gdsql_pool_stats* stats)
+{
+    int ret = 0;
+
+    do {
+        gdsql_poolh* ph = gdsql_check_pool(gdsql_pool);
+        if (ph == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (stats == 0) {
+            ret = 2;
+            break;
+        }
+
+        pthread_mutex_lock(&ph->lock);
+        stats->size = ph->size;
+        stats->in_use = ph->in_use;
+        stats->checkouts = ph->checkouts;
+        stats->waits = ph->waits;
+        stats->wait_nsecs = ph->wait_nsecs;
+        stats->timeouts = ph->timeouts;
+        stats->creations = ph->creations;
+        stats->failures = ph->failures;
+        stats->reaped = ph->reaped;
+        pthread_mutex_unlock(&ph->lock);
+    } while (0);
+
+    return ret;
+}
+
+
+static gdsql_dbh* open_db(gdsql_poolh* ph)
+{
+    gdsql_dbh* tmpl = ph->tmpl;
+
+    gdsql_db db = gdsql_alloc_db(tmpl->gdsql, tmpl->type);
+    if (db == 0)
+        return 0;
+
+    gdsql_db_set_host(db, tmpl->host);
+    gdsql_db_set_port(db, tmpl->port);
+    gdsql_db_set_name(db, tmpl->name);
+    gdsql_db_set_user(db, tmpl->user);
+    gdsql_db_set_password(db, tmpl->password);
+    gdsql_db_set_cache_size(db, tmpl->cache.size);
+    gdsql_db_set_stats(db, tmpl->stats);
+    if (gdsql_db_open(db) != 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("Could not open pooled connection to [%s]",
+                   tmpl->name));
+        gdsql_free_db(db);
+        return 0;
+    }
+
+    pthread_mutex_lock(&ph->lock);
+    ++ph->creations;
+    pthread_mutex_unlock(&ph->lock);
+
+    GDSQL_Log(LOG_INFO,
+              ("Opened pooled connection %p to [%s]",
+               db, tmpl->name));
+    return (gdsql_dbh*) db;
+}
+
+static void close_db(gdsql_dbh* dh)
+{
+    GDSQL_Log(LOG_INFO,
+              ("Closing pooled connection %p",
+               dh));
+    gdsql_db_close(dh);
+    gdsql_free_db(dh);
+}
+
+/*
+ * The slot of the most recently used idle connection: keeping the
+ * same few connections busy lets the rest go idle and be reaped.
+ */
+static int find_idle(gdsql_poolh* ph)
+{
+    int slot = -1;
+    int j = 0;
+    for (j = 0; j < ph->max_size; ++j) {
+        PoolSlot* ps = &ph->slots[j];
+        if (ps->db == 0 || ps->busy)
+            continue;
+
+        if (slot < 0 || ps->idle_since > ph->slots[slot].idle_since)
+            slot = j;
+    }
+
+    return slot;
+}
+
+static int find_empty(gdsql_poolh* ph)
+{
+    int j = 0;
+    for (j = 0; j < ph->max_size; ++j) {
+        if (ph->slots[j].db == 0 && ! ph->slots[j].busy)
+            return j;
+    }
+
+    return -1;
+}
+
+static int find_db(gdsql_poolh* ph,
+                   gdsql_dbh* dh)
+{
+    int j = 0;
+    for (j = 0; j < ph->max_size; ++j) {
+        if (ph->slots[j].db == dh && ph->slots[j].busy)
+            return j;
+    }
+
+    return -1;
+}
+
+/*
+ * With the lock held, take out of the pool a connection we can close,
+ * if there is one.  Otherwise note the earliest time when there may
+ * be one, so that check-ins do not look before then.
+ */
+static gdsql_dbh* take_reapable(gdsql_poolh* ph)
+{
+    if (ph->idle_msecs <= 0)
+        return 0;
+
+    unsigned long long now = gdsql_get_nsecs();
+    unsigned long long limit = (unsigned long long) ph->idle_msecs * 1000000ULL;
+    unsigned long long next = now + limit;
+    int j = 0;
+    for (j = 0; j < ph->max_size; ++j) {
+        PoolSlot* ps = &ph->slots[j];
+        if (ps->db == 0 || ps->busy)
+            continue;
+
+        if (now - ps->idle_since < limit) {
+            if (ps->idle_since + limit < next)
+                next = ps->idle_since + limit;
+            continue;
+        }
+
+        if (ph->size <= ph->min_size)
+            break;
+
+        gdsql_dbh* dh = ps->db;
+        ps->db = 0;
+        --ph->size;
+        ++ph->reaped;
+        return dh;
+    }
+
+    ph->reap_at = next;
+    return 0;
+}
+
+static void get_deadline(struct timespec* until,
+                         int msecs)
+{
+    clock_gettime(CLOCK_REALTIME, until);
+    until->tv_sec += msecs / 1000;
+    until->tv_nsec += (long) (msecs % 1000) * 1000000L;
+    if (until->tv_nsec >= 1000000000L) {
+        until->tv_nsec -= 1000000000L;
+        ++until->tv_sec;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef GDSQL_POOL_H_
+#define GDSQL_POOL_H_
+
+#include <gdsql_types.h>
+
+/*
+ * A pool of open connections, that can be shared by many threads.
+ * It is created with gdsql_db_alloc_pool() from a template gdsql_db
+ * (which does not need to be open, but must outlive the pool): all
+ * the connections in the pool are opened with its settings.  The
+ * pool keeps at least min_size connections open and never opens more
+ * than max_size.
+ *
+ * A thread takes a connection with gdsql_pool_checkout() and gives it
+ * back with gdsql_pool_checkin(); in between, nobody else uses it.  A
+ * connection that has been idle for validate_msecs or more is pinged
+ * before being handed out, and reopened if it is dead (-1 means never
+ * validate).  Connections above the minimum that stay idle for
+ * idle_msecs or more are closed (0 means never), by the next check-in
+ * after that or by gdsql_pool_reap().
+ *
+ * gdsql_db_free_pool() waits until all connections are checked in;
+ * no thread may check out a connection once it has been called.
+ */
+
+#define GDSQL_POOL_DEFAULT_VALIDATE_MSECS  1000
+#define GDSQL_POOL_DEFAULT_IDLE_MSECS     60000
+
+typedef struct gdsql_pool_stats {
+    int size;                       // connections open or opening
+    int in_use;                     // connections checked out
+    unsigned long checkouts;
+    unsigned long waits;            // checkouts that had to wait
+    unsigned long long wait_nsecs;  // total time spent waiting
+    unsigned long timeouts;         // checkouts that gave up
+    unsigned long creations;        // connections opened
+    unsigned long failures;         // connections found dead
+    unsigned long reaped;           // idle connections closed
+} gdsql_pool_stats;
+
+/*
+ * Get a connection from the pool, waiting for up to msecs
+ * milliseconds for one to be available (forever if msecs is
+ * negative); return 0 if none could be had.
+ */
+gdsql_db gdsql_pool_checkout(gdsql_pool gdsql_pool,
+                             int msecs);
+int gdsql_pool_checkin(gdsql_pool gdsql_pool,
+                       gdsql_db gdsql_db);
+
+int gdsql_pool_set_validate_msecs(gdsql_pool gdsql_pool,
+                                  int msecs);
+int gdsql_pool_set_idle_msecs(gdsql_pool gdsql_pool,
+                              int msecs);
+
+// Open connections until there are min_size of them.
+int gdsql_pool_fill(gdsql_pool gdsql_pool);
+
+// Close the connections that have been idle for too long.
+int gdsql_pool_reap(gdsql_pool gdsql_pool);
+
+int gdsql_pool_get_stats(gdsql_pool gdsql_pool,
+                         gdsql_pool_stats* stats);
+
+#endif
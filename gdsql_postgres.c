@@ -1,11 +1,16 @@
+#define LOG_CATEGORY LOG_CAT_POSTGRES
+
 #include <endian.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <netinet/in.h>
 #include <libpq-fe.h>
 #include <gdsql_log.h>
 #include <gdsql_hidden.h>
+#include <gdsql_cache.h>
 #include <gdsql_date.h>
 #include <gdsql_util.h>
 
@@ -23,19 +28,58 @@ typedef short int16;
 typedef int int32;
 typedef long long int64;
 
+/*
+ * Work queued in a pipeline, in the order it was sent, so that the
+ * results can be matched with the statements.  A statement that had
+ * to be prepared also gets an item for its preparation; name is then
+ * the name to cache if the preparation succeeds.
+ */
+typedef struct PipeItem {
+    gdsql_stmth* stmt;
+    int prepare;
+    char* name;
+} PipeItem;
+
+typedef struct Pipeline {
+    PipeItem* items;
+    int size;
+    int count;
+    int active;
+    char** drops;   // statements to deallocate when the pipeline ends
+    int drop_size;
+    int drop_count;
+} Pipeline;
+
 typedef struct DbData {
     PGconn* db;
+    unsigned int nstmt;
+    unsigned int ncursor;
+    gdsql_stmth* unnamed;   // statement in the unnamed slot, see run_query()
+    Pipeline pipe;
 } DbData;
 
 
 #define STMT_MAX_PARAMS        100
 #define STMT_MAX_PARAM_LENGTH   50
 
+/*
+ * How many executions to queue in a pipeline before syncing when
+ * running a statement for array parameters.
+ */
+#define STMT_ARRAY_BATCH       500
+
+/*
+ * How many rows to get with each FETCH for a GDSQL_FETCH_CURSOR, when
+ * the statement does not say.
+ */
+#define STMT_CURSOR_FETCH     1000
+
 typedef struct Param {
     char buf[STMT_MAX_PARAMS][STMT_MAX_PARAM_LENGTH+1];
     const char *val[STMT_MAX_PARAMS];
     int len[STMT_MAX_PARAMS];
     int bin[STMT_MAX_PARAMS];
+    int type[STMT_MAX_PARAMS];  // STMT_VAL_*, only to show the values
     int next;
 } Param;
 
@@ -43,13 +87,49 @@ typedef struct Cursor {
     int rows;
     int cols;
     int next;
+    int streaming;  // more results to come for a GDSQL_FETCH_STREAM
+    char portal[32];  // open server-side cursor for a GDSQL_FETCH_CURSOR
     Row row;
 } Cursor;
 
+/*
+ * Rows being loaded with COPY FROM STDIN, in binary format.  Each row
+ * starts with its field count, which is only known when the row ends,
+ * so we remember where the current row starts.
+ */
+#define LOAD_FLUSH_SIZE   (256 * 1024)
+
+typedef struct LoadData {
+    char* buf;
+    int size;
+    int len;
+    int mark;
+    int fields;
+    int in_row;
+} LoadData;
+
+/*
+ * Rows being read with COPY TO STDOUT, in binary format.  The server
+ * sends one CopyData message per row; the file header comes before
+ * the first row, and a field count of -1 marks the end of the data.
+ */
+#define COPY_HEADER_SIZE  19
+
+typedef struct CopyOut {
+    char* buf;
+    int len;
+    int pos;
+    int active;
+    int header;
+} CopyOut;
+
 typedef struct StmtData {
+    char* name;
     PGresult* result;
     Param param;
     Cursor cursor;
+    CopyOut copy;
+    int pending;    // started with gdsql_stmt_start(), not completed
 } StmtData;
 
 static int gdsql_postgres_init(void);
@@ -104,6 +184,121 @@ static int gdsql_postgres_stmt_step(gdsql_stmth* stmt);
 static int gdsql_postgres_stmt_is_column_null(gdsql_stmth* stmt,
                                               int pos);
 static int gdsql_postgres_stmt_finalize(gdsql_stmth* stmt);
+static int gdsql_postgres_stmt_reset(gdsql_stmth* stmt);
+static int gdsql_postgres_stmt_clear_bindings(gdsql_stmth* stmt);
+static int gdsql_postgres_stmt_execute_array(gdsql_stmth* stmt,
+                                             int* done);
+
+static int gdsql_postgres_cache_evict(gdsql_dbh* db,
+                                      void* handle);
+
+static int gdsql_postgres_load_begin(gdsql_loadh* load,
+                                     const char* table,
+                                     const char* columns);
+static int gdsql_postgres_load_put_null(gdsql_loadh* load);
+static int gdsql_postgres_load_put_int(gdsql_loadh* load,
+                                       int val);
+static int gdsql_postgres_load_put_double(gdsql_loadh* load,
+                                          double val);
+static int gdsql_postgres_load_put_string(gdsql_loadh* load,
+                                          const char* val,
+                                          int len);
+static int gdsql_postgres_load_put_date(gdsql_loadh* load,
+                                        double val);
+static int gdsql_postgres_load_put_boolean(gdsql_loadh* load,
+                                           int val);
+static int gdsql_postgres_load_end_row(gdsql_loadh* load);
+static int gdsql_postgres_load_flush(gdsql_loadh* load);
+static int gdsql_postgres_load_end(gdsql_loadh* load);
+static int gdsql_postgres_load_abort(gdsql_loadh* load);
+
+static int gdsql_postgres_stmt_set_fetch(gdsql_stmth* stmt,
+                                         int mode,
+                                         int size);
+static int gdsql_postgres_stmt_export(gdsql_stmth* stmt,
+                                      int fd);
+
+static int gdsql_postgres_db_pipeline_begin(gdsql_dbh* db);
+static int gdsql_postgres_db_pipeline_sync(gdsql_dbh* db);
+static int gdsql_postgres_db_pipeline_end(gdsql_dbh* db);
+static int gdsql_postgres_stmt_pipeline_queue(gdsql_stmth* stmt);
+
+static int gdsql_postgres_db_get_socket(gdsql_dbh* db);
+static int gdsql_postgres_stmt_start(gdsql_stmth* stmt);
+static int gdsql_postgres_stmt_poll(gdsql_stmth* stmt);
+static int gdsql_postgres_stmt_complete(gdsql_stmth* stmt);
+
+static int gdsql_postgres_db_exec(gdsql_dbh* db,
+                                  const char* sql);
+static int gdsql_postgres_db_ping(gdsql_dbh* db);
+
+static int gdsql_postgres_stmt_render_params(gdsql_stmth* stmt,
+                                             char* buf,
+                                             int size);
+
+static PGresult* run_query(DbData* ddata,
+                           const char* sql,
+                           const Param* param,
+                           int binary);
+static int deallocate_statement(DbData* ddata,
+                                const char* name);
+static int drop_statement(DbData* ddata,
+                          char* name);
+static int encode_array_value(Param* param,
+                              int j,
+                              const ArrayParam* ap,
+                              int row);
+static int param_slot(Param* param,
+                      int pos);
+static int fetch_column(Col* col,
+                        const char* val,
+                        int len,
+                        int null);
+static int take_result(StmtData* sdata,
+                       PGresult* res);
+
+/*
+ * Functions to read the results of a COPY TO STDOUT.
+ */
+static int start_copy_out(gdsql_stmth* stmt,
+                          DbData* ddata);
+static int read_copy_row(gdsql_stmth* stmt,
+                         PGconn* conn);
+static int next_copy_message(CopyOut* copy,
+                             PGconn* conn);
+static int finish_copy_out(CopyOut* copy,
+                           PGconn* conn);
+static int abort_copy_out(CopyOut* copy,
+                          PGconn* conn);
+static int write_fully(int fd,
+                       const char* buf,
+                       int len);
+
+/*
+ * Functions to read results as they are sent by the server.
+ */
+static int start_stream(gdsql_stmth* stmt,
+                        PGconn* conn);
+static int next_stream_result(StmtData* sdata,
+                              PGconn* conn);
+static int abort_stream(StmtData* sdata,
+                        PGconn* conn);
+static void cancel_query(PGconn* conn);
+
+/*
+ * Functions to read results through a server-side cursor.
+ */
+static int declare_cursor(gdsql_stmth* stmt,
+                          DbData* ddata);
+static int fetch_cursor(gdsql_stmth* stmt,
+                        DbData* ddata);
+static int close_cursor(StmtData* sdata,
+                        DbData* ddata);
+
+static int pipe_push(Pipeline* pipe,
+                     gdsql_stmth* stmt,
+                     int prepare,
+                     char* name);
 
 /*
  * Functions to get specific types from the query results.
@@ -156,6 +351,36 @@ int gdsql_postgres_boot(void)
         gdsql_postgres_stmt_step,
         gdsql_postgres_stmt_is_column_null,
         gdsql_postgres_stmt_finalize,
+        gdsql_postgres_stmt_reset,
+        gdsql_postgres_stmt_clear_bindings,
+        gdsql_postgres_stmt_execute_array,
+        gdsql_postgres_cache_evict,
+        gdsql_postgres_load_begin,
+        gdsql_postgres_load_put_null,
+        gdsql_postgres_load_put_int,
+        gdsql_postgres_load_put_double,
+        gdsql_postgres_load_put_string,
+        gdsql_postgres_load_put_date,
+        gdsql_postgres_load_put_boolean,
+        gdsql_postgres_load_end_row,
+        gdsql_postgres_load_flush,
+        gdsql_postgres_load_end,
+        gdsql_postgres_load_abort,
+        gdsql_postgres_stmt_set_fetch,
+        gdsql_postgres_stmt_export,
+        gdsql_postgres_db_pipeline_begin,
+        gdsql_postgres_db_pipeline_sync,
+        gdsql_postgres_db_pipeline_end,
+        gdsql_postgres_stmt_pipeline_queue,
+        gdsql_postgres_db_get_socket,
+        gdsql_postgres_stmt_start,
+        gdsql_postgres_stmt_poll,
+        gdsql_postgres_stmt_complete,
+        0,   // db_bulk_begin
+        0,   // db_bulk_end
+        gdsql_postgres_db_exec,
+        gdsql_postgres_db_ping,
+        gdsql_postgres_stmt_render_params,
     };
 
     GDSQL_Log(LOG_INFO,
@@ -167,6 +392,11 @@ int gdsql_postgres_boot(void)
 
 static int gdsql_postgres_init(void)
 {
+    if (! PQisthreadsafe())
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: library was built without thread support",
+                   DBNAME));
+
     return 0;
 }
 
@@ -212,6 +442,16 @@ static int gdsql_postgres_db_open(gdsql_dbh* db)
     
     DbData* data = (DbData*) malloc(sizeof(DbData));
     data->db = sql_db;
+    data->nstmt = 0;
+    data->ncursor = 0;
+    data->pipe.items = 0;
+    data->pipe.size = 0;
+    data->pipe.count = 0;
+    data->pipe.active = 0;
+    data->pipe.drops = 0;
+    data->pipe.drop_size = 0;
+    data->pipe.drop_count = 0;
+    data->unnamed = 0;
     db->data = data;
     return 0;
 }
@@ -240,6 +480,12 @@ static int gdsql_postgres_db_close(gdsql_dbh* db)
             GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
         } while (0);
 
+        // Statements still waiting to be dropped went with the connection.
+        int k = 0;
+        for (k = 0; k < ddata->pipe.drop_count; ++k)
+            free(ddata->pipe.drops[k]);
+        free(ddata->pipe.drops);
+        free(ddata->pipe.items);
         free(ddata);
         db->data = 0;
     } while (0);
@@ -256,12 +502,21 @@ static int gdsql_postgres_stmt_create(gdsql_stmth* stmt)
               ("%s: creating statement",
                DBNAME));
     StmtData* sdata = (StmtData*) malloc(sizeof(StmtData));
+    sdata->name = 0;
     sdata->result = 0;
     sdata->param.next = 0;
     sdata->cursor.rows = 0;
     sdata->cursor.cols = 0;
     sdata->cursor.next = 0;
+    sdata->cursor.streaming = 0;
+    sdata->cursor.portal[0] = '\0';
     sdata->cursor.row.ncol = 0;
+    sdata->copy.buf = 0;
+    sdata->copy.len = 0;
+    sdata->copy.pos = 0;
+    sdata->copy.active = 0;
+    sdata->copy.header = 0;
+    sdata->pending = 0;
     stmt->data = sdata;
     return 0;
 }
@@ -276,12 +531,33 @@ static int gdsql_postgres_stmt_prepare(gdsql_stmth* stmt)
         return 3;
     if (ddata->db == 0)
         return 4;
-    
+
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 2;
+
+    char* cached = (char*) gdsql_cache_get(stmt->gdsql_db,
+                                           stmt->query);
+    if (cached != 0) {
+        GDSQL_Log(LOG_INFO,
+                  ("%s: reusing cached statement %s [%s]",
+                   DBNAME, cached, stmt->query));
+        sdata->name = cached;
+        return 0;
+    }
+
+    // Statements that may be cached need a name of their own; all
+    // others use the unnamed statement.
+    char name[32];
+    name[0] = '\0';
+    if (gdsql_cache_enabled(stmt->gdsql_db))
+        sprintf(name, "gdsql_%u", ++ddata->nstmt);
+
     GDSQL_Log(LOG_INFO,
-              ("%s: preparing statement [%s]",
-               DBNAME, stmt->query));
+              ("%s: preparing statement [%s] as [%s]",
+               DBNAME, stmt->query, name));
     PGresult* sql_ps = PQprepare(ddata->db,
-                                 "", // unnamed statement
+                                 name,
                                  stmt->query,
                                  0,  // no params specified yet
                                  0);
@@ -301,6 +577,12 @@ static int gdsql_postgres_stmt_prepare(gdsql_stmth* stmt)
         st != PGRES_TUPLES_OK)
         return 6;
 
+    if (name[0] != '\0') {
+        sdata->name = strdup(name);
+        gdsql_cache_put(stmt->gdsql_db, stmt->query, sdata->name);
+    } else
+        ddata->unnamed = stmt;
+
     GDSQL_Log(LOG_INFO, ("%s: success!", DBNAME));
     return 0;
 }
@@ -313,16 +595,17 @@ static int gdsql_postgres_stmt_bindp_null(gdsql_stmth* stmt,
         return 1;
 
     Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
+    int j = param_slot(param, pos);
+    if (j < 0)
         return 3;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding NULL param pos %d",
-               DBNAME, pos));
-    param->val[param->next] = 0;
-    param->len[param->next] = 0;
-    param->bin[param->next] = 1;
-    ++param->next;
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding NULL param pos %d",
+                DBNAME, pos));
+    param->val[j] = 0;
+    param->len[j] = 0;
+    param->bin[j] = 1;
+    param->type[j] = STMT_VAL_INVALID;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -337,16 +620,17 @@ static int gdsql_postgres_stmt_bindp_int(gdsql_stmth* stmt,
         return 1;
 
     Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
+    int j = param_slot(param, pos);
+    if (j < 0)
         return 3;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding int param pos %d to %d",
-               DBNAME, pos, val));
-    param->len[param->next] = put_int32(val, param->buf[param->next]);
-    param->val[param->next] = param->buf[param->next];
-    param->bin[param->next] = 1;
-    ++param->next;
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding int param pos %d to %d",
+                DBNAME, pos, val));
+    param->len[j] = put_int32(val, param->buf[j]);
+    param->val[j] = param->buf[j];
+    param->bin[j] = 1;
+    param->type[j] = STMT_VAL_INT;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -361,17 +645,18 @@ static int gdsql_postgres_stmt_bindp_double(gdsql_stmth* stmt,
         return 1;
 
     Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
+    int j = param_slot(param, pos);
+    if (j < 0)
         return 3;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding double param pos %d to %lf",
-               DBNAME, pos, val));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding double param pos %d to %lf",
+                DBNAME, pos, val));
 
-    param->len[param->next] = put_double(val, param->buf[param->next]);
-    param->val[param->next] = param->buf[param->next];
-    param->bin[param->next] = 1;
-    ++param->next;
+    param->len[j] = put_double(val, param->buf[j]);
+    param->val[j] = param->buf[j];
+    param->bin[j] = 1;
+    param->type[j] = STMT_VAL_DOUBLE;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -386,24 +671,26 @@ static int gdsql_postgres_stmt_bindp_string(gdsql_stmth* stmt,
     if (sdata == 0)
         return 1;
 
-    Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
-        return 2;
-
+    // Check the value before taking a slot for it.
     if (len < 0)
         len = strlen(val);
     if (len >= STMT_MAX_PARAM_LENGTH)
         return 3;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding string param pos %d to [%d:%s]",
-               DBNAME, pos, len, val));
-
-    param->len[param->next] = len;
-    memcpy(param->buf[param->next], val, len);
-    param->val[param->next] = param->buf[param->next];
-    param->bin[param->next] = 1;
-    ++param->next;
+    Param* param = &sdata->param;
+    int j = param_slot(param, pos);
+    if (j < 0)
+        return 2;
+
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding string param pos %d to [%d:%s]",
+                DBNAME, pos, len, val));
+
+    param->len[j] = len;
+    memcpy(param->buf[j], val, len);
+    param->val[j] = param->buf[j];
+    param->bin[j] = 1;
+    param->type[j] = STMT_VAL_STRING;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -418,17 +705,18 @@ static int gdsql_postgres_stmt_bindp_date(gdsql_stmth* stmt,
         return 1;
 
     Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
+    int j = param_slot(param, pos);
+    if (j < 0)
         return 3;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding date param pos %d to %lf",
-               DBNAME, pos, val));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding date param pos %d to %lf",
+                DBNAME, pos, val));
 
-    param->len[param->next] = put_date(val, param->buf[param->next]);
-    param->val[param->next] = param->buf[param->next];
-    param->bin[param->next] = 1;
-    ++param->next;
+    param->len[j] = put_date(val, param->buf[j]);
+    param->val[j] = param->buf[j];
+    param->bin[j] = 1;
+    param->type[j] = STMT_VAL_DATE;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -443,17 +731,18 @@ static int gdsql_postgres_stmt_bindp_boolean(gdsql_stmth* stmt,
         return 1;
 
     Param* param = &sdata->param;
-    if (param->next >= STMT_MAX_PARAMS)
+    int j = param_slot(param, pos);
+    if (j < 0)
         return 3;
 
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding boolean param pos %d to %d",
-               DBNAME, pos, val));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding boolean param pos %d to %d",
+                DBNAME, pos, val));
     int8 b = (int8) val;
-    param->len[param->next] = put_int8(b, param->buf[param->next]);
-    param->val[param->next] = param->buf[param->next];
-    param->bin[param->next] = 1;
-    ++param->next;
+    param->len[j] = put_int8(b, param->buf[j]);
+    param->val[j] = param->buf[j];
+    param->bin[j] = 1;
+    param->type[j] = STMT_VAL_BOOLEAN;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -472,9 +761,9 @@ static int gdsql_postgres_stmt_bindr_int(gdsql_stmth* stmt,
         return 3;
 
     --pos;
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding int result pos %d to %p",
-               DBNAME, pos, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding int result pos %d to %p",
+                DBNAME, pos, var));
     row->cols[row->ncol].pos = pos;
     row->cols[row->ncol].type = STMT_VAL_INT;
     row->cols[row->ncol].val.ival = var;
@@ -498,9 +787,9 @@ static int gdsql_postgres_stmt_bindr_double(gdsql_stmth* stmt,
         return 3;
 
     --pos;
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding double result pos %d to %p",
-               DBNAME, pos, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding double result pos %d to %p",
+                DBNAME, pos, var));
     row->cols[row->ncol].pos = pos;
     row->cols[row->ncol].type = STMT_VAL_DOUBLE;
     row->cols[row->ncol].val.dval = var;
@@ -525,9 +814,9 @@ static int gdsql_postgres_stmt_bindr_string(gdsql_stmth* stmt,
         return 3;
 
     --pos;
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding string result pos %d to [%d:%p]",
-               DBNAME, pos, len, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding string result pos %d to [%d:%p]",
+                DBNAME, pos, len, var));
     row->cols[row->ncol].pos = pos;
     row->cols[row->ncol].type = STMT_VAL_STRING;
     row->cols[row->ncol].val.sval = var;
@@ -551,9 +840,9 @@ static int gdsql_postgres_stmt_bindr_date(gdsql_stmth* stmt,
         return 3;
 
     --pos;
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding date result pos %d to %p",
-               DBNAME, pos, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding date result pos %d to %p",
+                DBNAME, pos, var));
     row->cols[row->ncol].pos = pos;
     row->cols[row->ncol].type = STMT_VAL_DATE;
     row->cols[row->ncol].val.dval = var;
@@ -577,9 +866,9 @@ static int gdsql_postgres_stmt_bindr_boolean(gdsql_stmth* stmt,
         return 3;
 
     --pos;
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding boolean result pos %d to %p",
-               DBNAME, pos, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding boolean result pos %d to %p",
+                DBNAME, pos, var));
     row->cols[row->ncol].pos = pos;
     row->cols[row->ncol].type = STMT_VAL_BOOLEAN;
     row->cols[row->ncol].val.ival = var;
@@ -596,9 +885,25 @@ static int gdsql_postgres_stmt_step(gdsql_stmth* stmt)
     if (sdata == 0)
         return 1;
 
+    if (stmt->gdsql_db == 0)
+        return 2;
+    
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata == 0)
+        return 3;
+    if (ddata->db == 0)
+        return 4;
+
+    // In a pipeline statements are queued, not run.
+    if (ddata->pipe.active)
+        return 10;
+
     if (stmt->state < STMT_STATE_PREPARED) {
-        // Must prepare statement
-        if (gdsql_postgres_stmt_prepare(stmt) != 0)
+        // Must prepare statement; a COPY or a cursor does not use the
+        // prepared statement, so there is no point in preparing it.
+        if (stmt->fetch_mode != GDSQL_FETCH_COPY &&
+            stmt->fetch_mode != GDSQL_FETCH_CURSOR &&
+            gdsql_postgres_stmt_prepare(stmt) != 0)
             return 2;
         
         stmt->state = STMT_STATE_PREPARED;
@@ -614,6 +919,24 @@ static int gdsql_postgres_stmt_step(gdsql_stmth* stmt)
     
     Param* param = &sdata->param;
 
+    if (stmt->state < STMT_STATE_EXECUTED &&
+        stmt->fetch_mode == GDSQL_FETCH_COPY) {
+        int ret = start_copy_out(stmt, ddata);
+        if (ret != 0)
+            return ret;
+
+        stmt->state = STMT_STATE_EXECUTED;
+    }
+
+    if (stmt->state < STMT_STATE_EXECUTED &&
+        stmt->fetch_mode == GDSQL_FETCH_CURSOR) {
+        int ret = declare_cursor(stmt, ddata);
+        if (ret != 0)
+            return ret;
+
+        stmt->state = STMT_STATE_EXECUTED;
+    }
+
     if (stmt->state < STMT_STATE_EXECUTED) {
         // Must execute statement
 
@@ -621,125 +944,102 @@ static int gdsql_postgres_stmt_step(gdsql_stmth* stmt)
                   ("%s: executing statement",
                    DBNAME));
 
-        if (stmt->gdsql_db == 0)
+        // Another statement, or any query run on the connection, may
+        // have taken over the unnamed slot since we were prepared.
+        if (sdata->name == 0 &&
+            ddata->unnamed != stmt &&
+            gdsql_postgres_stmt_prepare(stmt) != 0)
             return 2;
     
-        DbData* ddata = (DbData*) stmt->gdsql_db->data;
-        if (ddata == 0)
-            return 3;
-        if (ddata->db == 0)
-            return 4;
-    
         GDSQL_Log(LOG_INFO,
                   ("%s: nParams = %d",
                    DBNAME, param->next));
-        sdata->result = PQexecPrepared(ddata->db,
-                                       "",
+        if (stmt->fetch_mode == GDSQL_FETCH_STREAM) {
+            int ret = start_stream(stmt, ddata->db);
+            if (ret != 0)
+                return ret;
+
+            stmt->state = STMT_STATE_EXECUTED;
+        }
+    }
+
+    if (stmt->state < STMT_STATE_EXECUTED) {
+        // Plain execution: get the whole result at once.
+        PGresult* res = PQexecPrepared(ddata->db,
+                                       sdata->name ? sdata->name : "",
                                        param->next,
                                        param->val,
                                        param->len,
                                        param->bin,
                                        1);
-        GDSQL_Log(LOG_INFO,
-                  ("%s: result = %p",
-                   DBNAME, sdata->result));
-        if (sdata->result == 0)
-            return 5;
-        
-        ExecStatusType st = PQresultStatus(sdata->result);
-        GDSQL_Log(LOG_INFO,
-                  ("%s: st = %d (%d / %d)",
-                   DBNAME, (int) st,
-                   (int) PGRES_COMMAND_OK, (int) PGRES_TUPLES_OK));
-        if (st != PGRES_COMMAND_OK &&
-            st != PGRES_TUPLES_OK)
-            return 6;
-
-        sdata->cursor.rows = 0;
-        sdata->cursor.cols = 0;
-        sdata->cursor.next = 0;
-        if (st == PGRES_TUPLES_OK) {
-            sdata->cursor.rows = PQntuples(sdata->result);
-            sdata->cursor.cols = PQnfields(sdata->result);
-            GDSQL_Log(LOG_INFO,
-                      ("%s: result size = %d x %d", 
-                       DBNAME, sdata->cursor.rows, sdata->cursor.cols));
-        }
+        int ret = take_result(sdata, res);
+        if (ret != 0)
+            return ret;
 
         stmt->state = STMT_STATE_EXECUTED;
     }
     
-    if (stmt->state < STMT_STATE_EXHAUSTED) {
+    if (stmt->state < STMT_STATE_EXHAUSTED &&
+        stmt->fetch_mode == GDSQL_FETCH_COPY) {
+        int ret = read_copy_row(stmt, ddata->db);
+        if (ret != 0) {
+            // No more rows, or the copy failed
+            stmt->state = STMT_STATE_EXHAUSTED;
+            if (ret > 0)
+                metrics_count(GDSQL_DB_POSTGRES, METRIC_ERRORS, 1);
+            return ret < 0 ? 7 : ret;
+        }
+    }
+
+    if (stmt->state < STMT_STATE_EXHAUSTED &&
+        stmt->fetch_mode != GDSQL_FETCH_COPY) {
+        while (sdata->cursor.next >= sdata->cursor.rows &&
+               (sdata->cursor.streaming ||
+                sdata->cursor.portal[0] != '\0')) {
+            int ret = sdata->cursor.streaming
+                    ? next_stream_result(sdata, ddata->db)
+                    : fetch_cursor(stmt, ddata);
+            if (ret > 0) {
+                stmt->state = STMT_STATE_EXHAUSTED;
+                metrics_count(GDSQL_DB_POSTGRES, METRIC_ERRORS, 1);
+                return ret;
+            }
+        }
+
         if (sdata->cursor.next >= sdata->cursor.rows) {
             // No more rows
             PQclear(sdata->result);
             sdata->result = 0;
-            param->next = 0;
             sdata->cursor.rows = 0;
             sdata->cursor.cols = 0;
             sdata->cursor.next = 0;
-            sdata->cursor.row.ncol = 0;
             stmt->state = STMT_STATE_EXHAUSTED;
             return 7;
         }
 
         // Not yet done, can call step
-        GDSQL_Log(LOG_INFO,
-              ("%s: stepping statement [%s]",
-               DBNAME, stmt->query));
+        GDSQL_LogC(LOG_CAT_STEP, LOG_INFO,
+               ("%s: stepping statement [%s]",
+                DBNAME, stmt->query));
 
+        unsigned long long t0 = STMT_STATS_START(stmt);
         int j = 0;
         Row* row = &sdata->cursor.row;
         for (j = 0; j < row->ncol; ++j) {
             int pos = row->cols[j].pos;
-            row->cols[j].null = PQgetisnull(sdata->result,
-                                            sdata->cursor.next,
-                                            pos);
-            const char* val = PQgetvalue(sdata->result,
-                                         sdata->cursor.next,
-                                         pos);
-            switch (row->cols[j].type) {
-            case STMT_VAL_INT:
-                GDSQL_Log(LOG_INFO,
-                          ("%s: column %d int%s",
-                           DBNAME, pos,
-                           row->cols[j].null ? " NULL" : ""));
-                *(row->cols[j].val.ival) = row->cols[j].null ? 0 : get_int32(val);
-                break;
-            case STMT_VAL_DOUBLE:
-                GDSQL_Log(LOG_INFO,
-                          ("%s: column %d double%s",
-                           DBNAME, pos,
-                           row->cols[j].null ? " NULL" : ""));
-                *(row->cols[j].val.dval) = row->cols[j].null ? 0.0 : get_double(val);
-                break;
-            case STMT_VAL_STRING:
-                GDSQL_Log(LOG_INFO,
-                          ("%s: column %d string%s",
-                           DBNAME, pos,
-                           row->cols[j].null ? " NULL" : ""));
-                row->cols[j].val.sval[0] = '\0';
-                if (! row->cols[j].null)
-                    gdsql_copy_at_most(row->cols[j].val.sval,
-                                       val,
-                                       row->cols[j].len);
-                break;
-            case STMT_VAL_DATE:
-                GDSQL_Log(LOG_INFO,
-                          ("%s: column %d date%s",
-                           DBNAME, pos,
-                           row->cols[j].null ? " NULL" : ""));
-                *(row->cols[j].val.dval) = row->cols[j].null ? 0.0 : get_date(val);
-                break;
-            case STMT_VAL_BOOLEAN:
-                GDSQL_Log(LOG_INFO,
-                          ("%s: column %d boolean%s",
-                           DBNAME, pos,
-                           row->cols[j].null ? " NULL" : ""));
-                *(row->cols[j].val.ival) = row->cols[j].null ? 0 : get_int8(val);
-                break;
-            }
+            fetch_column(&row->cols[j],
+                         PQgetvalue(sdata->result,
+                                    sdata->cursor.next,
+                                    pos),
+                         PQgetlength(sdata->result,
+                                     sdata->cursor.next,
+                                     pos),
+                         PQgetisnull(sdata->result,
+                                     sdata->cursor.next,
+                                     pos));
         }
+        if (t0 != 0)
+            stmt_stats_row(stmt, t0, row_bytes(row));
         ++sdata->cursor.next;
     }
     
@@ -791,6 +1091,36 @@ static int gdsql_postgres_stmt_finalize(gdsql_stmth* stmt)
             GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
         } while (0);
 
+        DbData* owner = (DbData*) stmt->gdsql_db->data;
+        if (owner != 0 && owner->unnamed == stmt)
+            owner->unnamed = 0;
+        if (owner != 0) {
+            // Forget about any work we still have in a pipeline.
+            int k = 0;
+            for (k = 0; k < owner->pipe.count; ++k) {
+                if (owner->pipe.items[k].stmt != stmt)
+                    continue;
+                owner->pipe.items[k].stmt = 0;
+                owner->pipe.items[k].name = 0;
+            }
+        }
+        if (owner != 0 && sdata->copy.active)
+            abort_copy_out(&sdata->copy, owner->db);
+        if (owner != 0 && (sdata->cursor.streaming || sdata->pending))
+            abort_stream(sdata, owner->db);
+        if (owner != 0 && sdata->cursor.portal[0] != '\0')
+            close_cursor(sdata, owner);
+
+        if (sdata->name != 0 &&
+            gdsql_cache_release(stmt->gdsql_db, sdata->name) != 0) {
+            // Named, but not owned by the cache (perhaps because its
+            // preparation is still in a pipeline): deallocate it here.
+            if (owner != 0 && owner->db != 0)
+                drop_statement(owner, sdata->name);
+            else
+                free(sdata->name);
+        }
+
         free(sdata);
         stmt->data = 0;
     } while (0);
@@ -798,6 +1128,1795 @@ static int gdsql_postgres_stmt_finalize(gdsql_stmth* stmt)
     return ret;
 }
 
+static int gdsql_postgres_stmt_reset(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: resetting statement [%s]",
+               DBNAME, stmt->query));
+    if (sdata->result != 0)
+        PQclear(sdata->result);
+    sdata->result = 0;
+    sdata->cursor.rows = 0;
+    sdata->cursor.cols = 0;
+    sdata->cursor.next = 0;
+
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata != 0 && sdata->copy.active)
+        abort_copy_out(&sdata->copy, ddata->db);
+    if (ddata != 0 && (sdata->cursor.streaming || sdata->pending))
+        abort_stream(sdata, ddata->db);
+    if (ddata != 0 && sdata->cursor.portal[0] != '\0')
+        close_cursor(sdata, ddata);
+
+    return 0;
+}
+
+static int gdsql_postgres_stmt_clear_bindings(gdsql_stmth* stmt)
+{
+    int ret = gdsql_postgres_stmt_reset(stmt);
+    if (ret != 0)
+        return ret;
+
+    StmtData* sdata = (StmtData*) stmt->data;
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: clearing bindings for statement [%s]",
+               DBNAME, stmt->query));
+    sdata->param.next = 0;
+
+    return 0;
+}
+
+static int gdsql_postgres_stmt_execute_array(gdsql_stmth* stmt,
+                                             int* done)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 2;
+
+    // We run our own pipeline, and would take the results queued in
+    // the caller's.
+    if (ddata->pipe.active) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: cannot execute array parameters in a pipeline",
+                   DBNAME));
+        return 4;
+    }
+
+    if (stmt->state < STMT_STATE_PREPARED ||
+        (sdata->name == 0 && ddata->unnamed != stmt)) {
+        if (gdsql_postgres_stmt_prepare(stmt) != 0)
+            return 2;
+
+        stmt->state = STMT_STATE_PREPARED;
+    }
+
+    ArrayParams* arrays = stmt->arrays;
+    if (arrays->next > STMT_MAX_PARAMS)
+        return 3;
+
+    Param* param = &sdata->param;
+    const char* name = sdata->name ? sdata->name : "";
+    int ret = 0;
+    int row = 0;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: executing statement [%s] for %d rows",
+               DBNAME, stmt->query, arrays->count));
+
+#ifdef LIBPQ_HAS_PIPELINING
+    // Queue executions in a pipeline and sync every few hundred of
+    // them, so that we pay one round trip per batch instead of one per
+    // row.  Each batch runs in its own implicit transaction.
+    if (PQenterPipelineMode(ddata->db) != 1)
+        return 4;
+
+    while (ret == 0 && row < arrays->count) {
+        int first = row;
+        int last = row + STMT_ARRAY_BATCH;
+        if (last > arrays->count)
+            last = arrays->count;
+
+        for (; row < last; ++row) {
+            int j = 0;
+            for (j = 0; j < arrays->next; ++j)
+                encode_array_value(param, j, &arrays->params[j], row);
+
+            if (PQsendQueryPrepared(ddata->db,
+                                    name,
+                                    arrays->next,
+                                    param->val,
+                                    param->len,
+                                    param->bin,
+                                    1) != 1) {
+                ret = 5;
+                break;
+            }
+        }
+
+        if (PQpipelineSync(ddata->db) != 1) {
+            ret = 5;
+            break;
+        }
+
+        // Collect one result (plus its terminating null) per queued
+        // execution, then the sync marker.
+        int sent = row - first;
+        int k = 0;
+        for (k = 0; k < sent; ++k) {
+            PGresult* res = PQgetResult(ddata->db);
+            ExecStatusType st = PQresultStatus(res);
+            if (st != PGRES_COMMAND_OK &&
+                st != PGRES_TUPLES_OK &&
+                ret == 0) {
+                GDSQL_Log(LOG_WARNING,
+                          ("%s: row %d failed: %s",
+                           DBNAME, first + k, PQresultErrorMessage(res)));
+                ret = 6;
+            }
+            PQclear(res);
+            while ((res = PQgetResult(ddata->db)) != 0)
+                PQclear(res);
+        }
+
+        PGresult* res = PQgetResult(ddata->db);
+        if (PQresultStatus(res) != PGRES_PIPELINE_SYNC && ret == 0)
+            ret = 7;
+        PQclear(res);
+
+        if (ret != 0)
+            row = first;
+    }
+
+    PQexitPipelineMode(ddata->db);
+#else
+    for (row = 0; row < arrays->count; ++row) {
+        int j = 0;
+        for (j = 0; j < arrays->next; ++j)
+            encode_array_value(param, j, &arrays->params[j], row);
+
+        PGresult* res = PQexecPrepared(ddata->db,
+                                       name,
+                                       arrays->next,
+                                       param->val,
+                                       param->len,
+                                       param->bin,
+                                       1);
+        ExecStatusType st = PQresultStatus(res);
+        PQclear(res);
+        if (st != PGRES_COMMAND_OK &&
+            st != PGRES_TUPLES_OK) {
+            ret = 6;
+            break;
+        }
+    }
+#endif
+
+    param->next = 0;
+    *done = row;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: executed %d rows, ret %d",
+               DBNAME, *done, ret));
+    return ret;
+}
+
+static int gdsql_postgres_cache_evict(gdsql_dbh* db,
+                                      void* handle)
+{
+    DbData* ddata = (DbData*) db->data;
+    char* name = (char*) handle;
+
+    if (ddata == 0 || ddata->db == 0) {
+        free(name);
+        return 0;
+    }
+
+    return drop_statement(ddata, name);
+}
+
+static PGconn* get_load_conn(gdsql_loadh* load)
+{
+    DbData* ddata = (DbData*) load->gdsql_db->data;
+    if (ddata == 0)
+        return 0;
+
+    return ddata->db;
+}
+
+static int load_reserve(LoadData* ldata,
+                        int need)
+{
+    if (ldata->len + need <= ldata->size)
+        return 0;
+
+    int size = ldata->size * 2;
+    while (ldata->len + need > size)
+        size *= 2;
+    char* buf = (char*) realloc(ldata->buf, size);
+    if (buf == 0)
+        return 1;
+
+    ldata->buf = buf;
+    ldata->size = size;
+    return 0;
+}
+
+/*
+ * Make room for a field of len bytes (plus its length word) in the
+ * current row, starting the row if needed; return where the field
+ * data goes.
+ */
+static char* load_field(LoadData* ldata,
+                        int len)
+{
+    if (load_reserve(ldata, 2 + 4 + (len > 0 ? len : 0)) != 0)
+        return 0;
+
+    if (! ldata->in_row) {
+        ldata->mark = ldata->len;
+        ldata->len += 2;  // field count, filled in by end_row
+        ldata->fields = 0;
+        ldata->in_row = 1;
+    }
+
+    ldata->len += put_int32(len, ldata->buf + ldata->len);
+    ++ldata->fields;
+
+    char* data = ldata->buf + ldata->len;
+    if (len > 0)
+        ldata->len += len;
+    return data;
+}
+
+static int send_load_data(PGconn* conn,
+                          LoadData* ldata,
+                          int upto)
+{
+    if (upto <= 0)
+        return 0;
+
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: sending %d bytes of COPY data",
+               DBNAME, upto));
+    if (PQputCopyData(conn, ldata->buf, upto) != 1) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not send COPY data: %s",
+                   DBNAME, PQerrorMessage(conn)));
+        return 1;
+    }
+
+    memmove(ldata->buf, ldata->buf + upto, ldata->len - upto);
+    ldata->len -= upto;
+    ldata->mark -= upto;
+    return 0;
+}
+
+static int finish_copy(PGconn* conn,
+                       const char* error)
+{
+    int ret = 0;
+
+    if (PQputCopyEnd(conn, error) != 1)
+        ret = 1;
+
+    PGresult* res = 0;
+    while ((res = PQgetResult(conn)) != 0) {
+        ExecStatusType st = PQresultStatus(res);
+        if (st != PGRES_COMMAND_OK && ret == 0) {
+            if (error == 0)
+                GDSQL_Log(LOG_WARNING,
+                          ("%s: COPY failed: %s",
+                           DBNAME, PQresultErrorMessage(res)));
+            ret = 2;
+        }
+        PQclear(res);
+    }
+
+    return ret;
+}
+
+static int gdsql_postgres_load_begin(gdsql_loadh* load,
+                                     const char* table,
+                                     const char* columns)
+{
+    DbData* ddata = (DbData*) load->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 3;
+
+    PGconn* conn = ddata->db;
+    char sql[512];
+    if (columns != 0 && columns[0] != '\0')
+        snprintf(sql, sizeof(sql),
+                 "COPY %s (%s) FROM STDIN (FORMAT binary)",
+                 table, columns);
+    else
+        snprintf(sql, sizeof(sql),
+                 "COPY %s FROM STDIN (FORMAT binary)",
+                 table);
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: starting load [%s]",
+               DBNAME, sql));
+    PGresult* res = run_query(ddata, sql, 0, 0);
+    ExecStatusType st = PQresultStatus(res);
+    PQclear(res);
+    if (st != PGRES_COPY_IN) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not start COPY: %s",
+                   DBNAME, PQerrorMessage(conn)));
+        return 4;
+    }
+
+    LoadData* ldata = (LoadData*) malloc(sizeof(LoadData));
+    if (ldata != 0) {
+        ldata->size = LOAD_FLUSH_SIZE + LOAD_FLUSH_SIZE / 4;
+        ldata->buf = (char*) malloc(ldata->size);
+    }
+    if (ldata == 0 || ldata->buf == 0) {
+        free(ldata);
+        finish_copy(conn, "out of memory");
+        return 5;
+    }
+
+    // Binary COPY header: signature, flags and header extension length.
+    static const char signature[11] = "PGCOPY\n\377\r\n\0";
+    memcpy(ldata->buf, signature, sizeof(signature));
+    ldata->len = sizeof(signature);
+    ldata->len += put_int32(0, ldata->buf + ldata->len);
+    ldata->len += put_int32(0, ldata->buf + ldata->len);
+    ldata->mark = ldata->len;
+    ldata->fields = 0;
+    ldata->in_row = 0;
+
+    load->data = ldata;
+    return 0;
+}
+
+static int gdsql_postgres_load_put_null(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    if (load_field(ldata, -1) == 0)
+        return 2;
+
+    return 0;
+}
+
+static int gdsql_postgres_load_put_int(gdsql_loadh* load,
+                                       int val)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    char* data = load_field(ldata, sizeof(int32));
+    if (data == 0)
+        return 2;
+
+    put_int32(val, data);
+    return 0;
+}
+
+static int gdsql_postgres_load_put_double(gdsql_loadh* load,
+                                          double val)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    char* data = load_field(ldata, sizeof(double));
+    if (data == 0)
+        return 2;
+
+    put_double(val, data);
+    return 0;
+}
+
+static int gdsql_postgres_load_put_string(gdsql_loadh* load,
+                                          const char* val,
+                                          int len)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    if (val == 0)
+        return gdsql_postgres_load_put_null(load);
+
+    if (len < 0)
+        len = strlen(val);
+
+    char* data = load_field(ldata, len);
+    if (data == 0)
+        return 2;
+
+    memcpy(data, val, len);
+    return 0;
+}
+
+static int gdsql_postgres_load_put_date(gdsql_loadh* load,
+                                        double val)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    char* data = load_field(ldata, sizeof(int64));
+    if (data == 0)
+        return 2;
+
+    put_date(val, data);
+    return 0;
+}
+
+static int gdsql_postgres_load_put_boolean(gdsql_loadh* load,
+                                           int val)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    char* data = load_field(ldata, sizeof(int8));
+    if (data == 0)
+        return 2;
+
+    put_int8(val ? 1 : 0, data);
+    return 0;
+}
+
+static int gdsql_postgres_load_end_row(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    if (! ldata->in_row)
+        return 2;
+
+    put_int16(ldata->fields, ldata->buf + ldata->mark);
+    ldata->in_row = 0;
+    ldata->mark = ldata->len;
+
+    if (ldata->len >= LOAD_FLUSH_SIZE)
+        return gdsql_postgres_load_flush(load);
+
+    return 0;
+}
+
+static int gdsql_postgres_load_flush(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    PGconn* conn = get_load_conn(load);
+    if (conn == 0)
+        return 3;
+
+    // Only complete rows can be sent, because the field count of the
+    // current row is not known yet.
+    int upto = ldata->in_row ? ldata->mark : ldata->len;
+    if (send_load_data(conn, ldata, upto) != 0)
+        return 4;
+
+    return 0;
+}
+
+static int gdsql_postgres_load_end(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    PGconn* conn = get_load_conn(load);
+    if (conn == 0)
+        return 3;
+
+    int ret = 0;
+    do {
+        if (ldata->in_row) {
+            GDSQL_Log(LOG_WARNING,
+                      ("%s: load ended in the middle of a row",
+                       DBNAME));
+            finish_copy(conn, "incomplete row");
+            ret = 4;
+            break;
+        }
+
+        // Trailer: a field count of -1.
+        if (load_reserve(ldata, 2) != 0) {
+            finish_copy(conn, "out of memory");
+            ret = 5;
+            break;
+        }
+        ldata->len += put_int16(-1, ldata->buf + ldata->len);
+
+        if (send_load_data(conn, ldata, ldata->len) != 0) {
+            finish_copy(conn, "could not send data");
+            ret = 6;
+            break;
+        }
+
+        if (finish_copy(conn, 0) != 0) {
+            ret = 7;
+            break;
+        }
+
+        GDSQL_Log(LOG_INFO,
+                  ("%s: load finished, %lu rows",
+                   DBNAME, load->rows));
+    } while (0);
+
+    free(ldata->buf);
+    free(ldata);
+    load->data = 0;
+    return ret;
+}
+
+static int gdsql_postgres_load_abort(gdsql_loadh* load)
+{
+    LoadData* ldata = (LoadData*) load->data;
+    if (ldata == 0)
+        return 1;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: aborting load",
+               DBNAME));
+    PGconn* conn = get_load_conn(load);
+    if (conn != 0)
+        finish_copy(conn, "load aborted");
+
+    free(ldata->buf);
+    free(ldata);
+    load->data = 0;
+    return 0;
+}
+
+static int gdsql_postgres_stmt_set_fetch(gdsql_stmth* stmt,
+                                         int mode,
+                                         int size)
+{
+    if (mode != GDSQL_FETCH_DEFAULT &&
+        mode != GDSQL_FETCH_COPY &&
+        mode != GDSQL_FETCH_STREAM &&
+        mode != GDSQL_FETCH_CURSOR &&
+        mode != GDSQL_FETCH_BUFFERED)
+        return 1;
+
+    return 0;
+}
+
+static int gdsql_postgres_stmt_export(gdsql_stmth* stmt,
+                                      int fd)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 2;
+
+    if (stmt->fetch_mode != GDSQL_FETCH_COPY ||
+        stmt->state == STMT_STATE_EXECUTED)
+        return 3;
+
+    int ret = start_copy_out(stmt, ddata);
+    if (ret != 0)
+        return ret;
+
+    stmt->state = STMT_STATE_EXECUTED;
+
+    // Pass the data along exactly as we get it, header and trailer
+    // included, one CopyData message at a time.
+    CopyOut* copy = &sdata->copy;
+    unsigned long bytes = 0;
+    while ((ret = next_copy_message(copy, ddata->db)) == 0) {
+        if (write_fully(fd, copy->buf, copy->len) != 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("%s: could not write export data: %s",
+                       DBNAME, strerror(errno)));
+            abort_copy_out(copy, ddata->db);
+            ret = 10;
+            break;
+        }
+        bytes += copy->len;
+    }
+
+    stmt->state = STMT_STATE_EXHAUSTED;
+    if (ret < 0)
+        ret = 0;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: exported %lu bytes, ret %d",
+               DBNAME, bytes, ret));
+    return ret;
+}
+
+static int gdsql_postgres_db_pipeline_begin(gdsql_dbh* db)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 1;
+
+    if (ddata->pipe.active)
+        return 2;
+
+#ifdef LIBPQ_HAS_PIPELINING
+    GDSQL_Log(LOG_INFO,
+              ("%s: entering pipeline mode",
+               DBNAME));
+    if (PQenterPipelineMode(ddata->db) != 1)
+        return 3;
+
+    ddata->pipe.count = 0;
+    ddata->pipe.active = 1;
+    return 0;
+#else
+    GDSQL_Log(LOG_WARNING,
+              ("%s: pipelines not supported by this libpq",
+               DBNAME));
+    return 3;
+#endif
+}
+
+static int gdsql_postgres_db_pipeline_sync(gdsql_dbh* db)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 1;
+
+    Pipeline* pipe = &ddata->pipe;
+    if (! pipe->active)
+        return 2;
+
+    int ret = 0;
+#ifdef LIBPQ_HAS_PIPELINING
+    GDSQL_Log(LOG_INFO,
+              ("%s: syncing pipeline with %d items",
+               DBNAME, pipe->count));
+    if (PQpipelineSync(ddata->db) != 1)
+        return 3;
+
+    // Collect one result (plus its terminating null) per item, in the
+    // order they were queued, and then the sync marker.
+    int k = 0;
+    for (k = 0; k < pipe->count; ++k) {
+        PipeItem* item = &pipe->items[k];
+        PGresult* res = PQgetResult(ddata->db);
+        ExecStatusType st = PQresultStatus(res);
+
+        int code = 0;
+        if (st == PGRES_PIPELINE_ABORTED)
+            code = 8;
+        else if (st != PGRES_COMMAND_OK &&
+                 st != PGRES_TUPLES_OK) {
+            GDSQL_Log(LOG_WARNING,
+                      ("%s: pipeline item %d failed: %s",
+                       DBNAME, k, res ? PQresultErrorMessage(res)
+                                      : PQerrorMessage(ddata->db)));
+            code = 6;
+        }
+        PQclear(res);
+        while ((res = PQgetResult(ddata->db)) != 0)
+            PQclear(res);
+
+        if (code != 0 && ret == 0)
+            ret = 4;
+
+        gdsql_stmth* stmt = item->stmt;
+        if (stmt == 0)
+            continue;
+
+        if (item->prepare && code == 0 && item->name != 0)
+            gdsql_cache_put(stmt->gdsql_db, stmt->query, item->name);
+        if (item->prepare && code != 0) {
+            // The statement will have to be prepared again.
+            StmtData* sdata = (StmtData*) stmt->data;
+            if (sdata != 0 && sdata->name == item->name) {
+                free(sdata->name);
+                sdata->name = 0;
+            }
+            if (ddata->unnamed == stmt)
+                ddata->unnamed = 0;
+            stmt->state = STMT_STATE_DEFINED;
+        }
+
+        // Keep the first failure of each statement.
+        if (stmt->status <= 0)
+            stmt->status = code;
+    }
+
+    PGresult* res = PQgetResult(ddata->db);
+    if (PQresultStatus(res) != PGRES_PIPELINE_SYNC && ret == 0)
+        ret = 5;
+    PQclear(res);
+#endif
+
+    pipe->count = 0;
+    return ret;
+}
+
+static int gdsql_postgres_db_pipeline_end(gdsql_dbh* db)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 1;
+
+    if (! ddata->pipe.active)
+        return 2;
+
+    int ret = 0;
+    if (ddata->pipe.count > 0)
+        ret = gdsql_postgres_db_pipeline_sync(db);
+
+#ifdef LIBPQ_HAS_PIPELINING
+    GDSQL_Log(LOG_INFO,
+              ("%s: leaving pipeline mode",
+               DBNAME));
+    if (PQexitPipelineMode(ddata->db) != 1 && ret == 0)
+        ret = 3;
+#endif
+
+    ddata->pipe.active = 0;
+
+    // Now we can get rid of the statements finalized or evicted while
+    // the pipeline was open.
+    int k = 0;
+    for (k = 0; k < ddata->pipe.drop_count; ++k)
+        drop_statement(ddata, ddata->pipe.drops[k]);
+    ddata->pipe.drop_count = 0;
+
+    return ret;
+}
+
+static int gdsql_postgres_stmt_pipeline_queue(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 2;
+
+    Pipeline* pipe = &ddata->pipe;
+    if (! pipe->active)
+        return 3;
+
+#ifdef LIBPQ_HAS_PIPELINING
+    // Statements that are not prepared (or lost the unnamed slot to
+    // another statement) get their preparation queued first.
+    if (stmt->state < STMT_STATE_PREPARED ||
+        (sdata->name == 0 && ddata->unnamed != stmt)) {
+        char* cached = (char*) gdsql_cache_get(stmt->gdsql_db,
+                                               stmt->query);
+        if (cached != 0)
+            sdata->name = cached;
+        else {
+            char name[32];
+            name[0] = '\0';
+            if (gdsql_cache_enabled(stmt->gdsql_db))
+                sprintf(name, "gdsql_%u", ++ddata->nstmt);
+
+            GDSQL_Log(LOG_INFO,
+                      ("%s: queueing preparation of [%s] as [%s]",
+                       DBNAME, stmt->query, name));
+            if (PQsendPrepare(ddata->db, name, stmt->query, 0, 0) != 1)
+                return 4;
+
+            if (name[0] != '\0')
+                sdata->name = strdup(name);
+            else
+                ddata->unnamed = stmt;
+            if (pipe_push(pipe, stmt, 1, sdata->name) != 0)
+                return 5;
+        }
+
+        stmt->state = STMT_STATE_PREPARED;
+    }
+
+    Param* param = &sdata->param;
+    GDSQL_Log(LOG_INFO,
+              ("%s: queueing execution of [%s] with %d params",
+               DBNAME, stmt->query, param->next));
+    if (PQsendQueryPrepared(ddata->db,
+                            sdata->name ? sdata->name : "",
+                            param->next,
+                            param->val,
+                            param->len,
+                            param->bin,
+                            1) != 1)
+        return 4;
+
+    if (pipe_push(pipe, stmt, 0, 0) != 0)
+        return 5;
+
+    return 0;
+#else
+    return 4;
+#endif
+}
+
+static int gdsql_postgres_db_get_socket(gdsql_dbh* db)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return -1;
+
+    return PQsocket(ddata->db);
+}
+
+static int gdsql_postgres_stmt_start(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 2;
+
+    if ((stmt->fetch_mode != GDSQL_FETCH_DEFAULT &&
+         stmt->fetch_mode != GDSQL_FETCH_BUFFERED) ||
+        sdata->pending ||
+        ddata->pipe.active)
+        return 3;
+
+    if (sdata->result != 0)
+        PQclear(sdata->result);
+    sdata->result = 0;
+
+    // Without this, sending a query with big parameters could block
+    // until the server reads them.
+    if (PQsetnonblocking(ddata->db, 1) != 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not set non-blocking mode: %s",
+                   DBNAME, PQerrorMessage(ddata->db)));
+        return 4;
+    }
+
+    // Run the prepared statement if we have one; otherwise send the
+    // query with its parameters, which needs no extra round trip but
+    // takes over the unnamed statement.
+    Param* param = &sdata->param;
+    int ok = 0;
+    if (stmt->state >= STMT_STATE_PREPARED &&
+        (sdata->name != 0 || ddata->unnamed == stmt)) {
+        GDSQL_Log(LOG_INFO,
+                  ("%s: starting prepared statement [%s]",
+                   DBNAME, stmt->query));
+        ok = PQsendQueryPrepared(ddata->db,
+                                 sdata->name ? sdata->name : "",
+                                 param->next,
+                                 param->val,
+                                 param->len,
+                                 param->bin,
+                                 1);
+    } else {
+        GDSQL_Log(LOG_INFO,
+                  ("%s: starting statement [%s]",
+                   DBNAME, stmt->query));
+        ok = PQsendQueryParams(ddata->db,
+                               stmt->query,
+                               param->next,
+                               0,
+                               param->val,
+                               param->len,
+                               param->bin,
+                               1);
+        ddata->unnamed = 0;
+    }
+
+    if (ok != 1 || PQflush(ddata->db) < 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not send query: %s",
+                   DBNAME, PQerrorMessage(ddata->db)));
+        PQsetnonblocking(ddata->db, 0);
+        return 5;
+    }
+
+    sdata->pending = 1;
+    return 0;
+}
+
+static int gdsql_postgres_stmt_poll(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0 || ! sdata->pending)
+        return GDSQL_POLL_ERROR;
+
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return GDSQL_POLL_ERROR;
+
+    // Whatever the query did not send yet goes first; reading in
+    // between keeps the server from blocking on us meanwhile.
+    int flush = PQflush(ddata->db);
+    if (flush < 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not send query: %s",
+                   DBNAME, PQerrorMessage(ddata->db)));
+        return GDSQL_POLL_ERROR;
+    }
+
+    if (PQconsumeInput(ddata->db) != 1) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not read from server: %s",
+                   DBNAME, PQerrorMessage(ddata->db)));
+        return GDSQL_POLL_ERROR;
+    }
+
+    if (flush > 0)
+        return GDSQL_POLL_BUSY;
+
+    return PQisBusy(ddata->db) ? GDSQL_POLL_BUSY : GDSQL_POLL_DONE;
+}
+
+static int gdsql_postgres_stmt_complete(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0 || ! sdata->pending)
+        return 1;
+
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 2;
+
+    // Back to blocking mode, which also sends anything still unsent.
+    sdata->pending = 0;
+    if (PQsetnonblocking(ddata->db, 0) != 0)
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not set blocking mode: %s",
+                   DBNAME, PQerrorMessage(ddata->db)));
+    int ret = take_result(sdata, PQgetResult(ddata->db));
+
+    PGresult* res = 0;
+    while ((res = PQgetResult(ddata->db)) != 0)
+        PQclear(res);
+
+    if (ret != 0)
+        return ret;
+
+    stmt->state = STMT_STATE_EXECUTED;
+    return 0;
+}
+
+static int gdsql_postgres_db_exec(gdsql_dbh* db,
+                                  const char* sql)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 3;
+
+    if (ddata->pipe.active)
+        return 4;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: running [%s]",
+               DBNAME, sql));
+    PGresult* res = run_query(ddata, sql, 0, 0);
+    ExecStatusType st = PQresultStatus(res);
+    PQclear(res);
+    if (st != PGRES_COMMAND_OK && st != PGRES_TUPLES_OK) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: [%s] failed: %s",
+                   DBNAME, sql, PQerrorMessage(ddata->db)));
+        return 5;
+    }
+
+    return 0;
+}
+
+static int gdsql_postgres_db_ping(gdsql_dbh* db)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 3;
+
+    if (PQstatus(ddata->db) != CONNECTION_OK)
+        return 4;
+
+    // An empty query is the cheapest round trip there is.
+    PGresult* res = run_query(ddata, "", 0, 0);
+    ExecStatusType st = PQresultStatus(res);
+    PQclear(res);
+    if (st != PGRES_EMPTY_QUERY) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: ping failed: %s",
+                   DBNAME, PQerrorMessage(ddata->db)));
+        return 5;
+    }
+
+    return 0;
+}
+
+static int gdsql_postgres_stmt_render_params(gdsql_stmth* stmt,
+                                             char* buf,
+                                             int size)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    // The values are kept in wire format, ready to send.
+    const Param* param = &sdata->param;
+    ParamText text = { buf, size, 0 };
+    int j = 0;
+    for (j = 0; j < param->next; ++j) {
+        const char* val = param->val[j];
+        if (val == 0) {
+            param_text_null(&text);
+            continue;
+        }
+
+        switch (param->type[j]) {
+        case STMT_VAL_INT:
+            param_text_int(&text, get_int32(val));
+            break;
+        case STMT_VAL_DOUBLE:
+            param_text_double(&text, get_double(val));
+            break;
+        case STMT_VAL_STRING:
+            param_text_string(&text, val, param->len[j]);
+            break;
+        case STMT_VAL_DATE:
+            param_text_date(&text, get_date(val));
+            break;
+        case STMT_VAL_BOOLEAN:
+            param_text_int(&text, get_int8(val));
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Run a query and wait for its result.  Anything sent this way, even
+ * without parameters, replaces the unnamed statement on the server,
+ * so whoever was using it will have to prepare it again.
+ */
+static PGresult* run_query(DbData* ddata,
+                           const char* sql,
+                           const Param* param,
+                           int binary)
+{
+    ddata->unnamed = 0;
+    if (param == 0 && ! binary)
+        return PQexec(ddata->db, sql);
+
+    return PQexecParams(ddata->db,
+                        sql,
+                        param ? param->next : 0,
+                        0,
+                        param ? param->val : 0,
+                        param ? param->len : 0,
+                        param ? param->bin : 0,
+                        binary);
+}
+
+static int deallocate_statement(DbData* ddata,
+                                const char* name)
+{
+    char sql[64];
+    sprintf(sql, "DEALLOCATE %s", name);
+
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: deallocating statement %s",
+               DBNAME, name));
+    PGresult* res = run_query(ddata, sql, 0, 0);
+    if (res == 0)
+        return 1;
+
+    ExecStatusType st = PQresultStatus(res);
+    PQclear(res);
+    if (st != PGRES_COMMAND_OK)
+        return 2;
+
+    return 0;
+}
+
+/*
+ * Deallocate a named statement and free its name.  Nothing but queued
+ * work can be sent while a pipeline is open, so until it ends the
+ * name is only remembered.
+ */
+static int drop_statement(DbData* ddata,
+                          char* name)
+{
+    Pipeline* pipe = &ddata->pipe;
+    if (! pipe->active) {
+        int ret = deallocate_statement(ddata, name);
+        free(name);
+        return ret;
+    }
+
+    if (pipe->drop_count >= pipe->drop_size) {
+        int size = pipe->drop_size ? 2 * pipe->drop_size : 16;
+        char** drops = (char**) realloc(pipe->drops,
+                                        size * sizeof(char*));
+        if (drops == 0) {
+            free(name);
+            return 1;
+        }
+
+        pipe->drops = drops;
+        pipe->drop_size = size;
+    }
+
+    pipe->drops[pipe->drop_count++] = name;
+    return 0;
+}
+
+/*
+ * The slot for the parameter at pos, replacing whatever was bound
+ * there before; slots skipped over are sent as NULL.  Return -1 if
+ * pos is out of range.
+ */
+static int param_slot(Param* param,
+                      int pos)
+{
+    if (pos < 1 || pos > STMT_MAX_PARAMS)
+        return -1;
+
+    while (param->next < pos) {
+        param->val[param->next] = 0;
+        param->len[param->next] = 0;
+        param->bin[param->next] = 1;
+        param->type[param->next] = STMT_VAL_INVALID;
+        ++param->next;
+    }
+
+    return pos - 1;
+}
+
+static int encode_array_value(Param* param,
+                              int j,
+                              const ArrayParam* ap,
+                              int row)
+{
+    param->bin[j] = 1;
+    param->type[j] = ap->type;
+    if (ap->nulls != 0 && ap->nulls[row]) {
+        param->val[j] = 0;
+        param->len[j] = 0;
+        return 0;
+    }
+
+    param->val[j] = param->buf[j];
+    switch (ap->type) {
+    case STMT_VAL_INT:
+        param->len[j] = put_int32(((const int*) ap->vals)[row],
+                                  param->buf[j]);
+        break;
+    case STMT_VAL_DOUBLE:
+        param->len[j] = put_double(((const double*) ap->vals)[row],
+                                   param->buf[j]);
+        break;
+    case STMT_VAL_DATE:
+        param->len[j] = put_date(((const double*) ap->vals)[row],
+                                 param->buf[j]);
+        break;
+    case STMT_VAL_BOOLEAN:
+        param->len[j] = put_int8((int8) ((const int*) ap->vals)[row],
+                                 param->buf[j]);
+        break;
+    case STMT_VAL_STRING:
+        // Strings are sent straight from the caller's memory.
+        param->val[j] = ((const char* const*) ap->vals)[row];
+        param->len[j] = ap->lens ? ap->lens[row] : strlen(param->val[j]);
+        break;
+    }
+
+    return 0;
+}
+
+
+static int fetch_column(Col* col,
+                        const char* val,
+                        int len,
+                        int null)
+{
+    col->null = null;
+    switch (col->type) {
+    case STMT_VAL_INT:
+        GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                   ("%s: column %d int%s",
+                    DBNAME, col->pos,
+                    null ? " NULL" : ""));
+        *(col->val.ival) = null ? 0 : get_int32(val);
+        break;
+    case STMT_VAL_DOUBLE:
+        GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                   ("%s: column %d double%s",
+                    DBNAME, col->pos,
+                    null ? " NULL" : ""));
+        *(col->val.dval) = null ? 0.0 : get_double(val);
+        break;
+    case STMT_VAL_STRING:
+        GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                   ("%s: column %d string%s",
+                    DBNAME, col->pos,
+                    null ? " NULL" : ""));
+        // Values are not always null-terminated (COPY data is not).
+        if (null || len < 0)
+            len = 0;
+        if (len >= col->len)
+            len = col->len - 1;
+        if (len < 0)
+            break;
+        memcpy(col->val.sval, val, len);
+        col->val.sval[len] = '\0';
+        break;
+    case STMT_VAL_DATE:
+        GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                   ("%s: column %d date%s",
+                    DBNAME, col->pos,
+                    null ? " NULL" : ""));
+        *(col->val.dval) = null ? 0.0 : get_date(val);
+        break;
+    case STMT_VAL_BOOLEAN:
+        GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                   ("%s: column %d boolean%s",
+                    DBNAME, col->pos,
+                    null ? " NULL" : ""));
+        *(col->val.ival) = null ? 0 : get_int8(val);
+        break;
+    }
+
+    return 0;
+}
+
+/*
+ * Keep the result of running a statement, ready to be stepped through.
+ */
+static int take_result(StmtData* sdata,
+                       PGresult* res)
+{
+    sdata->result = res;
+    sdata->cursor.rows = 0;
+    sdata->cursor.cols = 0;
+    sdata->cursor.next = 0;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: result = %p",
+               DBNAME, res));
+    if (res == 0)
+        return 5;
+
+    ExecStatusType st = PQresultStatus(res);
+    GDSQL_Log(LOG_INFO,
+              ("%s: st = %d (%d / %d)",
+               DBNAME, (int) st,
+               (int) PGRES_COMMAND_OK, (int) PGRES_TUPLES_OK));
+    if (st != PGRES_COMMAND_OK &&
+        st != PGRES_TUPLES_OK)
+        return 6;
+
+    if (st == PGRES_TUPLES_OK) {
+        sdata->cursor.rows = PQntuples(res);
+        sdata->cursor.cols = PQnfields(res);
+        GDSQL_Log(LOG_INFO,
+                  ("%s: result size = %d x %d",
+                   DBNAME, sdata->cursor.rows, sdata->cursor.cols));
+    }
+
+    return 0;
+}
+
+static int start_copy_out(gdsql_stmth* stmt,
+                          DbData* ddata)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+
+    // COPY cannot take parameters.
+    if (sdata->param.next > 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: cannot bind parameters for a COPY [%s]",
+                   DBNAME, stmt->query));
+        return 8;
+    }
+
+    char sql[sizeof(stmt->query) + 64];
+    sprintf(sql, "COPY (%s) TO STDOUT (FORMAT binary)", stmt->query);
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: starting copy [%s]",
+               DBNAME, sql));
+    PGresult* res = run_query(ddata, sql, 0, 0);
+    if (res == 0)
+        return 5;
+
+    ExecStatusType st = PQresultStatus(res);
+    if (st != PGRES_COPY_OUT)
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not start copy: %s",
+                   DBNAME, PQresultErrorMessage(res)));
+    PQclear(res);
+    if (st != PGRES_COPY_OUT)
+        return 6;
+
+    CopyOut* copy = &sdata->copy;
+    copy->buf = 0;
+    copy->len = 0;
+    copy->pos = 0;
+    copy->active = 1;
+    copy->header = 1;
+    return 0;
+}
+
+/*
+ * Decode the next row of a COPY into the bound result variables.
+ * Return 0 if there was a row, -1 at the end of the data, and a
+ * positive error code otherwise.
+ */
+static int read_copy_row(gdsql_stmth* stmt,
+                         PGconn* conn)
+{
+    static const char signature[] = "PGCOPY\n\377\r\n";
+
+    StmtData* sdata = (StmtData*) stmt->data;
+    CopyOut* copy = &sdata->copy;
+    if (! copy->active)
+        return -1;
+
+    int ret = 0;
+    while (copy->pos >= copy->len) {
+        ret = next_copy_message(copy, conn);
+        if (ret != 0)
+            return ret;
+
+        if (copy->header) {
+            if (copy->len < COPY_HEADER_SIZE ||
+                memcmp(copy->buf, signature, 11) != 0) {
+                abort_copy_out(copy, conn);
+                return 9;
+            }
+
+            // Skip the signature, the flags and the header extension.
+            copy->pos = COPY_HEADER_SIZE + get_int32(copy->buf + 15);
+            copy->header = 0;
+        }
+    }
+
+    const char* buf = copy->buf + copy->pos;
+    int left = copy->len - copy->pos;
+    if (left < 2) {
+        abort_copy_out(copy, conn);
+        return 9;
+    }
+
+    int nfields = get_int16(buf);
+    buf += 2;
+    left -= 2;
+    if (nfields < 0) {
+        // End of data: the server has nothing else to send.
+        copy->pos = copy->len;
+        while ((ret = next_copy_message(copy, conn)) == 0)
+            ;
+        return ret;
+    }
+
+    const char* val[STMT_MAX_COLS];
+    int len[STMT_MAX_COLS];
+    int k = 0;
+    for (k = 0; k < nfields; ++k) {
+        if (left < 4) {
+            abort_copy_out(copy, conn);
+            return 9;
+        }
+
+        int l = get_int32(buf);
+        buf += 4;
+        left -= 4;
+        if (l > left) {
+            abort_copy_out(copy, conn);
+            return 9;
+        }
+
+        if (k < STMT_MAX_COLS) {
+            val[k] = buf;
+            len[k] = l;
+        }
+        if (l > 0) {
+            buf += l;
+            left -= l;
+        }
+    }
+    copy->pos = copy->len - left;
+
+    GDSQL_LogC(LOG_CAT_STEP, LOG_INFO,
+               ("%s: stepping copy [%s]",
+                DBNAME, stmt->query));
+
+    unsigned long long t0 = STMT_STATS_START(stmt);
+    int j = 0;
+    Row* row = &sdata->cursor.row;
+    for (j = 0; j < row->ncol; ++j) {
+        int pos = row->cols[j].pos;
+        if (pos >= nfields || pos >= STMT_MAX_COLS)
+            fetch_column(&row->cols[j], 0, 0, 1);
+        else
+            fetch_column(&row->cols[j], val[pos], len[pos], len[pos] < 0);
+    }
+    if (t0 != 0)
+        stmt_stats_row(stmt, t0, row_bytes(row));
+
+    return 0;
+}
+
+/*
+ * Get the next CopyData message from the server, releasing the
+ * previous one.  Return 0 if there was a message, -1 when the copy
+ * finished successfully, and a positive error code otherwise.
+ */
+static int next_copy_message(CopyOut* copy,
+                             PGconn* conn)
+{
+    if (copy->buf != 0)
+        PQfreemem(copy->buf);
+    copy->buf = 0;
+    copy->len = 0;
+    copy->pos = 0;
+
+    int n = PQgetCopyData(conn, &copy->buf, 0);
+    if (n > 0) {
+        copy->len = n;
+        return 0;
+    }
+
+    if (n == -1)
+        return finish_copy_out(copy, conn) == 0 ? -1 : 6;
+
+    GDSQL_Log(LOG_WARNING,
+              ("%s: could not read copy data: %s",
+               DBNAME, PQerrorMessage(conn)));
+    finish_copy_out(copy, conn);
+    return 5;
+}
+
+static int finish_copy_out(CopyOut* copy,
+                           PGconn* conn)
+{
+    int ret = 0;
+    PGresult* res = 0;
+    while ((res = PQgetResult(conn)) != 0) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK && ret == 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("%s: copy failed: %s",
+                       DBNAME, PQresultErrorMessage(res)));
+            ret = 1;
+        }
+        PQclear(res);
+    }
+
+    copy->active = 0;
+    return ret;
+}
+
+/*
+ * Stop a COPY that has not been read to the end.  The server is asked
+ * to cancel it, and whatever it already sent is thrown away, so that
+ * the connection can be used again.
+ */
+static int abort_copy_out(CopyOut* copy,
+                          PGconn* conn)
+{
+    GDSQL_Log(LOG_INFO,
+              ("%s: aborting copy",
+               DBNAME));
+
+    cancel_query(conn);
+
+    if (copy->buf != 0)
+        PQfreemem(copy->buf);
+    copy->buf = 0;
+    copy->len = 0;
+    copy->pos = 0;
+
+    char* buf = 0;
+    while (PQgetCopyData(conn, &buf, 0) > 0) {
+        PQfreemem(buf);
+        buf = 0;
+    }
+
+    // An error result is expected here, since we cancelled the copy.
+    PGresult* res = 0;
+    while ((res = PQgetResult(conn)) != 0)
+        PQclear(res);
+
+    copy->active = 0;
+    return 0;
+}
+
+static int write_fully(int fd,
+                       const char* buf,
+                       int len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+
+static int start_stream(gdsql_stmth* stmt,
+                        PGconn* conn)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    Param* param = &sdata->param;
+
+    if (PQsendQueryPrepared(conn,
+                            sdata->name ? sdata->name : "",
+                            param->next,
+                            param->val,
+                            param->len,
+                            param->bin,
+                            1) != 1) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not send query: %s",
+                   DBNAME, PQerrorMessage(conn)));
+        return 5;
+    }
+
+    int ok = 0;
+#ifdef LIBPQ_HAS_CHUNK_MODE
+    if (stmt->fetch_size > 1)
+        ok = PQsetChunkedRowsMode(conn, stmt->fetch_size);
+    else
+#endif
+        ok = PQsetSingleRowMode(conn);
+
+    sdata->cursor.rows = 0;
+    sdata->cursor.cols = 0;
+    sdata->cursor.next = 0;
+    sdata->cursor.streaming = 1;
+    if (! ok) {
+        abort_stream(sdata, conn);
+        return 5;
+    }
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: streaming results for [%s]",
+               DBNAME, stmt->query));
+    return 0;
+}
+
+/*
+ * Replace the current result with the next one sent by the server.
+ * Return 0 if it has rows, -1 when there are no more results, and a
+ * positive error code otherwise.
+ */
+static int next_stream_result(StmtData* sdata,
+                              PGconn* conn)
+{
+    if (sdata->result != 0)
+        PQclear(sdata->result);
+    sdata->result = 0;
+    sdata->cursor.rows = 0;
+    sdata->cursor.next = 0;
+
+    PGresult* res = PQgetResult(conn);
+    ExecStatusType st = PQresultStatus(res);
+    if (st == PGRES_SINGLE_TUPLE
+#ifdef LIBPQ_HAS_CHUNK_MODE
+        || st == PGRES_TUPLES_CHUNK
+#endif
+        ) {
+        sdata->result = res;
+        sdata->cursor.rows = PQntuples(res);
+        sdata->cursor.cols = PQnfields(res);
+        return 0;
+    }
+
+    // The final result has no rows; anything else is an error.
+    int ret = -1;
+    if (st != PGRES_TUPLES_OK &&
+        st != PGRES_COMMAND_OK) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not get results: %s",
+                   DBNAME, res ? PQresultErrorMessage(res)
+                               : PQerrorMessage(conn)));
+        ret = 6;
+    }
+
+    PQclear(res);
+    while ((res = PQgetResult(conn)) != 0)
+        PQclear(res);
+    sdata->cursor.streaming = 0;
+
+    return ret;
+}
+
+/*
+ * Stop reading results before the end (of a stream, or of a statement
+ * that was started but not completed): the server is asked to cancel
+ * the query, and whatever it already sent is thrown away.
+ */
+static int abort_stream(StmtData* sdata,
+                        PGconn* conn)
+{
+    GDSQL_Log(LOG_INFO,
+              ("%s: aborting streamed results",
+               DBNAME));
+
+    cancel_query(conn);
+    if (sdata->pending)
+        PQsetnonblocking(conn, 0);
+
+    if (sdata->result != 0)
+        PQclear(sdata->result);
+    sdata->result = 0;
+
+    PGresult* res = 0;
+    while ((res = PQgetResult(conn)) != 0)
+        PQclear(res);
+
+    sdata->cursor.rows = 0;
+    sdata->cursor.next = 0;
+    sdata->cursor.streaming = 0;
+    sdata->pending = 0;
+    return 0;
+}
+
+static void cancel_query(PGconn* conn)
+{
+    PGcancel* cancel = PQgetCancel(conn);
+    if (cancel == 0)
+        return;
+
+    char err[256];
+    if (PQcancel(cancel, err, sizeof(err)) != 1)
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not cancel query: %s",
+                   DBNAME, err));
+    PQfreeCancel(cancel);
+}
+
+
+static int declare_cursor(gdsql_stmth* stmt,
+                          DbData* ddata)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    PGconn* conn = ddata->db;
+    Param* param = &sdata->param;
+
+    // Outside a transaction a cursor only survives if it is held.
+    int hold = PQtransactionStatus(conn) == PQTRANS_IDLE;
+
+    char name[32];
+    sprintf(name, "gdsql_cur_%u", ++ddata->ncursor);
+
+    char sql[sizeof(stmt->query) + 96];
+    sprintf(sql, "DECLARE %s NO SCROLL CURSOR %s FOR %s",
+            name, hold ? "WITH HOLD" : "WITHOUT HOLD", stmt->query);
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: declaring cursor [%s]",
+               DBNAME, sql));
+    PGresult* res = run_query(ddata, sql, param, 1);
+    ExecStatusType st = PQresultStatus(res);
+    if (st != PGRES_COMMAND_OK)
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not declare cursor: %s",
+                   DBNAME, res ? PQresultErrorMessage(res)
+                               : PQerrorMessage(conn)));
+    PQclear(res);
+    if (st != PGRES_COMMAND_OK)
+        return 6;
+
+    strcpy(sdata->cursor.portal, name);
+    sdata->cursor.rows = 0;
+    sdata->cursor.cols = 0;
+    sdata->cursor.next = 0;
+    return 0;
+}
+
+/*
+ * Replace the current result with the next batch of rows from the
+ * cursor.  Return 0 if there are rows, -1 when the cursor is done,
+ * and a positive error code otherwise.
+ */
+static int fetch_cursor(gdsql_stmth* stmt,
+                        DbData* ddata)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata->result != 0)
+        PQclear(sdata->result);
+    sdata->result = 0;
+    sdata->cursor.rows = 0;
+    sdata->cursor.next = 0;
+
+    int size = stmt->fetch_size > 0 ? stmt->fetch_size : STMT_CURSOR_FETCH;
+    char sql[64];
+    sprintf(sql, "FETCH FORWARD %d FROM %s", size, sdata->cursor.portal);
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: fetching [%s]",
+               DBNAME, sql));
+    PGresult* res = run_query(ddata, sql, 0, 1);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not fetch from cursor: %s",
+                   DBNAME, res ? PQresultErrorMessage(res)
+                               : PQerrorMessage(ddata->db)));
+        PQclear(res);
+        close_cursor(sdata, ddata);
+        return 6;
+    }
+
+    sdata->result = res;
+    sdata->cursor.rows = PQntuples(res);
+    sdata->cursor.cols = PQnfields(res);
+
+    // A short batch is the last one, so there is no need to ask again.
+    if (sdata->cursor.rows < size)
+        close_cursor(sdata, ddata);
+
+    return sdata->cursor.rows > 0 ? 0 : -1;
+}
+
+static int close_cursor(StmtData* sdata,
+                        DbData* ddata)
+{
+    char sql[64];
+    sprintf(sql, "CLOSE %s", sdata->cursor.portal);
+    sdata->cursor.portal[0] = '\0';
+
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: closing cursor [%s]",
+               DBNAME, sql));
+    PGresult* res = run_query(ddata, sql, 0, 0);
+    ExecStatusType st = PQresultStatus(res);
+    PQclear(res);
+
+    // This fails, harmlessly, if the transaction was aborted.
+    return st == PGRES_COMMAND_OK ? 0 : 1;
+}
+
+
+static int pipe_push(Pipeline* pipe,
+                     gdsql_stmth* stmt,
+                     int prepare,
+                     char* name)
+{
+    if (pipe->count >= pipe->size) {
+        int size = pipe->size ? 2 * pipe->size : 64;
+        PipeItem* items = (PipeItem*) realloc(pipe->items,
+                                              size * sizeof(PipeItem));
+        if (items == 0)
+            return 1;
+
+        pipe->items = items;
+        pipe->size = size;
+    }
+
+    PipeItem* item = &pipe->items[pipe->count++];
+    item->stmt = stmt;
+    item->prepare = prepare;
+    item->name = name;
+    return 0;
+}
+
 
 static int8 get_int8(const char* buf)
 {
@@ -0,0 +1,215 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <gdsql_log.h>
+#include <gdsql_hidden.h>
+#include <gdsql_slow.h>
+
+// Room for the bound values of one statement in a record.
+#define SLOW_PARAMS_SIZE  1024
+
+static int rotate(void);
+static void write_record(gdsql_stmth* stmt,
+                         const gdsql_stmt_stats* delta,
+                         unsigned long long total);
+
+/*
+ * Read without the lock by STMT_STATS_START on every call; everything
+ * else only changes under slow_lock.
+ */
+int slow_log_on = 0;
+
+static pthread_mutex_t slow_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* slow_file = 0;
+static char slow_path[1024];
+static unsigned long long slow_nsecs = 0;
+static long slow_max_bytes = GDSQL_SLOW_DEFAULT_BYTES;
+static int slow_max_files = GDSQL_SLOW_DEFAULT_FILES;
+static long slow_bytes = 0;
+
+
+int gdsql_slow_log_open(const char* path,
+                        int msecs,
+                        long max_bytes,
+                        int max_files)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&slow_lock);
+    do {
+        if (path == 0 || path[0] == '\0' ||
+            strlen(path) >= sizeof(slow_path) - 16 ||
+            msecs < 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid slow query log settings"));
+            ret = 1;
+            break;
+        }
+
+        FILE* f = fopen(path, "a");
+        if (f == 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Could not open slow query log [%s]",
+                       path));
+            ret = 2;
+            break;
+        }
+
+        if (slow_file != 0)
+            fclose(slow_file);
+        slow_file = f;
+        strcpy(slow_path, path);
+        __atomic_store_n(&slow_nsecs, msecs * 1000000ULL, __ATOMIC_RELAXED);
+        slow_max_bytes = max_bytes > 0 ? max_bytes : GDSQL_SLOW_DEFAULT_BYTES;
+        slow_max_files = max_files > 0 ? max_files : GDSQL_SLOW_DEFAULT_FILES;
+        fseek(slow_file, 0, SEEK_END);
+        slow_bytes = ftell(slow_file);
+        __atomic_store_n(&slow_log_on, 1, __ATOMIC_RELAXED);
+
+        GDSQL_Log(LOG_INFO,
+                  ("Logging queries slower than %d ms to [%s]",
+                   msecs, path));
+    } while (0);
+    pthread_mutex_unlock(&slow_lock);
+
+    return ret;
+}
+
+int gdsql_slow_log_close(void)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&slow_lock);
+    do {
+        if (slow_file == 0) {
+            ret = 1;
+            break;
+        }
+
+        __atomic_store_n(&slow_log_on, 0, __ATOMIC_RELAXED);
+        if (fclose(slow_file) != 0)
+            ret = 2;
+        slow_file = 0;
+    } while (0);
+    pthread_mutex_unlock(&slow_lock);
+
+    return ret;
+}
+
+/*
+ * Everything counted since the last time we looked belongs to this
+ * run of the statement.
+ */
+void slow_log_check(gdsql_stmth* stmt)
+{
+    gdsql_stmt_stats* base = &stmt->slow_base;
+    gdsql_stmt_stats delta;
+
+    delta.executions = stmt->stats.executions - base->executions;
+    delta.rows = stmt->stats.rows - base->rows;
+    delta.bytes = stmt->stats.bytes - base->bytes;
+    delta.prepare_nsecs = stmt->stats.prepare_nsecs - base->prepare_nsecs;
+    delta.bind_nsecs = stmt->stats.bind_nsecs - base->bind_nsecs;
+    delta.execute_nsecs = stmt->stats.execute_nsecs - base->execute_nsecs;
+    delta.fetch_nsecs = stmt->stats.fetch_nsecs - base->fetch_nsecs;
+    delta.decode_nsecs = stmt->stats.decode_nsecs - base->decode_nsecs;
+    *base = stmt->stats;
+
+    if (! __atomic_load_n(&slow_log_on, __ATOMIC_RELAXED))
+        return;
+
+    unsigned long long total = delta.prepare_nsecs + delta.bind_nsecs +
+                               delta.execute_nsecs + delta.fetch_nsecs +
+                               delta.decode_nsecs;
+    if (total < __atomic_load_n(&slow_nsecs, __ATOMIC_RELAXED))
+        return;
+
+    write_record(stmt, &delta, total);
+}
+
+
+static void write_record(gdsql_stmth* stmt,
+                         const gdsql_stmt_stats* delta,
+                         unsigned long long total)
+{
+    gdsql_dbh* dh = stmt->gdsql_db;
+    char params[SLOW_PARAMS_SIZE];
+    char conn[256];
+    int Y, M, D, h, m, s;
+
+    params[0] = '\0';
+    const DbOps* ops = get_dbops(dh->type);
+    if (ops != 0 && ops->stmt_render_params != 0)
+        ops->stmt_render_params(stmt, params, sizeof(params));
+
+    if (dh->host[0] != '\0')
+        snprintf(conn, sizeof(conn), "%s@%s:%u/%s",
+                 dh->user, dh->host, dh->port, dh->name);
+    else
+        snprintf(conn, sizeof(conn), "%s", dh->name);
+
+    gdsql_get_now(&Y, &M, &D, &h, &m, &s, 0);
+
+    pthread_mutex_lock(&slow_lock);
+    do {
+        if (slow_file == 0)
+            break;
+
+        int len = fprintf(slow_file,
+                          "%04d%02d%02d %02d%02d%02d %s conn=%s"
+                          " total=%.3fms prepare=%.3f bind=%.3f"
+                          " execute=%.3f fetch=%.3f decode=%.3f"
+                          " executions=%lu rows=%lu bytes=%llu"
+                          " query=[%s] params=(%s)\n",
+                          Y, M, D, h, m, s, get_dbname(dh->type), conn,
+                          total / 1e6,
+                          delta->prepare_nsecs / 1e6,
+                          delta->bind_nsecs / 1e6,
+                          delta->execute_nsecs / 1e6,
+                          delta->fetch_nsecs / 1e6,
+                          delta->decode_nsecs / 1e6,
+                          delta->executions, delta->rows, delta->bytes,
+                          stmt->query, params);
+        fflush(slow_file);
+        if (len > 0)
+            slow_bytes += len;
+
+        if (slow_bytes >= slow_max_bytes)
+            rotate();
+    } while (0);
+    pthread_mutex_unlock(&slow_lock);
+}
+
+/*
+ * Move path.N-1 to path.N, ..., path to path.1, and start a new
+ * file; called with the lock held.
+ */
+static int rotate(void)
+{
+    char from[sizeof(slow_path) + 16];
+    char to[sizeof(slow_path) + 16];
+    int n;
+
+    fclose(slow_file);
+    slow_file = 0;
+    slow_bytes = 0;
+
+    for (n = slow_max_files - 1; n > 0; --n) {
+        snprintf(from, sizeof(from), "%s.%d", slow_path, n);
+        snprintf(to, sizeof(to), "%s.%d", slow_path, n + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", slow_path);
+    rename(slow_path, to);
+
+    slow_file = fopen(slow_path, "w");
+    if (slow_file == 0) {
+        __atomic_store_n(&slow_log_on, 0, __ATOMIC_RELAXED);
+        GDSQL_Log(LOG_WARNING,
+                  ("Could not reopen slow query log [%s]",
+                   slow_path));
+        return 1;
+    }
+
+    return 0;
+}
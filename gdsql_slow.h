@@ -0,0 +1,28 @@
+#ifndef GDSQL_SLOW_H_
+#define GDSQL_SLOW_H_
+
+/*
+ * Slow query log, written to its own file and not to the GDSQL_LOG
+ * stream.  Each time a statement is run and its rows are all read (or
+ * it is reset or finalized before that), the time spent in gdsql
+ * calls for it is added up: binding, preparing, executing, fetching
+ * and decoding rows, so it includes waiting for the server and the
+ * work done on the client.  If that reaches msecs milliseconds, one
+ * line is written with the connection, the times of each phase, the
+ * rows returned, the query and its bound values.
+ *
+ * Statements are timed (see gdsql_stmt_get_stats()) while the log is
+ * open.  When the file grows past max_bytes it is renamed to
+ * path.1 (path.1 to path.2, and so on), keeping max_files old files.
+ */
+
+#define GDSQL_SLOW_DEFAULT_BYTES  (16L * 1024 * 1024)
+#define GDSQL_SLOW_DEFAULT_FILES  4
+
+int gdsql_slow_log_open(const char* path,
+                        int msecs,
+                        long max_bytes,
+                        int max_files);
+int gdsql_slow_log_close(void);
+
+#endif
@@ -1,15 +1,45 @@
+#define LOG_CATEGORY LOG_CAT_SQLITE
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sqlite3.h>
 #include <gdsql_date.h>
 #include <gdsql_log.h>
 #include <gdsql_hidden.h>
+#include <gdsql_cache.h>
 #include <gdsql_util.h>
 
 #define DBNAME "SQLite"
 
+/*
+ * Bulk mode: write statements run in transactions that we commit
+ * every so many rows or milliseconds, with the ingest settings below
+ * in place; the previous settings are saved here and restored at the
+ * end.
+ */
+#define BULK_JOURNAL_MODE  "WAL"
+#define BULK_SYNCHRONOUS   "NORMAL"
+#define BULK_CACHE_SIZE    "-65536"     // in KiB, so 64 MiB
+#define BULK_TEMP_STORE    "MEMORY"
+
+typedef struct Bulk {
+    int active;
+    int open;                   // we have a transaction going
+    int rows;
+    int msecs;
+    int count;                  // rows in the current transaction
+    unsigned long long started;
+    unsigned long long commits;
+    char journal_mode[16];
+    char synchronous[16];
+    char cache_size[16];
+    char temp_store[16];
+} Bulk;
+
 typedef struct DbData {
     sqlite3* db;
+    Bulk bulk;
 } DbData;
 
 #define STMT_MAX_PARAMS        100
@@ -98,6 +128,44 @@ static int gdsql_sqlite_stmt_step(gdsql_stmth* stmt);
 static int gdsql_sqlite_stmt_is_column_null(gdsql_stmth* stmt,
                                             int pos);
 static int gdsql_sqlite_stmt_finalize(gdsql_stmth* stmt);
+static int gdsql_sqlite_stmt_reset(gdsql_stmth* stmt);
+static int gdsql_sqlite_stmt_clear_bindings(gdsql_stmth* stmt);
+static int gdsql_sqlite_stmt_execute_array(gdsql_stmth* stmt,
+                                           int* done);
+
+static int gdsql_sqlite_cache_evict(gdsql_dbh* db,
+                                    void* handle);
+
+static int gdsql_sqlite_db_bulk_begin(gdsql_dbh* db,
+                                      int rows,
+                                      int msecs);
+static int gdsql_sqlite_db_bulk_end(gdsql_dbh* db);
+
+static int gdsql_sqlite_db_exec(gdsql_dbh* db,
+                                const char* sql);
+static int gdsql_sqlite_db_ping(gdsql_dbh* db);
+
+static int gdsql_sqlite_stmt_render_params(gdsql_stmth* stmt,
+                                           char* buf,
+                                           int size);
+
+static int param_slot(Param* param,
+                      int pos);
+
+/*
+ * Bulk mode helpers.
+ */
+static int get_pragma(sqlite3* db,
+                      const char* name,
+                      char* val,
+                      int len);
+static int set_pragma(sqlite3* db,
+                      const char* name,
+                      const char* val);
+static int bulk_open(DbData* ddata);
+static int bulk_commit(DbData* ddata);
+static int bulk_tick(DbData* ddata,
+                     int rows);
 
 
 int gdsql_sqlite_boot(void)
@@ -125,6 +193,36 @@ int gdsql_sqlite_boot(void)
         gdsql_sqlite_stmt_step,
         gdsql_sqlite_stmt_is_column_null,
         gdsql_sqlite_stmt_finalize,
+        gdsql_sqlite_stmt_reset,
+        gdsql_sqlite_stmt_clear_bindings,
+        gdsql_sqlite_stmt_execute_array,
+        gdsql_sqlite_cache_evict,
+        0,   // load_begin
+        0,   // load_put_null
+        0,   // load_put_int
+        0,   // load_put_double
+        0,   // load_put_string
+        0,   // load_put_date
+        0,   // load_put_boolean
+        0,   // load_end_row
+        0,   // load_flush
+        0,   // load_end
+        0,   // load_abort
+        0,   // stmt_set_fetch
+        0,   // stmt_export
+        0,   // db_pipeline_begin
+        0,   // db_pipeline_sync
+        0,   // db_pipeline_end
+        0,   // stmt_pipeline_queue
+        0,   // db_get_socket
+        0,   // stmt_start
+        0,   // stmt_poll
+        0,   // stmt_complete
+        gdsql_sqlite_db_bulk_begin,
+        gdsql_sqlite_db_bulk_end,
+        gdsql_sqlite_db_exec,
+        gdsql_sqlite_db_ping,
+        gdsql_sqlite_stmt_render_params,
     };
 
     GDSQL_Log(LOG_INFO,
@@ -145,6 +243,11 @@ static int gdsql_sqlite_init(void)
     if (sqlite3_initialize() != SQLITE_OK)
         ret = 1;
 
+    if (! sqlite3_threadsafe())
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: library was built without thread support",
+                   DBNAME));
+
     return ret;
 }
 
@@ -184,6 +287,7 @@ static int gdsql_sqlite_db_open(gdsql_dbh* db)
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     DbData* ddata = (DbData*) malloc(sizeof(DbData));
+    memset(ddata, 0, sizeof(DbData));
     ddata->db = sql_db;
     db->data = ddata;
     return 0;
@@ -206,6 +310,9 @@ static int gdsql_sqlite_db_close(gdsql_dbh* db)
                 break;
             }
 
+            if (ddata->bulk.active)
+                gdsql_sqlite_db_bulk_end(db);
+
             GDSQL_Log(LOG_INFO,
                       ("%s: closing file [%s]",
                        DBNAME, db->name));
@@ -252,10 +359,19 @@ static int gdsql_sqlite_stmt_prepare(gdsql_stmth* stmt)
     if (sdata == 0)
         return 4;
 
+    sqlite3_stmt *sql_ps = (sqlite3_stmt*) gdsql_cache_get(stmt->gdsql_db,
+                                                           stmt->query);
+    if (sql_ps != 0) {
+        GDSQL_Log(LOG_INFO,
+                  ("%s: reusing cached statement [%s]",
+                   DBNAME, stmt->query));
+        sdata->ps = sql_ps;
+        return 0;
+    }
+
     GDSQL_Log(LOG_INFO,
               ("%s: preparing statement [%s]",
                DBNAME, stmt->query));
-    sqlite3_stmt *sql_ps = 0;
     if (sqlite3_prepare_v2(ddata->db,
                            stmt->query,
                            -1,
@@ -264,6 +380,7 @@ static int gdsql_sqlite_stmt_prepare(gdsql_stmth* stmt)
         return 5;
 
     sdata->ps = sql_ps;
+    gdsql_cache_put(stmt->gdsql_db, stmt->query, sql_ps);
     GDSQL_Log(LOG_INFO, ("%s: success!", DBNAME));
     return 0;
 }
@@ -274,13 +391,15 @@ static int gdsql_sqlite_stmt_bindp_null(gdsql_stmth* stmt,
     StmtData* sdata = (StmtData*) stmt->data;
     if (sdata == 0)
         return 1;
+
+    int j = param_slot(&sdata->param, pos);
+    if (j < 0)
+        return 2;
     
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding NULL param pos %d",
-               DBNAME, pos));
-    sdata->param.pos[sdata->param.next] = pos;
-    sdata->param.type[sdata->param.next] = PARAM_TYPE_NULL;
-    ++sdata->param.next;
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding NULL param pos %d",
+                DBNAME, pos));
+    sdata->param.type[j] = PARAM_TYPE_NULL;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -293,14 +412,16 @@ static int gdsql_sqlite_stmt_bindp_int(gdsql_stmth* stmt,
     StmtData* sdata = (StmtData*) stmt->data;
     if (sdata == 0)
         return 1;
+
+    int j = param_slot(&sdata->param, pos);
+    if (j < 0)
+        return 2;
     
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding int param pos %d to %d",
-               DBNAME, pos, val));
-    sdata->param.pos[sdata->param.next] = pos;
-    sdata->param.type[sdata->param.next] = PARAM_TYPE_INT;
-    sdata->param.value[sdata->param.next].ival = val;
-    ++sdata->param.next;
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding int param pos %d to %d",
+                DBNAME, pos, val));
+    sdata->param.type[j] = PARAM_TYPE_INT;
+    sdata->param.value[j].ival = val;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -313,14 +434,16 @@ static int gdsql_sqlite_stmt_bindp_double(gdsql_stmth* stmt,
     StmtData* sdata = (StmtData*) stmt->data;
     if (sdata == 0)
         return 1;
+
+    int j = param_slot(&sdata->param, pos);
+    if (j < 0)
+        return 2;
     
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding double param pos %d to %lf",
-               DBNAME, pos, val));
-    sdata->param.pos[sdata->param.next] = pos;
-    sdata->param.type[sdata->param.next] = PARAM_TYPE_DOUBLE;
-    sdata->param.value[sdata->param.next].dval = val;
-    ++sdata->param.next;
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding double param pos %d to %lf",
+                DBNAME, pos, val));
+    sdata->param.type[j] = PARAM_TYPE_DOUBLE;
+    sdata->param.value[j].dval = val;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -337,15 +460,20 @@ static int gdsql_sqlite_stmt_bindp_string(gdsql_stmth* stmt,
 
     if (len < 0)
         len = strlen(val);
+    if (len > STMT_MAX_PARAM_LENGTH)
+        return 3;
+
+    int j = param_slot(&sdata->param, pos);
+    if (j < 0)
+        return 2;
     
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding string param pos %d to [%d:%s]",
-               DBNAME, pos, len, val));
-    sdata->param.pos[sdata->param.next] = pos;
-    sdata->param.type[sdata->param.next] = PARAM_TYPE_STRING;
-    memcpy(sdata->param.value[sdata->param.next].sval.buf, val, len+1);
-    sdata->param.value[sdata->param.next].sval.len = len;
-    ++sdata->param.next;
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding string param pos %d to [%d:%s]",
+                DBNAME, pos, len, val));
+    sdata->param.type[j] = PARAM_TYPE_STRING;
+    memcpy(sdata->param.value[j].sval.buf, val, len);
+    sdata->param.value[j].sval.buf[len] = '\0';
+    sdata->param.value[j].sval.len = len;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -358,14 +486,16 @@ static int gdsql_sqlite_stmt_bindp_date(gdsql_stmth* stmt,
     StmtData* sdata = (StmtData*) stmt->data;
     if (sdata == 0)
         return 1;
+
+    int j = param_slot(&sdata->param, pos);
+    if (j < 0)
+        return 2;
     
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding date param pos %d to %lf",
-               DBNAME, pos, val));
-    sdata->param.pos[sdata->param.next] = pos;
-    sdata->param.type[sdata->param.next] = PARAM_TYPE_DATE;
-    sdata->param.value[sdata->param.next].dval = val;
-    ++sdata->param.next;
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding date param pos %d to %lf",
+                DBNAME, pos, val));
+    sdata->param.type[j] = PARAM_TYPE_DATE;
+    sdata->param.value[j].dval = val;
     GDSQL_Log(LOG_DEBUG, ("%s: success!", DBNAME));
 
     return 0;
@@ -389,9 +519,9 @@ static int gdsql_sqlite_stmt_bindr_int(gdsql_stmth* stmt,
         return 3;
 
     --pos;
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding int result pos %d to %p",
-               DBNAME, pos, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding int result pos %d to %p",
+                DBNAME, pos, var));
     sdata->row.cols[sdata->row.ncol].pos = pos;
     sdata->row.cols[sdata->row.ncol].type = STMT_VAL_INT;
     sdata->row.cols[sdata->row.ncol].len = 0;
@@ -414,9 +544,9 @@ static int gdsql_sqlite_stmt_bindr_double(gdsql_stmth* stmt,
         return 3;
     
     --pos;
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding double result pos %d to %p",
-               DBNAME, pos, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding double result pos %d to %p",
+                DBNAME, pos, var));
     sdata->row.cols[sdata->row.ncol].pos = pos;
     sdata->row.cols[sdata->row.ncol].type = STMT_VAL_DOUBLE;
     sdata->row.cols[sdata->row.ncol].len = 0;
@@ -440,9 +570,9 @@ static int gdsql_sqlite_stmt_bindr_string(gdsql_stmth* stmt,
         return 3;
     
     --pos;
-    GDSQL_Log(LOG_INFO,
-              ("%s: binding string result pos %d to [%d:%p]",
-               DBNAME, pos, len, var));
+    GDSQL_LogC(LOG_CAT_BIND, LOG_INFO,
+               ("%s: binding string result pos %d to [%d:%p]",
+                DBNAME, pos, len, var));
     sdata->row.cols[sdata->row.ncol].pos = pos;
     sdata->row.cols[sdata->row.ncol].type = STMT_VAL_STRING;
     sdata->row.cols[sdata->row.ncol].len = len;
@@ -534,18 +664,30 @@ static int gdsql_sqlite_stmt_step(gdsql_stmth* stmt)
     
     if (stmt->state < STMT_STATE_EXHAUSTED) {
         // Not yet done, can call step
-        GDSQL_Log(LOG_INFO,
-                  ("%s: stepping statement [%s]",
-                   DBNAME, stmt->query));
+        DbData* ddata = (DbData*) stmt->gdsql_db->data;
+        int bulk = (ddata != 0 &&
+                    ddata->bulk.active &&
+                    ! sqlite3_stmt_readonly(sdata->ps));
+        if (bulk && bulk_open(ddata) != 0)
+            return 3;
+
+        GDSQL_LogC(LOG_CAT_STEP, LOG_INFO,
+                   ("%s: stepping statement [%s]",
+                    DBNAME, stmt->query));
         int st = sqlite3_step(sdata->ps);
-        GDSQL_Log(LOG_INFO,
-                  ("step returned %d (%d)",
-                   st, SQLITE_ROW));
+        GDSQL_LogC(LOG_CAT_STEP, LOG_INFO,
+                   ("step returned %d (%d)",
+                    st, SQLITE_ROW));
         if (st != SQLITE_ROW) {
+            if (bulk && st == SQLITE_DONE)
+                bulk_tick(ddata, 1);
+            if (st != SQLITE_DONE)
+                metrics_count(GDSQL_DB_SQLITE, METRIC_ERRORS, 1);
             stmt->state = STMT_STATE_EXHAUSTED;
             return 3;
         }
 
+        unsigned long long t0 = STMT_STATS_START(stmt);
         int j = 0;
         for (j = 0; j < sdata->row.ncol; ++j) {
             int pos = sdata->row.cols[j].pos;
@@ -553,9 +695,9 @@ static int gdsql_sqlite_stmt_step(gdsql_stmth* stmt)
 
             sdata->row.cols[j].null = 0;
             if (ctype == SQLITE_NULL) {
-                GDSQL_Log(LOG_INFO,
-                          ("%s: column %d NULL",
-                           DBNAME, pos));
+                GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                           ("%s: column %d NULL",
+                            DBNAME, pos));
                 sdata->row.cols[j].null = 1;
             }
         
@@ -563,46 +705,48 @@ static int gdsql_sqlite_stmt_step(gdsql_stmth* stmt)
             case STMT_VAL_INT:
                 *(sdata->row.cols[j].val.ival) = 0;
                 if (ctype == SQLITE_INTEGER) {
-                    GDSQL_Log(LOG_INFO,
-                              ("%s: column %d int NOT NULL",
-                               DBNAME, pos));
+                    GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                               ("%s: column %d int NOT NULL",
+                                DBNAME, pos));
                     *(sdata->row.cols[j].val.ival) = sqlite3_column_int(sdata->ps, pos);
                 } else {
-                    GDSQL_Log(LOG_INFO,
-                              ("%s: column %d int INVALID TYPE",
-                               DBNAME, pos));
+                    GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                               ("%s: column %d int INVALID TYPE",
+                                DBNAME, pos));
                 }
                 break;
             case STMT_VAL_DOUBLE:
                 *(sdata->row.cols[j].val.dval) = 0.0;
                 if (ctype == SQLITE_FLOAT) {
-                    GDSQL_Log(LOG_INFO,
-                              ("%s: column %d double NOT NULL",
-                               DBNAME, pos));
+                    GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                               ("%s: column %d double NOT NULL",
+                                DBNAME, pos));
                     *(sdata->row.cols[j].val.dval) = sqlite3_column_double(sdata->ps, pos);
                 } else {
-                    GDSQL_Log(LOG_INFO,
-                              ("%s: column %d double INVALID TYPE",
-                               DBNAME, pos));
+                    GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                               ("%s: column %d double INVALID TYPE",
+                                DBNAME, pos));
                 }
                 break;
             case STMT_VAL_STRING:
                 sdata->row.cols[j].val.sval[0] = '\0';
                 if (ctype == SQLITE_TEXT) {
-                    GDSQL_Log(LOG_INFO,
-                              ("%s: column %d string NOT NULL",
-                               DBNAME, pos));
+                    GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                               ("%s: column %d string NOT NULL",
+                                DBNAME, pos));
                     gdsql_copy_at_most(sdata->row.cols[j].val.sval,
                                        (char*) sqlite3_column_text(sdata->ps, pos),
                                        sdata->row.cols[j].len);
                 } else {
-                    GDSQL_Log(LOG_INFO,
-                              ("%s: column %d string INVALID TYPE",
-                               DBNAME, pos));
+                    GDSQL_LogC(LOG_CAT_COLUMN, LOG_INFO,
+                               ("%s: column %d string INVALID TYPE",
+                                DBNAME, pos));
                 }
                 break;
             }
         }
+        if (t0 != 0)
+            stmt_stats_row(stmt, t0, row_bytes(&sdata->row));
     }
 
     GDSQL_Log(LOG_INFO, ("%s: success!", DBNAME));
@@ -645,6 +789,15 @@ static int gdsql_sqlite_stmt_finalize(gdsql_stmth* stmt)
                 break;
             }
 
+            if (gdsql_cache_release(stmt->gdsql_db, sdata->ps) == 0) {
+                GDSQL_Log(LOG_DEBUG,
+                          ("%s: returning statement [%s] to cache",
+                           DBNAME, stmt->query));
+                sqlite3_reset(sdata->ps);
+                sqlite3_clear_bindings(sdata->ps);
+                break;
+            }
+
             GDSQL_Log(LOG_DEBUG,
                       ("%s: finalizing sqlite3 statement [%s]",
                        DBNAME, stmt->query));
@@ -661,3 +814,454 @@ static int gdsql_sqlite_stmt_finalize(gdsql_stmth* stmt)
 
     return ret;
 }
+
+static int gdsql_sqlite_stmt_reset(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    if (sdata->ps != 0) {
+        GDSQL_Log(LOG_DEBUG,
+                  ("%s: resetting statement [%s]",
+                   DBNAME, stmt->query));
+        sqlite3_reset(sdata->ps);
+    }
+
+    return 0;
+}
+
+static int gdsql_sqlite_stmt_clear_bindings(gdsql_stmth* stmt)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: clearing bindings for statement [%s]",
+               DBNAME, stmt->query));
+    if (sdata->ps != 0) {
+        sqlite3_reset(sdata->ps);
+        sqlite3_clear_bindings(sdata->ps);
+    }
+    sdata->param.next = 0;
+
+    return 0;
+}
+
+/*
+ * The slot for the parameter at pos: the one it already has if it is
+ * bound again without clearing the bindings, or a new one.  Return -1
+ * if there is no room left.
+ */
+static int param_slot(Param* param,
+                      int pos)
+{
+    // Parameters are usually bound in order, one per position.
+    int j = pos - 1;
+    if (j >= 0 && j < param->next && param->pos[j] == pos)
+        return j;
+
+    for (j = 0; j < param->next; ++j) {
+        if (param->pos[j] == pos)
+            return j;
+    }
+
+    if (param->next >= STMT_MAX_PARAMS)
+        return -1;
+
+    j = param->next++;
+    param->pos[j] = pos;
+    return j;
+}
+
+static int bind_array_value(sqlite3_stmt* ps,
+                            const ArrayParam* ap,
+                            int row)
+{
+    if (ap->nulls != 0 && ap->nulls[row])
+        return sqlite3_bind_null(ps, ap->pos);
+
+    switch (ap->type) {
+    case STMT_VAL_INT:
+    case STMT_VAL_BOOLEAN:
+        return sqlite3_bind_int(ps, ap->pos,
+                                ((const int*) ap->vals)[row]);
+    case STMT_VAL_DOUBLE:
+    case STMT_VAL_DATE:
+        return sqlite3_bind_double(ps, ap->pos,
+                                   ((const double*) ap->vals)[row]);
+    case STMT_VAL_STRING:
+        return sqlite3_bind_text(ps, ap->pos,
+                                 ((const char* const*) ap->vals)[row],
+                                 ap->lens ? ap->lens[row] : -1,
+                                 SQLITE_STATIC);
+    }
+
+    return SQLITE_MISUSE;
+}
+
+static int gdsql_sqlite_stmt_execute_array(gdsql_stmth* stmt,
+                                           int* done)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    DbData* ddata = (DbData*) stmt->gdsql_db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 2;
+
+    if (stmt->state < STMT_STATE_PREPARED) {
+        if (gdsql_sqlite_stmt_prepare(stmt) != 0)
+            return 2;
+
+        stmt->state = STMT_STATE_PREPARED;
+    }
+
+    ArrayParams* arrays = stmt->arrays;
+
+    // In bulk mode, the rows go into the bulk transaction.
+    int bulk = ddata->bulk.active;
+    if (bulk && bulk_open(ddata) != 0)
+        return 3;
+
+    // Unless the caller already has a transaction going, run all the
+    // rows in a single one; otherwise each row pays for a journal sync.
+    int own = sqlite3_get_autocommit(ddata->db);
+    if (own &&
+        sqlite3_exec(ddata->db, "BEGIN", 0, 0, 0) != SQLITE_OK)
+        return 3;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: executing statement [%s] for %d rows",
+               DBNAME, stmt->query, arrays->count));
+    int ret = 0;
+    int row = 0;
+    for (row = 0; row < arrays->count; ++row) {
+        sqlite3_reset(sdata->ps);
+
+        int j = 0;
+        for (j = 0; j < arrays->next; ++j) {
+            if (bind_array_value(sdata->ps,
+                                 &arrays->params[j],
+                                 row) != SQLITE_OK) {
+                ret = 4;
+                break;
+            }
+        }
+        if (ret != 0)
+            break;
+
+        int st = sqlite3_step(sdata->ps);
+        if (st != SQLITE_DONE && st != SQLITE_ROW) {
+            GDSQL_Log(LOG_WARNING,
+                      ("%s: row %d failed: %s",
+                       DBNAME, row, sqlite3_errmsg(ddata->db)));
+            ret = 5;
+            break;
+        }
+    }
+    sqlite3_reset(sdata->ps);
+    sqlite3_clear_bindings(sdata->ps);
+    *done = row;
+
+    if (own) {
+        if (ret != 0)
+            sqlite3_exec(ddata->db, "ROLLBACK", 0, 0, 0);
+        else if (sqlite3_exec(ddata->db, "COMMIT", 0, 0, 0) != SQLITE_OK) {
+            sqlite3_exec(ddata->db, "ROLLBACK", 0, 0, 0);
+            ret = 6;
+        }
+        if (ret != 0)
+            *done = 0;
+    }
+
+    if (bulk && ret == 0)
+        bulk_tick(ddata, *done);
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: executed %d rows, ret %d",
+               DBNAME, *done, ret));
+    return ret;
+}
+
+static int gdsql_sqlite_cache_evict(gdsql_dbh* db,
+                                    void* handle)
+{
+    sqlite3_stmt* sql_ps = (sqlite3_stmt*) handle;
+
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: finalizing cached statement %p",
+               DBNAME, sql_ps));
+    if (sqlite3_finalize(sql_ps) != SQLITE_OK)
+        return 1;
+
+    return 0;
+}
+
+static int gdsql_sqlite_db_bulk_begin(gdsql_dbh* db,
+                                      int rows,
+                                      int msecs)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 3;
+
+    Bulk* bulk = &ddata->bulk;
+    if (bulk->active)
+        return 4;
+
+    // The journal mode cannot be changed inside a transaction.
+    if (! sqlite3_get_autocommit(ddata->db)) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: cannot start bulk mode inside a transaction",
+                   DBNAME));
+        return 5;
+    }
+
+    if (get_pragma(ddata->db, "journal_mode",
+                   bulk->journal_mode, sizeof(bulk->journal_mode)) != 0 ||
+        get_pragma(ddata->db, "synchronous",
+                   bulk->synchronous, sizeof(bulk->synchronous)) != 0 ||
+        get_pragma(ddata->db, "cache_size",
+                   bulk->cache_size, sizeof(bulk->cache_size)) != 0 ||
+        get_pragma(ddata->db, "temp_store",
+                   bulk->temp_store, sizeof(bulk->temp_store)) != 0)
+        return 6;
+
+    // These are only hints: a database that cannot use WAL (for
+    // instance, one in memory) keeps its journal mode.
+    set_pragma(ddata->db, "journal_mode", BULK_JOURNAL_MODE);
+    set_pragma(ddata->db, "synchronous", BULK_SYNCHRONOUS);
+    set_pragma(ddata->db, "cache_size", BULK_CACHE_SIZE);
+    set_pragma(ddata->db, "temp_store", BULK_TEMP_STORE);
+
+    bulk->active = 1;
+    bulk->open = 0;
+    bulk->rows = rows;
+    bulk->msecs = msecs;
+    bulk->count = 0;
+    bulk->commits = 0;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: bulk mode started, committing every %d rows / %d ms"
+               " (journal_mode was %s, synchronous %s, cache_size %s,"
+               " temp_store %s)",
+               DBNAME, rows, msecs,
+               bulk->journal_mode, bulk->synchronous,
+               bulk->cache_size, bulk->temp_store));
+    return 0;
+}
+
+static int gdsql_sqlite_db_bulk_end(gdsql_dbh* db)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 3;
+
+    Bulk* bulk = &ddata->bulk;
+    if (! bulk->active)
+        return 4;
+
+    int ret = 0;
+    if (bulk_commit(ddata) != 0) {
+        sqlite3_exec(ddata->db, "ROLLBACK", 0, 0, 0);
+        bulk->open = 0;
+        ret = 5;
+    }
+    bulk->active = 0;
+
+    if (set_pragma(ddata->db, "journal_mode", bulk->journal_mode) != 0 ||
+        set_pragma(ddata->db, "synchronous", bulk->synchronous) != 0 ||
+        set_pragma(ddata->db, "cache_size", bulk->cache_size) != 0 ||
+        set_pragma(ddata->db, "temp_store", bulk->temp_store) != 0) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not restore settings after bulk mode: %s",
+                   DBNAME, sqlite3_errmsg(ddata->db)));
+        if (ret == 0)
+            ret = 6;
+    }
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: bulk mode ended after %llu commits, ret %d",
+               DBNAME, bulk->commits, ret));
+    return ret;
+}
+
+static int get_pragma(sqlite3* db,
+                      const char* name,
+                      char* val,
+                      int len)
+{
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA %s", name);
+
+    sqlite3_stmt* ps = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &ps, 0) != SQLITE_OK)
+        return 1;
+
+    int ret = 0;
+    if (sqlite3_step(ps) == SQLITE_ROW)
+        gdsql_copy_at_most(val,
+                           (const char*) sqlite3_column_text(ps, 0),
+                           len);
+    else
+        ret = 2;
+    sqlite3_finalize(ps);
+
+    return ret;
+}
+
+static int set_pragma(sqlite3* db,
+                      const char* name,
+                      const char* val)
+{
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA %s = %s", name, val);
+
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: running [%s]",
+               DBNAME, sql));
+    if (sqlite3_exec(db, sql, 0, 0, 0) != SQLITE_OK)
+        return 1;
+
+    return 0;
+}
+
+/*
+ * Make sure the bulk transaction is open.  If the caller opened one
+ * of their own, we leave it alone.
+ */
+static int bulk_open(DbData* ddata)
+{
+    Bulk* bulk = &ddata->bulk;
+    if (! sqlite3_get_autocommit(ddata->db))
+        return 0;
+
+    if (sqlite3_exec(ddata->db, "BEGIN", 0, 0, 0) != SQLITE_OK) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not begin bulk transaction: %s",
+                   DBNAME, sqlite3_errmsg(ddata->db)));
+        return 1;
+    }
+
+    bulk->open = 1;
+    bulk->count = 0;
+    bulk->started = gdsql_get_nsecs();
+    return 0;
+}
+
+static int bulk_commit(DbData* ddata)
+{
+    Bulk* bulk = &ddata->bulk;
+    if (! bulk->open)
+        return 0;
+
+    if (sqlite3_get_autocommit(ddata->db)) {
+        bulk->open = 0;     // someone else finished it
+        return 0;
+    }
+
+    // If this fails (for instance, because a statement is still
+    // writing) the transaction stays open and we try again later.
+    if (sqlite3_exec(ddata->db, "COMMIT", 0, 0, 0) != SQLITE_OK) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: could not commit bulk transaction: %s",
+                   DBNAME, sqlite3_errmsg(ddata->db)));
+        return 1;
+    }
+
+    bulk->open = 0;
+    ++bulk->commits;
+    GDSQL_Log(LOG_DEBUG,
+              ("%s: bulk transaction committed with %d rows",
+               DBNAME, bulk->count));
+    return 0;
+}
+
+static int bulk_tick(DbData* ddata,
+                     int rows)
+{
+    Bulk* bulk = &ddata->bulk;
+    if (! bulk->open)
+        return 0;
+
+    bulk->count += rows;
+    if (bulk->rows > 0 && bulk->count >= bulk->rows)
+        return bulk_commit(ddata);
+
+    if (bulk->msecs > 0 &&
+        gdsql_get_nsecs() - bulk->started >=
+        (unsigned long long) bulk->msecs * 1000000ULL)
+        return bulk_commit(ddata);
+
+    return 0;
+}
+
+static int gdsql_sqlite_db_exec(gdsql_dbh* db,
+                                const char* sql)
+{
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 3;
+
+    GDSQL_Log(LOG_INFO,
+              ("%s: running [%s]",
+               DBNAME, sql));
+    char* err = 0;
+    if (sqlite3_exec(ddata->db, sql, 0, 0, &err) != SQLITE_OK) {
+        GDSQL_Log(LOG_WARNING,
+                  ("%s: [%s] failed: %s",
+                   DBNAME, sql, err ? err : sqlite3_errmsg(ddata->db)));
+        sqlite3_free(err);
+        return 4;
+    }
+
+    return 0;
+}
+
+static int gdsql_sqlite_db_ping(gdsql_dbh* db)
+{
+    // There is no server that could have gone away.
+    DbData* ddata = (DbData*) db->data;
+    if (ddata == 0 || ddata->db == 0)
+        return 3;
+
+    return 0;
+}
+
+static int gdsql_sqlite_stmt_render_params(gdsql_stmth* stmt,
+                                           char* buf,
+                                           int size)
+{
+    StmtData* sdata = (StmtData*) stmt->data;
+    if (sdata == 0)
+        return 1;
+
+    ParamText text = { buf, size, 0 };
+    int j = 0;
+    for (j = 0; j < sdata->param.next; ++j) {
+        const PValue* value = &sdata->param.value[j];
+        switch (sdata->param.type[j]) {
+        case PARAM_TYPE_NULL:
+            param_text_null(&text);
+            break;
+        case PARAM_TYPE_INT:
+        case PARAM_TYPE_BOOLEAN:
+            param_text_int(&text, value->ival);
+            break;
+        case PARAM_TYPE_DOUBLE:
+            param_text_double(&text, value->dval);
+            break;
+        case PARAM_TYPE_STRING:
+            param_text_string(&text, value->sval.buf, value->sval.len);
+            break;
+        case PARAM_TYPE_DATE:
+            param_text_date(&text, value->dval);
+            break;
+        }
+    }
+
+    return 0;
+}
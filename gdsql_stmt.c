@@ -1,11 +1,32 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gdsql_log.h>
 #include <gdsql_hidden.h>
 #include <gdsql_util.h>
 #include <gdsql_stmt.h>
 
+static int bind_array(gdsql_stmt gdsql_stmt,
+                      int pos,
+                      int type,
+                      const void* vals,
+                      const int* lens,
+                      const char* nulls,
+                      int count);
+static void stats_add(unsigned long long* nsecs,
+                      unsigned long long t0);
+static void stats_step(gdsql_stmth* sh,
+                       int before,
+                       unsigned long long t0,
+                       unsigned long long d0);
+static void metrics_step(gdsql_stmth* sh,
+                         int before,
+                         int ret);
+static int traced(gdsql_stmth* sh,
+                  int op,
+                  sql_Sp* call);
+
 gdsql_db gdsql_stmt_get_db(gdsql_stmt gdsql_stmt)
 {
     gdsql_db gdsql_db = 0;
@@ -56,6 +77,11 @@ void gdsql_stmt_set_query(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        // Let go of the statement for the old query first, so that it
+        // goes back to the cache (or is deallocated).
+        if (sh->data != 0)
+            gdsql_stmt_finalize(gdsql_stmt);
+
         va_list ap;
         va_start(ap, fmt);
         vsprintf(sh->query, fmt, ap);
@@ -87,11 +113,17 @@ int gdsql_stmt_prepare(gdsql_stmt gdsql_stmt)
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(dh->type);
         if (ops != 0) {
-            ret = ops->stmt_prepare(sh);
+            ret = TRACE_ON(dh)
+                ? traced(sh, GDSQL_TRACE_STMT_PREPARE, ops->stmt_prepare)
+                : ops->stmt_prepare(sh);
             sh->state = STMT_STATE_PREPARED;
+            metrics_count(dh->type,
+                          ret == 0 ? METRIC_STMT_PREPARED : METRIC_ERRORS, 1);
         }
+        stats_add(&sh->stats.prepare_nsecs, t0);
     } while (0);
 
     return ret;
@@ -109,9 +141,11 @@ int gdsql_stmt_bindp_null(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindp_null(sh, pos);
+        stats_add(&sh->stats.bind_nsecs, t0);
     } while (0);
 
     return ret;
@@ -130,9 +164,11 @@ int gdsql_stmt_bindp_int(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindp_int(sh, pos, val);
+        stats_add(&sh->stats.bind_nsecs, t0);
     } while (0);
 
     return ret;
@@ -151,9 +187,11 @@ int gdsql_stmt_bindp_double(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindp_double(sh, pos, val);
+        stats_add(&sh->stats.bind_nsecs, t0);
     } while (0);
 
     return ret;
@@ -173,9 +211,11 @@ int gdsql_stmt_bindp_string(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindp_string(sh, pos, val, len);
+        stats_add(&sh->stats.bind_nsecs, t0);
     } while (0);
     
     return ret;
@@ -194,9 +234,11 @@ int gdsql_stmt_bindp_date(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindp_date(sh, pos, val);
+        stats_add(&sh->stats.bind_nsecs, t0);
     } while (0);
 
     return ret;
@@ -215,11 +257,117 @@ int gdsql_stmt_bindp_boolean(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindp_boolean(sh, pos, val);
+        stats_add(&sh->stats.bind_nsecs, t0);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_stmt_bindp_int_array(gdsql_stmt gdsql_stmt,
+                               int pos,
+                               const int* vals,
+                               const char* nulls,
+                               int count)
+{
+    return bind_array(gdsql_stmt, pos, STMT_VAL_INT,
+                      vals, 0, nulls, count);
+}
+
+int gdsql_stmt_bindp_double_array(gdsql_stmt gdsql_stmt,
+                                  int pos,
+                                  const double* vals,
+                                  const char* nulls,
+                                  int count)
+{
+    return bind_array(gdsql_stmt, pos, STMT_VAL_DOUBLE,
+                      vals, 0, nulls, count);
+}
+
+int gdsql_stmt_bindp_string_array(gdsql_stmt gdsql_stmt,
+                                  int pos,
+                                  const char* const* vals,
+                                  const int* lens,
+                                  const char* nulls,
+                                  int count)
+{
+    return bind_array(gdsql_stmt, pos, STMT_VAL_STRING,
+                      vals, lens, nulls, count);
+}
+
+int gdsql_stmt_bindp_date_array(gdsql_stmt gdsql_stmt,
+                                int pos,
+                                const double* vals,
+                                const char* nulls,
+                                int count)
+{
+    return bind_array(gdsql_stmt, pos, STMT_VAL_DATE,
+                      vals, 0, nulls, count);
+}
+
+int gdsql_stmt_bindp_boolean_array(gdsql_stmt gdsql_stmt,
+                                   int pos,
+                                   const int* vals,
+                                   const char* nulls,
+                                   int count)
+{
+    return bind_array(gdsql_stmt, pos, STMT_VAL_BOOLEAN,
+                      vals, 0, nulls, count);
+}
+
+int gdsql_stmt_execute_array(gdsql_stmt gdsql_stmt,
+                             int* done)
+{
+    int ret = 0;
+    int cnt = 0;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0 || sh->gdsql_db == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (sh->arrays == 0 || sh->arrays->next <= 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("No array parameters bound"));
+            ret = 2;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(sh->gdsql_db->type);
+        if (ops == 0 || ops->stmt_execute_array == 0) {
+            ret = 3;
+            break;
+        }
+
+        unsigned long long t0 = STMT_STATS_START(sh);
+        if (TRACE_ON(sh->gdsql_db)) {
+            TraceSpan span;
+            trace_begin(&span, sh->gdsql_db,
+                        GDSQL_TRACE_STMT_EXECUTE, sh->query);
+            ret = ops->stmt_execute_array(sh, &cnt);
+            trace_end(&span, ret);
+        } else
+            ret = ops->stmt_execute_array(sh, &cnt);
+        if (sh->state > STMT_STATE_PREPARED)
+            sh->state = STMT_STATE_PREPARED;
+        if (t0 != 0) {
+            stats_add(&sh->stats.execute_nsecs, t0);
+            sh->stats.executions += cnt;
+            slow_log_check(sh);
+        }
+        metrics_count(sh->gdsql_db->type, METRIC_STMT_EXECUTED, cnt);
+        if (ret != 0)
+            metrics_count(sh->gdsql_db->type, METRIC_ERRORS, 1);
     } while (0);
 
+    if (done != 0)
+        *done = cnt;
+
     return ret;
 }
 
@@ -236,9 +384,11 @@ int gdsql_stmt_bindr_int(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindr_int(sh, pos, var);
+        stats_add(&sh->stats.bind_nsecs, t0);
     } while (0);
 
     return ret;
@@ -257,9 +407,11 @@ int gdsql_stmt_bindr_double(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindr_double(sh, pos, var);
+        stats_add(&sh->stats.bind_nsecs, t0);
     } while (0);
 
     return ret;
@@ -279,9 +431,11 @@ int gdsql_stmt_bindr_string(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindr_string(sh, pos, var, len);
+        stats_add(&sh->stats.bind_nsecs, t0);
     } while (0);
 
     return ret;
@@ -300,9 +454,11 @@ int gdsql_stmt_bindr_date(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindr_date(sh, pos, var);
+        stats_add(&sh->stats.bind_nsecs, t0);
     } while (0);
 
     return ret;
@@ -321,9 +477,11 @@ int gdsql_stmt_bindr_boolean(gdsql_stmt gdsql_stmt,
             break;
         }
 
+        unsigned long long t0 = STMT_STATS_START(sh);
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
             ret = ops->stmt_bindr_boolean(sh, pos, var);
+        stats_add(&sh->stats.bind_nsecs, t0);
     } while (0);
 
     return ret;
@@ -340,9 +498,24 @@ int gdsql_stmt_step(gdsql_stmt gdsql_stmt)
             break;
         }
 
+        int before = sh->state;
+        unsigned long long t0 = STMT_STATS_START(sh);
+        unsigned long long d0 = sh->stats.decode_nsecs;
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
-            ret = ops->stmt_step(sh);
+            ret = TRACE_ON(sh->gdsql_db)
+                ? traced(sh, before < STMT_STATE_EXECUTED
+                             ? GDSQL_TRACE_STMT_EXECUTE
+                             : GDSQL_TRACE_STMT_STEP,
+                         ops->stmt_step)
+                : ops->stmt_step(sh);
+        if (t0 != 0) {
+            stats_step(sh, before, t0, d0);
+            if (before < STMT_STATE_EXHAUSTED &&
+                sh->state >= STMT_STATE_EXHAUSTED)
+                slow_log_check(sh);
+        }
+        metrics_step(sh, before, ret);
     } while (0);
 
     return ret;
@@ -379,10 +552,466 @@ int gdsql_stmt_finalize(gdsql_stmt gdsql_stmt)
             break;
         }
 
+        if (sh->state == STMT_STATE_EXECUTED &&
+            STMT_STATS_ON(sh->gdsql_db))
+            slow_log_check(sh);
+
+        const DbOps* ops = get_dbops(sh->gdsql_db->type);
+        if (ops != 0)
+            ret = TRACE_ON(sh->gdsql_db)
+                ? traced(sh, GDSQL_TRACE_STMT_FINALIZE, ops->stmt_finalize)
+                : ops->stmt_finalize(sh);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_stmt_reset(gdsql_stmt gdsql_stmt)
+{
+    int ret = 0;
+    
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0 || sh->gdsql_db == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (sh->state == STMT_STATE_EXECUTED &&
+            STMT_STATS_ON(sh->gdsql_db))
+            slow_log_check(sh);
+
         const DbOps* ops = get_dbops(sh->gdsql_db->type);
         if (ops != 0)
-            ret = ops->stmt_finalize(sh);
+            ret = ops->stmt_reset(sh);
+        if (ret == 0 && sh->state > STMT_STATE_PREPARED)
+            sh->state = STMT_STATE_PREPARED;
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_stmt_clear_bindings(gdsql_stmt gdsql_stmt)
+{
+    int ret = 0;
+    
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0 || sh->gdsql_db == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (sh->arrays != 0) {
+            sh->arrays->next = 0;
+            sh->arrays->count = 0;
+        }
+
+        if (sh->state == STMT_STATE_EXECUTED &&
+            STMT_STATS_ON(sh->gdsql_db))
+            slow_log_check(sh);
+
+        const DbOps* ops = get_dbops(sh->gdsql_db->type);
+        if (ops != 0)
+            ret = ops->stmt_clear_bindings(sh);
+        if (ret == 0 && sh->state > STMT_STATE_PREPARED)
+            sh->state = STMT_STATE_PREPARED;
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_stmt_set_fetch_mode(gdsql_stmt gdsql_stmt,
+                              int mode,
+                              int size)
+{
+    int ret = 0;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0 || sh->gdsql_db == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (sh->state == STMT_STATE_EXECUTED) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Cannot change fetch mode while returning rows"));
+            ret = 2;
+            break;
+        }
+
+        if (size < 0)
+            size = 0;
+
+        const DbOps* ops = get_dbops(sh->gdsql_db->type);
+        if (ops != 0 && ops->stmt_set_fetch != 0)
+            ret = ops->stmt_set_fetch(sh, mode, size);
+        else if (mode != GDSQL_FETCH_DEFAULT)
+            ret = 3;
+
+        if (ret != 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid fetch mode %d", mode));
+            break;
+        }
+
+        sh->fetch_mode = mode;
+        sh->fetch_size = size;
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_stmt_get_fetch_mode(gdsql_stmt gdsql_stmt)
+{
+    int mode = GDSQL_FETCH_DEFAULT;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0)
+            break;
+
+        mode = sh->fetch_mode;
+    } while (0);
+
+    return mode;
+}
+
+int gdsql_stmt_export(gdsql_stmt gdsql_stmt,
+                      int fd)
+{
+    int ret = 0;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0 || sh->gdsql_db == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (fd < 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid export fd %d", fd));
+            ret = 2;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(sh->gdsql_db->type);
+        if (ops == 0 || ops->stmt_export == 0) {
+            ret = 3;
+            break;
+        }
+
+        ret = ops->stmt_export(sh, fd);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_stmt_pipeline_queue(gdsql_stmt gdsql_stmt)
+{
+    int ret = 0;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0 || sh->gdsql_db == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(sh->gdsql_db->type);
+        if (ops == 0 || ops->stmt_pipeline_queue == 0) {
+            ret = 2;
+            break;
+        }
+
+        unsigned long long t0 = STMT_STATS_START(sh);
+        ret = ops->stmt_pipeline_queue(sh);
+        if (ret == 0)
+            sh->status = GDSQL_STATUS_PENDING;
+        if (t0 != 0) {
+            stats_add(&sh->stats.execute_nsecs, t0);
+            if (ret == 0)
+                ++sh->stats.executions;
+        }
+        metrics_count(sh->gdsql_db->type,
+                      ret == 0 ? METRIC_STMT_EXECUTED : METRIC_ERRORS, 1);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_stmt_get_status(gdsql_stmt gdsql_stmt)
+{
+    int status = 0;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0)
+            break;
+
+        status = sh->status;
+    } while (0);
+
+    return status;
+}
+
+int gdsql_stmt_start(gdsql_stmt gdsql_stmt)
+{
+    int ret = 0;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0 || sh->gdsql_db == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (sh->state == STMT_STATE_EXECUTED) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Cannot start a stmt while returning rows"));
+            ret = 2;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(sh->gdsql_db->type);
+        if (ops == 0 || ops->stmt_start == 0) {
+            ret = 3;
+            break;
+        }
+
+        unsigned long long t0 = STMT_STATS_START(sh);
+        ret = TRACE_ON(sh->gdsql_db)
+            ? traced(sh, GDSQL_TRACE_STMT_EXECUTE, ops->stmt_start)
+            : ops->stmt_start(sh);
+        stats_add(&sh->stats.execute_nsecs, t0);
+        if (ret != 0)
+            metrics_count(sh->gdsql_db->type, METRIC_ERRORS, 1);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_stmt_poll(gdsql_stmt gdsql_stmt)
+{
+    int ret = GDSQL_POLL_ERROR;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0 || sh->gdsql_db == 0)
+            break;
+
+        const DbOps* ops = get_dbops(sh->gdsql_db->type);
+        if (ops == 0 || ops->stmt_poll == 0)
+            break;
+
+        ret = ops->stmt_poll(sh);
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_stmt_complete(gdsql_stmt gdsql_stmt)
+{
+    int ret = 0;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0 || sh->gdsql_db == 0) {
+            ret = 1;
+            break;
+        }
+
+        const DbOps* ops = get_dbops(sh->gdsql_db->type);
+        if (ops == 0 || ops->stmt_complete == 0) {
+            ret = 3;
+            break;
+        }
+
+        unsigned long long t0 = STMT_STATS_START(sh);
+        ret = TRACE_ON(sh->gdsql_db)
+            ? traced(sh, GDSQL_TRACE_STMT_EXECUTE, ops->stmt_complete)
+            : ops->stmt_complete(sh);
+        if (t0 != 0) {
+            stats_add(&sh->stats.execute_nsecs, t0);
+            if (ret == 0)
+                ++sh->stats.executions;
+        }
+        metrics_count(sh->gdsql_db->type,
+                      ret == 0 ? METRIC_STMT_EXECUTED : METRIC_ERRORS, 1);
     } while (0);
 
     return ret;
 }
+
+int gdsql_stmt_get_stats(gdsql_stmt gdsql_stmt,
+                         gdsql_stmt_stats* stats)
+{
+    int ret = 0;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (stats == 0) {
+            ret = 2;
+            break;
+        }
+
+        *stats = sh->stats;
+    } while (0);
+
+    return ret;
+}
+
+int gdsql_stmt_clear_stats(gdsql_stmt gdsql_stmt)
+{
+    int ret = 0;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0) {
+            ret = 1;
+            break;
+        }
+
+        memset(&sh->stats, 0, sizeof(sh->stats));
+        memset(&sh->slow_base, 0, sizeof(sh->slow_base));
+    } while (0);
+
+    return ret;
+}
+
+
+static int bind_array(gdsql_stmt gdsql_stmt,
+                      int pos,
+                      int type,
+                      const void* vals,
+                      const int* lens,
+                      const char* nulls,
+                      int count)
+{
+    int ret = 0;
+
+    do {
+        gdsql_stmth* sh = gdsql_check_stmt(gdsql_stmt);
+        if (sh == 0 || sh->gdsql_db == 0) {
+            ret = 1;
+            break;
+        }
+
+        if (vals == 0 || count <= 0) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Invalid array param pos %d",
+                       pos));
+            ret = 2;
+            break;
+        }
+
+        if (sh->arrays == 0) {
+            sh->arrays = (ArrayParams*) malloc(sizeof(ArrayParams));
+            if (sh->arrays == 0) {
+                GDSQL_Log(LOG_WARNING,
+                          ("Could not create array params"));
+                ret = 3;
+                break;
+            }
+            sh->arrays->next = 0;
+            sh->arrays->count = 0;
+        }
+
+        ArrayParams* arrays = sh->arrays;
+        if (arrays->next >= STMT_MAX_COLS) {
+            ret = 4;
+            break;
+        }
+        if (arrays->next > 0 && arrays->count != count) {
+            GDSQL_Log(LOG_WARNING,
+                      ("Array param pos %d has %d values, expected %d",
+                       pos, count, arrays->count));
+            ret = 5;
+            break;
+        }
+
+        GDSQL_Log(LOG_INFO,
+                  ("Binding array param pos %d type %d to %d values",
+                   pos, type, count));
+        ArrayParam* ap = &arrays->params[arrays->next];
+        ap->pos = pos;
+        ap->type = type;
+        ap->vals = vals;
+        ap->lens = lens;
+        ap->nulls = nulls;
+        arrays->count = count;
+        ++arrays->next;
+    } while (0);
+
+    return ret;
+}
+
+static void stats_add(unsigned long long* nsecs,
+                      unsigned long long t0)
+{
+    if (t0 != 0)
+        *nsecs += gdsql_get_nsecs() - t0;
+}
+
+/*
+ * A step that finds the statement not yet executed runs it; any other
+ * step just fetches.  Decoding, counted by the driver, is taken out.
+ */
+static void stats_step(gdsql_stmth* sh,
+                       int before,
+                       unsigned long long t0,
+                       unsigned long long d0)
+{
+    unsigned long long nsecs = gdsql_get_nsecs() - t0;
+    unsigned long long decode = sh->stats.decode_nsecs - d0;
+    nsecs = nsecs > decode ? nsecs - decode : 0;
+
+    if (before < STMT_STATE_EXECUTED) {
+        sh->stats.execute_nsecs += nsecs;
+        if (sh->state >= STMT_STATE_EXECUTED)
+            ++sh->stats.executions;
+    } else
+        sh->stats.fetch_nsecs += nsecs;
+}
+
+/*
+ * A step returns non-zero both when the rows run out and when it
+ * fails; it can only be told to have failed here when the statement
+ * did not get to run, the drivers count the other failures.
+ */
+static void metrics_step(gdsql_stmth* sh,
+                         int before,
+                         int ret)
+{
+    int type = sh->gdsql_db->type;
+
+    if (before < STMT_STATE_PREPARED && sh->state >= STMT_STATE_PREPARED)
+        metrics_count(type, METRIC_STMT_PREPARED, 1);
+    if (before < STMT_STATE_EXECUTED && sh->state >= STMT_STATE_EXECUTED)
+        metrics_count(type, METRIC_STMT_EXECUTED, 1);
+
+    if (ret == 0)
+        metrics_count(type, METRIC_ROWS_FETCHED, 1);
+    else if (sh->state < STMT_STATE_EXECUTED)
+        metrics_count(type, METRIC_ERRORS, 1);
+}
+
+static int traced(gdsql_stmth* sh,
+                  int op,
+                  sql_Sp* call)
+{
+    TraceSpan span;
+
+    trace_begin(&span, sh->gdsql_db, op, sh->query);
+    int ret = call(sh);
+    trace_end(&span, ret);
+
+    return ret;
+}
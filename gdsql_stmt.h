@@ -31,6 +31,53 @@ int gdsql_stmt_bindp_boolean(gdsql_stmt gdsql_stmt,
                              int pos,
                              int val);
 
+/*
+ * Bulk (array) parameters.  Each call binds a whole column of count
+ * values, to be used by gdsql_stmt_execute_array(); nulls, if not 0,
+ * flags the values to be sent as NULL.  All parameters of the
+ * statement must be bound this way, in position order, and with the
+ * same count.  The arrays are not copied, so they must stay valid
+ * until the statement is executed.
+ */
+int gdsql_stmt_bindp_int_array(gdsql_stmt gdsql_stmt,
+                               int pos,
+                               const int* vals,
+                               const char* nulls,
+                               int count);
+int gdsql_stmt_bindp_double_array(gdsql_stmt gdsql_stmt,
+                                  int pos,
+                                  const double* vals,
+                                  const char* nulls,
+                                  int count);
+int gdsql_stmt_bindp_string_array(gdsql_stmt gdsql_stmt,
+                                  int pos,
+                                  const char* const* vals,
+                                  const int* lens,
+                                  const char* nulls,
+                                  int count);
+int gdsql_stmt_bindp_date_array(gdsql_stmt gdsql_stmt,
+                                int pos,
+                                const double* vals,
+                                const char* nulls,
+                                int count);
+int gdsql_stmt_bindp_boolean_array(gdsql_stmt gdsql_stmt,
+                                   int pos,
+                                   const int* vals,
+                                   const char* nulls,
+                                   int count);
+
+/*
+ * Execute the statement once for each set of array parameters, using
+ * the fastest path each database offers.  If done is not 0, it gets
+ * the number of parameter sets executed before the first failure;
+ * when the library had to open its own transaction (SQLite) or batch
+ * (Postgres), work already done in a failed transaction or batch is
+ * rolled back and not counted.  It cannot be used while a pipeline is
+ * open on the connection.
+ */
+int gdsql_stmt_execute_array(gdsql_stmt gdsql_stmt,
+                             int* done);
+
 int gdsql_stmt_bindr_int(gdsql_stmt gdsql_stmt,
                          int pos,
                          int* var);
@@ -54,5 +101,134 @@ int gdsql_stmt_is_column_null(gdsql_stmt gdsql_stmt,
 
 int gdsql_stmt_finalize(gdsql_stmt gdsql_stmt);
 
+/*
+ * Make a statement ready to run again, keeping it prepared.
+ * gdsql_stmt_reset() keeps the bound parameters, so the next step
+ * executes the same query with the same values;
+ * gdsql_stmt_clear_bindings() forgets the bound parameters, so new
+ * ones can be bound before the next step.  Result bindings are kept
+ * in both cases.
+ */
+int gdsql_stmt_reset(gdsql_stmt gdsql_stmt);
+int gdsql_stmt_clear_bindings(gdsql_stmt gdsql_stmt);
+
+/*
+ * How the results of a query are fetched from the server.  The
+ * default is whatever each database does for a plain query: Postgres
+ * and SQLite read the whole result at once, MySQL reads one row per
+ * step and keeps the server busy until the last one.
+ *
+ * GDSQL_FETCH_BUFFERED (Postgres and MySQL) reads the whole result
+ * into client memory when the statement is executed, which frees the
+ * server as soon as possible.
+ *
+ * GDSQL_FETCH_COPY (Postgres only) runs the query as a binary COPY TO
+ * STDOUT and decodes rows as they arrive, so memory use does not grow
+ * with the size of the result.  The query cannot take parameters.
+ *
+ * GDSQL_FETCH_STREAM (Postgres only) gets rows from the server as
+ * they are produced, size rows at a time where the client library
+ * supports it and one at a time otherwise.  The first row is available
+ * as soon as the server sends it, but the connection cannot be used
+ * for anything else until all rows are read or the statement is
+ * reset.
+ *
+ * GDSQL_FETCH_CURSOR (Postgres and MySQL) opens a read-only server-side
+ * cursor for the query and fetches size rows at a time (1000 if size
+ * is 0) as they are stepped through.  On Postgres this leaves the
+ * connection free for other statements in between; outside a
+ * transaction the cursor is declared WITH HOLD, which makes the server
+ * keep a copy of the whole result until the cursor is closed.
+ *
+ * The fetch mode can only be changed when the statement is not in the
+ * middle of returning rows; size is a hint whose meaning depends on
+ * the mode, and 0 means a sensible default.
+ */
+#define GDSQL_FETCH_DEFAULT 0
+#define GDSQL_FETCH_COPY    1
+#define GDSQL_FETCH_STREAM  2
+#define GDSQL_FETCH_CURSOR  3
+#define GDSQL_FETCH_BUFFERED 4
+
+int gdsql_stmt_set_fetch_mode(gdsql_stmt gdsql_stmt,
+                              int mode,
+                              int size);
+int gdsql_stmt_get_fetch_mode(gdsql_stmt gdsql_stmt);
+
+/*
+ * Run a statement in GDSQL_FETCH_COPY mode and write all of its
+ * results, in the database's own binary COPY format, to the file
+ * descriptor fd, instead of stepping through them.  The output can be
+ * loaded back with COPY FROM.
+ */
+int gdsql_stmt_export(gdsql_stmt gdsql_stmt,
+                      int fd);
+
+/*
+ * Queue an execution of the statement in the current pipeline (see
+ * gdsql_db_pipeline_begin()).  Its status is GDSQL_STATUS_PENDING
+ * until the pipeline is synced; then it is 0 if all its queued
+ * executions succeeded, or the error code of the first one that
+ * failed.
+ */
+#define GDSQL_STATUS_PENDING -1
+
+int gdsql_stmt_pipeline_queue(gdsql_stmt gdsql_stmt);
+int gdsql_stmt_get_status(gdsql_stmt gdsql_stmt);
+
+/*
+ * Running a statement without blocking (Postgres and MySQL), so that
+ * one thread can drive many connections from an event loop.
+ *
+ * gdsql_stmt_start() sends the statement and returns at once; only one
+ * statement per connection can be running at a time.  Whenever the
+ * descriptor returned by gdsql_db_get_socket() is readable,
+ * gdsql_stmt_poll() makes progress and returns GDSQL_POLL_BUSY until
+ * the statement is done.  gdsql_stmt_complete() then collects the
+ * outcome (blocking if the statement is still running), and its rows,
+ * if any, can be read with gdsql_stmt_step() without further waits.
+ *
+ * Preparing the statement and binding its parameters still block, so
+ * it pays to prepare statements in advance or keep them cached.
+ */
+#define GDSQL_POLL_DONE  0
+#define GDSQL_POLL_BUSY  1
+#define GDSQL_POLL_ERROR 2
+
+int gdsql_stmt_start(gdsql_stmt gdsql_stmt);
+int gdsql_stmt_poll(gdsql_stmt gdsql_stmt);
+int gdsql_stmt_complete(gdsql_stmt gdsql_stmt);
+
+/*
+ * Statistics, collected only while enabled on the connection (see
+ * gdsql_db_set_stats()) or while the slow query log is open (see
+ * gdsql_slow.h).  Times are in nanoseconds, from a monotonic
+ * clock, and only count time spent inside gdsql calls, by phase:
+ *
+ *   prepare   gdsql_stmt_prepare()
+ *   bind      binding parameters and results
+ *   execute   running the statement: the first step after it was
+ *             prepared, reset or rebound (including any preparing
+ *             and binding the driver does then), executing arrays,
+ *             starting / completing it, or queueing it in a pipeline
+ *   fetch     the steps after that one, waiting for rows
+ *   decode    converting the values of each row into the result
+ *             variables, which is not counted in execute or fetch
+ */
+typedef struct gdsql_stmt_stats {
+    unsigned long executions;
+    unsigned long rows;
+    unsigned long long bytes;           // decoded into result variables
+    unsigned long long prepare_nsecs;
+    unsigned long long bind_nsecs;
+    unsigned long long execute_nsecs;
+    unsigned long long fetch_nsecs;
+    unsigned long long decode_nsecs;
+} gdsql_stmt_stats;
+
+int gdsql_stmt_get_stats(gdsql_stmt gdsql_stmt,
+                         gdsql_stmt_stats* stats);
+int gdsql_stmt_clear_stats(gdsql_stmt gdsql_stmt);
+
 
 #endif
@@ -4,5 +4,8 @@
 typedef void *gdsql;
 typedef void *gdsql_db;
 typedef void *gdsql_stmt;
+typedef void *gdsql_load;
+typedef void *gdsql_group;
+typedef void *gdsql_pool;
 
 #endif
@@ -45,6 +45,51 @@ gdsql_stmth* gdsql_check_stmt(gdsql_stmt gdsql_stmt)
     return ds;
 }
 
+gdsql_loadh* gdsql_check_load(gdsql_load gdsql_load)
+{
+    gdsql_loadh* lh = (gdsql_loadh*) gdsql_load;
+    if (lh == 0 ||
+        lh->gdsql_db == 0 ||
+        lh->gdsql_db->gdsql == 0 ||
+        lh->gdsql_db->gdsql->version != GDSQL_VERSION) {
+        GDSQL_Log(LOG_WARNING,
+                  ("Bad gdsql_load object"));
+        return 0;
+    }
+
+    return lh;
+}
+
+gdsql_grouph* gdsql_check_group(gdsql_group gdsql_group)
+{
+    gdsql_grouph* gh = (gdsql_grouph*) gdsql_group;
+    if (gh == 0 ||
+        gh->gdsql_db == 0 ||
+        gh->gdsql_db->gdsql == 0 ||
+        gh->gdsql_db->gdsql->version != GDSQL_VERSION) {
+        GDSQL_Log(LOG_WARNING,
+                  ("Bad gdsql_group object"));
+        return 0;
+    }
+
+    return gh;
+}
+
+gdsql_poolh* gdsql_check_pool(gdsql_pool gdsql_pool)
+{
+    gdsql_poolh* ph = (gdsql_poolh*) gdsql_pool;
+    if (ph == 0 ||
+        ph->tmpl == 0 ||
+        ph->tmpl->gdsql == 0 ||
+        ph->tmpl->gdsql->version != GDSQL_VERSION) {
+        GDSQL_Log(LOG_WARNING,
+                  ("Bad gdsql_pool object"));
+        return 0;
+    }
+
+    return ph;
+}
+
 int gdsql_copy_at_most(char* tgt,
                        const char* src,
                        int top)
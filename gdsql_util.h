@@ -10,6 +10,9 @@
 gdsqlh* gdsql_check_gdsql(gdsql gdsql);
 gdsql_dbh* gdsql_check_db(gdsql_db gdsql_db);
 gdsql_stmth* gdsql_check_stmt(gdsql_stmt gdsql_stmt);
+gdsql_loadh* gdsql_check_load(gdsql_load gdsql_load);
+gdsql_grouph* gdsql_check_group(gdsql_group gdsql_group);
+gdsql_poolh* gdsql_check_pool(gdsql_pool gdsql_pool);
 
 int gdsql_copy_at_most(char* tgt,
                        const char* src,
@@ -1,11 +1,45 @@
 #include <stdio.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/stat.h>
 #include <gdsql.h>
 
+// Rows of (int, string) generated by the server, to compare the ways
+// of fetching them.
+#define PG_SERIES_ROWS   5000
+#define PG_SERIES        "SELECT g, 'row ' || g FROM generate_series(1, 5000) g"
+#define PG_SERIES_BIG    "SELECT g, 'row ' || g FROM generate_series(1, 100000) g"
+#define MY_SERIES_ROWS   1000
+#define MY_SERIES        "WITH RECURSIVE s (g) AS "                      \
+                         "(SELECT 1 UNION ALL SELECT g + 1 FROM s "      \
+                         "WHERE g < 1000) "                              \
+                         "SELECT g, CONCAT('row ', g) FROM s ORDER BY g"
+
 static int test_sqlite(gdsql gdsql);
 static int test_postgres(gdsql gdsql);
 static int test_mysql(gdsql gdsql);
 
+static int test_pg_load(gdsql_db db);
+static int test_pg_copy(gdsql_db db);
+static int test_pg_stream(gdsql_db db);
+static int test_pg_cursor(gdsql_db db);
+static int test_pg_pipeline(gdsql_db db);
+static int test_start(gdsql_db db,
+                      const char* dbname);
+static int test_my_modes(gdsql_db db);
+static int test_my_load(gdsql_db db);
+
+static int fetch_rows(gdsql_db db,
+                      const char* query,
+                      int mode,
+                      int size,
+                      unsigned long* sum);
+static int count_rows(gdsql_db db,
+                      const char* query);
+static unsigned long add_sum(unsigned long sum,
+                             int id,
+                             const char* name);
+
 static int show_results(gdsql_db db,
                         const char* query);
 
@@ -141,6 +175,13 @@ static int test_postgres(gdsql gdsql)
         printf("Results for Postgres DB:\n");
         n = show_results(db, query);
         printf("\n");
+
+        test_pg_load(db);
+        test_pg_copy(db);
+        test_pg_stream(db);
+        test_pg_cursor(db);
+        test_pg_pipeline(db);
+        test_start(db, "Postgres");
     } while (0);
     
     gdsql_db_close(db);
@@ -200,6 +241,10 @@ static int test_mysql(gdsql gdsql)
         printf("Results for MySQL DB:\n");
         n = show_results(db, query);
         printf("\n");
+
+        test_start(db, "MySQL");
+        test_my_modes(db);
+        test_my_load(db);
     } while (0);
     
     gdsql_db_close(db);
@@ -213,6 +258,840 @@ static int test_mysql(gdsql gdsql)
     return n;
 }
 
+/*
+ * Load some rows with COPY and read them back; then check that a load
+ * that fails when ended commits nothing and says so.
+ */
+static int test_pg_load(gdsql_db db)
+{
+    int ret = 0;
+    int rows = 1000;
+    gdsql_load load = 0;
+    gdsql_stmt stmt = 0;
+
+    do {
+        if (gdsql_db_exec(db,
+                          "CREATE TEMP TABLE t01_load ("
+                          "id INTEGER PRIMARY KEY, "
+                          "name VARCHAR(40), "
+                          "birth TIMESTAMP, "
+                          "height DOUBLE PRECISION, "
+                          "single BOOLEAN)") != 0) {
+            ret = 1;
+            break;
+        }
+
+        load = gdsql_db_alloc_load(db);
+        if (load == 0 ||
+            gdsql_load_begin(load, "t01_load", 0) != 0) {
+            ret = 2;
+            break;
+        }
+
+        double birth = gdsql_cal2jul(1970, 1, 1, 0, 0, 0);
+        int j = 0;
+        for (j = 0; j < rows; ++j) {
+            char name[40];
+            sprintf(name, "person %d", j);
+            gdsql_load_put_int(load, j);
+            if (j % 10 == 0)
+                gdsql_load_put_null(load);
+            else
+                gdsql_load_put_string(load, name, -1);
+            gdsql_load_put_date(load, birth + j);
+            gdsql_load_put_double(load, j * 0.5);
+            gdsql_load_put_boolean(load, j % 2);
+            gdsql_load_end_row(load);
+        }
+        if (gdsql_load_end(load) != 0 ||
+            gdsql_load_has_failed(load) ||
+            gdsql_load_get_rows(load) != (unsigned long) rows) {
+            ret = 3;
+            break;
+        }
+        fprintf(stderr,
+                "Loaded %lu rows\n",
+                gdsql_load_get_rows(load));
+        gdsql_db_free_load(load);
+        load = 0;
+
+        int id;
+        char name[40];
+        double height;
+        stmt = gdsql_db_alloc_stmt(db);
+        if (stmt == 0) {
+            ret = 4;
+            break;
+        }
+        gdsql_stmt_set_query(stmt,
+                             "SELECT id, name, height "
+                             "FROM t01_load ORDER BY id");
+        gdsql_stmt_bindr_int(stmt, 1, &id);
+        gdsql_stmt_bindr_string(stmt, 2, name, sizeof(name));
+        gdsql_stmt_bindr_double(stmt, 3, &height);
+        for (j = 0; gdsql_stmt_step(stmt) == 0; ++j) {
+            char want[40];
+            sprintf(want, "person %d", j);
+            if (id != j ||
+                gdsql_stmt_is_column_null(stmt, 2) != (j % 10 == 0) ||
+                (j % 10 != 0 && strcmp(name, want) != 0) ||
+                height != j * 0.5) {
+                fprintf(stderr,
+                        "Loaded row %d came back as %d|%s|%lf\n",
+                        j, id, name, height);
+                ret = 5;
+                break;
+            }
+        }
+        if (ret == 0 && j != rows) {
+            fprintf(stderr,
+                    "Read back %d loaded rows, expected %d\n",
+                    j, rows);
+            ret = 6;
+        }
+        gdsql_stmt_finalize(stmt);
+        if (ret != 0)
+            break;
+
+        // A duplicate key only fails when the COPY is ended.
+        load = gdsql_db_alloc_load(db);
+        if (load == 0 ||
+            gdsql_load_begin(load, "t01_load", "id") != 0) {
+            ret = 7;
+            break;
+        }
+        gdsql_load_put_int(load, rows);
+        gdsql_load_end_row(load);
+        gdsql_load_put_int(load, 0);
+        gdsql_load_end_row(load);
+        if (gdsql_load_end(load) == 0 ||
+            gdsql_load_has_failed(load) != 1) {
+            fprintf(stderr,
+                    "Load with a duplicate key did not fail\n");
+            ret = 8;
+            break;
+        }
+
+        gdsql_db_free_stmt(stmt);
+        stmt = gdsql_db_alloc_stmt(db);
+        if (stmt == 0) {
+            ret = 9;
+            break;
+        }
+        gdsql_stmt_set_query(stmt, "SELECT count(*)::int FROM t01_load");
+        gdsql_stmt_bindr_int(stmt, 1, &id);
+        if (gdsql_stmt_step(stmt) != 0 || id != rows) {
+            fprintf(stderr,
+                    "Failed load left %d rows, expected %d\n",
+                    id, rows);
+            ret = 10;
+            break;
+        }
+    } while (0);
+
+    gdsql_db_free_load(load);
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    gdsql_db_exec(db, "DROP TABLE IF EXISTS t01_load");
+
+    fprintf(stderr,
+            "Postgres load test: %s (%d)\n",
+            ret ? "FAILED" : "OK", ret);
+    return ret;
+}
+
+/*
+ * Fetching with COPY must give the same rows as a plain query, and
+ * exporting must write the binary COPY format: a 19 byte header, then
+ * per row a field count plus the length and value of each field, and
+ * a 2 byte trailer.  Finalizing a COPY half way must leave the
+ * connection usable.
+ */
+static int test_pg_copy(gdsql_db db)
+{
+    int ret = 0;
+    unsigned long sum = 0;
+    unsigned long copy_sum = 0;
+    gdsql_stmt stmt = 0;
+    FILE* out = 0;
+
+    do {
+        int rows = fetch_rows(db, PG_SERIES, GDSQL_FETCH_DEFAULT, 0, &sum);
+        int copy_rows = fetch_rows(db, PG_SERIES, GDSQL_FETCH_COPY, 0,
+                                   &copy_sum);
+        if (rows != PG_SERIES_ROWS ||
+            copy_rows != rows ||
+            copy_sum != sum) {
+            fprintf(stderr,
+                    "COPY fetched %d rows, plain query %d\n",
+                    copy_rows, rows);
+            ret = 1;
+            break;
+        }
+
+        long size = 19 + 2;
+        int j = 0;
+        for (j = 1; j <= PG_SERIES_ROWS; ++j) {
+            char name[40];
+            size += 2 + 4 + 4 + 4 + sprintf(name, "row %d", j);
+        }
+
+        struct stat st;
+        st.st_size = 0;
+        out = tmpfile();
+        stmt = gdsql_db_alloc_stmt(db);
+        if (out == 0 || stmt == 0) {
+            ret = 2;
+            break;
+        }
+        gdsql_stmt_set_query(stmt, PG_SERIES);
+        gdsql_stmt_set_fetch_mode(stmt, GDSQL_FETCH_COPY, 0);
+        if (gdsql_stmt_export(stmt, fileno(out)) != 0 ||
+            fstat(fileno(out), &st) != 0 ||
+            st.st_size != size) {
+            fprintf(stderr,
+                    "Exported %ld bytes, expected %ld\n",
+                    (long) st.st_size, size);
+            ret = 3;
+            break;
+        }
+        fprintf(stderr,
+                "Exported %ld bytes\n",
+                (long) st.st_size);
+        gdsql_stmt_finalize(stmt);
+
+        // Stop long before the server is done sending.
+        int id = 0;
+        gdsql_stmt_set_query(stmt, PG_SERIES_BIG);
+        gdsql_stmt_set_fetch_mode(stmt, GDSQL_FETCH_COPY, 0);
+        gdsql_stmt_bindr_int(stmt, 1, &id);
+        for (j = 0; j < 10 && gdsql_stmt_step(stmt) == 0; ++j)
+            ;
+        gdsql_stmt_finalize(stmt);
+        if (j != 10 ||
+            fetch_rows(db, PG_SERIES, GDSQL_FETCH_DEFAULT, 0,
+                       &copy_sum) != rows ||
+            copy_sum != sum) {
+            fprintf(stderr,
+                    "Connection not usable after an unfinished COPY\n");
+            ret = 4;
+            break;
+        }
+    } while (0);
+
+    if (out != 0)
+        fclose(out);
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+
+    fprintf(stderr,
+            "Postgres COPY test: %s (%d)\n",
+            ret ? "FAILED" : "OK", ret);
+    return ret;
+}
+
+/*
+ * Streaming must give the same rows as a plain query, and finalizing
+ * a stream half way must leave the connection usable.
+ */
+static int test_pg_stream(gdsql_db db)
+{
+    int ret = 0;
+    unsigned long sum = 0;
+    unsigned long stream_sum = 0;
+    gdsql_stmt stmt = 0;
+
+    do {
+        int rows = fetch_rows(db, PG_SERIES, GDSQL_FETCH_DEFAULT, 0, &sum);
+        int stream_rows = fetch_rows(db, PG_SERIES, GDSQL_FETCH_STREAM, 100,
+                                     &stream_sum);
+        if (rows != PG_SERIES_ROWS ||
+            stream_rows != rows ||
+            stream_sum != sum) {
+            fprintf(stderr,
+                    "Streaming fetched %d rows, plain query %d\n",
+                    stream_rows, rows);
+            ret = 1;
+            break;
+        }
+
+        int id = 0;
+        int j = 0;
+        stmt = gdsql_db_alloc_stmt(db);
+        if (stmt == 0) {
+            ret = 2;
+            break;
+        }
+        gdsql_stmt_set_query(stmt, PG_SERIES_BIG);
+        gdsql_stmt_set_fetch_mode(stmt, GDSQL_FETCH_STREAM, 100);
+        gdsql_stmt_bindr_int(stmt, 1, &id);
+        for (j = 0; j < 10 && gdsql_stmt_step(stmt) == 0; ++j)
+            ;
+        gdsql_stmt_finalize(stmt);
+        if (j != 10 ||
+            gdsql_db_exec(db, "SELECT 1") != 0 ||
+            fetch_rows(db, PG_SERIES, GDSQL_FETCH_DEFAULT, 0,
+                       &stream_sum) != rows ||
+            stream_sum != sum) {
+            fprintf(stderr,
+                    "Connection not usable after an unfinished stream\n");
+            ret = 3;
+            break;
+        }
+    } while (0);
+
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+
+    fprintf(stderr,
+            "Postgres streaming test: %s (%d)\n",
+            ret ? "FAILED" : "OK", ret);
+    return ret;
+}
+
+/*
+ * A cursor fetching a few rows at a time must give the same rows as a
+ * plain query, even with other statements run on the connection while
+ * it is open.
+ */
+static int test_pg_cursor(gdsql_db db)
+{
+    int ret = 0;
+    unsigned long sum = 0;
+    unsigned long cursor_sum = 0;
+    gdsql_stmt stmt = 0;
+    gdsql_stmt other = 0;
+
+    do {
+        int rows = fetch_rows(db, PG_SERIES, GDSQL_FETCH_DEFAULT, 0, &sum);
+        if (rows != PG_SERIES_ROWS) {
+            ret = 1;
+            break;
+        }
+
+        int id;
+        char name[100];
+        int answer;
+        stmt = gdsql_db_alloc_stmt(db);
+        other = gdsql_db_alloc_stmt(db);
+        if (stmt == 0 || other == 0) {
+            ret = 2;
+            break;
+        }
+        gdsql_stmt_set_query(stmt, PG_SERIES);
+        gdsql_stmt_set_fetch_mode(stmt, GDSQL_FETCH_CURSOR, 7);
+        gdsql_stmt_bindr_int(stmt, 1, &id);
+        gdsql_stmt_bindr_string(stmt, 2, name, sizeof(name));
+        gdsql_stmt_set_query(other, "SELECT 42");
+        gdsql_stmt_bindr_int(other, 1, &answer);
+
+        int n = 0;
+        while (gdsql_stmt_step(stmt) == 0) {
+            cursor_sum = add_sum(cursor_sum, id, name);
+            if (++n % 100 != 0)
+                continue;
+
+            answer = 0;
+            if (gdsql_stmt_step(other) != 0 ||
+                answer != 42) {
+                fprintf(stderr,
+                        "Statement between cursor fetches failed\n");
+                ret = 3;
+                break;
+            }
+            gdsql_stmt_reset(other);
+        }
+        if (ret != 0)
+            break;
+
+        if (n != rows || cursor_sum != sum) {
+            fprintf(stderr,
+                    "Cursor fetched %d rows, plain query %d\n",
+                    n, rows);
+            ret = 4;
+            break;
+        }
+    } while (0);
+
+    gdsql_stmt_finalize(other);
+    gdsql_db_free_stmt(other);
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+
+    fprintf(stderr,
+            "Postgres cursor test: %s (%d)\n",
+            ret ? "FAILED" : "OK", ret);
+    return ret;
+}
+
+/*
+ * A pipeline with a failing item in the middle: every statement is
+ * pending until the sync, then the one before the failure is fine,
+ * the failing one has its error and the one after it was aborted;
+ * and as they all ran in one transaction, nothing was inserted.  A
+ * statement finalized while the pipeline is open is only deallocated
+ * once it ends.
+ */
+static int test_pg_pipeline(gdsql_db db)
+{
+    int ret = 0;
+    gdsql_stmt stmts[3] = { 0, 0, 0 };
+    gdsql_stmt stmt = 0;
+    int pipeline = 0;
+
+    do {
+        if (gdsql_db_exec(db,
+                          "CREATE TEMP TABLE t01_pipe ("
+                          "id INTEGER PRIMARY KEY)") != 0) {
+            ret = 1;
+            break;
+        }
+
+        int j = 0;
+        for (j = 0; j < 3; ++j) {
+            stmts[j] = gdsql_db_alloc_stmt(db);
+            if (stmts[j] == 0)
+                break;
+        }
+        if (j < 3) {
+            ret = 2;
+            break;
+        }
+        gdsql_stmt_set_query(stmts[0], "INSERT INTO t01_pipe VALUES ($1)");
+        gdsql_stmt_bindp_int(stmts[0], 1, 1);
+        gdsql_stmt_set_query(stmts[1], "SELECT 1 / $1");
+        gdsql_stmt_bindp_int(stmts[1], 1, 0);
+        gdsql_stmt_set_query(stmts[2], "INSERT INTO t01_pipe VALUES ($1)");
+        gdsql_stmt_bindp_int(stmts[2], 1, 2);
+
+        if (gdsql_db_pipeline_begin(db) != 0) {
+            ret = 3;
+            break;
+        }
+        pipeline = 1;
+
+        for (j = 0; j < 3; ++j) {
+            if (gdsql_stmt_pipeline_queue(stmts[j]) != 0 ||
+                gdsql_stmt_get_status(stmts[j]) != GDSQL_STATUS_PENDING)
+                break;
+        }
+        if (j < 3) {
+            fprintf(stderr,
+                    "Pipeline item %d not queued\n",
+                    j);
+            ret = 4;
+            break;
+        }
+
+        int sync = gdsql_db_pipeline_sync(db);
+        int st0 = gdsql_stmt_get_status(stmts[0]);
+        int st1 = gdsql_stmt_get_status(stmts[1]);
+        int st2 = gdsql_stmt_get_status(stmts[2]);
+        fprintf(stderr,
+                "Pipeline synced (%d), statuses %d, %d, %d\n",
+                sync, st0, st1, st2);
+        // 6 is a failed item, 8 one aborted after it.
+        if (sync == 0 || st0 != 0 || st1 != 6 || st2 != 8) {
+            ret = 5;
+            break;
+        }
+
+        // The prepared statement must outlive the pipeline.
+        stmt = gdsql_db_alloc_stmt(db);
+        if (stmt == 0) {
+            ret = 6;
+            break;
+        }
+        gdsql_stmt_set_query(stmt, "SELECT $1::int /* t01 dealloc */");
+        gdsql_stmt_bindp_int(stmt, 1, 1);
+        if (gdsql_stmt_pipeline_queue(stmt) != 0) {
+            ret = 7;
+            break;
+        }
+        gdsql_stmt_finalize(stmt);
+
+        pipeline = 0;
+        if (gdsql_db_pipeline_end(db) != 0) {
+            ret = 8;
+            break;
+        }
+
+        int rows = count_rows(db, "SELECT count(*)::int FROM t01_pipe");
+        int left = count_rows(db,
+                              "SELECT count(*)::int FROM pg_prepared_statements "
+                              "WHERE statement LIKE '%t01' || ' dealloc%'");
+        if (rows != 0 || left != 0) {
+            fprintf(stderr,
+                    "After the pipeline: %d rows, %d statements left\n",
+                    rows, left);
+            ret = 9;
+            break;
+        }
+    } while (0);
+
+    if (pipeline)
+        gdsql_db_pipeline_end(db);
+
+    int j = 0;
+    for (j = 0; j < 3; ++j) {
+        gdsql_stmt_finalize(stmts[j]);
+        gdsql_db_free_stmt(stmts[j]);
+    }
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    gdsql_db_exec(db, "DROP TABLE IF EXISTS t01_pipe");
+
+    fprintf(stderr,
+            "Postgres pipeline test: %s (%d)\n",
+            ret ? "FAILED" : "OK", ret);
+    return ret;
+}
+
+/*
+ * Run a query without blocking, waiting for the connection's socket
+ * with poll() as an event loop would, and check that it returns the
+ * same rows as when stepped normally.  On MySQL, when the client
+ * library has no non-blocking calls, this goes through the driver's
+ * worker thread instead.
+ */
+static int test_start(gdsql_db db,
+                      const char* dbname)
+{
+    const char* query = "SELECT id FROM people ORDER BY id";
+    int ret = 0;
+    gdsql_stmt stmt = 0;
+
+    do {
+        int id = 0;
+        int rows = 0;
+        int sum = 0;
+        stmt = gdsql_db_alloc_stmt(db);
+        if (stmt == 0) {
+            ret = 1;
+            break;
+        }
+        gdsql_stmt_set_query(stmt, query);
+        gdsql_stmt_bindr_int(stmt, 1, &id);
+        while (gdsql_stmt_step(stmt) == 0) {
+            sum += id;
+            ++rows;
+        }
+        gdsql_stmt_reset(stmt);
+
+        if (gdsql_stmt_start(stmt) != 0) {
+            ret = 2;
+            break;
+        }
+
+        int polls = 0;
+        int st = 0;
+        while ((st = gdsql_stmt_poll(stmt)) == GDSQL_POLL_BUSY) {
+            struct pollfd pfd;
+            pfd.fd = gdsql_db_get_socket(db);
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (pfd.fd < 0) {
+                st = GDSQL_POLL_ERROR;
+                break;
+            }
+            poll(&pfd, 1, 1000);
+            ++polls;
+        }
+        if (st != GDSQL_POLL_DONE ||
+            gdsql_stmt_complete(stmt) != 0) {
+            fprintf(stderr,
+                    "Statement failed after %d polls\n",
+                    polls);
+            ret = 3;
+            break;
+        }
+
+        int async_rows = 0;
+        int async_sum = 0;
+        while (gdsql_stmt_step(stmt) == 0) {
+            async_sum += id;
+            ++async_rows;
+        }
+        fprintf(stderr,
+                "Got %d rows after %d polls, expected %d\n",
+                async_rows, polls, rows);
+        if (async_rows != rows || async_sum != sum) {
+            ret = 4;
+            break;
+        }
+    } while (0);
+
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+
+    fprintf(stderr,
+            "%s start / poll / complete test: %s (%d)\n",
+            dbname, ret ? "FAILED" : "OK", ret);
+    return ret;
+}
+
+/*
+ * The same query fetched one row at a time, buffered and through a
+ * cursor must give the same rows; with the statement cache on, the
+ * last two reuse the statement prepared for the first one.
+ */
+static int test_my_modes(gdsql_db db)
+{
+    int ret = 0;
+    int size = gdsql_db_get_cache_size(db);
+
+    do {
+        unsigned long sum = 0;
+        unsigned long buffered_sum = 0;
+        unsigned long cursor_sum = 0;
+
+        if (gdsql_db_set_cache_size(db, 8) != 0) {
+            ret = 1;
+            break;
+        }
+
+        int rows = fetch_rows(db, MY_SERIES, GDSQL_FETCH_DEFAULT, 0, &sum);
+        unsigned long hits = gdsql_db_get_cache_hits(db);
+        int buffered_rows = fetch_rows(db, MY_SERIES, GDSQL_FETCH_BUFFERED, 0,
+                                       &buffered_sum);
+        int cursor_rows = fetch_rows(db, MY_SERIES, GDSQL_FETCH_CURSOR, 50,
+                                     &cursor_sum);
+        hits = gdsql_db_get_cache_hits(db) - hits;
+        fprintf(stderr,
+                "Fetched %d rows, %d buffered, %d with a cursor; "
+                "%lu cache hits\n",
+                rows, buffered_rows, cursor_rows, hits);
+        if (rows != MY_SERIES_ROWS ||
+            buffered_rows != rows ||
+            buffered_sum != sum ||
+            cursor_rows != rows ||
+            cursor_sum != sum) {
+            ret = 2;
+            break;
+        }
+        if (hits != 2) {
+            ret = 3;
+            break;
+        }
+    } while (0);
+
+    gdsql_db_set_cache_size(db, size);
+
+    fprintf(stderr,
+            "MySQL fetch mode test: %s (%d)\n",
+            ret ? "FAILED" : "OK", ret);
+    return ret;
+}
+
+/*
+ * Load strings with every character LOAD DATA needs escaped, plus a
+ * NULL, and read them back byte by byte; then check that freeing a
+ * load that was not ended loads nothing.
+ */
+static int test_my_load(gdsql_db db)
+{
+    static const struct {
+        const char* val;
+        int len;
+    } names[] = {
+        { "tab\there",   8 },
+        { "new\nline",   8 },
+        { "back\\slash", 10 },
+        { "nul\0byte",   8 },
+        { "\\N",         2 },
+        { "plain",       5 },
+        { 0,             0 },
+    };
+    int count = sizeof(names) / sizeof(names[0]);
+    int ret = 0;
+    gdsql_load load = 0;
+    gdsql_stmt stmt = 0;
+
+    do {
+        if (gdsql_db_exec(db,
+                          "CREATE TEMPORARY TABLE t01_load ("
+                          "id INTEGER PRIMARY KEY, "
+                          "name VARCHAR(40), "
+                          "birth DATETIME, "
+                          "height DOUBLE) ENGINE=InnoDB") != 0) {
+            ret = 1;
+            break;
+        }
+
+        load = gdsql_db_alloc_load(db);
+        if (load == 0 ||
+            gdsql_load_begin(load, "t01_load", 0) != 0) {
+            ret = 2;
+            break;
+        }
+
+        double birth = gdsql_cal2jul(1970, 1, 1, 0, 0, 0);
+        int j = 0;
+        for (j = 0; j < count; ++j) {
+            gdsql_load_put_int(load, j);
+            gdsql_load_put_string(load, names[j].val, names[j].len);
+            gdsql_load_put_date(load, birth + j);
+            gdsql_load_put_double(load, j * 0.5);
+            gdsql_load_end_row(load);
+        }
+        if (gdsql_load_end(load) != 0 ||
+            gdsql_load_get_rows(load) != (unsigned long) count) {
+            ret = 3;
+            break;
+        }
+        gdsql_db_free_load(load);
+        load = 0;
+
+        int id;
+        char hex[100];
+        double height;
+        stmt = gdsql_db_alloc_stmt(db);
+        if (stmt == 0) {
+            ret = 4;
+            break;
+        }
+        gdsql_stmt_set_query(stmt,
+                             "SELECT id, HEX(name), height "
+                             "FROM t01_load ORDER BY id");
+        gdsql_stmt_bindr_int(stmt, 1, &id);
+        gdsql_stmt_bindr_string(stmt, 2, hex, sizeof(hex));
+        gdsql_stmt_bindr_double(stmt, 3, &height);
+        for (j = 0; gdsql_stmt_step(stmt) == 0; ++j) {
+            char want[100];
+            int k = 0;
+            for (k = 0; k < names[j].len; ++k)
+                sprintf(want + 2 * k, "%02X", (unsigned char) names[j].val[k]);
+            want[2 * k] = '\0';
+
+            int null = gdsql_stmt_is_column_null(stmt, 2);
+            if (id != j ||
+                null != (names[j].val == 0) ||
+                (! null && strcmp(hex, want) != 0) ||
+                height != j * 0.5) {
+                fprintf(stderr,
+                        "Loaded row %d came back as %d|%s|%lf, "
+                        "expected %s\n",
+                        j, id, null ? "NULL" : hex, height, want);
+                ret = 5;
+                break;
+            }
+        }
+        gdsql_stmt_finalize(stmt);
+        if (ret != 0)
+            break;
+        if (j != count) {
+            fprintf(stderr,
+                    "Read back %d loaded rows, expected %d\n",
+                    j, count);
+            ret = 6;
+            break;
+        }
+
+        // Rows sent to the server before the abort are not kept.
+        load = gdsql_db_alloc_load(db);
+        if (load == 0 ||
+            gdsql_load_begin(load, "t01_load", "id") != 0) {
+            ret = 7;
+            break;
+        }
+        for (j = 0; j < 1000; ++j) {
+            gdsql_load_put_int(load, count + j);
+            gdsql_load_end_row(load);
+        }
+        gdsql_load_flush(load);
+        gdsql_db_free_load(load);
+        load = 0;
+
+        int rows = count_rows(db, "SELECT count(*) FROM t01_load");
+        if (rows != count) {
+            fprintf(stderr,
+                    "Aborted load left %d rows, expected %d\n",
+                    rows, count);
+            ret = 8;
+            break;
+        }
+    } while (0);
+
+    gdsql_db_free_load(load);
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    gdsql_db_exec(db, "DROP TEMPORARY TABLE IF EXISTS t01_load");
+
+    fprintf(stderr,
+            "MySQL load test: %s (%d)\n",
+            ret ? "FAILED" : "OK", ret);
+    return ret;
+}
+
+/*
+ * Run a query returning (int, string) rows with a fetch mode; return
+ * how many rows there were (or -1), and a checksum of them in sum.
+ */
+static int fetch_rows(gdsql_db db,
+                      const char* query,
+                      int mode,
+                      int size,
+                      unsigned long* sum)
+{
+    int n = -1;
+    gdsql_stmt stmt = 0;
+
+    *sum = 0;
+    do {
+        int id;
+        char name[100];
+
+        stmt = gdsql_db_alloc_stmt(db);
+        if (stmt == 0)
+            break;
+
+        gdsql_stmt_set_query(stmt, query);
+        if (gdsql_stmt_set_fetch_mode(stmt, mode, size) != 0 ||
+            gdsql_stmt_bindr_int(stmt, 1, &id) != 0 ||
+            gdsql_stmt_bindr_string(stmt, 2, name, sizeof(name)) != 0)
+            break;
+
+        n = 0;
+        while (gdsql_stmt_step(stmt) == 0) {
+            *sum = add_sum(*sum, id, name);
+            ++n;
+        }
+    } while (0);
+
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    return n;
+}
+
+/*
+ * Run a query returning a single int; return it, or -1.
+ */
+static int count_rows(gdsql_db db,
+                      const char* query)
+{
+    int count = -1;
+
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(db);
+    gdsql_stmt_set_query(stmt, "%s", query);
+    gdsql_stmt_bindr_int(stmt, 1, &count);
+    if (gdsql_stmt_step(stmt) != 0)
+        count = -1;
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+
+    return count;
+}
+
+static unsigned long add_sum(unsigned long sum,
+                             int id,
+                             const char* name)
+{
+    sum = sum * 31 + id;
+    while (*name != '\0')
+        sum = sum * 31 + (unsigned char) *name++;
+    return sum;
+}
+
 static int show_results(gdsql_db db,
                         const char* query)
 {
@@ -303,6 +1182,18 @@ static int show_results(gdsql_db db,
                    height,
                    ns ? "NULL" : (single ? "TRUE" : "FALSE"));
         }
+
+        // The same rows again, after running something else.
+        gdsql_stmt_reset(stmt);
+        if (gdsql_db_exec(db, "SELECT 1") != 0)
+            break;
+
+        int again = 0;
+        while (gdsql_stmt_step(stmt) == 0)
+            ++again;
+        fprintf(stderr,
+                "Got %d rows again, expected %d\n",
+                again, n);
     } while (0);
 
     gdsql_stmt_finalize(stmt);
@@ -0,0 +1,945 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <gdsql.h>
+#include <gdsql_log.h>
+#include <gdsql_logbin.h>
+
+/*
+ * Stress test for concurrent use of the library: each thread works
+ * on its own connection (one connection per thread at a time), while
+ * the gdsql handle, the drivers, the logger and a connection pool are
+ * shared by all of them.
+ */
+
+#define TEST_THREADS   8
+#define TEST_ROWS   2000
+#define TEST_ROUNDS  200
+#define TEST_RERUNS  250
+#define TEST_GROUPED  20
+#define TEST_GROUP_FAIL 3   // the submission that fails in each thread
+#define TEST_LOG_MARK  "test02 log check"
+#define TEST_LOG_LINES  100     // well under what a ring holds
+#define TEST_LOG_BURST 100000   // enough to overflow a ring
+
+typedef struct Worker {
+    int id;
+    gdsql gdsql;
+    gdsql_db db;
+    gdsql_pool pool;
+    gdsql_group group;
+    int errors;
+    pthread_t thread;
+} Worker;
+
+static void* run_worker(void* arg);
+static int fill_table(Worker* w);
+static int check_table(Worker* w);
+static int rerun_query(Worker* w);
+static int reuse_stmt(Worker* w);
+static int insert_arrays(Worker* w);
+static int count_rows(gdsql_db db,
+                      const char* table);
+static int use_pool(Worker* w);
+static int use_group(Worker* w);
+static int group_work(gdsql_db db,
+                      void* arg);
+static int check_group(gdsql_db db);
+static int check_log_binary(void);
+static int check_log_async(void);
+static int check_log_masks(const char* self);
+static int check_masks(int which);
+static int check_log_category(void);
+static void log_samples(void);
+static int read_marked(FILE* f,
+                       const char* mark,
+                       char* buf,
+                       int size);
+static void* trace_start(void* ctx,
+                         int op,
+                         int dbtype,
+                         const char* query);
+static void trace_end(void* ctx,
+                      void* span,
+                      int op,
+                      int dbtype,
+                      const char* query,
+                      unsigned long long nsecs,
+                      int ret);
+
+// Driver calls seen by the trace hooks, by type of call.
+static unsigned long traced[GDSQL_TRACE_STMT_FINALIZE + 1];
+
+// GDSQL_LOG_CATEGORIES values, and the masks they must give at the
+// default level; each one is checked in a new process, since the
+// variable is only read when the library is loaded.
+#define ALL_BUT(c)  (LOG_CAT_ALL & ~(c))
+static const struct {
+    const char* env;
+    unsigned int masks[LOG_LAST];
+} mask_cases[] = {
+    { "-all,mysql:LOG_DEBUG",
+      { LOG_CAT_MYSQL, LOG_CAT_MYSQL, LOG_CAT_MYSQL,
+        LOG_CAT_MYSQL, LOG_CAT_MYSQL } },
+    { "-bind,-column",
+      { 0,
+        ALL_BUT(LOG_CAT_BIND | LOG_CAT_COLUMN),
+        ALL_BUT(LOG_CAT_BIND | LOG_CAT_COLUMN),
+        ALL_BUT(LOG_CAT_BIND | LOG_CAT_COLUMN),
+        ALL_BUT(LOG_CAT_BIND | LOG_CAT_COLUMN) } },
+};
+
+int main(int argc, char* argv[])
+{
+    gdsql gdsql = 0;
+    gdsql_db tmpl = 0;
+    gdsql_pool pool = 0;
+    gdsql_db gdb = 0;
+    gdsql_group group = 0;
+    Worker workers[TEST_THREADS];
+    int errors = 0;
+    int j = 0;
+
+    // Run by check_log_masks().
+    if (argc > 2 && strcmp(argv[1], "masks") == 0)
+        return check_masks(atoi(argv[2]));
+
+    do {
+        gdsql = gdsql_init();
+        if (gdsql == 0)
+            break;
+
+        tmpl = gdsql_alloc_db(gdsql, GDSQL_DB_SQLITE);
+        if (tmpl == 0)
+            break;
+        gdsql_db_set_name(tmpl, ":memory:");
+
+        pool = gdsql_db_alloc_pool(tmpl, 2, TEST_THREADS / 2);
+        if (pool == 0)
+            break;
+
+        // One connection shared by all threads through a group commit.
+        gdb = gdsql_alloc_db(gdsql, GDSQL_DB_SQLITE);
+        if (gdb == 0)
+            break;
+        gdsql_db_set_name(gdb, ":memory:");
+        if (gdsql_db_open(gdb) != 0 ||
+            gdsql_db_exec(gdb, "CREATE TABLE g (owner INTEGER, seq INTEGER)") != 0)
+            break;
+        group = gdsql_db_alloc_group(gdb);
+        if (group == 0)
+            break;
+        gdsql_group_set_limits(group, TEST_THREADS, 2);
+
+        for (j = 0; j < TEST_THREADS; ++j) {
+            char name[64];
+            Worker* w = &workers[j];
+
+            w->id = j;
+            w->gdsql = gdsql;
+            w->pool = pool;
+            w->group = group;
+            w->errors = 0;
+            sprintf(name, "test02-%d.dat", j);
+            remove(name);
+        }
+
+        // Keep only some of the per-row messages, from all threads.
+        gdsql_log_set_limit(LOG_CAT_BIND | LOG_CAT_STEP | LOG_CAT_COLUMN,
+                            LOG_INFO, 0, 0, 16);
+
+        gdsql_set_trace(gdsql, trace_start, trace_end, traced);
+
+        // Keep the metrics file fresh while the threads run.
+        remove("test02.prom");
+        gdsql_metrics_start_export("test02.prom", 100);
+
+        // Log every statement, so that the file keeps rotating.
+        if (gdsql_slow_log_open("test02-slow.log", 0, 256 * 1024, 2) != 0) {
+            fprintf(stderr, "Could not open slow query log\n");
+            ++errors;
+        }
+
+        fprintf(stderr,
+                "Starting %d threads\n",
+                TEST_THREADS);
+        for (j = 0; j < TEST_THREADS; ++j)
+            pthread_create(&workers[j].thread, 0,
+                           run_worker, &workers[j]);
+
+        for (j = 0; j < TEST_THREADS; ++j) {
+            pthread_join(workers[j].thread, 0);
+            errors += workers[j].errors;
+        }
+
+        if (check_group(gdb) != 0)
+            ++errors;
+
+        if (gdsql_metrics_stop_export() != 0) {
+            fprintf(stderr, "Could not export metrics\n");
+            ++errors;
+        }
+        remove("test02.prom");
+
+        gdsql_slow_log_close();
+        FILE* slow = fopen("test02-slow.log.2", "r");
+        if (slow == 0) {
+            fprintf(stderr, "Slow query log was not rotated\n");
+            ++errors;
+        } else
+            fclose(slow);
+        remove("test02-slow.log");
+        remove("test02-slow.log.1");
+        remove("test02-slow.log.2");
+
+        fprintf(stderr,
+                "Trace: %lu opens, %lu executions, %lu finalizations\n",
+                traced[GDSQL_TRACE_DB_OPEN],
+                traced[GDSQL_TRACE_STMT_EXECUTE],
+                traced[GDSQL_TRACE_STMT_FINALIZE]);
+        if (traced[GDSQL_TRACE_DB_OPEN] < TEST_THREADS ||
+            traced[GDSQL_TRACE_STMT_EXECUTE] < TEST_THREADS * TEST_ROWS) {
+            fprintf(stderr, "Trace hooks were not called\n");
+            ++errors;
+        }
+
+        gdsql_pool_stats stats;
+        gdsql_pool_get_stats(pool, &stats);
+        fprintf(stderr,
+                "Pool: %lu checkouts, %lu waits, %lu connections opened\n",
+                stats.checkouts, stats.waits, stats.creations);
+        fprintf(stderr,
+                "Group: %lu batches for %d submissions\n",
+                gdsql_group_get_batches(group),
+                TEST_THREADS * TEST_GROUPED);
+        fprintf(stderr,
+                "Log: %lu messages suppressed\n",
+                gdsql_log_get_suppressed(LOG_LAST));
+
+        if (check_log_binary() != 0)
+            ++errors;
+        if (check_log_async() != 0)
+            ++errors;
+        if (check_log_masks(argv[0]) != 0)
+            ++errors;
+        if (check_log_category() != 0)
+            ++errors;
+
+        for (j = 0; j < TEST_THREADS; ++j) {
+            char name[64];
+            sprintf(name, "test02-%d.dat", j);
+            remove(name);
+        }
+    } while (0);
+
+    gdsql_db_free_group(group);
+    gdsql_db_close(gdb);
+    gdsql_free_db(gdb);
+    gdsql_db_free_pool(pool);
+    gdsql_free_db(tmpl);
+    gdsql_fini(gdsql);
+
+    printf("%s: %d errors\n",
+           errors ? "FAILED" : "PASSED", errors);
+    return errors ? 1 : 0;
+}
+
+static void* run_worker(void* arg)
+{
+    Worker* w = (Worker*) arg;
+    char name[64];
+
+    do {
+        w->db = gdsql_alloc_db(w->gdsql, GDSQL_DB_SQLITE);
+        if (w->db == 0) {
+            ++w->errors;
+            break;
+        }
+
+        sprintf(name, "test02-%d.dat", w->id);
+        gdsql_db_set_name(w->db, name);
+        gdsql_db_set_cache_size(w->db, 4);
+        if (gdsql_db_open(w->db) != 0) {
+            ++w->errors;
+            break;
+        }
+
+        if (fill_table(w) != 0)
+            ++w->errors;
+        if (check_table(w) != 0)
+            ++w->errors;
+        if (rerun_query(w) != 0)
+            ++w->errors;
+        if (reuse_stmt(w) != 0)
+            ++w->errors;
+        if (insert_arrays(w) != 0)
+            ++w->errors;
+        if (use_pool(w) != 0)
+            ++w->errors;
+        if (use_group(w) != 0)
+            ++w->errors;
+
+        // Have everybody fight for the log and its level too.
+        int old = gdsql_set_log_level(LOG_WARNING);
+        gdsql_db_get_type(0);
+        gdsql_set_log_level(old);
+
+        gdsql_db_close(w->db);
+    } while (0);
+
+    gdsql_free_db(w->db);
+    return 0;
+}
+
+static int fill_table(Worker* w)
+{
+    int ret = 0;
+
+    do {
+        if (gdsql_db_exec(w->db,
+                          "CREATE TABLE t (id INTEGER, owner INTEGER)") != 0) {
+            ret = 1;
+            break;
+        }
+
+        gdsql_db_bulk_begin(w->db, 500, 0);
+
+        gdsql_stmt stmt = gdsql_db_alloc_stmt(w->db);
+        gdsql_stmt_set_query(stmt, "INSERT INTO t VALUES (?, ?)");
+
+        int j = 0;
+        for (j = 0; j < TEST_ROWS; ++j) {
+            gdsql_stmt_bindp_int(stmt, 1, j);
+            gdsql_stmt_bindp_int(stmt, 2, w->id);
+            gdsql_stmt_step(stmt);
+            gdsql_stmt_clear_bindings(stmt);
+        }
+
+        gdsql_stmt_finalize(stmt);
+        gdsql_db_free_stmt(stmt);
+
+        if (gdsql_db_bulk_end(w->db) != 0)
+            ret = 2;
+    } while (0);
+
+    return ret;
+}
+
+static int check_table(Worker* w)
+{
+    int ret = 0;
+    int count = 0;
+    int owner = -1;
+
+    gdsql_db_set_stats(w->db, 1);
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(w->db);
+    gdsql_stmt_set_query(stmt, "SELECT count(*), max(owner) FROM t");
+    gdsql_stmt_bindr_int(stmt, 1, &count);
+    gdsql_stmt_bindr_int(stmt, 2, &owner);
+    if (gdsql_stmt_step(stmt) != 0 ||
+        count != TEST_ROWS ||
+        owner != w->id) {
+        fprintf(stderr,
+                "Thread %d: got %d rows from owner %d\n",
+                w->id, count, owner);
+        ret = 1;
+    }
+
+    gdsql_stmt_stats stats;
+    gdsql_stmt_get_stats(stmt, &stats);
+    if (stats.executions != 1 ||
+        stats.rows != 1 ||
+        stats.bytes != 2 * sizeof(int) ||
+        stats.execute_nsecs == 0) {
+        fprintf(stderr,
+                "Thread %d: got stats for %lu executions, %lu rows\n",
+                w->id, stats.executions, stats.rows);
+        ret = 2;
+    }
+
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    return ret;
+}
+
+/*
+ * Run a statement again and again, binding its parameter each time,
+ * and sometimes after something else has used the connection.
+ */
+static int rerun_query(Worker* w)
+{
+    int ret = 0;
+    int count = 0;
+    int j = 0;
+
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(w->db);
+    gdsql_stmt_set_query(stmt, "SELECT count(*) FROM t WHERE owner = ?");
+    gdsql_stmt_bindr_int(stmt, 1, &count);
+    for (j = 0; j < TEST_RERUNS && ret == 0; ++j) {
+        int owner = j % 2 ? -1 : w->id;
+        int expected = j % 2 ? 0 : TEST_ROWS;
+
+        count = -1;
+        if (gdsql_stmt_bindp_int(stmt, 1, owner) != 0 ||
+            gdsql_stmt_step(stmt) != 0 ||
+            count != expected) {
+            fprintf(stderr,
+                    "Thread %d: run %d got %d rows\n",
+                    w->id, j, count);
+            ret = 1;
+        }
+
+        gdsql_stmt_reset(stmt);
+        if (j % 50 == 0 &&
+            gdsql_db_exec(w->db, "UPDATE t SET owner = owner WHERE id < 0") != 0)
+            ret = 2;
+    }
+
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    return ret;
+}
+
+/*
+ * Give one statement several queries in turn, on a connection with
+ * room for two of them in its cache.
+ */
+static int reuse_stmt(Worker* w)
+{
+    static const int queries[] = { 1, 1, 2, 1, 3 };
+    int ret = 0;
+    int val = 0;
+    int j = 0;
+
+    gdsql_db db = gdsql_alloc_db(w->gdsql, GDSQL_DB_SQLITE);
+    gdsql_db_set_name(db, ":memory:");
+    gdsql_db_set_cache_size(db, 2);
+    if (gdsql_db_open(db) != 0)
+        ret = 1;
+
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(db);
+    for (j = 0; j < 5 && ret == 0; ++j) {
+        gdsql_stmt_set_query(stmt, "SELECT %d", queries[j]);
+        gdsql_stmt_bindr_int(stmt, 1, &val);
+        if (gdsql_stmt_step(stmt) != 0 || val != queries[j])
+            ret = 2;
+    }
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+
+    // SELECT 1 comes back from the cache twice, and SELECT 2 is the
+    // one evicted for SELECT 3.
+    unsigned long hits = gdsql_db_get_cache_hits(db);
+    unsigned long misses = gdsql_db_get_cache_misses(db);
+    unsigned long evictions = gdsql_db_get_cache_evictions(db);
+    if (ret == 0 &&
+        (hits != 2 || misses != 3 || evictions != 1)) {
+        fprintf(stderr,
+                "Thread %d: cache got %lu hits, %lu misses, %lu evictions\n",
+                w->id, hits, misses, evictions);
+        ret = 3;
+    }
+
+    gdsql_db_close(db);
+    gdsql_free_db(db);
+    return ret;
+}
+
+/*
+ * Insert rows from arrays: all of them in one go, then a set with a
+ * duplicate key in the middle, which must leave nothing behind; and
+ * the same set again inside our own transaction, where the rows
+ * before the bad one stay.
+ */
+static int insert_arrays(Worker* w)
+{
+    static const int good[] = { 1, 2, 3, 4, 5 };
+    static const int bad[] = { 11, 12, 3, 13 };
+    static const char* const names[] = { "a", "b", "c", "d", "e" };
+    int ret = 0;
+    int done = -1;
+
+    gdsql_db db = gdsql_alloc_db(w->gdsql, GDSQL_DB_SQLITE);
+    gdsql_db_set_name(db, ":memory:");
+    if (gdsql_db_open(db) != 0 ||
+        gdsql_db_exec(db, "CREATE TABLE a (id INTEGER PRIMARY KEY, name TEXT)") != 0)
+        ret = 1;
+
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(db);
+    gdsql_stmt_set_query(stmt, "INSERT INTO a VALUES (?, ?)");
+    do {
+        if (ret != 0)
+            break;
+
+        gdsql_stmt_bindp_int_array(stmt, 1, good, 0, 5);
+        gdsql_stmt_bindp_string_array(stmt, 2, names, 0, 0, 5);
+        if (gdsql_stmt_execute_array(stmt, &done) != 0 ||
+            done != 5 ||
+            count_rows(db, "a") != 5) {
+            ret = 2;
+            break;
+        }
+
+        // No transaction may be left open.
+        if (gdsql_db_exec(db, "BEGIN") != 0 ||
+            gdsql_db_exec(db, "COMMIT") != 0) {
+            ret = 3;
+            break;
+        }
+
+        gdsql_stmt_clear_bindings(stmt);
+        gdsql_stmt_bindp_int_array(stmt, 1, bad, 0, 4);
+        gdsql_stmt_bindp_string_array(stmt, 2, names, 0, 0, 4);
+        done = -1;
+        if (gdsql_stmt_execute_array(stmt, &done) == 0 ||
+            done != 0 ||
+            count_rows(db, "a") != 5) {
+            ret = 4;
+            break;
+        }
+
+        gdsql_db_exec(db, "BEGIN");
+        done = -1;
+        if (gdsql_stmt_execute_array(stmt, &done) == 0 ||
+            done != 2 ||
+            count_rows(db, "a") != 7)
+            ret = 5;
+        gdsql_db_exec(db, "ROLLBACK");
+    } while (0);
+
+    if (ret != 0)
+        fprintf(stderr,
+                "Thread %d: array insert %d, %d rows done\n",
+                w->id, ret, done);
+
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    gdsql_db_close(db);
+    gdsql_free_db(db);
+    return ret;
+}
+
+static int count_rows(gdsql_db db,
+                      const char* table)
+{
+    int count = -1;
+
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(db);
+    gdsql_stmt_set_query(stmt, "SELECT count(*) FROM %s", table);
+    gdsql_stmt_bindr_int(stmt, 1, &count);
+    if (gdsql_stmt_step(stmt) != 0)
+        count = -1;
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+
+    return count;
+}
+
+static int use_pool(Worker* w)
+{
+    int ret = 0;
+    int j = 0;
+
+    for (j = 0; j < TEST_ROUNDS; ++j) {
+        gdsql_db db = gdsql_pool_checkout(w->pool, -1);
+        if (db == 0) {
+            ret = 1;
+            break;
+        }
+
+        int one = 0;
+        gdsql_stmt stmt = gdsql_db_alloc_stmt(db);
+        gdsql_stmt_set_query(stmt, "SELECT 1");
+        gdsql_stmt_bindr_int(stmt, 1, &one);
+        if (gdsql_stmt_step(stmt) != 0 || one != 1)
+            ret = 2;
+        gdsql_stmt_finalize(stmt);
+        gdsql_db_free_stmt(stmt);
+
+        gdsql_pool_checkin(w->pool, db);
+        if (ret != 0)
+            break;
+    }
+
+    return ret;
+}
+
+typedef struct GroupWork {
+    int owner;
+    int seq;
+} GroupWork;
+
+/*
+ * Submit work to the group, one piece at a time; one of them fails
+ * and must be rolled back on its own.
+ */
+static int use_group(Worker* w)
+{
+    int ret = 0;
+    int j = 0;
+
+    for (j = 0; j < TEST_GROUPED; ++j) {
+        GroupWork gw;
+        gw.owner = w->id;
+        gw.seq = j;
+
+        int expected = (j == TEST_GROUP_FAIL
+                        ? GDSQL_GROUP_WORK_FAILED
+                        : GDSQL_GROUP_OK);
+        int got = gdsql_group_submit(w->group, group_work, &gw);
+        if (got != expected) {
+            fprintf(stderr,
+                    "Thread %d: group work %d returned %d\n",
+                    w->id, j, got);
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Insert two rows with the same statement, running it again after a
+ * reset; the failing piece inserts its rows and then fails.
+ */
+static int group_work(gdsql_db db,
+                      void* arg)
+{
+    GroupWork* gw = (GroupWork*) arg;
+
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(db);
+    gdsql_stmt_set_query(stmt, "INSERT INTO g VALUES (?, ?)");
+    gdsql_stmt_bindp_int(stmt, 1, gw->owner);
+    gdsql_stmt_bindp_int(stmt, 2, gw->seq);
+    gdsql_stmt_step(stmt);
+    gdsql_stmt_reset(stmt);
+    gdsql_stmt_bindp_int(stmt, 2, -gw->seq - 1);
+    gdsql_stmt_step(stmt);
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+
+    return gw->seq == TEST_GROUP_FAIL;
+}
+
+/*
+ * Every thread must find the rows of all its work but the failed one.
+ */
+static int check_group(gdsql_db db)
+{
+    int ret = 0;
+    int owner = 0;
+    int count = 0;
+    int failed = 0;
+
+    gdsql_stmt stmt = gdsql_db_alloc_stmt(db);
+    gdsql_stmt_set_query(stmt,
+                         "SELECT owner, count(*), "
+                         "sum(seq = ? OR seq = ?) "
+                         "FROM g GROUP BY owner ORDER BY owner");
+    gdsql_stmt_bindp_int(stmt, 1, TEST_GROUP_FAIL);
+    gdsql_stmt_bindp_int(stmt, 2, -TEST_GROUP_FAIL - 1);
+    gdsql_stmt_bindr_int(stmt, 1, &owner);
+    gdsql_stmt_bindr_int(stmt, 2, &count);
+    gdsql_stmt_bindr_int(stmt, 3, &failed);
+
+    int j = 0;
+    for (j = 0; gdsql_stmt_step(stmt) == 0; ++j) {
+        if (owner != j ||
+            count != 2 * (TEST_GROUPED - 1) ||
+            failed != 0) {
+            fprintf(stderr,
+                    "Group: thread %d has %d rows, %d from failed work\n",
+                    owner, count, failed);
+            ret = 1;
+        }
+    }
+    if (j != TEST_THREADS) {
+        fprintf(stderr,
+                "Group: rows from %d threads\n",
+                j);
+        ret = 2;
+    }
+
+    gdsql_stmt_finalize(stmt);
+    gdsql_db_free_stmt(stmt);
+    return ret;
+}
+
+/*
+ * The same messages logged as text and in binary mode must read the
+ * same once the binary log is decoded, but for the fractions of a
+ * second it adds to the time.
+ */
+static int check_log_binary(void)
+{
+    int ret = 0;
+    char name[64];
+    char text[4096];
+    char bin[4096];
+    FILE* f = 0;
+
+    do {
+        log_samples();
+        if (gdsql_log_set_binary(1) != 0) {
+            fprintf(stderr, "Log: binary mode was already on\n");
+            ret = 1;
+            break;
+        }
+        log_samples();
+        gdsql_log_set_binary(0);
+        gdsql_logbin_close();
+
+        sprintf(name, "gdsql-%u.log", (unsigned int) getpid());
+        f = fopen(name, "r");
+        int lines = read_marked(f, TEST_LOG_MARK, text, sizeof(text));
+        if (f != 0)
+            fclose(f);
+
+        sprintf(name, "gdsql-%u.bin", (unsigned int) getpid());
+        f = tmpfile();
+        if (f == 0 ||
+            gdsql_logbin_decode(name, f) != 0) {
+            fprintf(stderr, "Log: could not decode %s\n", name);
+            ret = 2;
+            break;
+        }
+        rewind(f);
+        if (lines <= 0 ||
+            read_marked(f, TEST_LOG_MARK, bin, sizeof(bin)) != lines ||
+            strcmp(text, bin) != 0) {
+            fprintf(stderr,
+                    "Log: binary log does not match the text:\n%s---\n%s",
+                    text, bin);
+            ret = 3;
+            break;
+        }
+    } while (0);
+
+    if (f != 0)
+        fclose(f);
+    remove(name);
+    return ret;
+}
+
+/*
+ * In asynchronous mode, a few lines must all get written out, and
+ * logging much faster than the flusher can keep up with must drop
+ * (and count) messages instead of waiting.
+ */
+static int check_log_async(void)
+{
+    int ret = 0;
+    char name[64];
+    char line[1024];
+    char big[3000];
+    int lines = 0;
+    int j = 0;
+
+    do {
+        unsigned long drops = gdsql_log_get_drops();
+        if (gdsql_log_set_async(1) != 0) {
+            fprintf(stderr, "Log: async mode was already on\n");
+            ret = 1;
+            break;
+        }
+        for (j = 0; j < TEST_LOG_LINES; ++j)
+            GDSQL_Log(LOG_WARNING, ("%s: async %d", TEST_LOG_MARK, j));
+        gdsql_log_set_async(0);
+
+        sprintf(name, "gdsql-%u.log", (unsigned int) getpid());
+        FILE* f = fopen(name, "r");
+        while (f != 0 && fgets(line, sizeof(line), f) != 0) {
+            if (strstr(line, TEST_LOG_MARK ": async") != 0)
+                ++lines;
+        }
+        if (f != 0)
+            fclose(f);
+        if (lines != TEST_LOG_LINES ||
+            gdsql_log_get_drops() != drops) {
+            fprintf(stderr,
+                    "Log: %d of %d async lines written, %lu dropped\n",
+                    lines, TEST_LOG_LINES, gdsql_log_get_drops() - drops);
+            ret = 2;
+            break;
+        }
+
+        memset(big, 'x', sizeof(big) - 1);
+        big[sizeof(big) - 1] = '\0';
+        gdsql_log_set_async(1);
+        for (j = 0; j < TEST_LOG_BURST && gdsql_log_get_drops() == drops; ++j)
+            GDSQL_Log(LOG_WARNING, ("%s: burst %d %s", TEST_LOG_MARK, j, big));
+        gdsql_log_set_async(0);
+        if (gdsql_log_get_drops() == drops) {
+            fprintf(stderr,
+                    "Log: nothing dropped after %d async lines\n",
+                    j);
+            ret = 3;
+            break;
+        }
+    } while (0);
+
+    return ret;
+}
+
+/*
+ * Run ourselves once for each of mask_cases, with its value in the
+ * environment.
+ */
+static int check_log_masks(const char* self)
+{
+    int ret = 0;
+    unsigned int j = 0;
+
+    for (j = 0; j < sizeof(mask_cases) / sizeof(mask_cases[0]); ++j) {
+        char which[16];
+        int status = 0;
+
+        sprintf(which, "%u", j);
+        pid_t pid = fork();
+        if (pid == 0) {
+            setenv("GDSQL_LOG_CATEGORIES", mask_cases[j].env, 1);
+            unsetenv("GDSQL_LOG_LEVEL");
+            execl(self, self, "masks", which, (char*) 0);
+            _exit(127);
+        }
+
+        if (pid < 0 ||
+            waitpid(pid, &status, 0) != pid ||
+            ! WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+            fprintf(stderr,
+                    "Log: wrong masks for GDSQL_LOG_CATEGORIES=%s\n",
+                    mask_cases[j].env);
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
+
+static int check_masks(int which)
+{
+    int ret = 0;
+    int l = 0;
+
+    for (l = 0; l < LOG_LAST; ++l) {
+        unsigned int mask = gdsql_log_masks[l];
+        if (mask != mask_cases[which].masks[l]) {
+            fprintf(stderr,
+                    "Log: mask for level %d is 0x%04x, not 0x%04x\n",
+                    l, mask, mask_cases[which].masks[l]);
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Changing the level of some categories changes only their bits in
+ * the masks.
+ */
+static int check_log_category(void)
+{
+    unsigned int cats = LOG_CAT_SQLITE | LOG_CAT_DATE;
+    unsigned int other = gdsql_log_masks[LOG_DEBUG] & ~cats;
+    int sqlite = gdsql_log_get_category_level(LOG_CAT_SQLITE);
+    int date = gdsql_log_get_category_level(LOG_CAT_DATE);
+    int ret = 0;
+    int l = 0;
+
+    do {
+        if (gdsql_log_set_category_level(cats, LOG_DEBUG) != 0 ||
+            gdsql_log_get_category_level(LOG_CAT_DATE) != LOG_DEBUG ||
+            gdsql_log_masks[LOG_DEBUG] != (other | cats)) {
+            fprintf(stderr, "Log: categories not turned on\n");
+            ret = 1;
+            break;
+        }
+
+        gdsql_log_set_category_level(cats, LOG_LAST);
+        for (l = 0; l < LOG_LAST; ++l) {
+            if ((gdsql_log_masks[l] & cats) != 0)
+                ret = 2;
+        }
+        if (ret != 0 ||
+            gdsql_log_masks[LOG_DEBUG] != other) {
+            fprintf(stderr, "Log: categories not turned off\n");
+            ret = 2;
+            break;
+        }
+
+        if (gdsql_log_set_category_level(0x100, LOG_DEBUG) == 0) {
+            fprintf(stderr, "Log: unknown category accepted\n");
+            ret = 4;
+        }
+    } while (0);
+
+    gdsql_log_set_category_level(LOG_CAT_SQLITE, sqlite);
+    gdsql_log_set_category_level(LOG_CAT_DATE, date);
+    return ret;
+}
+
+static void log_samples(void)
+{
+    static int number = -42;
+    static unsigned long big = 4000000000ul;
+
+    GDSQL_Log(LOG_WARNING, ("%s: %d, %lu, %p, [%.*s], %g",
+                            TEST_LOG_MARK, number, big, (void*) &big,
+                            3, "abcdef", 2.5e-3));
+    GDSQL_Log(LOG_WARNING, ("%s: [%-8s] [%5d] [%08.3f]",
+                            TEST_LOG_MARK, "left", 17, -3.14159));
+}
+
+/*
+ * Put together the lines of a log with a mark, without the time
+ * they start with; return how many there were.
+ */
+static int read_marked(FILE* f,
+                       const char* mark,
+                       char* buf,
+                       int size)
+{
+    char line[1024];
+    int lines = 0;
+    int len = 0;
+
+    buf[0] = '\0';
+    while (f != 0 && fgets(line, sizeof(line), f) != 0) {
+        const char* p = strchr(line, ' ');
+        if (strstr(line, mark) == 0 ||
+            p == 0 ||
+            (p = strchr(p + 1, ' ')) == 0)
+            continue;
+
+        len += snprintf(buf + len, size - len, "%s", p + 1);
+        if (len >= size)
+            return -1;
+        ++lines;
+    }
+
+    return lines;
+}
+
+static void* trace_start(void* ctx,
+                         int op,
+                         int dbtype,
+                         const char* query)
+{
+    return (unsigned long*) ctx + op;
+}
+
+static void trace_end(void* ctx,
+                      void* span,
+                      int op,
+                      int dbtype,
+                      const char* query,
+                      unsigned long long nsecs,
+                      int ret)
+{
+    __atomic_add_fetch((unsigned long*) span, 1, __ATOMIC_RELAXED);
+}